@@ -0,0 +1,171 @@
+// times InstanceBvh culling of random boxes against random views, one view at
+// a time and all views on the job system, and checks every run against
+// testing each box on its own
+// usage: instance_bvh_bench [instance count] [view count] [repeats]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "culling.h"
+#include "instance_bvh.h"
+#include "job_system.h"
+
+namespace {
+constexpr float kSceneSize = 100.0f;
+constexpr float kMaxBoxSize = 1.0f;
+
+struct Boxes {
+  std::vector<glm::vec3> bounds_min;
+  std::vector<glm::vec3> bounds_max;
+};
+
+Boxes MakeBoxes(uint32_t count, std::mt19937& random) {
+  std::uniform_real_distribution<float> position(-kSceneSize * 0.5f,
+                                                 kSceneSize * 0.5f);
+  std::uniform_real_distribution<float> size(0.1f * kMaxBoxSize, kMaxBoxSize);
+  Boxes boxes;
+  for (uint32_t i = 0; i < count; ++i) {
+    glm::vec3 center(position(random), position(random), position(random));
+    glm::vec3 extent(size(random), size(random), size(random));
+    boxes.bounds_min.emplace_back(center - extent * 0.5f);
+    boxes.bounds_max.emplace_back(center + extent * 0.5f);
+  }
+  return boxes;
+}
+
+// cameras inside the scene looking at random points, a quarter to a half of
+// the scene deep
+std::vector<FrustumPlanes> MakeViews(uint32_t count, std::mt19937& random) {
+  std::uniform_real_distribution<float> position(-kSceneSize * 0.5f,
+                                                 kSceneSize * 0.5f);
+  std::uniform_real_distribution<float> depth(0.25f * kSceneSize,
+                                              0.5f * kSceneSize);
+  std::vector<FrustumPlanes> views;
+  while (views.size() < count) {
+    glm::vec3 eye(position(random), position(random), position(random));
+    glm::vec3 target(position(random), position(random), position(random));
+    if (glm::distance(eye, target) < 1.0f) {
+      continue;
+    }
+    glm::mat4 view_proj =
+        glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f,
+                         depth(random)) *
+        glm::lookAt(eye, target, glm::vec3(0.0f, 0.0f, 1.0f));
+    FrustumPlanes& planes = views.emplace_back();
+    ExtractFrustumPlanes(view_proj, planes.data());
+  }
+  return views;
+}
+
+// the far corner test of InstanceBvh with the same order of operations
+std::vector<uint32_t> CullEveryBox(const Boxes& boxes,
+                                   const FrustumPlanes& planes) {
+  std::vector<uint32_t> visible;
+  for (uint32_t i = 0; i < boxes.bounds_min.size(); ++i) {
+    bool outside = false;
+    for (const glm::vec4& plane : planes) {
+      glm::vec3 far = glm::mix(boxes.bounds_min[i], boxes.bounds_max[i],
+                               glm::vec3(glm::greaterThanEqual(
+                                   glm::vec3(plane), glm::vec3(0.0f))));
+      float distance = plane.x * far.x + plane.w;
+      distance = plane.y * far.y + distance;
+      distance = plane.z * far.z + distance;
+      outside = outside || distance < 0.0f;
+    }
+    if (!outside) {
+      visible.emplace_back(i);
+    }
+  }
+  return visible;
+}
+
+bool SameInstances(std::vector<uint32_t> a, std::vector<uint32_t> b) {
+  std::sort(a.begin(), a.end());
+  std::sort(b.begin(), b.end());
+  return a == b;
+}
+
+template <typename Function>
+double BestOf(uint32_t repeats, const Function& function) {
+  double best = 0.0;
+  for (uint32_t i = 0; i < repeats; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    std::chrono::duration<double, std::milli> duration =
+        std::chrono::steady_clock::now() - start;
+    best = i == 0 ? duration.count() : std::min(best, duration.count());
+  }
+  return best;
+}
+
+// culls every view with Cull and CullViews, true if both match the reference
+bool CullAndCheck(InstanceBvh& bvh, const Boxes& boxes,
+                  const std::vector<FrustumPlanes>& views, uint32_t repeats) {
+  std::vector<std::vector<uint32_t>> reference(views.size());
+  double reference_ms = BestOf(repeats, [&] {
+    for (size_t i = 0; i < views.size(); ++i) {
+      reference[i] = CullEveryBox(boxes, views[i]);
+    }
+  });
+  std::vector<std::vector<uint32_t>> single(views.size());
+  std::vector<BvhCullStats> single_stats(views.size());
+  double single_ms = BestOf(repeats, [&] {
+    for (size_t i = 0; i < views.size(); ++i) {
+      single[i].clear();
+      single_stats[i] = {};
+      bvh.Cull(views[i], single[i], single_stats[i]);
+    }
+  });
+  std::vector<std::vector<uint32_t>> parallel;
+  std::vector<BvhCullStats> parallel_stats;
+  double parallel_ms = BestOf(
+      repeats, [&] { bvh.CullViews(views, parallel, parallel_stats); });
+
+  bool same = true;
+  uint64_t visible = 0;
+  uint64_t tested = 0;
+  for (size_t i = 0; i < views.size(); ++i) {
+    same = same && SameInstances(single[i], reference[i]) &&
+           SameInstances(parallel[i], reference[i]);
+    visible += single_stats[i].visible;
+    tested += single_stats[i].tested;
+  }
+  std::cout << "every box: " << reference_ms << " ms\n"
+            << "bvh, one view at a time: " << single_ms << " ms, x"
+            << reference_ms / single_ms << "\n"
+            << "bvh, job system on " << JobSystem::GetWorkerCount() + 1
+            << " threads: " << parallel_ms << " ms, x"
+            << reference_ms / parallel_ms << "\n"
+            << visible / views.size() << " visible and "
+            << tested / views.size() << " boxes tested per view"
+            << (same ? "" : ", MISMATCH") << "\n";
+  return same;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint32_t instance_count = argc > 1 ? std::atoi(argv[1]) : 100000;
+  uint32_t view_count = argc > 2 ? std::atoi(argv[2]) : 8;
+  uint32_t repeats = argc > 3 ? std::atoi(argv[3]) : 5;
+  instance_count = std::max(instance_count, 1u);
+  view_count = std::max(view_count, 1u);
+  repeats = std::max(repeats, 1u);
+  JobSystem::Start();
+  std::mt19937 random(1);
+  Boxes boxes = MakeBoxes(instance_count, random);
+  std::vector<FrustumPlanes> views = MakeViews(view_count, random);
+  std::cout << instance_count << " instances, " << view_count << " views\n";
+
+  InstanceBvh bvh;
+  double build_ms =
+      BestOf(repeats, [&] { bvh.Build(boxes.bounds_min, boxes.bounds_max); });
+  std::cout << "build: " << build_ms << " ms, " << bvh.GetNodeCount()
+            << " nodes\n";
+  bool same = CullAndCheck(bvh, boxes, views, repeats);
+  JobSystem::Stop();
+  return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,135 @@
+// times BuildObjMesh on a synthetic grid for growing thread counts and checks
+// every run against the single threaded result
+// usage: obj_import_bench [grid size] [repeats]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "job_system.h"
+#include "obj_import.h"
+
+namespace {
+constexpr uint32_t kShapeCount = 4;
+
+// grid of size x size quads split into kShapeCount row bands, positions,
+// normals and tex coords share one index like most exported objs
+void MakeGrid(uint32_t size, tinyobj::attrib_t& attrib,
+              std::vector<tinyobj::shape_t>& shapes) {
+  uint32_t row = size + 1;
+  for (uint32_t y = 0; y <= size; ++y) {
+    for (uint32_t x = 0; x <= size; ++x) {
+      float u = static_cast<float>(x) / size;
+      float v = static_cast<float>(y) / size;
+      attrib.vertices.insert(attrib.vertices.end(), {u, 0.1f * u * v, v});
+      attrib.normals.insert(attrib.normals.end(), {0.0f, 1.0f, 0.0f});
+      attrib.texcoords.insert(attrib.texcoords.end(), {u, v});
+    }
+  }
+  shapes.resize(kShapeCount);
+  for (uint32_t y = 0; y < size; ++y) {
+    tinyobj::shape_t& shape = shapes[y * kShapeCount / size];
+    for (uint32_t x = 0; x < size; ++x) {
+      int corners[] = {
+          static_cast<int>(y * row + x),
+          static_cast<int>(y * row + x + 1),
+          static_cast<int>((y + 1) * row + x + 1),
+          static_cast<int>((y + 1) * row + x),
+      };
+      for (int corner : {0, 1, 2, 0, 2, 3}) {
+        int index = corners[corner];
+        shape.mesh.indices.emplace_back(tinyobj::index_t{index, index, index});
+      }
+    }
+  }
+}
+
+struct ImportedMesh {
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<SubMesh> sub_meshes;
+
+  bool operator==(const ImportedMesh& other) const {
+    if (indices != other.indices || vertices != other.vertices ||
+        sub_meshes.size() != other.sub_meshes.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < sub_meshes.size(); ++i) {
+      const SubMesh& a = sub_meshes[i];
+      const SubMesh& b = other.sub_meshes[i];
+      if (a.first_index != b.first_index || a.index_count != b.index_count ||
+          a.bounds_min != b.bounds_min || a.bounds_max != b.bounds_max) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// best of repeats in milliseconds, the job system gets thread_count - 1
+// workers, none runs every chunk inline
+double Run(const tinyobj::attrib_t& attrib,
+           const std::vector<tinyobj::shape_t>& shapes, uint32_t thread_count,
+           uint32_t repeats, ImportedMesh& mesh) {
+  if (thread_count > 1) {
+    JobSystem::Start(thread_count - 1);
+  } else {
+    JobSystem::Stop();
+  }
+  ObjImportOptions options{
+      .roughness_f0 = {0.5f, 0.04f, 0.04f, 0.04f},
+      .metallic = 0.0f,
+      .thread_count = thread_count,
+  };
+  double best = 0.0;
+  for (uint32_t i = 0; i < repeats; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    BuildObjMesh(attrib, shapes, options, mesh.vertices, mesh.indices,
+                 mesh.sub_meshes);
+    std::chrono::duration<double, std::milli> duration =
+        std::chrono::steady_clock::now() - start;
+    best = i == 0 ? duration.count() : std::min(best, duration.count());
+  }
+  return best;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint32_t size = argc > 1 ? std::atoi(argv[1]) : 1024;
+  uint32_t repeats = argc > 2 ? std::atoi(argv[2]) : 3;
+  size = std::max(size, kShapeCount);
+  repeats = std::max(repeats, 1u);
+  tinyobj::attrib_t attrib;
+  std::vector<tinyobj::shape_t> shapes;
+  MakeGrid(size, attrib, shapes);
+  size_t corner_count = 6 * static_cast<size_t>(size) * size;
+  std::cout << "grid " << size << "x" << size << ", " << corner_count / 3
+            << " triangles\n";
+
+  ImportedMesh reference;
+  double reference_ms = Run(attrib, shapes, 1, repeats, reference);
+  std::vector<uint32_t> thread_counts;
+  uint32_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  for (uint32_t threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.emplace_back(threads);
+  }
+  thread_counts.emplace_back(max_threads);
+
+  bool identical = true;
+  for (uint32_t threads : thread_counts) {
+    ImportedMesh mesh;
+    double ms = threads == 1 ? reference_ms
+                             : Run(attrib, shapes, threads, repeats, mesh);
+    bool same = threads == 1 || mesh == reference;
+    identical = identical && same;
+    std::cout << threads << " threads: " << ms << " ms, "
+              << corner_count / ms / 1e3 << " M corners/s, x"
+              << reference_ms / ms << (same ? "" : ", MISMATCH") << "\n";
+  }
+  std::cout << reference.vertices.size() << " unique vertices\n";
+  JobSystem::Stop();
+  return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
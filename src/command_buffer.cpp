@@ -29,14 +29,26 @@ void CreateCommandPool() {
       .queueFamilyIndex = Context::Instance()->g_queue_index};
   Context::Instance()->g_command_pool =
       vk::raii::CommandPool(Context::Instance()->g_device, pool_info);
+  pool_info.queueFamilyIndex = Context::Instance()->g_compute_queue_index;
+  Context::Instance()->g_compute_command_pool =
+      vk::raii::CommandPool(Context::Instance()->g_device, pool_info);
 }
 
+// graphics command buffers of each frame followed by the compute ones, which
+// belong to the compute queue family
 void CreateCommandBuffer() {
   vk::CommandBufferAllocateInfo alloc_info{
       .commandPool = Context::Instance()->g_command_pool,
       .level = vk::CommandBufferLevel::ePrimary,
       .commandBufferCount =
-          static_cast<uint32_t>(Context::Instance()->g_frame_in_flight) * 3};
+          static_cast<uint32_t>(Context::Instance()->g_frame_in_flight) * 2};
   Context::Instance()->g_command_buffer =
       vk::raii::CommandBuffers(Context::Instance()->g_device, alloc_info);
+  alloc_info.commandPool = Context::Instance()->g_compute_command_pool;
+  alloc_info.commandBufferCount = Context::Instance()->g_frame_in_flight;
+  for (auto& command_buffer :
+       vk::raii::CommandBuffers(Context::Instance()->g_device, alloc_info)) {
+    Context::Instance()->g_command_buffer.emplace_back(
+        std::move(command_buffer));
+  }
 }
@@ -2,9 +2,11 @@
 
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #include "data.h"
+#include "instance_bvh.h"
 #include "third_part/glfw_headers.h"
 #include "third_part/glm_headers.h"
 #include "third_part/imgui_headers.h"
@@ -31,6 +33,9 @@ class Context {
   vk::raii::Device g_device = nullptr;
   vk::raii::Queue g_queue = nullptr;
   uint32_t g_queue_index = 0;
+  // same as g_queue when the device has no compute only family
+  vk::raii::Queue g_compute_queue = nullptr;
+  uint32_t g_compute_queue_index = 0;
   vk::raii::SurfaceKHR g_surface = nullptr;
   vk::raii::SwapchainKHR g_swapchain = nullptr;
   vk::Format g_swapchain_image_format = vk::Format::eUndefined;
@@ -38,6 +43,9 @@ class Context {
   vk::Extent2D g_swapchain_extent;
   vk::raii::PipelineLayout g_pipeline_layout = nullptr;
   vk::raii::Pipeline g_graphics_pipeline = nullptr;
+  vk::raii::Pipeline g_depth_prepass_pipeline = nullptr;
+  vk::raii::Pipeline g_depth_prepass_masked_pipeline = nullptr;
+  vk::raii::Pipeline g_gbuffer_depth_equal_pipeline = nullptr;
   vk::raii::PipelineLayout g_lighting_pipeline_layout = nullptr;
   vk::raii::Pipeline g_lighting_pipeline = nullptr;
   uint32_t g_frame_in_flight = 2;
@@ -48,6 +56,11 @@ class Context {
   vk::raii::DeviceMemory g_vertex_buffer_memory = nullptr;
   vk::raii::Buffer g_index_buffer = nullptr;
   vk::raii::DeviceMemory g_index_buffer_memory = nullptr;
+  // start of the attribute stream in g_vertex_buffer, the position stream
+  // starts at 0
+  uint32_t g_attribute_offset = 0;
+  // eUint16 whenever the vertex count fits
+  vk::IndexType g_index_type = vk::IndexType::eUint32;
   std::vector<vk::raii::Buffer> g_ubo_buffer;
   std::vector<vk::raii::DeviceMemory> g_ubo_buffer_memory;
   std::vector<void*> g_ubo_buffer_maped;
@@ -59,6 +72,8 @@ class Context {
   vk::raii::DeviceMemory g_texture_image_memory = nullptr;
   vk::raii::ImageView g_texture_image_view = nullptr;
   vk::raii::Sampler g_texture_image_sampler = nullptr;
+  // texture has texels with alpha < 1, needs alpha test
+  bool g_texture_masked = true;
   vk::raii::Image g_depth_image = nullptr;
   vk::raii::DeviceMemory g_depth_image_memory = nullptr;
   vk::raii::ImageView g_depth_image_view = nullptr;
@@ -75,55 +90,356 @@ class Context {
   vk::raii::Image g_gbuffer_roughness_f0_image = nullptr;
   vk::raii::DeviceMemory g_gbuffer_roughness_f0_image_memory = nullptr;
   vk::raii::ImageView g_gbuffer_roughness_f0_image_view = nullptr;
+  // lit scene, the last color attachment of the deferred scope
+  vk::Format g_hdr_format = vk::Format::eR16G16B16A16Sfloat;
+  vk::raii::Image g_hdr_image = nullptr;
+  vk::raii::DeviceMemory g_hdr_image_memory = nullptr;
+  vk::raii::ImageView g_hdr_image_view = nullptr;
   vk::Format g_depth_image_format = vk::Format::eUndefined;
   vk::raii::CommandPool g_command_pool = nullptr;
+  vk::raii::CommandPool g_compute_command_pool = nullptr;
   std::vector<vk::raii::CommandBuffer> g_command_buffer;
   std::vector<vk::raii::Semaphore> g_present_complete_semaphore;
   std::vector<vk::raii::Semaphore> g_render_finished_semaphore;
   std::vector<vk::raii::Fence> g_draw_fence;
+  bool g_enable_timestamps = false;
+  bool g_enable_pipeline_statistics = false;
+  float g_timestamp_period = 1.0f;
+  std::vector<vk::raii::QueryPool> g_timestamp_query_pools;
+  std::vector<vk::raii::QueryPool> g_statistics_query_pools;
   vk::raii::DescriptorPool g_descriptor_pool = nullptr;
   vk::raii::DescriptorSetLayout g_descriptor_set_layout = nullptr;
   std::vector<vk::raii::DescriptorSet> g_descriptor_sets;
-  std::vector<Vertex> g_vertex_in;
+  // quantized vertex streams of every mesh, as stored in the mesh cache
+  std::vector<QuantizedPosition> g_vertex_positions;
+  std::vector<QuantizedAttributes> g_vertex_attributes;
   std::vector<uint32_t> g_index_in;
-  static constexpr uint32_t kParticleCount = 256;
+  // of every mesh of the scene, appended one mesh after another
+  std::vector<SubMesh> g_sub_meshes;
+  std::vector<Meshlet> g_meshlets;
+  vk::raii::Buffer g_meshlet_buffer = nullptr;
+  vk::raii::DeviceMemory g_meshlet_buffer_memory = nullptr;
+  // scene file given on the command line, DATA_FILE_PATH/scene.json if empty
+  std::string g_scene_path;
+  std::vector<Mesh> g_meshes;
+  std::vector<Instance> g_instances;
+  // boxes of g_instances in the space ubo modu maps from, built by LoadScene
+  InstanceBvh g_instance_bvh;
+  // instances are culled against every view on the cpu before the meshlets,
+  // the levels of instances outside of all views are not selected
+  bool g_enable_instance_culling = true;
+  vk::raii::Buffer g_instance_buffer = nullptr;
+  vk::raii::DeviceMemory g_instance_buffer_memory = nullptr;
+  // every meshlet of every instance
+  std::vector<MeshletCullItem> g_meshlet_cull_items;
+  vk::raii::Buffer g_meshlet_cull_item_buffer = nullptr;
+  vk::raii::DeviceMemory g_meshlet_cull_item_buffer_memory = nullptr;
+  // meshlets are culled on the gpu for every view and drawn from compacted
+  // indirect lists, without culling the lists hold every meshlet of the
+  // selected levels
+  bool g_enable_meshlet_culling = true;
+  // cull view of the camera, added every frame by CpuPrepareData
+  uint32_t g_meshlet_camera_view = 0;
+  // same planes as the camera view, only the late occlusion phase fills its
+  // list so the main pass can draw what the occluders missed on its own
+  uint32_t g_meshlet_late_camera_view = 0;
+  // level of detail of every sub mesh of every instance, the coarsest whose
+  // error projects to at most g_lod_error_threshold pixels on the camera, the
+  // shadow passes draw the same level so shadows match the geometry they
+  // fall on
+  bool g_enable_lod = true;
+  float g_lod_error_threshold = 1.0f;
+  // a coarser level needs an error this fraction below the threshold, so
+  // levels do not flicker at the switch distance
+  float g_lod_hysteresis = 0.25f;
+  std::vector<uint32_t> g_instance_lods;
+  // bumped whenever a level in g_instance_lods changes, cached shadow layers
+  // were drawn with the levels of their version
+  uint64_t g_lod_version = 0;
+  std::vector<vk::raii::Buffer> g_instance_lod_buffer;
+  std::vector<vk::raii::DeviceMemory> g_instance_lod_buffer_memory;
+  std::vector<void*> g_instance_lod_buffer_maped;
+  vk::raii::PipelineLayout g_meshlet_cull_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_meshlet_cull_pipeline = nullptr;
+  std::vector<vk::raii::Buffer> g_meshlet_cull_view_buffer;
+  std::vector<vk::raii::DeviceMemory> g_meshlet_cull_view_buffer_memory;
+  std::vector<void*> g_meshlet_cull_view_buffer_maped;
+  // the draw lists of all views, the draw counts of every view and their
+  // copies read back by the cpu
+  vk::raii::Buffer g_meshlet_draw_buffer = nullptr;
+  vk::raii::DeviceMemory g_meshlet_draw_buffer_memory = nullptr;
+  vk::raii::Buffer g_meshlet_count_buffer = nullptr;
+  vk::raii::DeviceMemory g_meshlet_count_buffer_memory = nullptr;
+  std::vector<vk::raii::Buffer> g_meshlet_count_readback_buffer;
+  std::vector<vk::raii::DeviceMemory> g_meshlet_count_readback_buffer_memory;
+  std::vector<void*> g_meshlet_count_readback_buffer_maped;
+  // the camera view is culled twice against the hi-z pyramid, first against
+  // the one of the last frame, then what that rejected against the one built
+  // from the survivors
+  bool g_enable_occlusion_culling = true;
+  vk::raii::Pipeline g_instance_occlusion_pipeline = nullptr;
+  vk::raii::Pipeline g_meshlet_occlusion_pipeline = nullptr;
+  // items the early phase rejected, the OcclusionCullState of the frame and
+  // its copies read back by the cpu
+  vk::raii::Buffer g_occlusion_reject_buffer = nullptr;
+  vk::raii::DeviceMemory g_occlusion_reject_buffer_memory = nullptr;
+  vk::raii::Buffer g_occlusion_state_buffer = nullptr;
+  vk::raii::DeviceMemory g_occlusion_state_buffer_memory = nullptr;
+  std::vector<vk::raii::Buffer> g_occlusion_readback_buffer;
+  std::vector<vk::raii::DeviceMemory> g_occlusion_readback_buffer_memory;
+  std::vector<void*> g_occlusion_readback_buffer_maped;
+  // 1 for every instance occluded as a whole
+  vk::raii::Buffer g_instance_occlusion_buffer = nullptr;
+  vk::raii::DeviceMemory g_instance_occlusion_buffer_memory = nullptr;
+  // farthest depth of the camera view, mip 0 is half the swapchain extent
+  // rounded up to powers of two so every mip halves the one above
+  vk::raii::Image g_hiz_image = nullptr;
+  vk::raii::DeviceMemory g_hiz_image_memory = nullptr;
+  vk::raii::ImageView g_hiz_image_view = nullptr;
+  std::vector<vk::raii::ImageView> g_hiz_image_views;
+  // keep in sync with hiz.slang
+  static constexpr uint32_t kMaxHiZMipLevels = 13;
+  vk::raii::PipelineLayout g_hiz_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_hiz_downsample_pipeline = nullptr;
+  // workgroups of the single pass downsample that are done
+  vk::raii::Buffer g_hiz_counter_buffer = nullptr;
+  vk::raii::DeviceMemory g_hiz_counter_buffer_memory = nullptr;
+  // depth only, the survivors of the early phase as occluders
+  vk::raii::Pipeline g_occluder_pipeline = nullptr;
+  vk::raii::Pipeline g_occluder_masked_pipeline = nullptr;
+  // bumped whenever the model matrix changes
+  uint64_t g_model_transform_version = 0;
+  // rotating the scene invalidates every cached shadow layer
+  bool g_enable_model_rotation = false;
+  // the particle buffers are reallocated before the next frame when the
+  // capacity changes
+  static constexpr uint32_t kMaxParticleCapacity = 1u << 22;
+  uint32_t g_particle_capacity = 1u << 18;
+  bool g_particle_pool_dirty = false;
+  std::vector<ParticleEmitter> g_particle_emitters = {
+      {.pos = {0.0f, 0.0f, 0.3f},
+       .radius = 0.02f,
+       .v = {0.0f, 0.0f, 0.8f},
+       .spread = 0.25f,
+       .color = {1.0f, 0.6f, 0.2f, 1.0f},
+       .lifetime = 2.0f,
+       .size = 6.0f,
+       .rate = 20000.0f},
+      {.pos = {0.5f, -0.5f, 0.5f},
+       .radius = 0.1f,
+       .v = {0.0f, 0.0f, 0.0f},
+       .spread = 0.1f,
+       .color = {0.3f, 0.6f, 1.0f, 1.0f},
+       .lifetime = 4.0f,
+       .size = 4.0f,
+       .rate = 10000.0f},
+  };
   vk::raii::PipelineLayout g_particle_pipeline_layout = nullptr;
   vk::raii::Pipeline g_particle_pipeline = nullptr;
-  vk::raii::PipelineLayout g_compute_pipeline_layout = nullptr;
-  vk::raii::Pipeline g_compute_pipeline = nullptr;
+  vk::raii::PipelineLayout g_particle_compute_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_particle_init_pipeline = nullptr;
+  vk::raii::Pipeline g_particle_kickoff_pipeline = nullptr;
+  vk::raii::Pipeline g_particle_emit_pipeline = nullptr;
+  vk::raii::Pipeline g_particle_simulate_pipeline = nullptr;
+  // the drawn list is binned into screen tiles and splatted by compute instead
+  // of drawn as point sprites
+  bool g_enable_compute_particles = false;
+  vk::raii::PipelineLayout g_particle_raster_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_particle_bin_pipeline = nullptr;
+  vk::raii::Pipeline g_particle_splat_pipeline = nullptr;
+  // weighted blended oit, accumulation is cleared to 0 and revealage to 1
+  // before the transparent draws and both are composited over g_hdr_image
+  vk::Format g_oit_accum_format = vk::Format::eR16G16B16A16Sfloat;
+  vk::raii::Image g_oit_accum_image = nullptr;
+  vk::raii::DeviceMemory g_oit_accum_image_memory = nullptr;
+  vk::raii::ImageView g_oit_accum_image_view = nullptr;
+  vk::Format g_oit_revealage_format = vk::Format::eR16Sfloat;
+  vk::raii::Image g_oit_revealage_image = nullptr;
+  vk::raii::DeviceMemory g_oit_revealage_image_memory = nullptr;
+  vk::raii::ImageView g_oit_revealage_image_view = nullptr;
+  vk::raii::PipelineLayout g_oit_composite_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_oit_composite_pipeline = nullptr;
   std::vector<vk::raii::Buffer> g_particle_ubo_buffer;
   std::vector<vk::raii::DeviceMemory> g_particle_ubo_buffer_memory;
   std::vector<void*> g_particle_ubo_buffer_maped;
-  std::vector<vk::raii::Buffer> g_particle_buffer;
-  std::vector<vk::raii::DeviceMemory> g_particle_buffer_memory;
+  vk::raii::Buffer g_particle_buffer = nullptr;
+  vk::raii::DeviceMemory g_particle_buffer_memory = nullptr;
+  // dead list followed by the two alive lists
+  vk::raii::Buffer g_particle_index_buffer = nullptr;
+  vk::raii::DeviceMemory g_particle_index_buffer_memory = nullptr;
+  // one per alive list, the first element holds the vk::DrawIndirectCommand
+  // of the list, the only particle buffers the graphics queue touches
+  std::vector<vk::raii::Buffer> g_particle_vertex_buffer;
+  std::vector<vk::raii::DeviceMemory> g_particle_vertex_buffer_memory;
+  vk::raii::Buffer g_particle_counter_buffer = nullptr;
+  vk::raii::DeviceMemory g_particle_counter_buffer_memory = nullptr;
+  // compute rasterizer, splats are sized by the capacity, the tiles by the
+  // swapchain extent with the particle counts of every tile first
+  vk::raii::Buffer g_particle_splat_buffer = nullptr;
+  vk::raii::DeviceMemory g_particle_splat_buffer_memory = nullptr;
+  vk::raii::Buffer g_particle_tile_buffer = nullptr;
+  vk::raii::DeviceMemory g_particle_tile_buffer_memory = nullptr;
+  // timeline semaphores, the compute queue signals one value per particle
+  // simulation and the graphics queue one per frame
   uint64_t g_particle_compute_count = 0;
   vk::raii::Semaphore g_particle_compute_semaphore = nullptr;
+  uint64_t g_graphics_count = 0;
+  vk::raii::Semaphore g_graphics_semaphore = nullptr;
   vk::raii::PipelineLayout g_shadowmap_pipeline_layout = nullptr;
   vk::raii::Pipeline g_shadowmap_pipeline = nullptr;
   vk::Format g_shadowmap_image_format = vk::Format::eD32Sfloat;
   vk::raii::Image g_shadowmap_image = nullptr;
   vk::raii::DeviceMemory g_shadowmap_image_memory = nullptr;
+  // all cascades, sampled by lighting
   vk::raii::ImageView g_shadowmap_image_view = nullptr;
-  uint32_t g_shadowmap_width = 1600;
-  uint32_t g_shadowmap_height = 1200;
+  // one per cascade, rendered by shadow pass
+  std::vector<vk::raii::ImageView> g_shadowmap_layer_image_views;
+  uint32_t g_shadowmap_width = 2048;
+  uint32_t g_shadowmap_height = 2048;
+  // set when the shadow resolution changed, only the shadow map, cache and
+  // moment images are recreated before the next frame
+  bool g_shadow_resources_dirty = false;
+  uint32_t g_shadow_cascade_count = kMaxShadowCascades;
+  // static casters of each cascade, composited under the dynamic casters
+  vk::raii::Image g_shadow_cache_image = nullptr;
+  vk::raii::DeviceMemory g_shadow_cache_image_memory = nullptr;
+  std::vector<vk::raii::ImageView> g_shadow_cache_layer_image_views;
+  bool g_enable_shadow_cache = true;
+  // blend of logarithmic and uniform splits
+  float g_shadow_cascade_split_lambda = 0.75f;
+  vk::raii::Sampler g_shadowmap_compare_sampler = nullptr;
+  // half resolution of shadow map
+  vk::Format g_shadow_moments_format = vk::Format::eR32G32Sfloat;
+  vk::raii::Image g_shadow_moments_temp_image = nullptr;
+  vk::raii::DeviceMemory g_shadow_moments_temp_image_memory = nullptr;
+  vk::raii::ImageView g_shadow_moments_temp_image_view = nullptr;
+  vk::raii::Image g_shadow_moments_image = nullptr;
+  vk::raii::DeviceMemory g_shadow_moments_image_memory = nullptr;
+  vk::raii::ImageView g_shadow_moments_image_view = nullptr;
+  vk::raii::Sampler g_shadow_moments_sampler = nullptr;
+  vk::raii::PipelineLayout g_shadow_moments_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_shadow_moments_horizontal_pipeline = nullptr;
+  vk::raii::Pipeline g_shadow_moments_vertical_pipeline = nullptr;
+  // depth tiles of every shadow casting local light
+  vk::raii::PipelineLayout g_shadow_atlas_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_shadow_atlas_pipeline = nullptr;
+  vk::raii::Image g_shadow_atlas_image = nullptr;
+  vk::raii::DeviceMemory g_shadow_atlas_image_memory = nullptr;
+  vk::raii::ImageView g_shadow_atlas_image_view = nullptr;
+  uint32_t g_shadow_atlas_size = 4096;
+  std::vector<vk::raii::Buffer> g_shadow_light_buffer;
+  std::vector<vk::raii::DeviceMemory> g_shadow_light_buffer_memory;
+  std::vector<void*> g_shadow_light_buffer_maped;
+  std::vector<LocalLight> g_local_lights = {
+      {.pos = {0.2f, -0.2f, 0.4f},
+       .intensities = {1.0f, 0.7f, 0.4f},
+       .range = 1.5f,
+       .type = kLightTypePoint},
+      {.pos = {-0.3f, 0.3f, 0.3f},
+       .intensities = {0.4f, 0.6f, 1.0f},
+       .range = 1.5f,
+       .type = kLightTypePoint},
+      {.pos = {0.8f, 0.8f, 0.8f},
+       .intensities = {2.0f, 2.0f, 1.8f},
+       .range = 3.0f,
+       .type = kLightTypeSpot,
+       .direction = {-0.57735f, -0.57735f, -0.57735f},
+       .spot_angle = 0.4f},
+  };
+  bool g_enable_local_lights = true;
+  // occlusion traced at half resolution, bilateral upsampled for lighting
+  vk::Format g_ssao_format = vk::Format::eR8Unorm;
+  vk::raii::Image g_ssao_half_image = nullptr;
+  vk::raii::DeviceMemory g_ssao_half_image_memory = nullptr;
+  vk::raii::ImageView g_ssao_half_image_view = nullptr;
+  // horizontally blurred half resolution occlusion
+  vk::raii::Image g_ssao_blur_image = nullptr;
+  vk::raii::DeviceMemory g_ssao_blur_image_memory = nullptr;
+  vk::raii::ImageView g_ssao_blur_image_view = nullptr;
+  vk::raii::Image g_ssao_image = nullptr;
+  vk::raii::DeviceMemory g_ssao_image_memory = nullptr;
+  vk::raii::ImageView g_ssao_image_view = nullptr;
+  vk::raii::PipelineLayout g_ssao_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_ssao_pipeline = nullptr;
+  vk::raii::Pipeline g_ssao_blur_horizontal_pipeline = nullptr;
+  vk::raii::Pipeline g_ssao_blur_vertical_pipeline = nullptr;
+  vk::raii::Pipeline g_ssao_upsample_pipeline = nullptr;
+  int32_t g_ssao_sample_count = 8;
+  float g_ssao_radius = 0.05f;
+  // ao and main light shadow accumulated over frames by reprojection, every
+  // frame takes a 1 / kTemporalSampleDivisor share of the samples, the
+  // shadow mask gets it as a push constant
+  static constexpr uint32_t kTemporalSampleDivisor = 4;
+  // camera matrix of the last frame for reprojection, the current one is
+  // taken instead while invalid, i.e. after a resize or a scene load
+  glm::mat4 g_prev_model_view_proj{1.0f};
+  bool g_prev_model_view_proj_valid = false;
+  vk::Format g_shadow_mask_format = vk::Format::eR8Unorm;
+  vk::raii::Image g_shadow_mask_image = nullptr;
+  vk::raii::DeviceMemory g_shadow_mask_image_memory = nullptr;
+  vk::raii::ImageView g_shadow_mask_image_view = nullptr;
+  // one history per frame in flight, each frame reads the one of the last
+  vk::Format g_temporal_history_format = vk::Format::eR16G16B16A16Sfloat;
+  std::vector<vk::raii::Image> g_temporal_history_images;
+  std::vector<vk::raii::DeviceMemory> g_temporal_history_image_memory;
+  std::vector<vk::raii::ImageView> g_temporal_history_image_views;
+  vk::raii::PipelineLayout g_temporal_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_shadow_mask_pipeline = nullptr;
+  vk::raii::Pipeline g_temporal_accumulate_pipeline = nullptr;
+  bool g_enable_temporal_visibility = true;
+  uint32_t g_frame_count = 0;
+  vk::Format g_bloom_format = vk::Format::eR16G16B16A16Sfloat;
   vk::raii::Image g_bloom_image = nullptr;
   vk::raii::DeviceMemory g_bloom_image_memory = nullptr;
   vk::raii::ImageView g_bloom_image_view = nullptr;
   std::vector<vk::raii::ImageView> g_bloom_image_views;
-  static constexpr uint32_t g_bloom_mip_levels = 6;
-  vk::raii::PipelineLayout g_bloom_downsample_pipeline_layout = nullptr;
+  // keep in sync with bloom.slang
+  static constexpr uint32_t kMaxBloomMipLevels = 8;
+  // bloom mip 0 is the swapchain extent divided by g_bloom_downscale, the
+  // chain is cut short if the extent runs out of mips. mips past the 6 of a
+  // downsample tile are reduced by the last workgroup
+  uint32_t g_bloom_downscale = 2;
+  uint32_t g_bloom_mip_levels = 7;
+  // set when the resolution or the mip count changed, only the bloom chain is
+  // recreated before the next frame
+  bool g_bloom_resources_dirty = false;
+  vk::raii::Sampler g_bloom_sampler = nullptr;
+  // bloom composite, tonemapping, fxaa and dithering into the swapchain image
+  vk::raii::PipelineLayout g_post_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_post_pipeline = nullptr;
+  float g_exposure = 1.0f;
+  bool g_enable_fxaa = true;
+  bool g_enable_dither = true;
+  vk::raii::PipelineLayout g_bloom_pipeline_layout = nullptr;
   vk::raii::Pipeline g_bloom_downsample_pipeline = nullptr;
-  vk::raii::PipelineLayout g_bloom_upsample_pipeline_layout = nullptr;
   vk::raii::Pipeline g_bloom_upsample_pipeline = nullptr;
+  // workgroups of the single pass downsample that are done
+  vk::raii::Buffer g_bloom_counter_buffer = nullptr;
+  vk::raii::DeviceMemory g_bloom_counter_buffer_memory = nullptr;
   static constexpr float kBloomRate = 1.5f;
+  vk::Format g_visibility_image_format = vk::Format::eR32Uint;
+  vk::raii::Image g_visibility_image = nullptr;
+  vk::raii::DeviceMemory g_visibility_image_memory = nullptr;
+  vk::raii::ImageView g_visibility_image_view = nullptr;
+  vk::raii::PipelineLayout g_visibility_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_visibility_pipeline = nullptr;
+  vk::raii::PipelineLayout g_visibility_material_pipeline_layout = nullptr;
+  vk::raii::Pipeline g_visibility_material_pipeline = nullptr;
   ImGuiContext* g_imgui_context;
   vk::raii::DescriptorPool g_imgui_pool = nullptr;
   float g_pbr_roughness = 0.5f;
   float g_pbr_f0 = 0.04f;
   float g_pbr_metallic = 0.0f;
+  // set when a pbr slider moved, the vertices are written and uploaded again
+  // before the next frame
+  bool g_pbr_dirty = false;
   float g_light_intensity = 10.0f;
   bool g_enable_ssao = true;
   bool g_enable_bloom = true;
+  bool g_enable_visibility_buffer = false;
+  bool g_enable_depth_prepass = true;
+  // int32_t for ImGui::Combo, cast to ShadowFilterMode when used
+  int32_t g_shadow_filter_mode = kShadowFilterPoisson;
 
   const std::vector<const char*> kValidationLayers = {
       "VK_LAYER_KHRONOS_validation"};
@@ -0,0 +1,75 @@
+#include "culling.h"
+
+bool IntersectFrustum(const glm::mat4& model_view_proj,
+                      const glm::vec3& bounds_min,
+                      const glm::vec3& bounds_max) {
+  // culled if all corners are outside of the same clip plane
+  uint32_t outside = 0x3f;
+  for (uint32_t i = 0; i < 8; ++i) {
+    glm::vec4 clip =
+        model_view_proj * glm::vec4(i & 1 ? bounds_max.x : bounds_min.x,
+                                    i & 2 ? bounds_max.y : bounds_min.y,
+                                    i & 4 ? bounds_max.z : bounds_min.z, 1.0f);
+    outside &= (clip.x < -clip.w) | (clip.x > clip.w) << 1 |
+               (clip.y < -clip.w) << 2 | (clip.y > clip.w) << 3 |
+               (clip.z < 0.0f) << 4 | (clip.z > clip.w) << 5;
+  }
+  return outside == 0;
+}
+
+bool IntersectFrustum(const glm::mat4& model_view_proj,
+                      const SubMesh& sub_mesh) {
+  return IntersectFrustum(model_view_proj, sub_mesh.bounds_min,
+                          sub_mesh.bounds_max);
+}
+
+void TransformBounds(const glm::mat4& model, const glm::vec3& bounds_min,
+                     const glm::vec3& bounds_max, glm::vec3& out_min,
+                     glm::vec3& out_max) {
+  // https://github.com/erich666/GraphicsGems/blob/master/gems/TransBox.c
+  out_min = out_max = glm::vec3(model[3]);
+  for (uint32_t i = 0; i < 3; ++i) {
+    glm::vec3 a = glm::vec3(model[i]) * bounds_min[i];
+    glm::vec3 b = glm::vec3(model[i]) * bounds_max[i];
+    out_min += glm::min(a, b);
+    out_max += glm::max(a, b);
+  }
+}
+
+void ExtractFrustumPlanes(const glm::mat4& model_view_proj,
+                          glm::vec4 planes[6]) {
+  glm::mat4 rows = glm::transpose(model_view_proj);
+  planes[0] = rows[3] + rows[0];
+  planes[1] = rows[3] - rows[0];
+  planes[2] = rows[3] + rows[1];
+  planes[3] = rows[3] - rows[1];
+  planes[4] = rows[2];
+  planes[5] = rows[3] - rows[2];
+  for (uint32_t i = 0; i < 6; ++i) {
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+  }
+}
+
+uint32_t SelectLod(const SubMesh& sub_mesh, const glm::mat4& model,
+                   const glm::vec3& camera_pos, float error_scale,
+                   float threshold, float hysteresis, uint32_t current_lod) {
+  float scale = glm::length(glm::vec3(model[0]));
+  glm::vec3 local_center = (sub_mesh.bounds_min + sub_mesh.bounds_max) * 0.5f;
+  glm::vec3 center = glm::vec3(model * glm::vec4(local_center, 1.0f));
+  float radius =
+      glm::distance(sub_mesh.bounds_min, sub_mesh.bounds_max) * 0.5f * scale;
+  // the closest point of the bounding sphere, the full level inside it
+  float distance = glm::distance(center, camera_pos) - radius;
+  if (distance <= 0.0f) {
+    return 0;
+  }
+  float pixels_per_error = error_scale * scale / distance;
+  for (uint32_t lod = sub_mesh.lod_count; lod-- > 1;) {
+    float limit =
+        lod > current_lod ? threshold * (1.0f - hysteresis) : threshold;
+    if (sub_mesh.lods[lod].error * pixels_per_error <= limit) {
+      return lod;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "data.h"
+#include "third_part/glm_headers.h"
+
+// false if the box is outside of the clip volume, depth in [0, 1]
+bool IntersectFrustum(const glm::mat4& model_view_proj,
+                      const glm::vec3& bounds_min,
+                      const glm::vec3& bounds_max);
+bool IntersectFrustum(const glm::mat4& model_view_proj,
+                      const SubMesh& sub_mesh);
+// axis aligned box around the box transformed by model
+void TransformBounds(const glm::mat4& model, const glm::vec3& bounds_min,
+                     const glm::vec3& bounds_max, glm::vec3& out_min,
+                     glm::vec3& out_max);
+// normalized planes of the clip volume in the space model_view_proj maps
+// from, a point p is inside if dot(plane.xyz, p) + plane.w >= 0 for all
+// https://www.gamedevs.org/uploads/fast-extraction-viewing-frustum-planes-from-world-view-projection-matrix.pdf
+void ExtractFrustumPlanes(const glm::mat4& model_view_proj,
+                          glm::vec4 planes[6]);
+// coarsest level of the sub mesh whose error projects to at most threshold
+// pixels, error_scale is pixels per model space unit at distance 1 from the
+// camera, levels coarser than current_lod need an error hysteresis times
+// smaller, model is a rigid transform with uniform scale
+uint32_t SelectLod(const SubMesh& sub_mesh, const glm::mat4& model,
+                   const glm::vec3& camera_pos, float error_scale,
+                   float threshold, float hysteresis, uint32_t current_lod);
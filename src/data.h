@@ -2,7 +2,35 @@
 
 #include "third_part/glm_headers.h"
 #include "third_part/vulkan_headers.h"
+#include "vertex_layout.h"
 
+constexpr uint32_t kMaxShadowCascades = 4;
+// shadow casting local lights, a spot light owns one atlas view and a point
+// light one per cube face
+constexpr uint32_t kMaxShadowLights = 16;
+constexpr uint32_t kMaxShadowLightViews = 6;
+constexpr uint32_t kMaxParticleEmitters = 4;
+// screen tiles of the compute particle rasterizer, particles binned into a
+// full tile are dropped from it
+constexpr uint32_t kParticleTileSize = 16;
+constexpr uint32_t kParticleTileCapacity = 1024;
+// limits of the meshlets built at import, the sizes mesh shading hardware
+// works best with, even though they are drawn with indirect draws here
+constexpr uint32_t kMaxMeshletVertices = 64;
+constexpr uint32_t kMaxMeshletTriangles = 124;
+// the camera and its late occlusion list, the static and the dynamic casters
+// of every cascade and every shadow atlas view
+constexpr uint32_t kMaxMeshletCullViews =
+    2 + 2 * kMaxShadowCascades + kMaxShadowLights * kMaxShadowLightViews;
+// levels of detail of a sub mesh including the full one
+constexpr uint32_t kMaxMeshLods = 4;
+// draws kept per shadow atlas view, local lights reach few meshlets, the
+// camera and cascade views have room for every meshlet of the scene. the gui
+// shows the meshlets dropped by full lists
+constexpr uint32_t kMaxLocalLightMeshletDraws = 4096;
+
+// full precision vertex of the import, optimization and mesh cache, the gpu
+// only sees QuantizedPosition and QuantizedAttributes
 struct Vertex {
   alignas(16) glm::vec3 position;
   alignas(16) glm::vec4 roughness_f0;
@@ -10,12 +38,144 @@ struct Vertex {
   float metallic;
   glm::vec2 tex_coord;
 
-  static vk::VertexInputBindingDescription GetBindingDescription();
-  static std::array<vk::VertexInputAttributeDescription, 5>
-  GetAttributeDescription();
   bool operator==(const Vertex& other) const;
 };
 
+// the gpu vertex is split into two streams, 20 bytes instead of 64, mirrored
+// by VertexIn in global_data.slangh
+// position stream, the only one depth only passes bind
+struct QuantizedPosition {
+  // xyz inside the bounds of its mesh, dequantized with position_offset and
+  // position_scale of the Mesh, w is the metallic
+  glm::u16vec4 position_metallic;
+};
+// attribute stream, bound after the positions by the shading passes
+struct QuantizedAttributes {
+  glm::u8vec4 roughness_f0;
+  // octahedral
+  glm::i16vec2 normal;
+  // half floats
+  glm::u16vec2 tex_coord;
+};
+void QuantizeVertex(const Vertex& vertex, const glm::vec3& position_offset,
+                    const glm::vec3& position_scale,
+                    QuantizedPosition& position,
+                    QuantizedAttributes& attributes);
+using QuantizedPositionLayout = VertexLayout<
+    QuantizedPosition,
+    VERTEX_ATTRIBUTE(QuantizedPosition, position_metallic,
+                     eR16G16B16A16Unorm)>;
+using QuantizedAttributeLayout = VertexLayout<
+    QuantizedAttributes,
+    VERTEX_ATTRIBUTE(QuantizedAttributes, roughness_f0, eR8G8B8A8Unorm),
+    VERTEX_ATTRIBUTE(QuantizedAttributes, normal, eR16G16Snorm),
+    VERTEX_ATTRIBUTE(QuantizedAttributes, tex_coord, eR16G16Sfloat)>;
+using QuantizedVertexStreams =
+    VertexStreams<QuantizedPositionLayout, QuantizedAttributeLayout>;
+
+// index range of one simplified level, error is how far in model space its
+// surface may be from the full detail one
+struct MeshLod {
+  uint32_t first_index;
+  uint32_t index_count;
+  float error;
+};
+
+// index range of one obj shape, bounds in model space
+struct SubMesh {
+  uint32_t first_index;
+  uint32_t index_count;
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+  // moves on its own, redrawn into the shadow map every frame on top of the
+  // cached static casters
+  bool dynamic_caster = false;
+  // lods[0] is the full detail range above, coarser levels follow
+  uint32_t lod_count = 0;
+  MeshLod lods[kMaxMeshLods] = {};
+};
+
+// contiguous index range of one level of a sub mesh, drawn on its own once it
+// survived culling, keep in sync with meshlet.slang
+enum MeshletFlags : uint32_t {
+  kMeshletDynamicCaster = 1,
+};
+struct Meshlet {
+  // bounding sphere in the space of its mesh
+  alignas(16) glm::vec3 center;
+  float radius;
+  // normal cone, every triangle faces away from eye if
+  // dot(center - eye, cone_axis) >= cone_cutoff * |center - eye| + radius,
+  // a cutoff of 1 is never culled
+  alignas(16) glm::vec3 cone_axis;
+  float cone_cutoff;
+  uint32_t first_index;
+  uint32_t index_count;
+  uint32_t vertex_count;
+  uint32_t flags;
+  // drawn when lod is the level selected for its sub mesh, sub_mesh counts
+  // from the first sub mesh of its mesh
+  uint32_t sub_mesh;
+  uint32_t lod;
+};
+
+// one obj of the scene, its ranges of the global sub mesh and meshlet arrays
+struct Mesh {
+  uint32_t first_sub_mesh;
+  uint32_t sub_mesh_count;
+  uint32_t first_meshlet;
+  uint32_t meshlet_count;
+  // of all sub meshes
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+  // its vertices in g_vertex_positions and g_vertex_attributes, quantized
+  // inside its own bounds, position = position_offset + unorm * position_scale
+  uint32_t first_vertex;
+  uint32_t vertex_count;
+  glm::vec3 position_offset;
+  glm::vec3 position_scale;
+};
+
+// placement of a mesh in the scene, model maps the mesh into the space ubo
+// modu maps to the world, rigid with uniform scale
+struct Instance {
+  uint32_t mesh;
+  glm::mat4 model;
+  // moves on its own, every meshlet of it is drawn with the dynamic casters
+  bool dynamic_caster;
+  // first of the lod slots of its sub meshes
+  uint32_t first_lod;
+};
+// lod slot of an instance outside of every cull view, no meshlet of it
+// matches, keep in sync with meshlet.slang
+constexpr uint32_t kLodHidden = 0xffffffffu;
+// an Instance as the shaders see it, keep in sync with global_data.slangh
+struct InstanceData {
+  alignas(16) glm::mat4 model;
+  // box of its mesh, in the space of the mesh
+  glm::vec3 bounds_min;
+  uint32_t first_lod;
+  alignas(16) glm::vec3 bounds_max;
+  // MeshletFlags applied to all of its meshlets
+  uint32_t flags;
+  // dequantization of its mesh, w unused
+  alignas(16) glm::vec4 position_offset;
+  alignas(16) glm::vec4 position_scale;
+};
+
+// one meshlet of one instance, the meshlet culling runs one thread per item
+// and view
+struct MeshletCullItem {
+  uint32_t instance;
+  uint32_t meshlet;
+};
+// an indirect draw of the culled lists followed by the instance it draws,
+// first_instance is the slot of the draw so vertex shaders find the instance
+struct MeshletDraw {
+  vk::DrawIndexedIndirectCommand command;
+  uint32_t instance;
+};
+
 struct UniformBufferObject {
   alignas(16) glm::mat4 modu;
   alignas(16) glm::mat4 view;
@@ -30,32 +190,226 @@ struct UniformBufferObject {
   alignas(16) glm::mat4 light_proj;
   alignas(8) glm::vec2 shadowmap_resolution;
   alignas(8) glm::vec2 shadowmap_scale;
+  alignas(16) glm::mat4 light_view_proj[kMaxShadowCascades];
+  // far view depth of each cascade
+  alignas(16) glm::vec4 cascade_splits;
+  uint32_t cascade_count;
+  uint32_t shadow_light_count;
+  // object space from the current depth and back to the last frame
+  alignas(16) glm::mat4 inv_model_view_proj;
+  alignas(16) glm::mat4 prev_model_view_proj;
+  uint32_t frame_count;
+  // the index buffer holds uint16_t indices
+  uint32_t index_16bit;
+};
+
+enum LightType : uint32_t {
+  kLightTypeSpot = 0,
+  kLightTypePoint = 1,
+};
+struct LocalLight {
+  glm::vec3 pos;
+  glm::vec3 intensities;
+  float range;
+  LightType type;
+  // spot lights only, half angle of the cone in radians
+  glm::vec3 direction{0.0f, 0.0f, -1.0f};
+  float spot_angle = 0.5f;
 };
+// keep in sync with shadow.slang
+struct ShadowLight {
+  alignas(16) glm::mat4 view_proj[kMaxShadowLightViews];
+  // uv offset and scale of each view in the atlas
+  alignas(16) glm::vec4 atlas_rect[kMaxShadowLightViews];
+  alignas(16) glm::vec3 pos;
+  float range;
+  alignas(16) glm::vec3 intensities;
+  uint32_t type;
+  alignas(16) glm::vec3 direction;
+  float spot_cos_angle;
+  // 0 if the light did not fit into the atlas
+  uint32_t view_count;
+};
+// keep in sync with shadow.slang
+enum ShadowFilterMode : uint32_t {
+  kShadowFilterPcss = 0,
+  kShadowFilterPcf = 1,
+  kShadowFilterPoisson = 2,
+  kShadowFilterVsm = 3,
+};
+
 // push_constants size should be multiple of 4
 struct LightingPushConstants {
   int32_t enable_ssao;
+  uint32_t shadow_filter_mode;
+  int32_t enable_temporal;
+};
+
+struct PostPushConstants {
+  float exposure;
+  // 0 if bloom is off
+  float bloom_factor;
+  int32_t enable_fxaa;
+  int32_t enable_dither;
+};
+
+struct SsaoPushConstants {
+  uint32_t sample_count;
+  float radius;
+  uint32_t noise_frame;
+};
+
+struct TemporalPushConstants {
+  uint32_t shadow_filter_mode;
+  int32_t enable_ssao;
+  uint32_t reset_history;
+  uint32_t sample_divisor;
+};
+
+struct ShadowPushConstants {
+  uint32_t cascade_index;
+};
+
+// which meshlets a cull view keeps, keep in sync with meshlet.slang
+enum MeshletCullFilter : uint32_t {
+  kMeshletCullAll = 0,
+  kMeshletCullStatic = 1,
+  kMeshletCullDynamic = 2,
+};
+// one view the meshlets are culled for, written by the cpu every frame
+struct MeshletCullView {
+  // clip planes in the space of the instances, normalized so distances are
+  // in its units
+  alignas(16) glm::vec4 planes[6];
+  // eye in the space of the instances, the normal cones are only tested if
+  // w is 1
+  alignas(16) glm::vec4 eye;
+  MeshletCullFilter filter;
+  // the draw list of the view in the draw buffer
+  uint32_t draw_offset;
+  uint32_t draw_capacity;
+};
+
+struct MeshletCullPushConstants {
+  uint32_t view_count;
+  uint32_t item_count;
+  // 0 keeps every meshlet of the selected levels
+  uint32_t enable_culling;
+  uint32_t instance_count;
+  // OcclusionPhase of occlusion_view, the other views are not occlusion
+  // culled
+  uint32_t occlusion_phase;
+  uint32_t occlusion_view;
+  // the late phase appends here instead of to occlusion_view, Cull skips it
+  uint32_t occlusion_late_view;
+  // of the depth buffer the hi-z pyramid is built from
+  uint32_t occlusion_width;
+  uint32_t occlusion_height;
+};
+
+// two phase occlusion culling of the camera view against the hi-z pyramid,
+// keep in sync with meshlet.slang
+enum OcclusionPhase : uint32_t {
+  kOcclusionOff = 0,
+  // against the pyramid of the last frame, the occluded meshlets are kept for
+  // the late phase
+  kOcclusionEarly = 1,
+  // the meshlets the early phase kept against the pyramid of this frame
+  kOcclusionLate = 2,
+};
+
+// written by the occlusion culling of a frame, starts as {{0, 1, 1}}
+struct OcclusionCullState {
+  // one workgroup of the late phase per kMeshletCullGroupSize kept meshlets
+  vk::DispatchIndirectCommand late_dispatch;
+  uint32_t occluded_instances;
+  uint32_t recovered_instances;
+  uint32_t rejected_meshlets;
+  uint32_t recovered_meshlets;
+};
+
+struct HiZPushConstants {
+  uint32_t mip_count;
+  uint32_t group_count;
+};
+
+struct ShadowAtlasPushConstants {
+  uint32_t light_index;
+  uint32_t view_index;
 };
 
 struct BloomPushConstants {
   uint32_t bloom_mip_level;
   float bloom_factor;
+  uint32_t mip_count;
+  uint32_t group_count;
+};
+
+struct ParticleRasterPushConstants {
+  // alive list drawn this frame
+  uint32_t list;
+  uint32_t capacity;
+  uint32_t tile_count_x;
+  uint32_t tile_count_y;
 };
 
+// simulation state, only touched by compute
 struct Particle {
   alignas(16) glm::vec3 pos;
+  float age;
   alignas(16) glm::vec3 v;
+  float lifetime;
   alignas(16) glm::vec3 color;
-  static vk::VertexInputBindingDescription GetBindingDescription();
-  static std::array<vk::VertexInputAttributeDescription, 3>
-  GetAttributeDescription();
+  float size;
+};
+// compacted alive particles written by the simulation, drawn as points
+struct ParticleVertex {
+  alignas(16) glm::vec3 pos;
+  float size;
+  alignas(16) glm::vec4 color;
+};
+using ParticleVertexLayout = VertexLayout<
+    ParticleVertex, VERTEX_ATTRIBUTE(ParticleVertex, pos, eR32G32B32Sfloat),
+    VERTEX_ATTRIBUTE(ParticleVertex, size, eR32Sfloat),
+    VERTEX_ATTRIBUTE(ParticleVertex, color, eR32G32B32A32Sfloat)>;
+// projected by the compute rasterizer, one per vertex of the drawn list
+struct ParticleSplat {
+  glm::vec2 pos;
+  float depth;
+  // in pixels
+  float radius;
+  glm::vec4 color;
+};
+struct ParticleEmitter {
+  alignas(16) glm::vec3 pos;
+  // particles spawn inside this sphere
+  float radius;
+  alignas(16) glm::vec3 v;
+  // random velocity added to v
+  float spread;
+  alignas(16) glm::vec4 color;
+  float lifetime;
+  float size;
+  // particles per second
+  float rate;
+  // filled in every frame from rate
+  uint32_t emit_count;
 };
 struct ParticleUbo {
   float delta_time = 0;
+  uint32_t emitter_count;
+  uint32_t capacity;
+  uint32_t seed;
+  // alive list simulated this frame, the other one receives the survivors
+  uint32_t current_list;
+  alignas(16) ParticleEmitter emitters[kMaxParticleEmitters];
 };
-
-namespace std {
-template <>
-struct hash<Vertex> {
-  size_t operator()(Vertex const& vertex) const;
+// written by the particle kernels only, draw[i].vertexCount is the size of
+// alive list i
+struct ParticleCounters {
+  vk::DrawIndirectCommand draw[2];
+  vk::DispatchIndirectCommand emit_dispatch;
+  vk::DispatchIndirectCommand simulate_dispatch;
+  uint32_t dead_count;
+  uint32_t emit_count;
 };
-}  // namespace std
\ No newline at end of file
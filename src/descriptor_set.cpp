@@ -13,7 +13,8 @@ void DescriptorSetManager::CreateDescriptorSetLayout() {
   std::vector<vk::DescriptorSetLayoutBinding> layout_bindings;
   for (const DescriptorSetInfo& descriptor_set_info : descriptor_set_infos) {
     layout_bindings.emplace_back(descriptor_set_info.binding,
-                                 descriptor_set_info.type, 1,
+                                 descriptor_set_info.type,
+                                 descriptor_set_info.descriptor_count,
                                  descriptor_set_info.stage, nullptr);
   }
   vk::DescriptorSetLayoutCreateInfo set_layout_info{
@@ -28,7 +29,8 @@ void DescriptorSetManager::CreateDescriptorPool() {
   std::vector<vk::DescriptorPoolSize> pool_sizes;
   std::unordered_map<vk::DescriptorType, uint32_t> type_counts;
   for (const DescriptorSetInfo& descriptor_set_info : descriptor_set_infos) {
-    ++type_counts[descriptor_set_info.type];
+    type_counts[descriptor_set_info.type] +=
+        descriptor_set_info.descriptor_count;
   }
   for (const auto& type_count : type_counts) {
     pool_sizes.emplace_back(vk::DescriptorPoolSize{
@@ -62,9 +64,10 @@ void DescriptorSetManager::UpdateDescriptorSets() {
               .dstSet = Context::Instance()->g_descriptor_sets[i],
               .dstBinding = descriptor_set_info.binding,
               .dstArrayElement = 0,
-              .descriptorCount = 1,
+              .descriptorCount = descriptor_set_info.descriptor_count,
               .descriptorType = descriptor_set_info.type,
-              .pImageInfo = &descriptor_set_info.image_info[i]});
+              .pImageInfo = &descriptor_set_info.image_info
+                                 [i * descriptor_set_info.descriptor_count]});
           break;
         case vk::DescriptorType::eUniformBuffer:
         case vk::DescriptorType::eStorageBuffer:
@@ -74,9 +77,10 @@ void DescriptorSetManager::UpdateDescriptorSets() {
               .dstSet = Context::Instance()->g_descriptor_sets[i],
               .dstBinding = descriptor_set_info.binding,
               .dstArrayElement = 0,
-              .descriptorCount = 1,
+              .descriptorCount = descriptor_set_info.descriptor_count,
               .descriptorType = descriptor_set_info.type,
-              .pBufferInfo = &descriptor_set_info.buffer_info[i]});
+              .pBufferInfo = &descriptor_set_info.buffer_info
+                                 [i * descriptor_set_info.descriptor_count]});
           break;
         default:
           break;
@@ -106,7 +110,8 @@ void DescriptorSetManager::ClearDescriptorSetInfo() {
 void DescriptorSetManager::RegisterDescriptorSetInfo(
     uint32_t binding, vk::DescriptorType type, vk::ShaderStageFlags stage,
     std::vector<vk::DescriptorImageInfo> image_info,
-    std::vector<vk::DescriptorBufferInfo> buffer_info) {
+    std::vector<vk::DescriptorBufferInfo> buffer_info,
+    uint32_t descriptor_count) {
   descriptor_set_infos.emplace_back(binding, type, stage, image_info,
-                                    buffer_info);
+                                    buffer_info, descriptor_count);
 }
@@ -10,8 +10,10 @@ struct DescriptorSetInfo {
   uint32_t binding;
   vk::DescriptorType type;
   vk::ShaderStageFlags stage;
+  // descriptor_count infos per frame in flight, frame after frame
   std::vector<vk::DescriptorImageInfo> image_info;
   std::vector<vk::DescriptorBufferInfo> buffer_info;
+  uint32_t descriptor_count = 1;
 };
 void CreateDescriptorSetLayout();
 void CreateDescriptorPool();
@@ -21,6 +23,7 @@ void ClearDescriptorSetInfo();
 void RegisterDescriptorSetInfo(
     uint32_t binding, vk::DescriptorType type, vk::ShaderStageFlags stage,
     std::vector<vk::DescriptorImageInfo> image_info,
-    std::vector<vk::DescriptorBufferInfo> buffer_info);
+    std::vector<vk::DescriptorBufferInfo> buffer_info,
+    uint32_t descriptor_count = 1);
 
 }  // namespace DescriptorSetManager
@@ -64,7 +64,7 @@ void PickPhysicalDevice() {
     auto features = device.getFeatures2<
         vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features,
         vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT,
-        vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR,
+        vk::PhysicalDeviceVulkan12Features,
         vk::PhysicalDeviceDynamicRenderingLocalReadFeaturesKHR>();
     bool supports_required_features =
         features.get<vk::PhysicalDeviceVulkan13Features>().dynamicRendering &&
@@ -73,8 +73,19 @@ void PickPhysicalDevice() {
             .extendedDynamicState &&
         features.get<vk::PhysicalDeviceFeatures2>()
             .features.samplerAnisotropy &&
-        features.get<vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR>()
-            .timelineSemaphore &&
+        features.get<vk::PhysicalDeviceFeatures2>().features.geometryShader &&
+        features.get<vk::PhysicalDeviceFeatures2>()
+            .features.multiDrawIndirect &&
+        features.get<vk::PhysicalDeviceFeatures2>()
+            .features.drawIndirectFirstInstance &&
+        features.get<vk::PhysicalDeviceFeatures2>()
+            .features.shaderStorageImageExtendedFormats &&
+        features.get<vk::PhysicalDeviceFeatures2>()
+            .features.shaderStorageBufferArrayDynamicIndexing &&
+        features.get<vk::PhysicalDeviceFeatures2>()
+            .features.shaderStorageImageArrayDynamicIndexing &&
+        features.get<vk::PhysicalDeviceVulkan12Features>().drawIndirectCount &&
+        features.get<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore &&
         features.get<vk::PhysicalDeviceDynamicRenderingLocalReadFeaturesKHR>()
             .dynamicRenderingLocalRead;
     if (found == false ||
@@ -111,26 +122,63 @@ void CreateLogicalDevice() {
     throw std::runtime_error(
         "Could not find a queue for graphics and present!");
   }
+  // a compute only family runs the particle simulation next to graphics,
+  // otherwise the graphics queue does both
+  uint32_t compute_queue_index = queue_index;
+  for (uint32_t i = 0; i < queue_family_properties.size(); ++i) {
+    if ((queue_family_properties[i].queueFlags & vk::QueueFlagBits::eCompute) &&
+        !(queue_family_properties[i].queueFlags &
+          vk::QueueFlagBits::eGraphics)) {
+      compute_queue_index = i;
+      break;
+    }
+  }
   float queue_priorities[1] = {0.0};
-  vk::DeviceQueueCreateInfo device_queue_create_info{
+  std::vector<vk::DeviceQueueCreateInfo> device_queue_create_infos{{
       .queueFamilyIndex = queue_index,
       .queueCount = 1,
-      .pQueuePriorities = queue_priorities};
+      .pQueuePriorities = queue_priorities,
+  }};
+  if (compute_queue_index != queue_index) {
+    device_queue_create_infos.push_back({
+        .queueFamilyIndex = compute_queue_index,
+        .queueCount = 1,
+        .pQueuePriorities = queue_priorities,
+    });
+  }
   vk::PhysicalDeviceFeatures devices_features;
+  // optional, only used for gpu stats
+  Context::Instance()->g_enable_pipeline_statistics =
+      Context::Instance()
+          ->g_physical_device.getFeatures()
+          .pipelineStatisticsQuery;
   vk::StructureChain<vk::PhysicalDeviceFeatures2,
                      vk::PhysicalDeviceVulkan13Features,
                      vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT,
-                     vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR,
+                     vk::PhysicalDeviceVulkan12Features,
                      vk::PhysicalDeviceDynamicRenderingLocalReadFeaturesKHR>
-      feature_chain = {{.features = {.samplerAnisotropy = true}},
+      feature_chain = {{.features = {.geometryShader = true,
+                                      .multiDrawIndirect = true,
+                                      .drawIndirectFirstInstance = true,
+                                      .samplerAnisotropy = true,
+                                      .pipelineStatisticsQuery =
+                                          Context::Instance()
+                                              ->g_enable_pipeline_statistics,
+                                      .shaderStorageImageExtendedFormats =
+                                          true,
+                                      .shaderStorageBufferArrayDynamicIndexing =
+                                          true,
+                                      .shaderStorageImageArrayDynamicIndexing =
+                                          true}},
                        {.synchronization2 = true, .dynamicRendering = true},
                        {.extendedDynamicState = true},
-                       {.timelineSemaphore = true},
+                       {.drawIndirectCount = true, .timelineSemaphore = true},
                        {.dynamicRenderingLocalRead = true}};
   vk::DeviceCreateInfo device_create_info{
       .pNext = &feature_chain.get<vk::PhysicalDeviceFeatures2>(),
-      .queueCreateInfoCount = 1,
-      .pQueueCreateInfos = &device_queue_create_info,
+      .queueCreateInfoCount =
+          static_cast<uint32_t>(device_queue_create_infos.size()),
+      .pQueueCreateInfos = device_queue_create_infos.data(),
       .enabledExtensionCount = static_cast<uint32_t>(
           Context::Instance()->kRequiredDeviceExtensions.size()),
       .ppEnabledExtensionNames =
@@ -140,6 +188,12 @@ void CreateLogicalDevice() {
   Context::Instance()->g_queue =
       vk::raii::Queue(Context::Instance()->g_device, queue_index, 0);
   Context::Instance()->g_queue_index = queue_index;
+  Context::Instance()->g_compute_queue =
+      vk::raii::Queue(Context::Instance()->g_device, compute_queue_index, 0);
+  Context::Instance()->g_compute_queue_index = compute_queue_index;
+  if (compute_queue_index != queue_index) {
+    LOG("using async compute queue family: ", compute_queue_index);
+  }
 }
 
 void InitDevice() {
@@ -1,6 +1,14 @@
 #include "gui.h"
 
+#include <bit>
+#include <cmath>
+
 #include "context.h"
+#include "job_system.h"
+#include "query.h"
+#include "render_pass/meshlet_cull_pass.h"
+#include "render_pass/shadow_atlas_pass.h"
+#include "render_pass/shadowmap_pass.h"
 
 namespace {
 void FramebufferSizeCallback(GLFWwindow* window, int /* width */,
@@ -103,23 +111,27 @@ void Gui::Update() {
     ImGui::Text("Roughness:");
     ImGui::TableSetColumnIndex(1);
     ImGui::SetNextItemWidth(-1.0f);
-    ImGui::SliderFloat("##RoughnessSlider",
-                       &Context::Instance()->g_pbr_roughness, 0.0f, 1.0f,
-                       "%.2f");
+    bool pbr_changed = ImGui::SliderFloat(
+        "##RoughnessSlider", &Context::Instance()->g_pbr_roughness, 0.0f, 1.0f,
+        "%.2f");
     ImGui::TableNextRow();
     ImGui::TableSetColumnIndex(0);
     ImGui::Text("F0:");
     ImGui::TableSetColumnIndex(1);
     ImGui::SetNextItemWidth(-1.0f);
-    ImGui::SliderFloat("##F0Slider", &Context::Instance()->g_pbr_f0, 0.0f, 1.0f,
-                       "%.2f");
+    pbr_changed |= ImGui::SliderFloat(
+        "##F0Slider", &Context::Instance()->g_pbr_f0, 0.0f, 1.0f, "%.2f");
     ImGui::TableNextRow();
     ImGui::TableSetColumnIndex(0);
     ImGui::Text("Metallic:");
     ImGui::TableSetColumnIndex(1);
     ImGui::SetNextItemWidth(-1.0f);
-    ImGui::SliderFloat("##MetallicSlider", &Context::Instance()->g_pbr_metallic,
-                       0.0f, 1.0f, "%.2f");
+    pbr_changed |= ImGui::SliderFloat("##MetallicSlider",
+                                      &Context::Instance()->g_pbr_metallic,
+                                      0.0f, 1.0f, "%.2f");
+    if (pbr_changed) {
+      Context::Instance()->g_pbr_dirty = true;
+    }
     ImGui::TableNextRow();
     ImGui::TableSetColumnIndex(0);
     ImGui::Text("Light:");
@@ -130,7 +142,186 @@ void Gui::Update() {
     ImGui::EndTable();
   }
   ImGui::Checkbox("SSAO", &Context::Instance()->g_enable_ssao);
+  ImGui::SliderInt("SSAO Samples", &Context::Instance()->g_ssao_sample_count,
+                   1, 32);
+  ImGui::SliderFloat("SSAO Radius", &Context::Instance()->g_ssao_radius, 0.01f,
+                     0.3f, "%.2f");
+  // ssao samples and poisson taps are spread over the accumulated frames
+  ImGui::Checkbox("Temporal AO/Shadow",
+                  &Context::Instance()->g_enable_temporal_visibility);
   ImGui::Checkbox("Bloom", &Context::Instance()->g_enable_bloom);
+  int bloom_resolution_index = static_cast<int>(
+      std::log2(Context::Instance()->g_bloom_downscale));
+  int bloom_mip_levels =
+      static_cast<int>(Context::Instance()->g_bloom_mip_levels);
+  bool bloom_changed = ImGui::Combo("Bloom Resolution", &bloom_resolution_index,
+                                    "Full\0" "Half\0" "Quarter\0");
+  bloom_changed |= ImGui::SliderInt("Bloom Mips", &bloom_mip_levels, 1,
+                                    Context::kMaxBloomMipLevels);
+  if (bloom_changed) {
+    Context::Instance()->g_bloom_downscale = 1u << bloom_resolution_index;
+    Context::Instance()->g_bloom_mip_levels = bloom_mip_levels;
+    Context::Instance()->g_bloom_resources_dirty = true;
+  }
+  ImGui::SliderFloat("Exposure", &Context::Instance()->g_exposure, 0.1f, 4.0f,
+                     "%.2f");
+  ImGui::Checkbox("FXAA", &Context::Instance()->g_enable_fxaa);
+  ImGui::Checkbox("Dither", &Context::Instance()->g_enable_dither);
+  int particle_capacity_log2 = static_cast<int>(
+      std::bit_width(Context::Instance()->g_particle_capacity) - 1);
+  if (ImGui::SliderInt(
+          "Particle Capacity", &particle_capacity_log2, 10,
+          static_cast<int>(std::bit_width(Context::kMaxParticleCapacity) - 1),
+          "2^%d")) {
+    Context::Instance()->g_particle_capacity = 1u << particle_capacity_log2;
+    Context::Instance()->g_particle_pool_dirty = true;
+  }
+  for (uint32_t i = 0; i < Context::Instance()->g_particle_emitters.size();
+       ++i) {
+    ImGui::PushID(static_cast<int>(i));
+    ImGui::SliderFloat("Emitter Rate",
+                       &Context::Instance()->g_particle_emitters[i].rate, 0.0f,
+                       2000000.0f, "%.0f/s", ImGuiSliderFlags_Logarithmic);
+    ImGui::PopID();
+  }
+  // compare the "Particle Tiles" and "Transparency" timestamps
+  ImGui::Checkbox("Compute Particles",
+                  &Context::Instance()->g_enable_compute_particles);
+  ImGui::Checkbox("Visibility Buffer",
+                  &Context::Instance()->g_enable_visibility_buffer);
+  // ssao and the temporal accumulation read the depth of the prepass, defer
+  // lighting forces it on for them
+  // the occluders of the occlusion culling are the prepass of the early list
+  bool depth_prepass_forced =
+      !Context::Instance()->g_enable_visibility_buffer &&
+      (Context::Instance()->g_enable_ssao ||
+       Context::Instance()->g_enable_temporal_visibility ||
+       Context::Instance()->g_enable_occlusion_culling);
+  bool depth_prepass_on = true;
+  ImGui::BeginDisabled(depth_prepass_forced);
+  ImGui::Checkbox("Depth Prepass",
+                  depth_prepass_forced
+                      ? &depth_prepass_on
+                      : &Context::Instance()->g_enable_depth_prepass);
+  ImGui::EndDisabled();
+  if (depth_prepass_forced) {
+    ImGui::SameLine();
+    ImGui::TextDisabled("(SSAO/Temporal/Occlusion)");
+  }
+  ImGui::Checkbox("Instance Culling",
+                  &Context::Instance()->g_enable_instance_culling);
+  ImGui::Checkbox("Meshlet Culling",
+                  &Context::Instance()->g_enable_meshlet_culling);
+  ImGui::Checkbox("Occlusion Culling",
+                  &Context::Instance()->g_enable_occlusion_culling);
+  ImGui::Checkbox("LOD", &Context::Instance()->g_enable_lod);
+  ImGui::SliderFloat("LOD Error (px)",
+                     &Context::Instance()->g_lod_error_threshold, 0.25f, 8.0f,
+                     "%.2f");
+  ImGui::SliderFloat("LOD Hysteresis", &Context::Instance()->g_lod_hysteresis,
+                     0.0f, 0.9f, "%.2f");
+  ImGui::Combo("Shadow Filter", &Context::Instance()->g_shadow_filter_mode,
+               "PCSS\0PCF\0Poisson PCF\0VSM\0");
+  int cascade_count =
+      static_cast<int>(Context::Instance()->g_shadow_cascade_count);
+  if (ImGui::SliderInt("Shadow Cascades", &cascade_count, 1,
+                       kMaxShadowCascades)) {
+    Context::Instance()->g_shadow_cascade_count = cascade_count;
+  }
+  ImGui::SliderFloat("Cascade Split Lambda",
+                     &Context::Instance()->g_shadow_cascade_split_lambda, 0.0f,
+                     1.0f, "%.2f");
+  int resolution_index = static_cast<int>(
+      std::log2(Context::Instance()->g_shadowmap_width / 1024));
+  if (ImGui::Combo("Shadow Resolution", &resolution_index,
+                   "1024\0" "2048\0" "4096\0")) {
+    Context::Instance()->g_shadowmap_width = 1024u << resolution_index;
+    Context::Instance()->g_shadowmap_height = 1024u << resolution_index;
+    Context::Instance()->g_shadow_resources_dirty = true;
+  }
+  ImGui::Checkbox("Shadow Cache", &Context::Instance()->g_enable_shadow_cache);
+  ImGui::Checkbox("Rotate Model",
+                  &Context::Instance()->g_enable_model_rotation);
+  ImGui::Checkbox("Local Lights", &Context::Instance()->g_enable_local_lights);
+  if (ImGui::CollapsingHeader("GPU Profile")) {
+    ImGui::Text("Shadow cascades rendered: %u / %u",
+                ShadowmapPass::GetRenderedCascadeCount(),
+                Context::Instance()->g_shadow_cascade_count);
+    ImGui::Text("Shadow atlas: %u views, %.0f%% used",
+                ShadowAtlasPass::GetAtlasViewCount(),
+                ShadowAtlasPass::GetAtlasOccupancy() * 100.0f);
+    uint32_t lod_triangles = 0;
+    uint32_t full_triangles = 0;
+    for (const Instance& instance : Context::Instance()->g_instances) {
+      const Mesh& mesh = Context::Instance()->g_meshes[instance.mesh];
+      for (uint32_t i = 0; i < mesh.sub_mesh_count; ++i) {
+        const SubMesh& sub_mesh =
+            Context::Instance()->g_sub_meshes[mesh.first_sub_mesh + i];
+        uint32_t lod =
+            Context::Instance()->g_instance_lods[instance.first_lod + i];
+        if (lod != kLodHidden) {
+          lod_triangles += sub_mesh.lods[lod].index_count / 3;
+        }
+        full_triangles += sub_mesh.index_count / 3;
+      }
+    }
+    ImGui::Text("Instances: %zu of %zu meshes",
+                Context::Instance()->g_instances.size(),
+                Context::Instance()->g_meshes.size());
+    ImGui::Text("LOD triangles: %u / %u", lod_triangles, full_triangles);
+    const std::vector<BvhCullStats>& instance_cull_stats =
+        MeshletCullPass::GetInstanceCullStats();
+    if (ImGui::TreeNode("Instance Culling Stats",
+                        "Instance culling: %.3f ms, %u bvh nodes, %u threads",
+                        MeshletCullPass::GetInstanceCullTime(),
+                        Context::Instance()->g_instance_bvh.GetNodeCount(),
+                        JobSystem::GetWorkerCount() + 1)) {
+      for (size_t i = 0; i < instance_cull_stats.size(); ++i) {
+        ImGui::Text("View %zu: %u visible, %u boxes tested", i,
+                    instance_cull_stats[i].visible,
+                    instance_cull_stats[i].tested);
+      }
+      ImGui::TreePop();
+    }
+    ImGui::Text("Meshlets: %zu, drawn %u over %u views",
+                Context::Instance()->g_meshlet_cull_items.size(),
+                MeshletCullPass::GetDrawnMeshletCount(),
+                MeshletCullPass::GetViewCount());
+    if (MeshletCullPass::GetDroppedMeshletCount() > 0) {
+      ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f),
+                         "Meshlet lists full: %u meshlets dropped",
+                         MeshletCullPass::GetDroppedMeshletCount());
+    }
+    if (Context::Instance()->g_enable_occlusion_culling) {
+      // what stays occluded after the late phase
+      const OcclusionCullState& occlusion =
+          MeshletCullPass::GetOcclusionState();
+      ImGui::Text("Occlusion: %u instances and %u meshlets culled",
+                  occlusion.occluded_instances - occlusion.recovered_instances,
+                  occlusion.rejected_meshlets - occlusion.recovered_meshlets);
+      ImGui::Text("Camera: %u meshlets drawn, %u recovered late",
+                  MeshletCullPass::GetDrawnCameraMeshletCount(),
+                  occlusion.recovered_meshlets);
+    }
+    for (const QueryManager::TimestampResult& timestamp :
+         QueryManager::GetTimestampResults()) {
+      ImGui::Text("%s: %.3f ms", timestamp.name.c_str(), timestamp.time_ms);
+    }
+    // fragment shader invocations per pixel, 1.0 means no overdraw
+    double pixel_count =
+        static_cast<double>(Context::Instance()->g_swapchain_extent.width) *
+        Context::Instance()->g_swapchain_extent.height;
+    for (const QueryManager::StatisticsResult& statistics :
+         QueryManager::GetStatisticsResults()) {
+      ImGui::Text("%s: vs %llu, fs %llu, overdraw %.2f",
+                  statistics.name.c_str(),
+                  static_cast<unsigned long long>(
+                      statistics.vertex_invocations),
+                  static_cast<unsigned long long>(
+                      statistics.fragment_invocations),
+                  statistics.fragment_invocations / pixel_count);
+    }
+  }
   ImGui::End();
   ImGui::Render();
 }
@@ -0,0 +1,339 @@
+#include "instance_bvh.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "job_system.h"
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#define INSTANCE_BVH_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace {
+constexpr uint32_t kLeafBit = 0x80000000u;
+// smaller trees run one job per view, splitting them costs more than it saves
+constexpr uint32_t kMinParallelInstances = 4096;
+// a node has at most 4 children and the stack holds 3 per level
+constexpr uint32_t kMaxStackSize = 256;
+
+#ifdef INSTANCE_BVH_SSE
+using Float4 = __m128;
+Float4 Load(const float* values) { return _mm_load_ps(values); }
+Float4 Broadcast(float value) { return _mm_set1_ps(value); }
+Float4 MulAdd(Float4 a, Float4 b, Float4 c) {
+  return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+uint32_t NegativeMask(Float4 a) {
+  return static_cast<uint32_t>(
+      _mm_movemask_ps(_mm_cmplt_ps(a, _mm_setzero_ps())));
+}
+#else
+struct Float4 {
+  float v[4];
+};
+Float4 Load(const float* values) {
+  return {values[0], values[1], values[2], values[3]};
+}
+Float4 Broadcast(float value) { return {value, value, value, value}; }
+Float4 MulAdd(Float4 a, Float4 b, Float4 c) {
+  Float4 result;
+  for (uint32_t i = 0; i < 4; ++i) {
+    result.v[i] = a.v[i] * b.v[i] + c.v[i];
+  }
+  return result;
+}
+uint32_t NegativeMask(Float4 a) {
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < 4; ++i) {
+    mask |= (a.v[i] < 0.0f ? 1u : 0u) << i;
+  }
+  return mask;
+}
+#endif
+}  // namespace
+
+// broadcast once per view, the sign of each normal picks the corner of a box
+// that is tested
+struct InstanceBvh::ViewPlanes {
+  Float4 x[6];
+  Float4 y[6];
+  Float4 z[6];
+  Float4 w[6];
+  bool positive_x[6];
+  bool positive_y[6];
+  bool positive_z[6];
+
+  explicit ViewPlanes(const FrustumPlanes& planes) {
+    for (uint32_t i = 0; i < 6; ++i) {
+      x[i] = Broadcast(planes[i].x);
+      y[i] = Broadcast(planes[i].y);
+      z[i] = Broadcast(planes[i].z);
+      w[i] = Broadcast(planes[i].w);
+      positive_x[i] = planes[i].x >= 0.0f;
+      positive_y[i] = planes[i].y >= 0.0f;
+      positive_z[i] = planes[i].z >= 0.0f;
+    }
+  }
+
+  // lanes of the node outside of a plane, inside gets the lanes inside of
+  // all planes, lanes past lane_count count as outside
+  uint32_t Test(const Node& node, uint32_t& inside) const {
+    Float4 min_x = Load(node.min_x);
+    Float4 min_y = Load(node.min_y);
+    Float4 min_z = Load(node.min_z);
+    Float4 max_x = Load(node.max_x);
+    Float4 max_y = Load(node.max_y);
+    Float4 max_z = Load(node.max_z);
+    uint32_t empty = 0xfu & ~((1u << node.lane_count) - 1);
+    uint32_t outside = empty;
+    uint32_t crossing = 0;
+    for (uint32_t i = 0; i < 6 && outside != 0xfu; ++i) {
+      // the corner farthest along the normal is behind the plane only if the
+      // whole box is, the nearest one only if some of it is
+      Float4 far = MulAdd(x[i], positive_x[i] ? max_x : min_x, w[i]);
+      far = MulAdd(y[i], positive_y[i] ? max_y : min_y, far);
+      far = MulAdd(z[i], positive_z[i] ? max_z : min_z, far);
+      Float4 near = MulAdd(x[i], positive_x[i] ? min_x : max_x, w[i]);
+      near = MulAdd(y[i], positive_y[i] ? min_y : max_y, near);
+      near = MulAdd(z[i], positive_z[i] ? min_z : max_z, near);
+      outside |= NegativeMask(far);
+      crossing |= NegativeMask(near);
+    }
+    inside = 0xfu & ~(outside | crossing);
+    return outside;
+  }
+};
+
+void InstanceBvh::Build(std::vector<glm::vec3> bounds_min,
+                        std::vector<glm::vec3> bounds_max) {
+  m_bounds_min = std::move(bounds_min);
+  m_bounds_max = std::move(bounds_max);
+  uint32_t count = static_cast<uint32_t>(m_bounds_min.size());
+  std::vector<uint32_t> items(count);
+  std::iota(items.begin(), items.end(), 0u);
+  std::vector<glm::vec3> centroids(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    centroids[i] = (m_bounds_min[i] + m_bounds_max[i]) * 0.5f;
+  }
+  m_nodes.clear();
+  // about a third of the instances with full nodes
+  m_nodes.reserve(count / 3 + 1);
+  BuildNode(items, centroids, 0, count);
+
+  // the lanes of the root and its children, 16 jobs for a full tree
+  m_task_lanes.clear();
+  const Node& root = m_nodes[0];
+  for (uint32_t lane = 0; lane < root.lane_count; ++lane) {
+    uint32_t child = root.child[lane];
+    if (child & kLeafBit) {
+      m_task_lanes.emplace_back(0, lane);
+      continue;
+    }
+    for (uint32_t child_lane = 0; child_lane < m_nodes[child].lane_count;
+         ++child_lane) {
+      m_task_lanes.emplace_back(child, child_lane);
+    }
+  }
+}
+
+uint32_t InstanceBvh::BuildNode(std::vector<uint32_t>& items,
+                                const std::vector<glm::vec3>& centroids,
+                                uint32_t begin, uint32_t end) {
+  uint32_t node = static_cast<uint32_t>(m_nodes.size());
+  m_nodes.emplace_back(Node{
+      .min_x = {},
+      .min_y = {},
+      .min_z = {},
+      .max_x = {},
+      .max_y = {},
+      .max_z = {},
+      .child = {},
+      .lane_count = 0,
+  });
+  // the largest range is halved until there are 4 or all hold one instance
+  std::array<std::pair<uint32_t, uint32_t>, 4> ranges{};
+  ranges[0] = {begin, end};
+  uint32_t range_count = 1;
+  while (range_count < 4) {
+    uint32_t largest = 0;
+    for (uint32_t i = 1; i < range_count; ++i) {
+      if (ranges[i].second - ranges[i].first >
+          ranges[largest].second - ranges[largest].first) {
+        largest = i;
+      }
+    }
+    auto [range_begin, range_end] = ranges[largest];
+    if (range_end - range_begin <= 1) {
+      break;
+    }
+    glm::vec3 centroid_min = centroids[items[range_begin]];
+    glm::vec3 centroid_max = centroid_min;
+    for (uint32_t i = range_begin + 1; i < range_end; ++i) {
+      centroid_min = glm::min(centroid_min, centroids[items[i]]);
+      centroid_max = glm::max(centroid_max, centroids[items[i]]);
+    }
+    glm::vec3 extent = centroid_max - centroid_min;
+    uint32_t axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                        : (extent.y > extent.z ? 1 : 2);
+    uint32_t middle = range_begin + (range_end - range_begin) / 2;
+    std::nth_element(items.begin() + range_begin, items.begin() + middle,
+                     items.begin() + range_end,
+                     [&](uint32_t a, uint32_t b) {
+                       return centroids[a][axis] < centroids[b][axis];
+                     });
+    ranges[largest] = {range_begin, middle};
+    ranges[range_count++] = {middle, range_end};
+  }
+  std::sort(ranges.begin(), ranges.begin() + range_count);
+
+  for (uint32_t lane = 0; lane < range_count; ++lane) {
+    auto [range_begin, range_end] = ranges[lane];
+    glm::vec3 bounds_min = m_bounds_min[items[range_begin]];
+    glm::vec3 bounds_max = m_bounds_max[items[range_begin]];
+    for (uint32_t i = range_begin + 1; i < range_end; ++i) {
+      bounds_min = glm::min(bounds_min, m_bounds_min[items[i]]);
+      bounds_max = glm::max(bounds_max, m_bounds_max[items[i]]);
+    }
+    uint32_t child;
+    if (range_end - range_begin == 1) {
+      child = kLeafBit | items[range_begin];
+    } else {
+      // m_nodes grows, no reference to the node is held across this
+      child = BuildNode(items, centroids, range_begin, range_end);
+    }
+    m_nodes[node].child[lane] = child;
+    SetLane(node, lane, bounds_min, bounds_max);
+  }
+  m_nodes[node].lane_count = range_count;
+  return node;
+}
+
+void InstanceBvh::SetLane(uint32_t node, uint32_t lane,
+                          const glm::vec3& bounds_min,
+                          const glm::vec3& bounds_max) {
+  Node& target = m_nodes[node];
+  target.min_x[lane] = bounds_min.x;
+  target.min_y[lane] = bounds_min.y;
+  target.min_z[lane] = bounds_min.z;
+  target.max_x[lane] = bounds_max.x;
+  target.max_y[lane] = bounds_max.y;
+  target.max_z[lane] = bounds_max.z;
+}
+
+void InstanceBvh::AppendSubtree(uint32_t node,
+                                std::vector<uint32_t>& visible) const {
+  uint32_t stack[kMaxStackSize];
+  uint32_t stack_size = 0;
+  stack[stack_size++] = node;
+  while (stack_size > 0) {
+    const Node& current = m_nodes[stack[--stack_size]];
+    for (uint32_t lane = 0; lane < current.lane_count; ++lane) {
+      uint32_t child = current.child[lane];
+      if (child & kLeafBit) {
+        visible.emplace_back(child & ~kLeafBit);
+      } else {
+        stack[stack_size++] = child;
+      }
+    }
+  }
+}
+
+void InstanceBvh::CullSubtree(uint32_t node, const ViewPlanes& planes,
+                              std::vector<uint32_t>& visible,
+                              BvhCullStats& stats) const {
+  uint32_t stack[kMaxStackSize];
+  uint32_t stack_size = 0;
+  stack[stack_size++] = node;
+  while (stack_size > 0) {
+    const Node& current = m_nodes[stack[--stack_size]];
+    uint32_t inside = 0;
+    uint32_t outside = planes.Test(current, inside);
+    stats.tested += current.lane_count;
+    for (uint32_t lane = 0; lane < current.lane_count; ++lane) {
+      if (outside & (1u << lane)) {
+        continue;
+      }
+      uint32_t child = current.child[lane];
+      if (child & kLeafBit) {
+        visible.emplace_back(child & ~kLeafBit);
+      } else if (inside & (1u << lane)) {
+        AppendSubtree(child, visible);
+      } else {
+        stack[stack_size++] = child;
+      }
+    }
+  }
+}
+
+void InstanceBvh::CullLane(uint32_t node, uint32_t lane,
+                           const ViewPlanes& planes,
+                           std::vector<uint32_t>& visible,
+                           BvhCullStats& stats) const {
+  uint32_t inside = 0;
+  uint32_t outside = planes.Test(m_nodes[node], inside);
+  stats.tested += 1;
+  if (outside & (1u << lane)) {
+    return;
+  }
+  uint32_t child = m_nodes[node].child[lane];
+  if (child & kLeafBit) {
+    visible.emplace_back(child & ~kLeafBit);
+  } else if (inside & (1u << lane)) {
+    AppendSubtree(child, visible);
+  } else {
+    CullSubtree(child, planes, visible, stats);
+  }
+}
+
+void InstanceBvh::Cull(const FrustumPlanes& planes,
+                       std::vector<uint32_t>& visible,
+                       BvhCullStats& stats) const {
+  size_t first = visible.size();
+  if (!m_nodes.empty()) {
+    CullSubtree(0, ViewPlanes(planes), visible, stats);
+  }
+  stats.visible += static_cast<uint32_t>(visible.size() - first);
+}
+
+void InstanceBvh::CullViews(const std::vector<FrustumPlanes>& views,
+                            std::vector<std::vector<uint32_t>>& visible,
+                            std::vector<BvhCullStats>& stats) {
+  uint32_t view_count = static_cast<uint32_t>(views.size());
+  uint32_t tasks_per_view =
+      GetInstanceCount() >= kMinParallelInstances
+          ? static_cast<uint32_t>(m_task_lanes.size())
+          : 1;
+  uint32_t task_count = view_count * tasks_per_view;
+  // the lists keep their capacity from frame to frame
+  if (m_task_visible.size() < task_count) {
+    m_task_visible.resize(task_count);
+  }
+  m_task_stats.assign(task_count, {});
+  JobSystem::ParallelFor(task_count, [&](uint32_t task) {
+    ViewPlanes planes(views[task / tasks_per_view]);
+    std::vector<uint32_t>& task_visible = m_task_visible[task];
+    task_visible.clear();
+    if (m_nodes.empty()) {
+      return;
+    }
+    if (tasks_per_view == 1) {
+      CullSubtree(0, planes, task_visible, m_task_stats[task]);
+    } else {
+      auto [node, lane] = m_task_lanes[task % tasks_per_view];
+      CullLane(node, lane, planes, task_visible, m_task_stats[task]);
+    }
+  });
+  visible.resize(view_count);
+  stats.assign(view_count, {});
+  for (uint32_t view = 0; view < view_count; ++view) {
+    visible[view].clear();
+    for (uint32_t i = 0; i < tasks_per_view; ++i) {
+      uint32_t task = view * tasks_per_view + i;
+      visible[view].insert(visible[view].end(), m_task_visible[task].begin(),
+                           m_task_visible[task].end());
+      stats[view].tested += m_task_stats[task].tested;
+    }
+    stats[view].visible = static_cast<uint32_t>(visible[view].size());
+  }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "third_part/glm_headers.h"
+
+// planes as ExtractFrustumPlanes writes them
+using FrustumPlanes = std::array<glm::vec4, 6>;
+
+struct BvhCullStats {
+  // boxes tested against the planes, boxes inside a box that is fully inside
+  // are not tested
+  uint32_t tested = 0;
+  uint32_t visible = 0;
+};
+
+// 4 wide bounding volume hierarchy over the boxes of the scene instances, a
+// node keeps the boxes of its children side by side so one sse test covers
+// all four, every leaf is one instance
+// https://www.embree.org/papers/2008-RT08-Dammertz-Shallow-BVH.pdf
+class InstanceBvh {
+ public:
+  // top down, every node splits its instances at the centroid median of the
+  // widest axis twice
+  void Build(std::vector<glm::vec3> bounds_min,
+             std::vector<glm::vec3> bounds_max);
+  // appends the instances whose box is not outside of one of the planes
+  void Cull(const FrustumPlanes& planes, std::vector<uint32_t>& visible,
+            BvhCullStats& stats) const;
+  // every view at once, large trees are split into subtrees so the job
+  // system can run one view on several threads, visible[i] and stats[i]
+  // belong to views[i] and come out in the order of Cull
+  void CullViews(const std::vector<FrustumPlanes>& views,
+                 std::vector<std::vector<uint32_t>>& visible,
+                 std::vector<BvhCullStats>& stats);
+  uint32_t GetNodeCount() const {
+    return static_cast<uint32_t>(m_nodes.size());
+  }
+  uint32_t GetInstanceCount() const {
+    return static_cast<uint32_t>(m_bounds_min.size());
+  }
+
+ private:
+  struct Node {
+    alignas(16) float min_x[4];
+    alignas(16) float min_y[4];
+    alignas(16) float min_z[4];
+    alignas(16) float max_x[4];
+    alignas(16) float max_y[4];
+    alignas(16) float max_z[4];
+    // child node, or kLeafBit | instance
+    uint32_t child[4];
+    uint32_t lane_count;
+  };
+  struct ViewPlanes;
+
+  uint32_t BuildNode(std::vector<uint32_t>& items,
+                     const std::vector<glm::vec3>& centroids, uint32_t begin,
+                     uint32_t end);
+  void SetLane(uint32_t node, uint32_t lane, const glm::vec3& bounds_min,
+               const glm::vec3& bounds_max);
+  void CullLane(uint32_t node, uint32_t lane, const ViewPlanes& planes,
+                std::vector<uint32_t>& visible, BvhCullStats& stats) const;
+  void CullSubtree(uint32_t node, const ViewPlanes& planes,
+                   std::vector<uint32_t>& visible, BvhCullStats& stats) const;
+  void AppendSubtree(uint32_t node, std::vector<uint32_t>& visible) const;
+
+  std::vector<Node> m_nodes;
+  std::vector<glm::vec3> m_bounds_min;
+  std::vector<glm::vec3> m_bounds_max;
+  // node and lane of the subtrees CullViews hands out as jobs
+  std::vector<std::pair<uint32_t, uint32_t>> m_task_lanes;
+  // results of the jobs of the last CullViews
+  std::vector<std::vector<uint32_t>> m_task_visible;
+  std::vector<BvhCullStats> m_task_stats;
+};
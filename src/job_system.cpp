@@ -0,0 +1,105 @@
+#include "job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+std::vector<std::thread> workers;
+std::mutex mutex;
+std::condition_variable start_condition;
+std::condition_variable done_condition;
+bool stopping = false;
+// the batch of the last ParallelFor, every worker runs each generation once
+// so a batch is only replaced after all workers left it
+uint64_t batch_generation = 0;
+const std::function<void(uint32_t)>* batch_task = nullptr;
+uint32_t batch_count = 0;
+uint32_t batch_pending_workers = 0;
+std::atomic<uint32_t> batch_next = 0;
+
+void RunBatch(const std::function<void(uint32_t)>& task, uint32_t count) {
+  for (uint32_t i = batch_next.fetch_add(1); i < count;
+       i = batch_next.fetch_add(1)) {
+    task(i);
+  }
+}
+
+// generation is the last batch before the worker started
+void WorkerLoop(uint64_t generation) {
+  while (true) {
+    const std::function<void(uint32_t)>* task = nullptr;
+    uint32_t count = 0;
+    {
+      std::unique_lock lock(mutex);
+      start_condition.wait(lock, [&] {
+        return stopping || batch_generation != generation;
+      });
+      if (stopping) {
+        return;
+      }
+      generation = batch_generation;
+      task = batch_task;
+      count = batch_count;
+    }
+    RunBatch(*task, count);
+    std::lock_guard lock(mutex);
+    if (--batch_pending_workers == 0) {
+      done_condition.notify_one();
+    }
+  }
+}
+}  // namespace
+
+void JobSystem::Start(uint32_t thread_count) {
+  Stop();
+  if (thread_count == 0) {
+    thread_count = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+  }
+  stopping = false;
+  workers.reserve(thread_count);
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    workers.emplace_back(WorkerLoop, batch_generation);
+  }
+}
+
+void JobSystem::Stop() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  start_condition.notify_all();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+}
+
+uint32_t JobSystem::GetWorkerCount() {
+  return static_cast<uint32_t>(workers.size());
+}
+
+void JobSystem::ParallelFor(uint32_t count,
+                            const std::function<void(uint32_t)>& task) {
+  if (workers.empty() || count <= 1) {
+    for (uint32_t i = 0; i < count; ++i) {
+      task(i);
+    }
+    return;
+  }
+  {
+    std::lock_guard lock(mutex);
+    batch_task = &task;
+    batch_count = count;
+    batch_next = 0;
+    batch_pending_workers = static_cast<uint32_t>(workers.size());
+    ++batch_generation;
+  }
+  start_condition.notify_all();
+  RunBatch(task, count);
+  std::unique_lock lock(mutex);
+  done_condition.wait(lock, [] { return batch_pending_workers == 0; });
+}
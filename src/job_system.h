@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+// persistent worker threads for short parallel loops inside a frame, where
+// starting threads per call would cost more than the work
+namespace JobSystem {
+// thread_count workers next to the calling thread, 0 picks
+// hardware_concurrency - 1, restarts if already started
+void Start(uint32_t thread_count = 0);
+void Stop();
+uint32_t GetWorkerCount();
+// runs task(i) for every i below count on the workers and the calling thread
+// and returns once all ran, runs inline without workers, called from one
+// thread at a time and not from inside a task
+void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& task);
+}  // namespace JobSystem
@@ -0,0 +1,231 @@
+#include "json.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+
+// recursive descent over https://www.json.org/json-en.html, \u escapes
+// outside of ascii are kept as utf-8
+class JsonParser {
+ public:
+  explicit JsonParser(std::string_view text) : m_text(text) {}
+
+  JsonValue ParseDocument() {
+    JsonValue value = ParseValue();
+    SkipSpace();
+    if (m_pos != m_text.size()) {
+      Fail("trailing characters");
+    }
+    return value;
+  }
+
+ private:
+  [[noreturn]] void Fail(const char* what) const {
+    throw std::runtime_error("json: " + std::string(what) + " at offset " +
+                             std::to_string(m_pos) + "!");
+  }
+
+  void SkipSpace() {
+    while (m_pos < m_text.size() &&
+           (m_text[m_pos] == ' ' || m_text[m_pos] == '\t' ||
+            m_text[m_pos] == '\n' || m_text[m_pos] == '\r')) {
+      ++m_pos;
+    }
+  }
+
+  bool Consume(char c) {
+    SkipSpace();
+    if (m_pos < m_text.size() && m_text[m_pos] == c) {
+      ++m_pos;
+      return true;
+    }
+    return false;
+  }
+
+  void Expect(char c) {
+    if (!Consume(c)) {
+      Fail("unexpected character");
+    }
+  }
+
+  bool ConsumeWord(std::string_view word) {
+    if (m_text.substr(m_pos, word.size()) == word) {
+      m_pos += word.size();
+      return true;
+    }
+    return false;
+  }
+
+  JsonValue ParseValue() {
+    SkipSpace();
+    if (m_pos == m_text.size()) {
+      Fail("unexpected end");
+    }
+    JsonValue value;
+    char c = m_text[m_pos];
+    if (c == '{') {
+      ++m_pos;
+      value.m_type = JsonValue::Type::kObject;
+      if (Consume('}')) {
+        return value;
+      }
+      do {
+        SkipSpace();
+        std::string key = ParseString();
+        Expect(':');
+        value.m_object.emplace_back(std::move(key), ParseValue());
+      } while (Consume(','));
+      Expect('}');
+    } else if (c == '[') {
+      ++m_pos;
+      value.m_type = JsonValue::Type::kArray;
+      if (Consume(']')) {
+        return value;
+      }
+      do {
+        value.m_array.emplace_back(ParseValue());
+      } while (Consume(','));
+      Expect(']');
+    } else if (c == '"') {
+      value.m_type = JsonValue::Type::kString;
+      value.m_string = ParseString();
+    } else if (ConsumeWord("true")) {
+      value.m_type = JsonValue::Type::kBool;
+      value.m_bool = true;
+    } else if (ConsumeWord("false")) {
+      value.m_type = JsonValue::Type::kBool;
+    } else if (ConsumeWord("null")) {
+      value.m_type = JsonValue::Type::kNull;
+    } else {
+      value.m_type = JsonValue::Type::kNumber;
+      const char* begin = m_text.data() + m_pos;
+      const char* end = m_text.data() + m_text.size();
+      auto [ptr, ec] = std::from_chars(begin, end, value.m_number);
+      if (ec != std::errc() || ptr == begin) {
+        Fail("invalid number");
+      }
+      m_pos += ptr - begin;
+    }
+    return value;
+  }
+
+  std::string ParseString() {
+    if (m_pos == m_text.size() || m_text[m_pos] != '"') {
+      Fail("expected a string");
+    }
+    ++m_pos;
+    std::string result;
+    while (m_pos < m_text.size() && m_text[m_pos] != '"') {
+      char c = m_text[m_pos++];
+      if (c != '\\') {
+        result += c;
+        continue;
+      }
+      if (m_pos == m_text.size()) {
+        break;
+      }
+      char escape = m_text[m_pos++];
+      switch (escape) {
+        case 'b':
+          result += '\b';
+          break;
+        case 'f':
+          result += '\f';
+          break;
+        case 'n':
+          result += '\n';
+          break;
+        case 'r':
+          result += '\r';
+          break;
+        case 't':
+          result += '\t';
+          break;
+        case 'u': {
+          uint32_t code = 0;
+          auto [ptr, ec] = std::from_chars(
+              m_text.data() + m_pos,
+              m_text.data() + std::min(m_pos + 4, m_text.size()), code, 16);
+          if (ec != std::errc() || ptr != m_text.data() + m_pos + 4) {
+            Fail("invalid escape");
+          }
+          m_pos += 4;
+          if (code < 0x80) {
+            result += static_cast<char>(code);
+          } else if (code < 0x800) {
+            result += static_cast<char>(0xc0 | code >> 6);
+            result += static_cast<char>(0x80 | (code & 0x3f));
+          } else {
+            result += static_cast<char>(0xe0 | code >> 12);
+            result += static_cast<char>(0x80 | (code >> 6 & 0x3f));
+            result += static_cast<char>(0x80 | (code & 0x3f));
+          }
+          break;
+        }
+        default:
+          result += escape;
+          break;
+      }
+    }
+    if (m_pos == m_text.size()) {
+      Fail("unterminated string");
+    }
+    ++m_pos;
+    return result;
+  }
+
+  std::string_view m_text;
+  size_t m_pos = 0;
+};
+
+JsonValue JsonValue::Parse(std::string_view text) {
+  return JsonParser(text).ParseDocument();
+}
+
+bool JsonValue::AsBool() const {
+  if (m_type != Type::kBool) {
+    throw std::runtime_error("json: expected a bool!");
+  }
+  return m_bool;
+}
+
+double JsonValue::AsNumber() const {
+  if (m_type != Type::kNumber) {
+    throw std::runtime_error("json: expected a number!");
+  }
+  return m_number;
+}
+
+const std::string& JsonValue::AsString() const {
+  if (m_type != Type::kString) {
+    throw std::runtime_error("json: expected a string!");
+  }
+  return m_string;
+}
+
+const std::vector<JsonValue>& JsonValue::AsArray() const {
+  if (m_type != Type::kArray) {
+    throw std::runtime_error("json: expected an array!");
+  }
+  return m_array;
+}
+
+const JsonValue* JsonValue::Find(std::string_view key) const {
+  for (const auto& [name, value] : m_object) {
+    if (name == key) {
+      return &value;
+    }
+  }
+  return nullptr;
+}
+
+double JsonValue::NumberOr(std::string_view key, double fallback) const {
+  const JsonValue* value = Find(key);
+  return value ? value->AsNumber() : fallback;
+}
+
+bool JsonValue::BoolOr(std::string_view key, bool fallback) const {
+  const JsonValue* value = Find(key);
+  return value ? value->AsBool() : fallback;
+}
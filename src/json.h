@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// small json document for the scene files, the accessors throw
+// std::runtime_error on a type mismatch so a bad file fails with a message
+class JsonValue {
+ public:
+  enum class Type { kNull, kBool, kNumber, kString, kArray, kObject };
+
+  // the whole text has to be one value
+  static JsonValue Parse(std::string_view text);
+
+  Type GetType() const { return m_type; }
+  bool AsBool() const;
+  double AsNumber() const;
+  const std::string& AsString() const;
+  const std::vector<JsonValue>& AsArray() const;
+  // nullptr if this is no object or has no such member
+  const JsonValue* Find(std::string_view key) const;
+  // the member or fallback
+  double NumberOr(std::string_view key, double fallback) const;
+  bool BoolOr(std::string_view key, bool fallback) const;
+
+ private:
+  friend class JsonParser;
+
+  Type m_type = Type::kNull;
+  bool m_bool = false;
+  double m_number = 0.0;
+  std::string m_string;
+  std::vector<JsonValue> m_array;
+  std::vector<std::pair<std::string, JsonValue>> m_object;
+};
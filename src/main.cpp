@@ -1,12 +1,19 @@
 #include "main.h"
 
-void Init() {}
-void Cleanup() { Context::Cleanup(); }
+void Init() { JobSystem::Start(); }
+void Cleanup() {
+  JobSystem::Stop();
+  Context::Cleanup();
+}
 
 int main(int argc, char** argv) {
   std::cout << "start" << std::endl;
   Init();
   ExitGuard exit_guard(Cleanup);
+  // optional scene file, see LoadScene
+  if (argc > 1) {
+    Context::Instance()->g_scene_path = argv[1];
+  }
   try {
     Application app;
     app.Run();
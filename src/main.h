@@ -9,4 +9,5 @@
 // self headers
 #include "application.h"
 #include "context.h"
+#include "job_system.h"
 #include "utils.h"
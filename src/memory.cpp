@@ -42,14 +42,14 @@ void CreateImage(uint32_t width, uint32_t height, uint32_t mip_levels,
                  vk::SampleCountFlagBits sample_count, vk::Format format,
                  vk::ImageTiling tiling, vk::ImageUsageFlags usage,
                  vk::MemoryPropertyFlags properties, vk::raii::Image& image,
-                 vk::raii::DeviceMemory& memory) {
+                 vk::raii::DeviceMemory& memory, uint32_t array_layers) {
   vk::ImageCreateInfo image_info{
       .flags = {},
       .imageType = vk::ImageType::e2D,
       .format = format,
       .extent = {width, height, 1},
       .mipLevels = mip_levels,
-      .arrayLayers = 1,
+      .arrayLayers = array_layers,
       .samples = sample_count,
       .tiling = tiling,
       .usage = usage,
@@ -72,10 +72,13 @@ void CreateImage(uint32_t width, uint32_t height, uint32_t mip_levels,
 vk::raii::ImageView CreateImageView(const vk::Image& image,
                                     uint32_t base_mip_level,
                                     uint32_t mip_levels, vk::Format format,
-                                    vk::ImageAspectFlagBits aspect) {
+                                    vk::ImageAspectFlagBits aspect,
+                                    uint32_t base_array_layer,
+                                    uint32_t layer_count,
+                                    vk::ImageViewType view_type) {
   vk::ImageViewCreateInfo image_view_create_info{
       .image = image,
-      .viewType = vk::ImageViewType::e2D,
+      .viewType = view_type,
       .format = format,
       .components =
           {
@@ -91,8 +94,8 @@ vk::raii::ImageView CreateImageView(const vk::Image& image,
       .subresourceRange = {.aspectMask = aspect,
                            .baseMipLevel = base_mip_level,
                            .levelCount = mip_levels,
-                           .baseArrayLayer = 0,
-                           .layerCount = 1}};
+                           .baseArrayLayer = base_array_layer,
+                           .layerCount = layer_count}};
   return vk::raii::ImageView(Context::Instance()->g_device,
                              image_view_create_info);
 }
@@ -135,7 +138,7 @@ void TransformImageLayout(const vk::Image& image, uint32_t command_buffer_index,
                            .baseMipLevel = base_mip_level,
                            .levelCount = level_count,
                            .baseArrayLayer = 0,
-                           .layerCount = 1}};
+                           .layerCount = vk::RemainingArrayLayers}};
   vk::DependencyInfo dependency_info{
       .dependencyFlags = {},
       .imageMemoryBarrierCount = 1,
@@ -145,6 +148,54 @@ void TransformImageLayout(const vk::Image& image, uint32_t command_buffer_index,
       dependency_info);
 }
 
+void GlobalMemoryBarrier(uint32_t command_buffer_index,
+                         vk::AccessFlags2 src_access_mask,
+                         vk::AccessFlags2 dst_access_mask,
+                         vk::PipelineStageFlags2 src_stage_mask,
+                         vk::PipelineStageFlags2 dst_stage_mask) {
+  vk::MemoryBarrier2 barrier = {
+      .srcStageMask = src_stage_mask,
+      .srcAccessMask = src_access_mask,
+      .dstStageMask = dst_stage_mask,
+      .dstAccessMask = dst_access_mask,
+  };
+  vk::DependencyInfo dependency_info{
+      .dependencyFlags = {},
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+  };
+  Context::Instance()->g_command_buffer[command_buffer_index].pipelineBarrier2(
+      dependency_info);
+}
+
+void BufferMemoryBarrier(uint32_t command_buffer_index,
+                         const vk::Buffer& buffer,
+                         vk::AccessFlags2 src_access_mask,
+                         vk::AccessFlags2 dst_access_mask,
+                         vk::PipelineStageFlags2 src_stage_mask,
+                         vk::PipelineStageFlags2 dst_stage_mask,
+                         uint32_t src_queue_family_index,
+                         uint32_t dst_queue_family_index) {
+  vk::BufferMemoryBarrier2 barrier = {
+      .srcStageMask = src_stage_mask,
+      .srcAccessMask = src_access_mask,
+      .dstStageMask = dst_stage_mask,
+      .dstAccessMask = dst_access_mask,
+      .srcQueueFamilyIndex = src_queue_family_index,
+      .dstQueueFamilyIndex = dst_queue_family_index,
+      .buffer = buffer,
+      .offset = 0,
+      .size = vk::WholeSize,
+  };
+  vk::DependencyInfo dependency_info{
+      .dependencyFlags = {},
+      .bufferMemoryBarrierCount = 1,
+      .pBufferMemoryBarriers = &barrier,
+  };
+  Context::Instance()->g_command_buffer[command_buffer_index].pipelineBarrier2(
+      dependency_info);
+}
+
 void TransformImageLayoutImmediately(
     const vk::raii::Image& image, vk::ImageLayout old_layout,
     vk::ImageLayout new_layout, vk::AccessFlags src_access_mask,
@@ -164,7 +215,7 @@ void TransformImageLayoutImmediately(
                            .baseMipLevel = base_mip_level,
                            .levelCount = level_count,
                            .baseArrayLayer = 0,
-                           .layerCount = 1}};
+                           .layerCount = vk::RemainingArrayLayers}};
   command_buffer.pipelineBarrier(src_stage_mask, dst_stage_mask, {}, {},
                                  nullptr, barrier);
   EndOneTimeCommandBuffer(command_buffer);
@@ -18,13 +18,18 @@ void CreateImage(uint32_t width, uint32_t height, uint32_t mip_levels,
                  vk::SampleCountFlagBits sample_count, vk::Format format,
                  vk::ImageTiling tiling, vk::ImageUsageFlags usage,
                  vk::MemoryPropertyFlags properties, vk::raii::Image& image,
-                 vk::raii::DeviceMemory& memory);
+                 vk::raii::DeviceMemory& memory, uint32_t array_layers = 1);
 void CopyBufferToImage(const vk::raii::Buffer& buffer, vk::raii::Image& image,
                        uint32_t width, uint32_t height);
 vk::raii::ImageView CreateImageView(const vk::Image& image,
                                     uint32_t base_mip_level,
                                     uint32_t mip_levels, vk::Format format,
-                                    vk::ImageAspectFlagBits aspect);
+                                    vk::ImageAspectFlagBits aspect,
+                                    uint32_t base_array_layer = 0,
+                                    uint32_t layer_count = 1,
+                                    vk::ImageViewType view_type =
+                                        vk::ImageViewType::e2D);
+// barriers cover all array layers
 void TransformImageLayout(
     const vk::Image& image, uint32_t command_buffer_index,
     vk::ImageLayout old_layout, vk::ImageLayout new_layout,
@@ -33,6 +38,21 @@ void TransformImageLayout(
     vk::PipelineStageFlags2 dst_stage_mask,
     vk::ImageAspectFlags aspect_flags = vk::ImageAspectFlagBits::eColor,
     uint32_t base_mip_level = 0, uint32_t level_count = 1);
+// for buffers, which have no layout
+void GlobalMemoryBarrier(uint32_t command_buffer_index,
+                         vk::AccessFlags2 src_access_mask,
+                         vk::AccessFlags2 dst_access_mask,
+                         vk::PipelineStageFlags2 src_stage_mask,
+                         vk::PipelineStageFlags2 dst_stage_mask);
+// queue family ownership transfers need a release barrier on the source queue
+// and an acquire barrier on the destination queue
+void BufferMemoryBarrier(
+    uint32_t command_buffer_index, const vk::Buffer& buffer,
+    vk::AccessFlags2 src_access_mask, vk::AccessFlags2 dst_access_mask,
+    vk::PipelineStageFlags2 src_stage_mask,
+    vk::PipelineStageFlags2 dst_stage_mask,
+    uint32_t src_queue_family_index = VK_QUEUE_FAMILY_IGNORED,
+    uint32_t dst_queue_family_index = VK_QUEUE_FAMILY_IGNORED);
 void TransformImageLayoutImmediately(
     const vk::raii::Image& image, vk::ImageLayout old_layout,
     vk::ImageLayout new_layout, vk::AccessFlags src_access_mask,
@@ -0,0 +1,283 @@
+#include "mesh_cache.h"
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <type_traits>
+
+#include "context.h"
+#include "utils.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(std::is_trivially_copyable_v<QuantizedPosition>);
+static_assert(std::is_trivially_copyable_v<QuantizedAttributes>);
+static_assert(std::is_trivially_copyable_v<SubMesh>);
+static_assert(std::is_trivially_copyable_v<Meshlet>);
+
+namespace {
+constexpr char kMeshCacheMagic[4] = {'V', 'K', 'M', 'C'};
+// bump when the layout of the file, the quantized vertices, SubMesh, Meshlet
+// or the import passes change
+constexpr uint32_t kMeshCacheVersion = 5;
+constexpr uint64_t kStreamAlignment = 16;
+
+// read only view of a whole file, empty if it can not be mapped
+class MappedFile {
+ public:
+  explicit MappedFile(const std::filesystem::path& path) {
+#ifdef _WIN32
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+      return;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+      return;
+    }
+    m_mapping =
+        CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr) {
+      return;
+    }
+    m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m_data != nullptr) {
+      m_size = static_cast<size_t>(size.QuadPart);
+    }
+#else
+    m_file = open(path.c_str(), O_RDONLY);
+    if (m_file < 0) {
+      return;
+    }
+    struct stat file_stat;
+    if (fstat(m_file, &file_stat) != 0 || file_stat.st_size == 0) {
+      return;
+    }
+    void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE,
+                      m_file, 0);
+    if (data != MAP_FAILED) {
+      m_data = data;
+      m_size = static_cast<size_t>(file_stat.st_size);
+    }
+#endif
+  }
+  ~MappedFile() {
+#ifdef _WIN32
+    if (m_data != nullptr) {
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+      CloseHandle(m_mapping);
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+      CloseHandle(m_file);
+    }
+#else
+    if (m_data != nullptr) {
+      munmap(m_data, m_size);
+    }
+    if (m_file >= 0) {
+      close(m_file);
+    }
+#endif
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* Data() const { return static_cast<const char*>(m_data); }
+  size_t Size() const { return m_size; }
+
+ private:
+#ifdef _WIN32
+  HANDLE m_file = INVALID_HANDLE_VALUE;
+  HANDLE m_mapping = nullptr;
+#else
+  int m_file = -1;
+#endif
+  void* m_data = nullptr;
+  size_t m_size = 0;
+};
+
+// https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+uint64_t Fnv1a(uint64_t hash, const void* data, size_t size) {
+  const auto* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+template <typename T>
+uint64_t HashValue(uint64_t hash, const T& value) {
+  return Fnv1a(hash, &value, sizeof(value));
+}
+
+uint64_t AlignStream(uint64_t offset) {
+  return (offset + kStreamAlignment - 1) / kStreamAlignment *
+         kStreamAlignment;
+}
+
+// stream of count elements at offset, fully inside the mapping
+template <typename T>
+bool CopyStream(const MappedFile& file, uint64_t offset, uint32_t count,
+                std::vector<T>& out) {
+  uint64_t size = sizeof(T) * static_cast<uint64_t>(count);
+  if (offset > file.Size() || size > file.Size() - offset) {
+    return false;
+  }
+  out.resize(count);
+  memcpy(out.data(), file.Data() + offset, size);
+  return true;
+}
+}  // namespace
+
+uint64_t MeshSourceHash(const std::filesystem::path& source_path) {
+  uint64_t hash = 14695981039346656037ull;
+  hash = HashValue(hash, kMeshCacheVersion);
+  hash = HashValue(hash, std::filesystem::file_size(source_path));
+  hash = HashValue(
+      hash,
+      std::filesystem::last_write_time(source_path).time_since_epoch().count());
+  // baked into every vertex by LoadMesh
+  hash = HashValue(hash, Context::Instance()->g_pbr_roughness);
+  hash = HashValue(hash, Context::Instance()->g_pbr_f0);
+  hash = HashValue(hash, Context::Instance()->g_pbr_metallic);
+  return hash;
+}
+
+bool LoadMeshCache(const std::filesystem::path& cache_path,
+                   uint64_t source_hash,
+                   std::vector<QuantizedPosition>& positions,
+                   std::vector<QuantizedAttributes>& attributes,
+                   std::vector<uint32_t>& indices,
+                   std::vector<SubMesh>& sub_meshes,
+                   std::vector<Meshlet>& meshlets) {
+  MappedFile file(cache_path);
+  if (file.Size() < sizeof(MeshCacheHeader)) {
+    return false;
+  }
+  MeshCacheHeader header;
+  memcpy(&header, file.Data(), sizeof(header));
+  if (memcmp(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic)) != 0 ||
+      header.version != kMeshCacheVersion ||
+      header.source_hash != source_hash ||
+      header.position_stride != sizeof(QuantizedPosition) ||
+      header.attribute_stride != sizeof(QuantizedAttributes)) {
+    return false;
+  }
+  std::vector<QuantizedPosition> cached_positions;
+  std::vector<QuantizedAttributes> cached_attributes;
+  std::vector<uint32_t> cached_indices;
+  std::vector<SubMesh> cached_sub_meshes;
+  std::vector<Meshlet> cached_meshlets;
+  if (!CopyStream(file, header.position_offset, header.vertex_count,
+                  cached_positions) ||
+      !CopyStream(file, header.attribute_offset, header.vertex_count,
+                  cached_attributes) ||
+      !CopyStream(file, header.index_offset, header.index_count,
+                  cached_indices) ||
+      !CopyStream(file, header.sub_mesh_offset, header.sub_mesh_count,
+                  cached_sub_meshes) ||
+      !CopyStream(file, header.meshlet_offset, header.meshlet_count,
+                  cached_meshlets)) {
+    return false;
+  }
+  positions = std::move(cached_positions);
+  attributes = std::move(cached_attributes);
+  indices = std::move(cached_indices);
+  sub_meshes = std::move(cached_sub_meshes);
+  meshlets = std::move(cached_meshlets);
+  return true;
+}
+
+void WriteMeshCache(const std::filesystem::path& cache_path,
+                    uint64_t source_hash,
+                    const std::vector<QuantizedPosition>& positions,
+                    const std::vector<QuantizedAttributes>& attributes,
+                    const std::vector<uint32_t>& indices,
+                    const std::vector<SubMesh>& sub_meshes,
+                    const std::vector<Meshlet>& meshlets) {
+  glm::vec3 bounds_min(std::numeric_limits<float>::max());
+  glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+  for (const SubMesh& sub_mesh : sub_meshes) {
+    bounds_min = glm::min(bounds_min, sub_mesh.bounds_min);
+    bounds_max = glm::max(bounds_max, sub_mesh.bounds_max);
+  }
+  uint64_t position_offset = AlignStream(sizeof(MeshCacheHeader));
+  uint64_t attribute_offset = AlignStream(
+      position_offset + sizeof(QuantizedPosition) * positions.size());
+  uint64_t index_offset = AlignStream(
+      attribute_offset + sizeof(QuantizedAttributes) * attributes.size());
+  uint64_t sub_mesh_offset =
+      AlignStream(index_offset + sizeof(uint32_t) * indices.size());
+  uint64_t meshlet_offset =
+      AlignStream(sub_mesh_offset + sizeof(SubMesh) * sub_meshes.size());
+  MeshCacheHeader header{
+      .magic = {kMeshCacheMagic[0], kMeshCacheMagic[1], kMeshCacheMagic[2],
+                kMeshCacheMagic[3]},
+      .version = kMeshCacheVersion,
+      .source_hash = source_hash,
+      .position_stride = sizeof(QuantizedPosition),
+      .attribute_stride = sizeof(QuantizedAttributes),
+      .vertex_count = static_cast<uint32_t>(positions.size()),
+      .index_count = static_cast<uint32_t>(indices.size()),
+      .sub_mesh_count = static_cast<uint32_t>(sub_meshes.size()),
+      .meshlet_count = static_cast<uint32_t>(meshlets.size()),
+      .position_offset = position_offset,
+      .attribute_offset = attribute_offset,
+      .index_offset = index_offset,
+      .sub_mesh_offset = sub_mesh_offset,
+      .meshlet_offset = meshlet_offset,
+      .bounds_min = bounds_min,
+      .bounds_max = bounds_max,
+  };
+
+  std::filesystem::path temp_path = cache_path;
+  temp_path += ".tmp";
+  {
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      LOG("failed to write mesh cache ", cache_path.string());
+      return;
+    }
+    auto write_at = [&file](uint64_t offset, const void* data, size_t size) {
+      file.seekp(static_cast<std::streamoff>(offset));
+      file.write(static_cast<const char*>(data),
+                 static_cast<std::streamsize>(size));
+    };
+    write_at(0, &header, sizeof(header));
+    write_at(header.position_offset, positions.data(),
+             sizeof(QuantizedPosition) * positions.size());
+    write_at(header.attribute_offset, attributes.data(),
+             sizeof(QuantizedAttributes) * attributes.size());
+    write_at(header.index_offset, indices.data(),
+             sizeof(uint32_t) * indices.size());
+    write_at(header.sub_mesh_offset, sub_meshes.data(),
+             sizeof(SubMesh) * sub_meshes.size());
+    write_at(header.meshlet_offset, meshlets.data(),
+             sizeof(Meshlet) * meshlets.size());
+    if (!file) {
+      file.close();
+      std::error_code error;
+      std::filesystem::remove(temp_path, error);
+      LOG("failed to write mesh cache ", cache_path.string());
+      return;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temp_path, cache_path, error);
+  if (error) {
+    std::filesystem::remove(temp_path, error);
+    LOG("failed to write mesh cache ", cache_path.string());
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "data.h"
+
+// baked mesh next to the source obj, the header is followed by the quantized
+// position and attribute, index, sub mesh and meshlet streams at the given
+// offsets, the vertex streams are uploaded as they are
+struct MeshCacheHeader {
+  char magic[4];
+  uint32_t version;
+  // source file and everything baked into the vertices, see MeshSourceHash
+  uint64_t source_hash;
+  uint32_t position_stride;
+  uint32_t attribute_stride;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t sub_mesh_count;
+  uint32_t meshlet_count;
+  uint64_t position_offset;
+  uint64_t attribute_offset;
+  uint64_t index_offset;
+  uint64_t sub_mesh_offset;
+  uint64_t meshlet_offset;
+  // of the whole mesh
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+};
+
+// size and write time of the source instead of its contents, hashing a large
+// obj would cost as much as reading it
+uint64_t MeshSourceHash(const std::filesystem::path& source_path);
+// maps the cache and copies each stream in one go, false if the cache is
+// missing, stale or truncated
+bool LoadMeshCache(const std::filesystem::path& cache_path,
+                   uint64_t source_hash,
+                   std::vector<QuantizedPosition>& positions,
+                   std::vector<QuantizedAttributes>& attributes,
+                   std::vector<uint32_t>& indices,
+                   std::vector<SubMesh>& sub_meshes,
+                   std::vector<Meshlet>& meshlets);
+// written to a temporary file first, a failed write leaves no cache behind
+void WriteMeshCache(const std::filesystem::path& cache_path,
+                    uint64_t source_hash,
+                    const std::vector<QuantizedPosition>& positions,
+                    const std::vector<QuantizedAttributes>& attributes,
+                    const std::vector<uint32_t>& indices,
+                    const std::vector<SubMesh>& sub_meshes,
+                    const std::vector<Meshlet>& meshlets);
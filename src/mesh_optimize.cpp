@@ -0,0 +1,326 @@
+#include "mesh_optimize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <span>
+
+namespace {
+// entries of the simulated and the optimized for cache, small enough to hold
+// on every gpu the renderer runs on
+constexpr uint32_t kCacheSize = 16;
+// a soft cluster split may cost this much over the acmr of its hard cluster
+constexpr float kOverdrawThreshold = 1.05f;
+constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+// fifo post transform cache, a vertex hits if it missed within the last
+// kCacheSize misses
+class FifoCache {
+ public:
+  explicit FifoCache(size_t vertex_count) : m_timestamps(vertex_count, 0) {}
+
+  // 1 on a miss
+  uint32_t Access(uint32_t vertex) {
+    if (m_time - m_timestamps[vertex] > kCacheSize) {
+      m_timestamps[vertex] = m_time++;
+      return 1;
+    }
+    return 0;
+  }
+  void Flush() { m_time += kCacheSize + 1; }
+
+ private:
+  std::vector<uint32_t> m_timestamps;
+  uint32_t m_time = kCacheSize + 1;
+};
+
+// linear speed vertex cache optimisation, Tom Forsyth 2006
+// https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+float VertexScore(int cache_position, uint32_t live_triangles) {
+  if (live_triangles == 0) {
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    // the last triangle gets a fixed score, it would be emitted again
+    // otherwise
+    score = cache_position < 3
+                ? 0.75f
+                : std::pow(1.0f - (cache_position - 3) *
+                                      (1.0f / (kCacheSize - 3)),
+                           1.5f);
+  }
+  // finish off vertices with few triangles left
+  return score + 2.0f / std::sqrt(static_cast<float>(live_triangles));
+}
+
+// indices reference vertices below vertex_count only
+void OptimizeVertexCache(std::span<uint32_t> indices, size_t vertex_count) {
+  size_t triangle_count = indices.size() / 3;
+  // unemitted triangles of every vertex
+  std::vector<uint32_t> live(vertex_count, 0);
+  for (uint32_t index : indices) {
+    ++live[index];
+  }
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  std::inclusive_scan(live.begin(), live.end(), offsets.begin() + 1);
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < indices.size(); ++i) {
+    adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  std::vector<int> cache_positions(vertex_count, -1);
+  std::vector<float> vertex_scores(vertex_count);
+  for (size_t i = 0; i < vertex_count; ++i) {
+    vertex_scores[i] = VertexScore(-1, live[i]);
+  }
+  std::vector<float> triangle_scores(triangle_count);
+  uint32_t best = kNone;
+  float best_score = -1.0f;
+  for (size_t i = 0; i < triangle_count; ++i) {
+    triangle_scores[i] = vertex_scores[indices[3 * i + 0]] +
+                         vertex_scores[indices[3 * i + 1]] +
+                         vertex_scores[indices[3 * i + 2]];
+    if (triangle_scores[i] > best_score) {
+      best = static_cast<uint32_t>(i);
+      best_score = triangle_scores[i];
+    }
+  }
+
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<uint32_t> output;
+  output.reserve(indices.size());
+  // most recent first, the three extra slots hold vertices pushed out by the
+  // last triangle
+  std::vector<uint32_t> cache, next_cache;
+  cache.reserve(kCacheSize + 3);
+  next_cache.reserve(kCacheSize + 3);
+  size_t cursor = 0;
+  while (output.size() < indices.size()) {
+    if (best == kNone) {
+      // nothing in the cache has triangles left, restart anywhere
+      while (emitted[cursor]) {
+        ++cursor;
+      }
+      best = static_cast<uint32_t>(cursor);
+    }
+    emitted[best] = true;
+    const uint32_t* triangle = &indices[3 * best];
+    output.insert(output.end(), triangle, triangle + 3);
+
+    next_cache.assign(triangle, triangle + 3);
+    for (int i = 0; i < 3; ++i) {
+      uint32_t vertex = triangle[i];
+      uint32_t* begin = &adjacency[offsets[vertex]];
+      uint32_t* end = begin + live[vertex];
+      *std::find(begin, end, best) = *(end - 1);
+      --live[vertex];
+    }
+    for (uint32_t vertex : cache) {
+      if (vertex != triangle[0] && vertex != triangle[1] &&
+          vertex != triangle[2]) {
+        next_cache.emplace_back(vertex);
+      }
+    }
+    std::swap(cache, next_cache);
+    for (size_t i = 0; i < cache.size(); ++i) {
+      cache_positions[cache[i]] = i < kCacheSize ? static_cast<int>(i) : -1;
+    }
+    for (uint32_t vertex : cache) {
+      vertex_scores[vertex] =
+          VertexScore(cache_positions[vertex], live[vertex]);
+    }
+
+    best = kNone;
+    best_score = -1.0f;
+    for (uint32_t vertex : cache) {
+      for (uint32_t i = 0; i < live[vertex]; ++i) {
+        uint32_t t = adjacency[offsets[vertex] + i];
+        triangle_scores[t] = vertex_scores[indices[3 * t + 0]] +
+                             vertex_scores[indices[3 * t + 1]] +
+                             vertex_scores[indices[3 * t + 2]];
+        if (triangle_scores[t] > best_score) {
+          best = t;
+          best_score = triangle_scores[t];
+        }
+      }
+    }
+    if (cache.size() > kCacheSize) {
+      cache.resize(kCacheSize);
+    }
+  }
+  std::copy(output.begin(), output.end(), indices.begin());
+}
+
+// cache optimized triangles split into clusters and sorted so outward facing
+// clusters at the rim draw first, fast triangle reordering for vertex
+// locality and reduced overdraw, Sander et al. 2007
+void OptimizeOverdraw(std::span<uint32_t> indices,
+                      const std::vector<Vertex>& vertices, FifoCache& cache) {
+  uint32_t triangle_count = static_cast<uint32_t>(indices.size() / 3);
+  if (triangle_count == 0) {
+    return;
+  }
+  auto triangle_misses = [&](uint32_t t) {
+    return cache.Access(indices[3 * t + 0]) + cache.Access(indices[3 * t + 1]) +
+           cache.Access(indices[3 * t + 2]);
+  };
+  // hard boundaries where the cache restarted anyway, reordering there costs
+  // nothing
+  std::vector<uint32_t> hard_clusters;
+  cache.Flush();
+  for (uint32_t t = 0; t < triangle_count; ++t) {
+    if (triangle_misses(t) == 3 || t == 0) {
+      hard_clusters.emplace_back(t);
+    }
+  }
+  hard_clusters.emplace_back(triangle_count);
+  // soft boundaries once a cluster got close to the acmr of its hard cluster
+  std::vector<uint32_t> clusters;
+  for (size_t i = 0; i + 1 < hard_clusters.size(); ++i) {
+    uint32_t begin = hard_clusters[i];
+    uint32_t end = hard_clusters[i + 1];
+    cache.Flush();
+    uint32_t misses = 0;
+    for (uint32_t t = begin; t < end; ++t) {
+      misses += triangle_misses(t);
+    }
+    float threshold = kOverdrawThreshold * misses / (end - begin);
+    cache.Flush();
+    clusters.emplace_back(begin);
+    uint32_t start = begin;
+    misses = 0;
+    for (uint32_t t = begin; t + 1 < end; ++t) {
+      misses += triangle_misses(t);
+      if (misses <= threshold * (t + 1 - start)) {
+        clusters.emplace_back(t + 1);
+        cache.Flush();
+        start = t + 1;
+        misses = 0;
+      }
+    }
+  }
+  clusters.emplace_back(triangle_count);
+
+  // area weighted centroid and normal of every cluster
+  size_t cluster_count = clusters.size() - 1;
+  std::vector<glm::vec3> centroids(cluster_count, glm::vec3(0.0f));
+  std::vector<glm::vec3> normals(cluster_count, glm::vec3(0.0f));
+  std::vector<float> areas(cluster_count, 0.0f);
+  glm::vec3 mesh_centroid(0.0f);
+  float mesh_area = 0.0f;
+  for (size_t c = 0; c < cluster_count; ++c) {
+    for (uint32_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+      const glm::vec3& p0 = vertices[indices[3 * t + 0]].position;
+      const glm::vec3& p1 = vertices[indices[3 * t + 1]].position;
+      const glm::vec3& p2 = vertices[indices[3 * t + 2]].position;
+      glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+      float area = glm::length(normal);
+      centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+      normals[c] += normal;
+      areas[c] += area;
+    }
+    mesh_centroid += centroids[c];
+    mesh_area += areas[c];
+  }
+  if (mesh_area > 0.0f) {
+    mesh_centroid /= mesh_area;
+  }
+  std::vector<float> keys(cluster_count, 0.0f);
+  for (size_t c = 0; c < cluster_count; ++c) {
+    float normal_length = glm::length(normals[c]);
+    if (areas[c] > 0.0f && normal_length > 0.0f) {
+      keys[c] = glm::dot(centroids[c] / areas[c] - mesh_centroid,
+                         normals[c] / normal_length);
+    }
+  }
+  std::vector<uint32_t> order(cluster_count);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+  std::vector<uint32_t> output;
+  output.reserve(indices.size());
+  for (uint32_t c : order) {
+    output.insert(output.end(), indices.begin() + 3 * clusters[c],
+                  indices.begin() + 3 * clusters[c + 1]);
+  }
+  std::copy(output.begin(), output.end(), indices.begin());
+}
+
+// vertices in first use order, unused ones are dropped
+void OptimizeVertexFetch(std::vector<Vertex>& vertices,
+                         std::vector<uint32_t>& indices) {
+  std::vector<uint32_t> remap(vertices.size(), kNone);
+  std::vector<Vertex> fetch_ordered;
+  fetch_ordered.reserve(vertices.size());
+  for (uint32_t& index : indices) {
+    if (remap[index] == kNone) {
+      remap[index] = static_cast<uint32_t>(fetch_ordered.size());
+      fetch_ordered.emplace_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices = std::move(fetch_ordered);
+}
+}  // namespace
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices,
+                                    size_t vertex_count) {
+  FifoCache cache(vertex_count);
+  std::vector<bool> used(vertex_count, false);
+  uint32_t misses = 0;
+  uint32_t unique = 0;
+  for (uint32_t index : indices) {
+    misses += cache.Access(index);
+    if (!used[index]) {
+      used[index] = true;
+      ++unique;
+    }
+  }
+  if (indices.empty()) {
+    return {.acmr = 0.0f, .atvr = 0.0f};
+  }
+  return {
+      .acmr = static_cast<float>(misses) / (indices.size() / 3),
+      .atvr = static_cast<float>(misses) / unique,
+  };
+}
+
+void OptimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+                  const std::vector<SubMesh>& sub_meshes) {
+  // the vertex cache pass works on the vertices of one range at a time
+  std::vector<uint32_t> global_to_local(vertices.size(), kNone);
+  std::vector<uint32_t> local_to_global;
+  std::vector<uint32_t> local_indices;
+  FifoCache cache(vertices.size());
+  auto optimize_range = [&](std::span<uint32_t> sub_indices) {
+    local_to_global.clear();
+    local_indices.clear();
+    for (uint32_t index : sub_indices) {
+      if (global_to_local[index] == kNone) {
+        global_to_local[index] = static_cast<uint32_t>(local_to_global.size());
+        local_to_global.emplace_back(index);
+      }
+      local_indices.emplace_back(global_to_local[index]);
+    }
+    OptimizeVertexCache(local_indices, local_to_global.size());
+    for (size_t i = 0; i < sub_indices.size(); ++i) {
+      sub_indices[i] = local_to_global[local_indices[i]];
+    }
+    for (uint32_t index : local_to_global) {
+      global_to_local[index] = kNone;
+    }
+    OptimizeOverdraw(sub_indices, vertices, cache);
+  };
+  for (const SubMesh& sub_mesh : sub_meshes) {
+    for (uint32_t lod = 0; lod < sub_mesh.lod_count; ++lod) {
+      optimize_range(
+          std::span<uint32_t>(indices.data() + sub_mesh.lods[lod].first_index,
+                              sub_mesh.lods[lod].index_count));
+    }
+  }
+  OptimizeVertexFetch(vertices, indices);
+}
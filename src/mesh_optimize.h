@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "data.h"
+
+// of a fifo post transform cache, acmr is vertex shader invocations per
+// triangle (0.5 at best), atvr per unique vertex (1.0 at best)
+struct VertexCacheStats {
+  float acmr;
+  float atvr;
+};
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices,
+                                    size_t vertex_count);
+// reorders the triangles of every level of every sub mesh for the vertex
+// cache, then orders clusters of them front to back for less overdraw, and
+// finally renumbers the vertices in first use order so vertex fetch walks the
+// buffer linearly, sub mesh ranges and bounds stay valid
+void OptimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+                  const std::vector<SubMesh>& sub_meshes);
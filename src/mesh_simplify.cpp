@@ -0,0 +1,426 @@
+#include "mesh_simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <tuple>
+
+namespace {
+// every level aims at this fraction of the triangles of the level before
+constexpr float kLodReduction = 0.5f;
+// a level that keeps more is not worth its indices and ends the chain
+constexpr float kMinLodReduction = 0.8f;
+// smaller levels are not simplified further
+constexpr uint32_t kMinLodTriangles = 32;
+// no collapse may move the surface further than this fraction of the
+// diagonal of the sub mesh bounds
+constexpr float kMaxLodError = 0.05f;
+// a collapse may turn a remaining triangle by at most ~75 degrees
+constexpr float kMinNormalDot = 0.25f;
+constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+// area weighted sum of squared distances to the planes of triangles
+struct Quadric {
+  double a00 = 0.0, a11 = 0.0, a22 = 0.0, a01 = 0.0, a02 = 0.0, a12 = 0.0;
+  double b0 = 0.0, b1 = 0.0, b2 = 0.0, c = 0.0;
+  double weight = 0.0;
+
+  // plane dot(normal, p) + distance = 0, normal of unit length
+  void AddPlane(const glm::vec3& normal, float distance, float area) {
+    a00 += area * normal.x * normal.x;
+    a11 += area * normal.y * normal.y;
+    a22 += area * normal.z * normal.z;
+    a01 += area * normal.x * normal.y;
+    a02 += area * normal.x * normal.z;
+    a12 += area * normal.y * normal.z;
+    b0 += area * normal.x * distance;
+    b1 += area * normal.y * distance;
+    b2 += area * normal.z * distance;
+    c += area * distance * distance;
+    weight += area;
+  }
+  Quadric& operator+=(const Quadric& other) {
+    a00 += other.a00;
+    a11 += other.a11;
+    a22 += other.a22;
+    a01 += other.a01;
+    a02 += other.a02;
+    a12 += other.a12;
+    b0 += other.b0;
+    b1 += other.b1;
+    b2 += other.b2;
+    c += other.c;
+    weight += other.weight;
+    return *this;
+  }
+  // mean squared distance of p to the planes
+  double Error(const glm::vec3& p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double r = a00 * x * x + a11 * y * y + a22 * z * z +
+               2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+               2.0 * (b0 * x + b1 * y + b2 * z) + c;
+    return weight > 0.0 ? std::abs(r) / weight : 0.0;
+  }
+};
+
+// edge collapse of one index range with locally numbered vertices, vertices
+// at the same position form a class that moves as a whole, every vertex of
+// a collapsed class is remapped to a vertex of the target class it shares a
+// triangle with so attributes stay continuous, classes on borders and non
+// manifold edges never move
+class Simplifier {
+ public:
+  Simplifier(std::vector<glm::vec3> positions, std::vector<uint32_t> indices)
+      : m_positions(std::move(positions)),
+        m_indices(std::move(indices)),
+        m_remap(m_positions.size()) {
+    std::iota(m_remap.begin(), m_remap.end(), 0u);
+    Weld();
+    ComputeQuadrics();
+    LockBorders();
+  }
+
+  // collapses the cheapest edges until at most target_index_count indices
+  // are left or no collapse within max_error is possible
+  void Simplify(size_t target_index_count, float max_error) {
+    double max_squared_error = static_cast<double>(max_error) * max_error;
+    while (m_indices.size() > target_index_count &&
+           Pass(target_index_count, max_squared_error)) {
+    }
+  }
+  const std::vector<uint32_t>& Indices() const { return m_indices; }
+  // in model space, the largest of all collapses so far
+  float Error() const { return static_cast<float>(std::sqrt(m_error)); }
+
+ private:
+  struct Collapse {
+    uint32_t src;
+    uint32_t dst;
+    double cost;
+  };
+
+  void Weld() {
+    std::vector<uint32_t> order(m_positions.size());
+    std::iota(order.begin(), order.end(), 0u);
+    auto key = [this](uint32_t v) {
+      return std::tie(m_positions[v].x, m_positions[v].y, m_positions[v].z);
+    };
+    std::sort(order.begin(), order.end(),
+              [&](uint32_t a, uint32_t b) { return key(a) < key(b); });
+    m_class.resize(m_positions.size());
+    m_wedge_next.resize(m_positions.size());
+    uint32_t class_count = 0;
+    for (size_t i = 0; i < order.size();) {
+      size_t end = i + 1;
+      while (end < order.size() && key(order[end]) == key(order[i])) {
+        ++end;
+      }
+      // ring of the vertices of one class
+      for (size_t j = i; j < end; ++j) {
+        m_class[order[j]] = class_count;
+        m_wedge_next[order[j]] = order[j + 1 < end ? j + 1 : i];
+      }
+      m_class_vertex.emplace_back(order[i]);
+      ++class_count;
+      i = end;
+    }
+  }
+
+  void ComputeQuadrics() {
+    m_quadrics.assign(m_class_vertex.size(), {});
+    for (size_t i = 0; i + 2 < m_indices.size(); i += 3) {
+      const glm::vec3& p0 = m_positions[m_indices[i]];
+      glm::vec3 normal = glm::cross(m_positions[m_indices[i + 1]] - p0,
+                                    m_positions[m_indices[i + 2]] - p0);
+      float length = glm::length(normal);
+      if (length == 0.0f) {
+        continue;
+      }
+      normal /= length;
+      float distance = -glm::dot(normal, p0);
+      for (uint32_t j = 0; j < 3; ++j) {
+        m_quadrics[m_class[m_indices[i + j]]].AddPlane(normal, distance,
+                                                       length * 0.5f);
+      }
+    }
+  }
+
+  // an edge between two classes that is not shared by exactly two triangles
+  // would tear open when collapsed
+  void LockBorders() {
+    std::vector<uint64_t> edges;
+    for (size_t i = 0; i + 2 < m_indices.size(); i += 3) {
+      for (uint32_t j = 0; j < 3; ++j) {
+        uint32_t a = m_class[m_indices[i + j]];
+        uint32_t b = m_class[m_indices[i + (j + 1) % 3]];
+        if (a != b) {
+          edges.emplace_back(uint64_t{std::min(a, b)} << 32 | std::max(a, b));
+        }
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+    m_locked.assign(m_class_vertex.size(), false);
+    for (size_t i = 0; i < edges.size();) {
+      size_t end = i + 1;
+      while (end < edges.size() && edges[end] == edges[i]) {
+        ++end;
+      }
+      if (end - i != 2) {
+        m_locked[edges[i] >> 32] = true;
+        m_locked[edges[i] & 0xffffffffu] = true;
+      }
+      i = end;
+    }
+  }
+
+  uint32_t Resolve(uint32_t v) const {
+    while (m_remap[v] != v) {
+      v = m_remap[v];
+    }
+    return v;
+  }
+
+  // vertex of class dst sharing a triangle with v
+  uint32_t Partner(uint32_t v, uint32_t dst) const {
+    for (uint32_t k = m_adjacency_offsets[v]; k < m_adjacency_offsets[v + 1];
+         ++k) {
+      uint32_t triangle = m_adjacency[k];
+      for (uint32_t j = 0; j < 3; ++j) {
+        uint32_t u = Resolve(m_indices[triangle * 3 + j]);
+        if (m_class[u] == dst) {
+          return u;
+        }
+      }
+    }
+    return kNone;
+  }
+
+  bool CanCollapse(uint32_t src, uint32_t dst) const {
+    if (m_locked[src]) {
+      return false;
+    }
+    uint32_t v = m_class_vertex[src];
+    do {
+      if (Partner(v, dst) == kNone) {
+        return false;
+      }
+      v = m_wedge_next[v];
+    } while (v != m_class_vertex[src]);
+    return true;
+  }
+
+  // triangles around src that survive the collapse must not turn over,
+  // returns the number of triangles it removes or kNone if one would
+  uint32_t CollapsedTriangles(uint32_t src, uint32_t dst) const {
+    const glm::vec3& target = m_positions[m_class_vertex[dst]];
+    uint32_t removed = 0;
+    uint32_t v = m_class_vertex[src];
+    do {
+      for (uint32_t k = m_adjacency_offsets[v];
+           k < m_adjacency_offsets[v + 1]; ++k) {
+        uint32_t triangle = m_adjacency[k];
+        uint32_t corners[3];
+        bool degenerate = false;
+        for (uint32_t j = 0; j < 3; ++j) {
+          corners[j] = Resolve(m_indices[triangle * 3 + j]);
+          degenerate |= m_class[corners[j]] == dst;
+        }
+        if (degenerate) {
+          ++removed;
+          continue;
+        }
+        glm::vec3 p[3];
+        glm::vec3 q[3];
+        for (uint32_t j = 0; j < 3; ++j) {
+          p[j] = m_positions[corners[j]];
+          q[j] = m_class[corners[j]] == src ? target : p[j];
+        }
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, after) <
+            kMinNormalDot * glm::length(before) * glm::length(after)) {
+          return kNone;
+        }
+      }
+      v = m_wedge_next[v];
+    } while (v != m_class_vertex[src]);
+    return removed;
+  }
+
+  void BuildAdjacency() {
+    m_adjacency_offsets.assign(m_positions.size() + 1, 0);
+    for (uint32_t index : m_indices) {
+      ++m_adjacency_offsets[index + 1];
+    }
+    std::partial_sum(m_adjacency_offsets.begin(), m_adjacency_offsets.end(),
+                     m_adjacency_offsets.begin());
+    m_adjacency.resize(m_indices.size());
+    std::vector<uint32_t> fill(m_adjacency_offsets.begin(),
+                               m_adjacency_offsets.end() - 1);
+    for (size_t i = 0; i < m_indices.size(); ++i) {
+      m_adjacency[fill[m_indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  // one round of independent collapses, false if none was possible
+  bool Pass(size_t target_index_count, double max_squared_error) {
+    BuildAdjacency();
+    std::vector<uint64_t> edges;
+    for (size_t i = 0; i + 2 < m_indices.size(); i += 3) {
+      for (uint32_t j = 0; j < 3; ++j) {
+        uint32_t a = m_class[m_indices[i + j]];
+        uint32_t b = m_class[m_indices[i + (j + 1) % 3]];
+        edges.emplace_back(uint64_t{std::min(a, b)} << 32 | std::max(a, b));
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    std::vector<Collapse> collapses;
+    auto cost = [this](uint32_t src, uint32_t dst) {
+      Quadric quadric = m_quadrics[src];
+      quadric += m_quadrics[dst];
+      return quadric.Error(m_positions[m_class_vertex[dst]]);
+    };
+    for (uint64_t edge : edges) {
+      uint32_t a = static_cast<uint32_t>(edge >> 32);
+      uint32_t b = static_cast<uint32_t>(edge & 0xffffffffu);
+      double cost_ab = CanCollapse(a, b)
+                           ? cost(a, b)
+                           : std::numeric_limits<double>::infinity();
+      double cost_ba = CanCollapse(b, a)
+                           ? cost(b, a)
+                           : std::numeric_limits<double>::infinity();
+      if (cost_ab <= max_squared_error || cost_ba <= max_squared_error) {
+        collapses.emplace_back(cost_ab <= cost_ba ? Collapse{a, b, cost_ab}
+                                                  : Collapse{b, a, cost_ba});
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse& a, const Collapse& b) {
+                return a.cost < b.cost;
+              });
+
+    // a class is changed by at most one collapse per pass so the quadrics
+    // and adjacency used above stay valid
+    std::vector<bool> touched(m_class_vertex.size(), false);
+    size_t removed_indices = 0;
+    size_t excess_indices = m_indices.size() - target_index_count;
+    bool collapsed = false;
+    for (const Collapse& collapse : collapses) {
+      if (touched[collapse.src] || touched[collapse.dst]) {
+        continue;
+      }
+      uint32_t removed = CollapsedTriangles(collapse.src, collapse.dst);
+      if (removed == kNone) {
+        continue;
+      }
+      uint32_t v = m_class_vertex[collapse.src];
+      std::vector<uint32_t> partners;
+      do {
+        partners.emplace_back(Partner(v, collapse.dst));
+        v = m_wedge_next[v];
+      } while (v != m_class_vertex[collapse.src]);
+      for (uint32_t partner : partners) {
+        m_remap[v] = partner;
+        v = m_wedge_next[v];
+      }
+      m_quadrics[collapse.dst] += m_quadrics[collapse.src];
+      m_error = std::max(m_error, collapse.cost);
+      touched[collapse.src] = true;
+      touched[collapse.dst] = true;
+      collapsed = true;
+      removed_indices += removed * 3;
+      if (removed_indices >= excess_indices) {
+        break;
+      }
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i + 2 < m_indices.size(); i += 3) {
+      uint32_t a = Resolve(m_indices[i]);
+      uint32_t b = Resolve(m_indices[i + 1]);
+      uint32_t c = Resolve(m_indices[i + 2]);
+      if (m_class[a] == m_class[b] || m_class[b] == m_class[c] ||
+          m_class[a] == m_class[c]) {
+        continue;
+      }
+      m_indices[count++] = a;
+      m_indices[count++] = b;
+      m_indices[count++] = c;
+    }
+    m_indices.resize(count);
+    return collapsed;
+  }
+
+  std::vector<glm::vec3> m_positions;
+  std::vector<uint32_t> m_indices;
+  // collapsed vertices point at their partner
+  std::vector<uint32_t> m_remap;
+  std::vector<uint32_t> m_class;
+  std::vector<uint32_t> m_wedge_next;
+  // first vertex of each class
+  std::vector<uint32_t> m_class_vertex;
+  std::vector<Quadric> m_quadrics;
+  std::vector<bool> m_locked;
+  std::vector<uint32_t> m_adjacency_offsets;
+  std::vector<uint32_t> m_adjacency;
+  double m_error = 0.0;
+};
+}  // namespace
+
+void GenerateLods(const std::vector<Vertex>& vertices,
+                  std::vector<uint32_t>& indices,
+                  std::vector<SubMesh>& sub_meshes) {
+  std::vector<uint32_t> global_to_local(vertices.size(), kNone);
+  std::vector<uint32_t> local_to_global;
+  for (SubMesh& sub_mesh : sub_meshes) {
+    sub_mesh.lods[0] = {.first_index = sub_mesh.first_index,
+                        .index_count = sub_mesh.index_count,
+                        .error = 0.0f};
+    sub_mesh.lod_count = 1;
+
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> local_indices;
+    local_to_global.clear();
+    for (uint32_t i = sub_mesh.first_index;
+         i < sub_mesh.first_index + sub_mesh.index_count; ++i) {
+      uint32_t index = indices[i];
+      if (global_to_local[index] == kNone) {
+        global_to_local[index] = static_cast<uint32_t>(local_to_global.size());
+        local_to_global.emplace_back(index);
+        positions.emplace_back(vertices[index].position);
+      }
+      local_indices.emplace_back(global_to_local[index]);
+    }
+    for (uint32_t index : local_to_global) {
+      global_to_local[index] = kNone;
+    }
+
+    float max_error =
+        kMaxLodError * glm::distance(sub_mesh.bounds_min, sub_mesh.bounds_max);
+    Simplifier simplifier(std::move(positions), std::move(local_indices));
+    size_t index_count = sub_mesh.index_count;
+    while (sub_mesh.lod_count < kMaxMeshLods &&
+           index_count / 3 >= kMinLodTriangles) {
+      size_t target_triangles =
+          static_cast<size_t>(index_count / 3 * kLodReduction);
+      simplifier.Simplify(target_triangles * 3, max_error);
+      const std::vector<uint32_t>& lod_indices = simplifier.Indices();
+      if (lod_indices.empty() ||
+          lod_indices.size() > index_count * kMinLodReduction) {
+        break;
+      }
+      sub_mesh.lods[sub_mesh.lod_count++] = {
+          .first_index = static_cast<uint32_t>(indices.size()),
+          .index_count = static_cast<uint32_t>(lod_indices.size()),
+          .error = simplifier.Error(),
+      };
+      for (uint32_t index : lod_indices) {
+        indices.emplace_back(local_to_global[index]);
+      }
+      index_count = lod_indices.size();
+    }
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "data.h"
+
+// appends up to kMaxMeshLods - 1 simplified levels of every sub mesh to the
+// index buffer and records them in SubMesh::lods, lods[0] is the full detail
+// range, every level has about half the triangles of the one before and
+// indexes the same vertices, run before OptimizeMesh so each level is
+// optimized too
+// https://www.cs.cmu.edu/~garland/Papers/quadrics.pdf
+// https://github.com/zeux/meshoptimizer/blob/master/src/simplifier.cpp
+void GenerateLods(const std::vector<Vertex>& vertices,
+                  std::vector<uint32_t>& indices,
+                  std::vector<SubMesh>& sub_meshes);
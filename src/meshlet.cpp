@@ -0,0 +1,144 @@
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+// wider cones are never culled, the test would rarely pass anyway
+constexpr float kMinConeDot = 0.1f;
+constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+glm::vec3 TriangleNormal(const std::vector<Vertex>& vertices,
+                         const uint32_t* triangle) {
+  const glm::vec3& a = vertices[triangle[0]].position;
+  const glm::vec3& b = vertices[triangle[1]].position;
+  const glm::vec3& c = vertices[triangle[2]].position;
+  return glm::cross(b - a, c - a);
+}
+
+// +1 if the winding of most triangles agrees with their vertex normals, so
+// cones built with it face the way the rasterizer culls
+float WindingSign(const std::vector<Vertex>& vertices,
+                  const std::vector<uint32_t>& indices) {
+  double agreement = 0.0;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    glm::vec3 normal = vertices[indices[i]].normal +
+                       vertices[indices[i + 1]].normal +
+                       vertices[indices[i + 2]].normal;
+    agreement += glm::dot(TriangleNormal(vertices, &indices[i]), normal);
+  }
+  return agreement < 0.0 ? -1.0f : 1.0f;
+}
+
+// bounding sphere around the box center and normal cone of the triangles in
+// [first_index, first_index + index_count)
+// https://github.com/zeux/meshoptimizer/blob/master/src/clusterizer.cpp
+void ComputeBounds(const std::vector<Vertex>& vertices,
+                   const std::vector<uint32_t>& indices, float winding_sign,
+                   Meshlet& meshlet) {
+  glm::vec3 bounds_min(std::numeric_limits<float>::max());
+  glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+  uint32_t end = meshlet.first_index + meshlet.index_count;
+  for (uint32_t i = meshlet.first_index; i < end; ++i) {
+    bounds_min = glm::min(bounds_min, vertices[indices[i]].position);
+    bounds_max = glm::max(bounds_max, vertices[indices[i]].position);
+  }
+  meshlet.center = (bounds_min + bounds_max) * 0.5f;
+  meshlet.radius = 0.0f;
+  for (uint32_t i = meshlet.first_index; i < end; ++i) {
+    meshlet.radius =
+        std::max(meshlet.radius, glm::distance(meshlet.center,
+                                               vertices[indices[i]].position));
+  }
+
+  std::vector<glm::vec3> normals;
+  normals.reserve(meshlet.index_count / 3);
+  glm::vec3 axis(0.0f);
+  for (uint32_t i = meshlet.first_index; i < end; i += 3) {
+    glm::vec3 normal = TriangleNormal(vertices, &indices[i]) * winding_sign;
+    float length = glm::length(normal);
+    // degenerate triangles are never rasterized
+    if (length > 0.0f) {
+      normals.emplace_back(normal / length);
+      axis += normals.back();
+    }
+  }
+  meshlet.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+  meshlet.cone_cutoff = 1.0f;
+  float axis_length = glm::length(axis);
+  if (normals.empty() || axis_length == 0.0f) {
+    return;
+  }
+  axis /= axis_length;
+  float min_dot = 1.0f;
+  for (const glm::vec3& normal : normals) {
+    min_dot = std::min(min_dot, glm::dot(axis, normal));
+  }
+  if (min_dot <= kMinConeDot) {
+    return;
+  }
+  meshlet.cone_axis = axis;
+  // sine of the cone half angle, the view direction has to be further than
+  // 90 degrees from every normal
+  meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+}
+}  // namespace
+
+void BuildMeshlets(const std::vector<Vertex>& vertices,
+                   const std::vector<uint32_t>& indices,
+                   const std::vector<SubMesh>& sub_meshes,
+                   std::vector<Meshlet>& meshlets) {
+  meshlets.clear();
+  float winding_sign = WindingSign(vertices, indices);
+  // meshlet that last used each vertex
+  std::vector<uint32_t> vertex_meshlet(vertices.size(), kNone);
+  // vertices of the triangle at index i that meshlet id does not hold yet
+  auto new_vertex_count = [&](uint32_t i, uint32_t id) {
+    uint32_t count = 0;
+    for (uint32_t j = 0; j < 3; ++j) {
+      bool repeated = (j > 0 && indices[i + j] == indices[i]) ||
+                      (j > 1 && indices[i + j] == indices[i + 1]);
+      count += vertex_meshlet[indices[i + j]] != id && !repeated;
+    }
+    return count;
+  };
+  for (uint32_t sub_mesh_index = 0; sub_mesh_index < sub_meshes.size();
+       ++sub_mesh_index) {
+    const SubMesh& sub_mesh = sub_meshes[sub_mesh_index];
+    for (uint32_t lod = 0; lod < sub_mesh.lod_count; ++lod) {
+      uint32_t first_index = sub_mesh.lods[lod].first_index;
+      uint32_t end = first_index + sub_mesh.lods[lod].index_count;
+      Meshlet empty{
+          .first_index = first_index,
+          .flags = sub_mesh.dynamic_caster ? kMeshletDynamicCaster : 0u,
+          .sub_mesh = sub_mesh_index,
+          .lod = lod,
+      };
+      Meshlet meshlet = empty;
+      auto emit = [&]() {
+        if (meshlet.index_count > 0) {
+          ComputeBounds(vertices, indices, winding_sign, meshlet);
+          meshlets.emplace_back(meshlet);
+        }
+      };
+      for (uint32_t i = first_index; i + 2 < end; i += 3) {
+        uint32_t id = static_cast<uint32_t>(meshlets.size());
+        uint32_t new_vertices = new_vertex_count(i, id);
+        if (meshlet.vertex_count + new_vertices > kMaxMeshletVertices ||
+            meshlet.index_count / 3 + 1 > kMaxMeshletTriangles) {
+          emit();
+          meshlet = empty;
+          meshlet.first_index = i;
+          new_vertices = new_vertex_count(i, ++id);
+        }
+        for (uint32_t j = 0; j < 3; ++j) {
+          vertex_meshlet[indices[i + j]] = id;
+        }
+        meshlet.vertex_count += new_vertices;
+        meshlet.index_count += 3;
+      }
+      emit();
+    }
+  }
+}
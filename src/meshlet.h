@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "data.h"
+
+// splits every level of every sub mesh into runs of triangles in index order,
+// each run ends before it would exceed kMaxMeshletVertices or
+// kMaxMeshletTriangles, the index buffer is left as is so a meshlet is an
+// index range, run after OptimizeMesh so the runs are spatially tight
+void BuildMeshlets(const std::vector<Vertex>& vertices,
+                   const std::vector<uint32_t>& indices,
+                   const std::vector<SubMesh>& sub_meshes,
+                   std::vector<Meshlet>& meshlets);
@@ -1,9 +1,23 @@
 #include "model.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <string>
+
 #define NOMINMAX
 #include "command_buffer.h"
 #include "context.h"
 #include "memory.h"
+#include "mesh_cache.h"
+#include "mesh_optimize.h"
+#include "mesh_simplify.h"
+#include "meshlet.h"
+#include "obj_import.h"
+#include "scene.h"
+#include "utils.h"
 
 void GenerateMipmaps(const vk::raii::Image& image, vk::Format format,
                      int32_t width, int32_t height, uint32_t mip_levels) {
@@ -92,6 +106,13 @@ void CreateTexture() {
   void* data = memory.mapMemory(0, image_size);
   memcpy(data, pixels, image_size);
   memory.unmapMemory();
+  Context::Instance()->g_texture_masked = false;
+  for (vk::DeviceSize i = 3; i < image_size; i += 4) {
+    if (pixels[i] < 255) {
+      Context::Instance()->g_texture_masked = true;
+      break;
+    }
+  }
   // stbi need free
   stbi_image_free(pixels);
   CreateImage(tex_width, tex_height, mip_levels, vk::SampleCountFlagBits::e1,
@@ -139,74 +160,218 @@ void CreateTexture() {
       vk::raii::Sampler(Context::Instance()->g_device, sampler_info);
 }
 
-void LoadMesh() {
+void ParseObj(const std::filesystem::path& source_path,
+              std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+              std::vector<SubMesh>& sub_meshes,
+              std::vector<Meshlet>& meshlets) {
   tinyobj::attrib_t attr;
   std::vector<tinyobj::shape_t> shapes;
   std::vector<tinyobj::material_t> materials;
   std::string err, warn;
   if (!tinyobj::LoadObj(&attr, &shapes, &materials, &warn, &err,
-                        DATA_FILE_PATH "/viking_room.obj")) {
+                        source_path.string().c_str())) {
     throw std::runtime_error(warn + err);
   }
-  std::unordered_map<Vertex, uint32_t> index_map;
-  for (const auto& shape : shapes) {
-    for (const auto& index : shape.mesh.indices) {
-      Vertex vertex{
-          .position = {attr.vertices[3 * index.vertex_index + 0],
-                       attr.vertices[3 * index.vertex_index + 1],
-                       attr.vertices[3 * index.vertex_index + 2]},
-          .roughness_f0 = {Context::Instance()->g_pbr_roughness,
-                           Context::Instance()->g_pbr_f0,
-                           Context::Instance()->g_pbr_f0,
-                           Context::Instance()->g_pbr_f0},
-          .normal =
-              {
-                  attr.normals[3 * index.normal_index + 0],
-                  attr.normals[3 * index.normal_index + 1],
-                  attr.normals[3 * index.normal_index + 2],
-              },
-          .metallic = Context::Instance()->g_pbr_metallic,
-          .tex_coord = {attr.texcoords[2 * index.texcoord_index + 0],
-                        1.0f - attr.texcoords[2 * index.texcoord_index + 1]}};
-      if (!index_map.count(vertex)) {
-        index_map[vertex] = Context::Instance()->g_vertex_in.size();
-        Context::Instance()->g_vertex_in.emplace_back(vertex);
-      }
-      Context::Instance()->g_index_in.emplace_back(index_map[vertex]);
+  ObjImportOptions options{
+      .roughness_f0 = {Context::Instance()->g_pbr_roughness,
+                       Context::Instance()->g_pbr_f0,
+                       Context::Instance()->g_pbr_f0,
+                       Context::Instance()->g_pbr_f0},
+      .metallic = Context::Instance()->g_pbr_metallic,
+  };
+  BuildObjMesh(attr, shapes, options, vertices, indices, sub_meshes);
+  GenerateLods(vertices, indices, sub_meshes);
+  VertexCacheStats before = AnalyzeVertexCache(indices, vertices.size());
+  OptimizeMesh(vertices, indices, sub_meshes);
+  VertexCacheStats after = AnalyzeVertexCache(indices, vertices.size());
+  LOG("vertex cache acmr ", std::to_string(before.acmr), " -> ",
+      std::to_string(after.acmr), ", atvr ", std::to_string(before.atvr),
+      " -> ", std::to_string(after.atvr));
+  BuildMeshlets(vertices, indices, sub_meshes, meshlets);
+}
+
+// bounds of the whole mesh, every vertex is quantized inside them
+void MeshBounds(const std::vector<SubMesh>& sub_meshes, glm::vec3& bounds_min,
+                glm::vec3& bounds_max) {
+  bounds_min = glm::vec3(std::numeric_limits<float>::max());
+  bounds_max = glm::vec3(std::numeric_limits<float>::lowest());
+  for (const SubMesh& sub_mesh : sub_meshes) {
+    bounds_min = glm::min(bounds_min, sub_mesh.bounds_min);
+    bounds_max = glm::max(bounds_max, sub_mesh.bounds_max);
+  }
+  if (sub_meshes.empty()) {
+    bounds_min = bounds_max = glm::vec3(0.0f);
+  }
+}
+
+glm::vec3 PositionScale(const glm::vec3& bounds_min,
+                        const glm::vec3& bounds_max) {
+  return glm::max(bounds_max - bounds_min, glm::vec3(1e-6f));
+}
+
+uint32_t LoadMesh(const std::filesystem::path& source_path) {
+  std::filesystem::path cache_path = source_path;
+  cache_path.replace_extension(".mesh");
+  auto start = std::chrono::steady_clock::now();
+  std::vector<QuantizedPosition> positions;
+  std::vector<QuantizedAttributes> attributes;
+  std::vector<uint32_t> indices;
+  std::vector<SubMesh> sub_meshes;
+  std::vector<Meshlet> meshlets;
+  uint64_t source_hash = MeshSourceHash(source_path);
+  bool cached = LoadMeshCache(cache_path, source_hash, positions, attributes,
+                              indices, sub_meshes, meshlets);
+  if (!cached) {
+    std::vector<Vertex> vertices;
+    ParseObj(source_path, vertices, indices, sub_meshes, meshlets);
+    // quantized once here, a cache hit only copies the streams
+    glm::vec3 bounds_min, bounds_max;
+    MeshBounds(sub_meshes, bounds_min, bounds_max);
+    glm::vec3 position_scale = PositionScale(bounds_min, bounds_max);
+    positions.resize(vertices.size());
+    attributes.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      QuantizeVertex(vertices[i], bounds_min, position_scale, positions[i],
+                     attributes[i]);
+    }
+    WriteMeshCache(cache_path, source_hash, positions, attributes, indices,
+                   sub_meshes, meshlets);
+  }
+  std::chrono::duration<double, std::milli> duration =
+      std::chrono::steady_clock::now() - start;
+  uint32_t lod_count = 0;
+  for (const SubMesh& sub_mesh : sub_meshes) {
+    lod_count += sub_mesh.lod_count;
+  }
+  LOG(source_path.filename().string(),
+      cached ? " mesh cache hit, " : " mesh cache miss, ",
+      std::to_string(duration.count()), " ms, ",
+      std::to_string(meshlets.size()), " meshlets, ",
+      std::to_string(lod_count), " lods");
+
+  // the cache holds ranges of the mesh alone, rebase them onto the buffers
+  // shared by all meshes
+  std::vector<QuantizedPosition>& vertex_positions =
+      Context::Instance()->g_vertex_positions;
+  std::vector<QuantizedAttributes>& vertex_attributes =
+      Context::Instance()->g_vertex_attributes;
+  std::vector<uint32_t>& index_in = Context::Instance()->g_index_in;
+  uint32_t vertex_base = static_cast<uint32_t>(vertex_positions.size());
+  uint32_t index_base = static_cast<uint32_t>(index_in.size());
+  Mesh mesh{
+      .first_sub_mesh =
+          static_cast<uint32_t>(Context::Instance()->g_sub_meshes.size()),
+      .sub_mesh_count = static_cast<uint32_t>(sub_meshes.size()),
+      .first_meshlet =
+          static_cast<uint32_t>(Context::Instance()->g_meshlets.size()),
+      .meshlet_count = static_cast<uint32_t>(meshlets.size()),
+      .bounds_min = {},
+      .bounds_max = {},
+      .first_vertex = vertex_base,
+      .vertex_count = static_cast<uint32_t>(positions.size()),
+  };
+  MeshBounds(sub_meshes, mesh.bounds_min, mesh.bounds_max);
+  mesh.position_offset = mesh.bounds_min;
+  mesh.position_scale = PositionScale(mesh.bounds_min, mesh.bounds_max);
+  vertex_positions.insert(vertex_positions.end(), positions.begin(),
+                          positions.end());
+  vertex_attributes.insert(vertex_attributes.end(), attributes.begin(),
+                           attributes.end());
+  for (uint32_t index : indices) {
+    index_in.emplace_back(vertex_base + index);
+  }
+  for (SubMesh sub_mesh : sub_meshes) {
+    sub_mesh.first_index += index_base;
+    for (uint32_t lod = 0; lod < sub_mesh.lod_count; ++lod) {
+      sub_mesh.lods[lod].first_index += index_base;
     }
+    Context::Instance()->g_sub_meshes.emplace_back(sub_mesh);
   }
+  for (Meshlet meshlet : meshlets) {
+    meshlet.first_index += index_base;
+    Context::Instance()->g_meshlets.emplace_back(meshlet);
+  }
+  Context::Instance()->g_meshes.emplace_back(mesh);
+  return static_cast<uint32_t>(Context::Instance()->g_meshes.size() - 1);
+}
+
+uint32_t VertexCount() {
+  return static_cast<uint32_t>(
+      Context::Instance()->g_vertex_positions.size());
+}
+
+// position stream followed by the attribute stream
+uint32_t VertexBufferSize() {
+  return Context::Instance()->g_attribute_offset +
+         sizeof(QuantizedAttributes) * VertexCount();
+}
+
+// both streams into the mapped staging buffer as they are, every mesh already
+// sits at its vertex base, g_attribute_offset has to be set
+void CopyVertexStreams() {
+  auto* data = static_cast<char*>(Context::Instance()->g_transfer_buffer_maped);
+  memcpy(data, Context::Instance()->g_vertex_positions.data(),
+         sizeof(QuantizedPosition) * VertexCount());
+  memcpy(data + Context::Instance()->g_attribute_offset,
+         Context::Instance()->g_vertex_attributes.data(),
+         sizeof(QuantizedAttributes) * VertexCount());
 }
 
 void UpdateMesh() {
-  for (Vertex& vertex : Context::Instance()->g_vertex_in) {
-    vertex.roughness_f0 = {
-        Context::Instance()->g_pbr_roughness, Context::Instance()->g_pbr_f0,
-        Context::Instance()->g_pbr_f0, Context::Instance()->g_pbr_f0};
-    vertex.metallic = Context::Instance()->g_pbr_metallic;
-  }
-  uint32_t size = sizeof(Context::Instance()->g_vertex_in[0]) *
-                  Context::Instance()->g_vertex_in.size();
-  memcpy(Context::Instance()->g_transfer_buffer_maped,
-         Context::Instance()->g_vertex_in.data(), size);
+  // only the material of the streams follows the sliders
+  glm::u8vec4 roughness_f0 = glm::packUnorm<uint8_t>(glm::vec4(
+      Context::Instance()->g_pbr_roughness, Context::Instance()->g_pbr_f0,
+      Context::Instance()->g_pbr_f0, Context::Instance()->g_pbr_f0));
+  uint16_t metallic = glm::packUnorm<uint16_t>(
+                          glm::vec4(Context::Instance()->g_pbr_metallic))
+                          .x;
+  for (QuantizedPosition& position : Context::Instance()->g_vertex_positions) {
+    position.position_metallic.w = metallic;
+  }
+  for (QuantizedAttributes& attributes :
+       Context::Instance()->g_vertex_attributes) {
+    attributes.roughness_f0 = roughness_f0;
+  }
+  CopyVertexStreams();
   CopyBuffer(Context::Instance()->g_transfer_buffer,
-             Context::Instance()->g_vertex_buffer, size);
+             Context::Instance()->g_vertex_buffer, VertexBufferSize());
 }
 
 void CreateVertexBuffer() {
-  uint32_t size = sizeof(Context::Instance()->g_vertex_in[0]) *
-                  Context::Instance()->g_vertex_in.size();
-  CreateBuffer(size, vk::BufferUsageFlagBits::eTransferSrc,
+  // storage buffer descriptors of each stream need an aligned offset, 256
+  // is the largest minStorageBufferOffsetAlignment allowed
+  constexpr uint32_t kStreamAlignment = 256;
+  uint32_t position_size = sizeof(QuantizedPosition) * VertexCount();
+  Context::Instance()->g_attribute_offset =
+      (position_size + kStreamAlignment - 1) / kStreamAlignment *
+      kStreamAlignment;
+  uint32_t size = VertexBufferSize();
+  // reused by the index, meshlet, instance and cull item uploads, large
+  // enough for 32 bit indices
+  uint32_t transfer_size = std::max<uint32_t>(
+      {size,
+       static_cast<uint32_t>(sizeof(uint32_t) *
+                             Context::Instance()->g_index_in.size()),
+       static_cast<uint32_t>(sizeof(Meshlet) *
+                             Context::Instance()->g_meshlets.size()),
+       static_cast<uint32_t>(sizeof(InstanceData) *
+                             Context::Instance()->g_instances.size()),
+       static_cast<uint32_t>(
+           sizeof(MeshletCullItem) *
+           Context::Instance()->g_meshlet_cull_items.size())});
+  CreateBuffer(transfer_size, vk::BufferUsageFlagBits::eTransferSrc,
                vk::SharingMode::eExclusive,
                vk::MemoryPropertyFlagBits::eHostVisible |
                    vk::MemoryPropertyFlagBits::eHostCoherent,
                Context::Instance()->g_transfer_buffer,
                Context::Instance()->g_transfer_buffer_memory);
   Context::Instance()->g_transfer_buffer_maped =
-      Context::Instance()->g_transfer_buffer_memory.mapMemory(0, size);
-  memcpy(Context::Instance()->g_transfer_buffer_maped,
-         Context::Instance()->g_vertex_in.data(), size);
+      Context::Instance()->g_transfer_buffer_memory.mapMemory(0,
+                                                              transfer_size);
+  CopyVertexStreams();
   CreateBuffer(size,
                vk::BufferUsageFlagBits::eVertexBuffer |
+                   vk::BufferUsageFlagBits::eStorageBuffer |
                    vk::BufferUsageFlagBits::eTransferDst,
                vk::SharingMode::eExclusive,
                vk::MemoryPropertyFlagBits::eDeviceLocal,
@@ -214,15 +379,31 @@ void CreateVertexBuffer() {
                Context::Instance()->g_vertex_buffer_memory);
   CopyBuffer(Context::Instance()->g_transfer_buffer,
              Context::Instance()->g_vertex_buffer, size);
+  LOG("vertex buffer ", std::to_string(size), " bytes, ",
+      std::to_string(sizeof(Vertex) * VertexCount()), " unquantized");
 }
 
 void CreateIndexBuffer() {
-  uint32_t size = sizeof(Context::Instance()->g_index_in[0]) *
-                  Context::Instance()->g_index_in.size();
-  memcpy(Context::Instance()->g_transfer_buffer_maped,
-         Context::Instance()->g_index_in.data(), size);
+  const std::vector<uint32_t>& indices = Context::Instance()->g_index_in;
+  bool index_16bit = VertexCount() <=
+                     std::numeric_limits<uint16_t>::max() + size_t{1};
+  Context::Instance()->g_index_type =
+      index_16bit ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+  uint32_t size = sizeof(uint32_t) * indices.size();
+  if (index_16bit) {
+    auto* dst =
+        static_cast<uint16_t*>(Context::Instance()->g_transfer_buffer_maped);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      dst[i] = static_cast<uint16_t>(indices[i]);
+    }
+    // whole words, the visibility material pass reads the buffer as uints
+    size = (sizeof(uint16_t) * indices.size() + 3) & ~3u;
+  } else {
+    memcpy(Context::Instance()->g_transfer_buffer_maped, indices.data(), size);
+  }
   CreateBuffer(size,
                vk::BufferUsageFlagBits::eIndexBuffer |
+                   vk::BufferUsageFlagBits::eStorageBuffer |
                    vk::BufferUsageFlagBits::eTransferDst,
                vk::SharingMode::eExclusive,
                vk::MemoryPropertyFlagBits::eDeviceLocal,
@@ -232,9 +413,81 @@ void CreateIndexBuffer() {
              Context::Instance()->g_index_buffer, size);
 }
 
+// bounds and index ranges read by the meshlet culling
+void CreateMeshletBuffer() {
+  uint32_t size = sizeof(Meshlet) * Context::Instance()->g_meshlets.size();
+  memcpy(Context::Instance()->g_transfer_buffer_maped,
+         Context::Instance()->g_meshlets.data(), size);
+  CreateBuffer(std::max<uint32_t>(size, sizeof(Meshlet)),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_meshlet_buffer,
+               Context::Instance()->g_meshlet_buffer_memory);
+  if (size > 0) {
+    CopyBuffer(Context::Instance()->g_transfer_buffer,
+               Context::Instance()->g_meshlet_buffer, size);
+  }
+}
+
+// transforms and lod slots the vertex shaders and the meshlet culling read
+void CreateInstanceBuffer() {
+  const std::vector<Instance>& instances = Context::Instance()->g_instances;
+  auto* data =
+      static_cast<InstanceData*>(Context::Instance()->g_transfer_buffer_maped);
+  for (size_t i = 0; i < instances.size(); ++i) {
+    const Mesh& mesh = Context::Instance()->g_meshes[instances[i].mesh];
+    data[i] = InstanceData{
+        .model = instances[i].model,
+        .bounds_min = mesh.bounds_min,
+        .first_lod = instances[i].first_lod,
+        .bounds_max = mesh.bounds_max,
+        .flags = instances[i].dynamic_caster ? kMeshletDynamicCaster : 0u,
+        .position_offset = glm::vec4(mesh.position_offset, 0.0f),
+        .position_scale = glm::vec4(mesh.position_scale, 0.0f),
+    };
+  }
+  uint32_t size = sizeof(InstanceData) * instances.size();
+  CreateBuffer(std::max<uint32_t>(size, sizeof(InstanceData)),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_instance_buffer,
+               Context::Instance()->g_instance_buffer_memory);
+  if (size > 0) {
+    CopyBuffer(Context::Instance()->g_transfer_buffer,
+               Context::Instance()->g_instance_buffer, size);
+  }
+}
+
+void CreateMeshletCullItemBuffer() {
+  uint32_t size = sizeof(MeshletCullItem) *
+                  Context::Instance()->g_meshlet_cull_items.size();
+  memcpy(Context::Instance()->g_transfer_buffer_maped,
+         Context::Instance()->g_meshlet_cull_items.data(), size);
+  CreateBuffer(std::max<uint32_t>(size, sizeof(MeshletCullItem)),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_meshlet_cull_item_buffer,
+               Context::Instance()->g_meshlet_cull_item_buffer_memory);
+  if (size > 0) {
+    CopyBuffer(Context::Instance()->g_transfer_buffer,
+               Context::Instance()->g_meshlet_cull_item_buffer, size);
+  }
+}
+
 void LoadModel() {
-  LoadMesh();
+  LoadScene(Context::Instance()->g_scene_path.empty()
+                ? std::filesystem::path(DATA_FILE_PATH "/scene.json")
+                : std::filesystem::path(Context::Instance()->g_scene_path));
   CreateTexture();
   CreateVertexBuffer();
   CreateIndexBuffer();
+  CreateMeshletBuffer();
+  CreateInstanceBuffer();
+  CreateMeshletCullItemBuffer();
 }
@@ -1,12 +1,21 @@
 #pragma once
 
 #include <cstdint>
+#include <filesystem>
 
 #include "third_part/vulkan_headers.h"
 
 void CreateTexture();
-void LoadMesh();
+// the obj is parsed, deduplicated and optimized once, later runs map the
+// baked cache, appends the mesh to the scene geometry and returns its index
+// into g_meshes
+uint32_t LoadMesh(const std::filesystem::path& source_path);
+// repacks the pbr sliders into the quantized streams and uploads the vertex
+// buffer, the device must be idle
 void UpdateMesh();
 void CreateVertexBuffer();
 void CreateIndexBuffer();
+void CreateMeshletBuffer();
+void CreateInstanceBuffer();
+void CreateMeshletCullItemBuffer();
 void LoadModel();
@@ -0,0 +1,299 @@
+#include "obj_import.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include "job_system.h"
+
+namespace {
+// smaller chunks cost more in scheduling and merging than they save
+constexpr size_t kMinChunkCorners = size_t{1} << 16;
+
+// the fields of a vertex without the alignment padding, the last float stays
+// zero so the size is a multiple of 8
+struct PackedVertex {
+  float data[14];
+  bool operator==(const PackedVertex& other) const {
+    return memcmp(data, other.data, sizeof(data)) == 0;
+  }
+};
+static_assert(sizeof(PackedVertex) % sizeof(uint64_t) == 0);
+
+PackedVertex Pack(const Vertex& vertex) {
+  float fields[] = {
+      vertex.position.x,     vertex.position.y,     vertex.position.z,
+      vertex.roughness_f0.x, vertex.roughness_f0.y, vertex.roughness_f0.z,
+      vertex.roughness_f0.w, vertex.normal.x,       vertex.normal.y,
+      vertex.normal.z,       vertex.metallic,       vertex.tex_coord.x,
+      vertex.tex_coord.y,
+  };
+  PackedVertex packed{};
+  for (size_t i = 0; i < std::size(fields); ++i) {
+    // -0 and 0 compare equal, keep them equal byte wise
+    packed.data[i] = fields[i] + 0.0f;
+  }
+  return packed;
+}
+
+// murmur3 style mixing of every 64 bit word, finished with fmix64
+// https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp
+uint64_t Hash(const PackedVertex& packed) {
+  uint64_t words[sizeof(PackedVertex) / sizeof(uint64_t)];
+  memcpy(words, packed.data, sizeof(words));
+  uint64_t hash = 0x9e3779b97f4a7c15ull;
+  for (uint64_t word : words) {
+    word *= 0x87c37b91114253d5ull;
+    word = std::rotl(word, 31);
+    word *= 0x4cf5ad432745937full;
+    hash ^= word;
+    hash = std::rotl(hash, 27) * 5 + 0x52dce729;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// open addressing with robin hood linear probing, maps a vertex to its id, the
+// packed vertices live outside the map indexed by id
+class VertexIndexMap {
+ public:
+  explicit VertexIndexMap(size_t expected_size) {
+    // at most half full
+    m_slots.resize(std::bit_ceil(std::max<size_t>(expected_size * 2, 16)));
+    m_mask = m_slots.size() - 1;
+  }
+
+  // id of an equal vertex in keys, or id after it was inserted
+  uint32_t FindOrInsert(const PackedVertex& key, uint64_t hash, uint32_t id,
+                        const std::vector<PackedVertex>& keys) {
+    if ((m_size + 1) * 2 > m_slots.size()) {
+      Grow();
+    }
+    Slot entry{.hash = hash, .id = id, .distance = 1};
+    size_t pos = hash & m_mask;
+    for (;; pos = (pos + 1) & m_mask, ++entry.distance) {
+      Slot& slot = m_slots[pos];
+      if (slot.distance == 0) {
+        slot = entry;
+        ++m_size;
+        return id;
+      }
+      if (slot.hash == hash && keys[slot.id] == key) {
+        return slot.id;
+      }
+      // a richer slot means the vertex is not in the map
+      if (slot.distance < entry.distance) {
+        std::swap(slot, entry);
+        break;
+      }
+    }
+    ++entry.distance;
+    Place(entry, (pos + 1) & m_mask);
+    ++m_size;
+    return id;
+  }
+
+ private:
+  struct Slot {
+    uint64_t hash;
+    uint32_t id;
+    // probe length plus one, 0 if empty
+    uint32_t distance;
+  };
+
+  // inserts an entry known to be unique
+  void Place(Slot entry, size_t pos) {
+    for (;; pos = (pos + 1) & m_mask, ++entry.distance) {
+      Slot& slot = m_slots[pos];
+      if (slot.distance == 0) {
+        slot = entry;
+        return;
+      }
+      if (slot.distance < entry.distance) {
+        std::swap(slot, entry);
+      }
+    }
+  }
+
+  void Grow() {
+    std::vector<Slot> old_slots(m_slots.size() * 2);
+    std::swap(old_slots, m_slots);
+    m_mask = m_slots.size() - 1;
+    for (const Slot& slot : old_slots) {
+      if (slot.distance != 0) {
+        Place(Slot{.hash = slot.hash, .id = slot.id, .distance = 1},
+              slot.hash & m_mask);
+      }
+    }
+  }
+
+  std::vector<Slot> m_slots;
+  size_t m_mask = 0;
+  size_t m_size = 0;
+};
+
+// unique vertices of a contiguous range of corners in first use order
+struct Chunk {
+  size_t begin;
+  size_t end;
+  std::vector<Vertex> vertices;
+  std::vector<PackedVertex> keys;
+  std::vector<uint64_t> hashes;
+  // chunk vertex id to mesh vertex id
+  std::vector<uint32_t> remap;
+  // of every shape, untouched shapes keep an empty box
+  std::vector<std::pair<glm::vec3, glm::vec3>> shape_bounds;
+};
+
+Vertex MakeVertex(const tinyobj::attrib_t& attrib,
+                  const tinyobj::index_t& index,
+                  const ObjImportOptions& options) {
+  Vertex vertex{
+      .position = {attrib.vertices[3 * index.vertex_index + 0],
+                   attrib.vertices[3 * index.vertex_index + 1],
+                   attrib.vertices[3 * index.vertex_index + 2]},
+      .roughness_f0 = options.roughness_f0,
+      .normal = {0.0f, 0.0f, 0.0f},
+      .metallic = options.metallic,
+      .tex_coord = {0.0f, 0.0f},
+  };
+  if (index.normal_index >= 0) {
+    vertex.normal = {attrib.normals[3 * index.normal_index + 0],
+                     attrib.normals[3 * index.normal_index + 1],
+                     attrib.normals[3 * index.normal_index + 2]};
+  }
+  if (index.texcoord_index >= 0) {
+    vertex.tex_coord = {attrib.texcoords[2 * index.texcoord_index + 0],
+                        1.0f - attrib.texcoords[2 * index.texcoord_index + 1]};
+  }
+  return vertex;
+}
+}  // namespace
+
+void BuildObjMesh(const tinyobj::attrib_t& attrib,
+                  const std::vector<tinyobj::shape_t>& shapes,
+                  const ObjImportOptions& options,
+                  std::vector<Vertex>& vertices,
+                  std::vector<uint32_t>& indices,
+                  std::vector<SubMesh>& sub_meshes) {
+  const glm::vec3 empty_min(std::numeric_limits<float>::max());
+  const glm::vec3 empty_max(std::numeric_limits<float>::lowest());
+  vertices.clear();
+  sub_meshes.clear();
+  // first corner of every shape, and the corner count at the end
+  std::vector<size_t> shape_offsets{0};
+  for (const auto& shape : shapes) {
+    sub_meshes.emplace_back(SubMesh{
+        .first_index = static_cast<uint32_t>(shape_offsets.back()),
+        .index_count = static_cast<uint32_t>(shape.mesh.indices.size()),
+        .bounds_min = empty_min,
+        .bounds_max = empty_max,
+        // obj groups named dynamic* skip the shadow cache
+        .dynamic_caster = shape.name.starts_with("dynamic"),
+    });
+    shape_offsets.emplace_back(shape_offsets.back() +
+                               shape.mesh.indices.size());
+  }
+  size_t corner_count = shape_offsets.back();
+  indices.assign(corner_count, 0);
+
+  size_t thread_count = options.thread_count != 0
+                            ? options.thread_count
+                            : JobSystem::GetWorkerCount() + 1;
+  uint32_t chunk_count = static_cast<uint32_t>(
+      std::clamp<size_t>(corner_count / kMinChunkCorners, 1,
+                         std::max<size_t>(thread_count, 1)));
+  std::vector<Chunk> chunks(chunk_count);
+  for (uint32_t i = 0; i < chunk_count; ++i) {
+    chunks[i].begin = corner_count * i / chunk_count;
+    chunks[i].end = corner_count * (i + 1) / chunk_count;
+  }
+
+  // local deduplication, indices hold chunk vertex ids for now
+  JobSystem::ParallelFor(chunk_count, [&](uint32_t chunk_index) {
+    Chunk& chunk = chunks[chunk_index];
+    chunk.shape_bounds.assign(shapes.size(), {empty_min, empty_max});
+    VertexIndexMap map((chunk.end - chunk.begin) / 4);
+    size_t shape_index =
+        std::upper_bound(shape_offsets.begin(), shape_offsets.end(),
+                         chunk.begin) -
+        shape_offsets.begin() - 1;
+    for (size_t corner = chunk.begin; corner < chunk.end; ++corner) {
+      while (corner >= shape_offsets[shape_index + 1]) {
+        ++shape_index;
+      }
+      const tinyobj::index_t& index =
+          shapes[shape_index]
+              .mesh.indices[corner - shape_offsets[shape_index]];
+      Vertex vertex = MakeVertex(attrib, index, options);
+      PackedVertex key = Pack(vertex);
+      uint64_t hash = Hash(key);
+      uint32_t next_id = static_cast<uint32_t>(chunk.vertices.size());
+      uint32_t id = map.FindOrInsert(key, hash, next_id, chunk.keys);
+      if (id == next_id) {
+        chunk.vertices.emplace_back(vertex);
+        chunk.keys.emplace_back(key);
+        chunk.hashes.emplace_back(hash);
+      }
+      indices[corner] = id;
+      auto& [bounds_min, bounds_max] = chunk.shape_bounds[shape_index];
+      bounds_min = glm::min(bounds_min, vertex.position);
+      bounds_max = glm::max(bounds_max, vertex.position);
+    }
+  });
+
+  if (chunk_count == 1) {
+    Chunk& chunk = chunks[0];
+    vertices = std::move(chunk.vertices);
+    for (size_t i = 0; i < shapes.size(); ++i) {
+      sub_meshes[i].bounds_min = chunk.shape_bounds[i].first;
+      sub_meshes[i].bounds_max = chunk.shape_bounds[i].second;
+    }
+    return;
+  }
+
+  // merged in chunk order, vertices end up in the order of their first use
+  // just like a single threaded pass
+  size_t local_vertex_count = 0;
+  for (const Chunk& chunk : chunks) {
+    local_vertex_count += chunk.vertices.size();
+  }
+  VertexIndexMap map(local_vertex_count);
+  std::vector<PackedVertex> keys;
+  vertices.reserve(local_vertex_count);
+  keys.reserve(local_vertex_count);
+  for (Chunk& chunk : chunks) {
+    chunk.remap.resize(chunk.vertices.size());
+    for (size_t i = 0; i < chunk.vertices.size(); ++i) {
+      uint32_t next_id = static_cast<uint32_t>(vertices.size());
+      uint32_t id =
+          map.FindOrInsert(chunk.keys[i], chunk.hashes[i], next_id, keys);
+      if (id == next_id) {
+        vertices.emplace_back(chunk.vertices[i]);
+        keys.emplace_back(chunk.keys[i]);
+      }
+      chunk.remap[i] = id;
+    }
+    for (size_t i = 0; i < shapes.size(); ++i) {
+      sub_meshes[i].bounds_min =
+          glm::min(sub_meshes[i].bounds_min, chunk.shape_bounds[i].first);
+      sub_meshes[i].bounds_max =
+          glm::max(sub_meshes[i].bounds_max, chunk.shape_bounds[i].second);
+    }
+    std::vector<Vertex>().swap(chunk.vertices);
+    std::vector<PackedVertex>().swap(chunk.keys);
+  }
+
+  JobSystem::ParallelFor(chunk_count, [&](uint32_t chunk_index) {
+    const Chunk& chunk = chunks[chunk_index];
+    for (size_t corner = chunk.begin; corner < chunk.end; ++corner) {
+      indices[corner] = chunk.remap[indices[corner]];
+    }
+  });
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "data.h"
+#include "third_part/tiny_obj_loader_headers.h"
+
+struct ObjImportOptions {
+  // written into every vertex, obj materials are not used
+  glm::vec4 roughness_f0;
+  float metallic;
+  // chunks run on the job system, 0 picks one per worker and the calling
+  // thread
+  uint32_t thread_count = 0;
+};
+
+// deduplicates the corners of all shapes into vertices and indices, one sub
+// mesh per shape, chunks of corners are deduplicated in parallel and merged in
+// order so the output does not depend on the thread count
+void BuildObjMesh(const tinyobj::attrib_t& attrib,
+                  const std::vector<tinyobj::shape_t>& shapes,
+                  const ObjImportOptions& options,
+                  std::vector<Vertex>& vertices,
+                  std::vector<uint32_t>& indices,
+                  std::vector<SubMesh>& sub_meshes);
@@ -0,0 +1,202 @@
+#include "query.h"
+
+#include <algorithm>
+
+#include "context.h"
+
+namespace {
+constexpr uint32_t kMaxTimestampQueries = 64;
+constexpr uint32_t kMaxStatisticsQueries = 16;
+// vertex shader invocations, fragment shader invocations
+constexpr uint32_t kStatisticsCount = 2;
+
+struct FrameQueries {
+  // timestamp query 2 * i is the begin of timestamp_names[i], 2 * i + 1 the end
+  std::vector<std::string> timestamp_names;
+  std::vector<std::string> statistics_names;
+};
+std::vector<FrameQueries> frame_queries;
+std::vector<QueryManager::TimestampResult> timestamp_results;
+std::vector<QueryManager::StatisticsResult> statistics_results;
+
+// returns names.size() if the query was skipped at begin
+uint32_t FindQuery(const std::vector<std::string>& names,
+                   const std::string& name) {
+  return static_cast<uint32_t>(std::ranges::find(names, name) -
+                               names.begin());
+}
+
+void ReadTimestamps(uint32_t frame_index) {
+  std::vector<std::string>& names =
+      frame_queries[frame_index].timestamp_names;
+  if (names.empty()) {
+    return;
+  }
+  uint32_t query_count = static_cast<uint32_t>(names.size()) * 2;
+  auto [result, timestamps] =
+      Context::Instance()
+          ->g_timestamp_query_pools[frame_index]
+          .getResults<uint64_t>(0, query_count,
+                                sizeof(uint64_t) * query_count,
+                                sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+  if (result != vk::Result::eSuccess) {
+    return;
+  }
+  timestamp_results.clear();
+  for (uint32_t i = 0; i < names.size(); ++i) {
+    timestamp_results.emplace_back(
+        names[i], (timestamps[i * 2 + 1] - timestamps[i * 2]) *
+                      Context::Instance()->g_timestamp_period / 1e6);
+  }
+}
+
+void ReadStatistics(uint32_t frame_index) {
+  std::vector<std::string>& names =
+      frame_queries[frame_index].statistics_names;
+  if (names.empty()) {
+    return;
+  }
+  uint32_t query_count = static_cast<uint32_t>(names.size());
+  auto [result, statistics] =
+      Context::Instance()
+          ->g_statistics_query_pools[frame_index]
+          .getResults<uint64_t>(
+              0, query_count,
+              sizeof(uint64_t) * kStatisticsCount * query_count,
+              sizeof(uint64_t) * kStatisticsCount,
+              vk::QueryResultFlagBits::e64);
+  if (result != vk::Result::eSuccess) {
+    return;
+  }
+  statistics_results.clear();
+  for (uint32_t i = 0; i < names.size(); ++i) {
+    statistics_results.emplace_back(names[i],
+                                    statistics[i * kStatisticsCount],
+                                    statistics[i * kStatisticsCount + 1]);
+  }
+}
+}  // namespace
+
+void QueryManager::CreateQueryPools() {
+  Context::Instance()->g_timestamp_query_pools.clear();
+  Context::Instance()->g_statistics_query_pools.clear();
+  frame_queries.assign(Context::Instance()->g_frame_in_flight, {});
+  Context::Instance()->g_timestamp_period =
+      Context::Instance()
+          ->g_physical_device.getProperties()
+          .limits.timestampPeriod;
+  Context::Instance()->g_enable_timestamps =
+      Context::Instance()
+          ->g_physical_device
+          .getQueueFamilyProperties()[Context::Instance()->g_queue_index]
+          .timestampValidBits > 0;
+  for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+    if (Context::Instance()->g_enable_timestamps) {
+      Context::Instance()->g_timestamp_query_pools.emplace_back(
+          Context::Instance()->g_device,
+          vk::QueryPoolCreateInfo{
+              .queryType = vk::QueryType::eTimestamp,
+              .queryCount = kMaxTimestampQueries,
+          });
+    }
+    if (Context::Instance()->g_enable_pipeline_statistics) {
+      Context::Instance()->g_statistics_query_pools.emplace_back(
+          Context::Instance()->g_device,
+          vk::QueryPoolCreateInfo{
+              .queryType = vk::QueryType::ePipelineStatistics,
+              .queryCount = kMaxStatisticsQueries,
+              .pipelineStatistics =
+                  vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+                  vk::QueryPipelineStatisticFlagBits::
+                      eFragmentShaderInvocations,
+          });
+    }
+  }
+}
+
+void QueryManager::BeginFrame(uint32_t frame_index) {
+  // the draw fence of this frame has been waited, results are available
+  if (Context::Instance()->g_enable_timestamps) {
+    ReadTimestamps(frame_index);
+    Context::Instance()->g_command_buffer[frame_index].resetQueryPool(
+        Context::Instance()->g_timestamp_query_pools[frame_index], 0,
+        kMaxTimestampQueries);
+  }
+  if (Context::Instance()->g_enable_pipeline_statistics) {
+    ReadStatistics(frame_index);
+    Context::Instance()->g_command_buffer[frame_index].resetQueryPool(
+        Context::Instance()->g_statistics_query_pools[frame_index], 0,
+        kMaxStatisticsQueries);
+  }
+  frame_queries[frame_index].timestamp_names.clear();
+  frame_queries[frame_index].statistics_names.clear();
+}
+
+void QueryManager::BeginTimestamp(uint32_t frame_index,
+                                  const std::string& name) {
+  std::vector<std::string>& names =
+      frame_queries[frame_index].timestamp_names;
+  if (!Context::Instance()->g_enable_timestamps ||
+      names.size() * 2 >= kMaxTimestampQueries) {
+    return;
+  }
+  Context::Instance()->g_command_buffer[frame_index].writeTimestamp2(
+      vk::PipelineStageFlagBits2::eAllCommands,
+      Context::Instance()->g_timestamp_query_pools[frame_index],
+      static_cast<uint32_t>(names.size()) * 2);
+  names.emplace_back(name);
+}
+
+void QueryManager::EndTimestamp(uint32_t frame_index,
+                                const std::string& name) {
+  if (!Context::Instance()->g_enable_timestamps) {
+    return;
+  }
+  uint32_t index =
+      FindQuery(frame_queries[frame_index].timestamp_names, name);
+  if (index == frame_queries[frame_index].timestamp_names.size()) {
+    return;
+  }
+  Context::Instance()->g_command_buffer[frame_index].writeTimestamp2(
+      vk::PipelineStageFlagBits2::eAllCommands,
+      Context::Instance()->g_timestamp_query_pools[frame_index],
+      index * 2 + 1);
+}
+
+void QueryManager::BeginStatistics(uint32_t frame_index,
+                                   const std::string& name) {
+  std::vector<std::string>& names =
+      frame_queries[frame_index].statistics_names;
+  if (!Context::Instance()->g_enable_pipeline_statistics ||
+      names.size() >= kMaxStatisticsQueries) {
+    return;
+  }
+  Context::Instance()->g_command_buffer[frame_index].beginQuery(
+      Context::Instance()->g_statistics_query_pools[frame_index],
+      static_cast<uint32_t>(names.size()), {});
+  names.emplace_back(name);
+}
+
+void QueryManager::EndStatistics(uint32_t frame_index,
+                                 const std::string& name) {
+  if (!Context::Instance()->g_enable_pipeline_statistics) {
+    return;
+  }
+  uint32_t index =
+      FindQuery(frame_queries[frame_index].statistics_names, name);
+  if (index == frame_queries[frame_index].statistics_names.size()) {
+    return;
+  }
+  Context::Instance()->g_command_buffer[frame_index].endQuery(
+      Context::Instance()->g_statistics_query_pools[frame_index], index);
+}
+
+const std::vector<QueryManager::TimestampResult>&
+QueryManager::GetTimestampResults() {
+  return timestamp_results;
+}
+
+const std::vector<QueryManager::StatisticsResult>&
+QueryManager::GetStatisticsResults() {
+  return statistics_results;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "third_part/vulkan_headers.h"
+
+namespace QueryManager {
+struct TimestampResult {
+  std::string name;
+  double time_ms;
+};
+struct StatisticsResult {
+  std::string name;
+  uint64_t vertex_invocations;
+  uint64_t fragment_invocations;
+};
+void CreateQueryPools();
+// read back the queries of the last submit of this frame and reset them, must
+// be recorded outside of rendering
+void BeginFrame(uint32_t frame_index);
+void BeginTimestamp(uint32_t frame_index, const std::string& name);
+void EndTimestamp(uint32_t frame_index, const std::string& name);
+void BeginStatistics(uint32_t frame_index, const std::string& name);
+void EndStatistics(uint32_t frame_index, const std::string& name);
+const std::vector<TimestampResult>& GetTimestampResults();
+const std::vector<StatisticsResult>& GetStatisticsResults();
+}  // namespace QueryManager
@@ -1,15 +1,26 @@
 #include "render.h"
 
+#include <cmath>
 #include <vector>
 
 #include "context.h"
+#include "culling.h"
 #include "descriptor_set.h"
 #include "memory.h"
 #include "model.h"
+#include "query.h"
 #include "render_pass/bloom_pass.h"
 #include "render_pass/defer_lighting_pass.h"
+#include "render_pass/hiz_pass.h"
+#include "render_pass/meshlet_cull_pass.h"
+#include "render_pass/oit_pass.h"
 #include "render_pass/particle_pass.h"
+#include "render_pass/post_pass.h"
+#include "render_pass/shadow_atlas_pass.h"
 #include "render_pass/shadowmap_pass.h"
+#include "render_pass/ssao_pass.h"
+#include "render_pass/temporal_pass.h"
+#include "render_pass/visibility_buffer_pass.h"
 #include "swapchain.h"
 #include "third_part/vulkan_headers.h"
 #include "utils.h"
@@ -30,7 +41,15 @@ void CreatePipelines() {
   DeferLightingPass::CreatePipeline(shader_module);
   BloomPass::CreatePipeline(shader_module);
   ShadowmapPass::CreatePipeline(shader_module);
+  ShadowAtlasPass::CreatePipeline(shader_module);
+  SsaoPass::CreatePipeline(shader_module);
+  TemporalPass::CreatePipeline(shader_module);
   ParticlePass::CreatePipeline(shader_module);
+  OitPass::CreatePipeline(shader_module);
+  VisibilityBufferPass::CreatePipeline(shader_module);
+  MeshletCullPass::CreatePipeline(shader_module);
+  HiZPass::CreatePipeline(shader_module);
+  PostPass::CreatePipeline(shader_module);
 }
 
 void RecordCommandBuffer(
@@ -43,71 +62,80 @@ void RecordCommandBuffer(
     vk::Rect2D scissor = vk::Rect2D({0, 0},
                                     Context::Instance()->g_swapchain_extent)) {
   Context::Instance()->g_command_buffer[frame_index].begin({});
+  QueryManager::BeginFrame(frame_index);
+  ParticlePass::Acquire(frame_index);
   TransformImageLayout(Context::Instance()->g_swapchain_images[image_index],
                        frame_index, vk::ImageLayout::eUndefined,
-                       vk::ImageLayout::eTransferDstOptimal, {},
-                       vk::AccessFlagBits2::eTransferWrite,
+                       vk::ImageLayout::eColorAttachmentOptimal, {},
+                       vk::AccessFlagBits2::eColorAttachmentWrite,
                        vk::PipelineStageFlagBits2::eTopOfPipe,
-                       vk::PipelineStageFlagBits2::eTransfer);
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput);
 
+  QueryManager::BeginTimestamp(frame_index, "Meshlet Cull");
+  MeshletCullPass::Cull(frame_index);
+  QueryManager::EndTimestamp(frame_index, "Meshlet Cull");
+  // the survivors of the early phase become the occluders of a pyramid, what
+  // they hid is tested again against it
+  if (MeshletCullPass::CullsOcclusion()) {
+    QueryManager::BeginTimestamp(frame_index, "Occluders");
+    HiZPass::DrawOccluders(frame_index, viewport, scissor);
+    QueryManager::EndTimestamp(frame_index, "Occluders");
+  }
+  QueryManager::BeginTimestamp(frame_index, "Occlusion Cull");
+  MeshletCullPass::CullOccluded(frame_index);
+  QueryManager::EndTimestamp(frame_index, "Occlusion Cull");
+  QueryManager::BeginTimestamp(frame_index, "Shadowmap");
   ShadowmapPass::Draw(image_index, frame_index, viewport, scissor);
-  DeferLightingPass::Draw(image_index, frame_index, viewport, scissor);
+  QueryManager::EndTimestamp(frame_index, "Shadowmap");
+  QueryManager::BeginTimestamp(frame_index, "Shadow Atlas");
+  ShadowAtlasPass::Draw(image_index, frame_index, viewport, scissor);
+  QueryManager::EndTimestamp(frame_index, "Shadow Atlas");
+  QueryManager::BeginTimestamp(frame_index, "Geometry + Lighting");
+  if (Context::Instance()->g_enable_visibility_buffer) {
+    VisibilityBufferPass::Draw(image_index, frame_index, viewport, scissor);
+  } else {
+    DeferLightingPass::Draw(image_index, frame_index, viewport, scissor);
+  }
+  QueryManager::EndTimestamp(frame_index, "Geometry + Lighting");
+  // the final depth is the pyramid the early phase of the next frame tests
+  // against
+  if (Context::Instance()->g_enable_occlusion_culling) {
+    QueryManager::BeginTimestamp(frame_index, "Hi-Z");
+    HiZPass::Draw(image_index, frame_index, viewport, scissor);
+    QueryManager::EndTimestamp(frame_index, "Hi-Z");
+  } else {
+    HiZPass::Invalidate();
+  }
+  // particles are the only transparent draws, the oit scope is skipped when
+  // compute splats them
+  if (Context::Instance()->g_enable_compute_particles) {
+    QueryManager::BeginTimestamp(frame_index, "Particle Tiles");
+    ParticlePass::Rasterize(frame_index);
+    QueryManager::EndTimestamp(frame_index, "Particle Tiles");
+  } else {
+    QueryManager::BeginTimestamp(frame_index, "Transparency");
+    OitPass::Draw(image_index, frame_index, viewport, scissor);
+    QueryManager::EndTimestamp(frame_index, "Transparency");
+  }
 
   if (Context::Instance()->g_enable_bloom) {
+    QueryManager::BeginTimestamp(frame_index, "Bloom");
     BloomPass::Draw(image_index, frame_index, viewport, scissor);
+    QueryManager::EndTimestamp(frame_index, "Bloom");
   }
 
-  vk::ImageMemoryBarrier bloom_barrier{
-      .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
-      .dstAccessMask = vk::AccessFlagBits::eTransferRead,
-      .oldLayout = vk::ImageLayout::eGeneral,
-      .newLayout = vk::ImageLayout::eTransferSrcOptimal,
-      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .image = Context::Instance()->g_bloom_image,
-      .subresourceRange = {.aspectMask = vk::ImageAspectFlagBits::eColor,
-                           .baseMipLevel = 0,
-                           .levelCount = 1,
-                           .baseArrayLayer = 0,
-                           .layerCount = 1},
-  };
-  Context::Instance()->g_command_buffer[frame_index].pipelineBarrier(
-      vk::PipelineStageFlagBits::eFragmentShader,
-      vk::PipelineStageFlagBits::eTransfer, {}, {}, nullptr, bloom_barrier);
-  vk::ImageBlit image_blit{
-      .srcSubresource = {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
-      .srcOffsets =
-          std::array{
-              vk::Offset3D{0, 0, 0},
-              vk::Offset3D{static_cast<int32_t>(
-                               Context::Instance()->g_swapchain_extent.width),
-                           static_cast<int32_t>(
-                               Context::Instance()->g_swapchain_extent.height),
-                           1},
-          },
-      .dstSubresource = {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
-      .dstOffsets =
-          std::array{
-              vk::Offset3D{0, 0, 0},
-              vk::Offset3D{static_cast<int32_t>(
-                               Context::Instance()->g_swapchain_extent.width),
-                           static_cast<int32_t>(
-                               Context::Instance()->g_swapchain_extent.height),
-                           1},
-          },
-  };
-  Context::Instance()->g_command_buffer[frame_index].blitImage(
-      Context::Instance()->g_bloom_image, vk::ImageLayout::eTransferSrcOptimal,
-      Context::Instance()->g_swapchain_images[image_index],
-      vk::ImageLayout::eTransferDstOptimal, image_blit, vk::Filter::eLinear);
+  QueryManager::BeginTimestamp(frame_index, "Post");
+  PostPass::Draw(image_index, frame_index, viewport, scissor);
+  QueryManager::EndTimestamp(frame_index, "Post");
 
-  // imgui
+  // imgui draws over the post pass output
   TransformImageLayout(Context::Instance()->g_swapchain_images[image_index],
-                       frame_index, vk::ImageLayout::eTransferDstOptimal,
+                       frame_index, vk::ImageLayout::eColorAttachmentOptimal,
                        vk::ImageLayout::eColorAttachmentOptimal,
-                       vk::AccessFlagBits2::eTransferWrite,
                        vk::AccessFlagBits2::eColorAttachmentWrite,
-                       vk::PipelineStageFlagBits2::eTransfer,
+                       vk::AccessFlagBits2::eColorAttachmentRead |
+                           vk::AccessFlagBits2::eColorAttachmentWrite,
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput,
                        vk::PipelineStageFlagBits2::eColorAttachmentOutput);
   std::vector<vk::RenderingAttachmentInfo> imgui_attachment_infos{{
       .imageView = Context::Instance()->g_swapchain_image_views[image_index],
@@ -138,6 +166,7 @@ void RecordCommandBuffer(
                        vk::AccessFlagBits2::eColorAttachmentWrite, {},
                        vk::PipelineStageFlagBits2::eColorAttachmentOutput,
                        vk::PipelineStageFlagBits2::eBottomOfPipe);
+  ParticlePass::Release(frame_index);
   Context::Instance()->g_command_buffer[frame_index].end();
 }
 
@@ -159,14 +188,29 @@ void CreateSyncObjects() {
   };
   Context::Instance()->g_particle_compute_semaphore = vk::raii::Semaphore(
       Context::Instance()->g_device, {.pNext = &timeline_type_info});
+  Context::Instance()->g_graphics_semaphore = vk::raii::Semaphore(
+      Context::Instance()->g_device, {.pNext = &timeline_type_info});
 }
 
 bool CpuPrepareData(uint32_t frame_index) {
   UniformBufferObject ubo;
   glm::vec3 camera_pos{1.0f, 1.0f, 1.0f};
-  ubo.modu = glm::rotate<float>(
-      glm::mat4(1.0f), Context::Instance()->g_time * glm::radians(10.0f),
-      glm::vec3(0.0f, 0.0f, 1.0f));
+  constexpr float kCameraNear = 0.1f;
+  constexpr float kCameraFar = 3.0f;
+  static double last_time = Context::Instance()->g_time;
+  static double model_angle = 0.0;
+  if (Context::Instance()->g_enable_model_rotation) {
+    model_angle +=
+        (Context::Instance()->g_time - last_time) * glm::radians(10.0f);
+  }
+  last_time = Context::Instance()->g_time;
+  ubo.modu = glm::rotate<float>(glm::mat4(1.0f), model_angle,
+                                glm::vec3(0.0f, 0.0f, 1.0f));
+  static glm::mat4 last_modu(0.0f);
+  if (ubo.modu != last_modu) {
+    last_modu = ubo.modu;
+    ++Context::Instance()->g_model_transform_version;
+  }
   // https://learnopengl.com/Getting-started/Coordinate-Systems
   // https://learnopengl.com/Getting-started/Camera
   ubo.view = glm::lookAt(camera_pos, glm::vec3(0.0f, 0.0f, 0.0f),
@@ -175,7 +219,7 @@ bool CpuPrepareData(uint32_t frame_index) {
       glm::radians(90.0f),
       static_cast<float>(Context::Instance()->g_swapchain_extent.width) /
           static_cast<float>(Context::Instance()->g_swapchain_extent.height),
-      0.1f, 3.0f);
+      kCameraNear, kCameraFar);
   ubo.light.pos = glm::vec3(1.0f, 0.0f, 2.0f);
   ubo.light.intensities = glm::vec3(Context::Instance()->g_light_intensity);
   ubo.camera_pos = camera_pos;
@@ -193,13 +237,92 @@ bool CpuPrepareData(uint32_t frame_index) {
                     (float)Context::Instance()->g_swapchain_extent.width,
                 Context::Instance()->g_shadowmap_height /
                     (float)Context::Instance()->g_swapchain_extent.height);
+  // reprojection of the temporal accumulation
+  glm::mat4 model_view_proj = ubo.proj * ubo.view * ubo.modu;
+  if (!Context::Instance()->g_prev_model_view_proj_valid) {
+    Context::Instance()->g_prev_model_view_proj = model_view_proj;
+    Context::Instance()->g_prev_model_view_proj_valid = true;
+  }
+  ubo.inv_model_view_proj = glm::inverse(model_view_proj);
+  ubo.prev_model_view_proj = Context::Instance()->g_prev_model_view_proj;
+  Context::Instance()->g_prev_model_view_proj = model_view_proj;
+  ubo.frame_count = Context::Instance()->g_frame_count++;
+  ubo.index_16bit =
+      Context::Instance()->g_index_type == vk::IndexType::eUint16;
+  // pixels per unit at distance 1 along the view axis
+  float lod_error_scale =
+      std::abs(ubo.proj[1][1]) * 0.5f *
+      static_cast<float>(Context::Instance()->g_swapchain_extent.height);
+  MeshletCullPass::ResetViews();
+  // the camera passes cull back faces, so its view tests the normal cones
+  glm::vec4 camera_eye(
+      glm::vec3(glm::inverse(ubo.modu) * glm::vec4(camera_pos, 1.0f)), 1.0f);
+  Context::Instance()->g_meshlet_camera_view =
+      MeshletCullPass::AddView(model_view_proj, kMeshletCullAll, camera_eye);
+  Context::Instance()->g_meshlet_late_camera_view =
+      MeshletCullPass::AddView(model_view_proj, kMeshletCullAll, camera_eye);
+  ShadowmapPass::UpdateCascades(ubo, kCameraNear, kCameraFar);
+  ShadowAtlasPass::UpdateLights(ubo, frame_index);
+  MeshletCullPass::CullInstances();
+  ShadowmapPass::UpdateCasters();
+  // instances outside of every view keep no level, the meshlet culling
+  // rejects them first
+  static std::vector<bool> instance_visible;
+  instance_visible.assign(Context::Instance()->g_instances.size(), false);
+  for (uint32_t view = 0;
+       view < MeshletCullPass::GetInstanceCullStats().size(); ++view) {
+    for (uint32_t instance : MeshletCullPass::GetVisibleInstances(view)) {
+      instance_visible[instance] = true;
+    }
+  }
+  bool lods_changed = false;
+  for (uint32_t j = 0; j < Context::Instance()->g_instances.size(); ++j) {
+    const Instance& instance = Context::Instance()->g_instances[j];
+    const Mesh& mesh = Context::Instance()->g_meshes[instance.mesh];
+    glm::mat4 model = ubo.modu * instance.model;
+    for (uint32_t i = 0; i < mesh.sub_mesh_count; ++i) {
+      const SubMesh& sub_mesh =
+          Context::Instance()->g_sub_meshes[mesh.first_sub_mesh + i];
+      uint32_t& lod =
+          Context::Instance()->g_instance_lods[instance.first_lod + i];
+      uint32_t last_lod = lod;
+      if (!instance_visible[j]) {
+        lod = kLodHidden;
+      } else if (Context::Instance()->g_enable_lod) {
+        lod = SelectLod(sub_mesh, model, camera_pos, lod_error_scale,
+                        Context::Instance()->g_lod_error_threshold,
+                        Context::Instance()->g_lod_hysteresis, lod);
+      } else {
+        lod = 0;
+      }
+      lods_changed |= lod != last_lod;
+    }
+  }
+  if (lods_changed) {
+    ++Context::Instance()->g_lod_version;
+  }
   memcpy(Context::Instance()->g_ubo_buffer_maped[frame_index], &ubo,
          sizeof(ubo));
-  UpdateMesh();
   return true;
 }
 
-void UpdateParticle(uint32_t frame_index) {
+// records and submits the next particle simulation to the compute queue, it
+// overlaps the graphics work of the frame submitted before it
+void UpdateParticle() {
+  uint32_t frame_in_flight = Context::Instance()->g_frame_in_flight;
+  uint64_t compute_count = Context::Instance()->g_particle_compute_count;
+  uint32_t compute_index = compute_count % frame_in_flight;
+  // the simulation that used this command buffer and uniform buffer
+  if (compute_count >= frame_in_flight) {
+    uint64_t wait_value = compute_count - frame_in_flight + 1;
+    vk::SemaphoreWaitInfo wait_info{
+        .semaphoreCount = 1,
+        .pSemaphores = &*Context::Instance()->g_particle_compute_semaphore,
+        .pValues = &wait_value,
+    };
+    while (vk::Result::eTimeout ==
+           Context::Instance()->g_device.waitSemaphores(wait_info, UINT64_MAX));
+  }
   ParticleUbo ubo;
   static double last_particle_update_time = 0.0f;
   if (last_particle_update_time == 0.0f) {
@@ -207,18 +330,20 @@ void UpdateParticle(uint32_t frame_index) {
   }
   ubo.delta_time = Context::Instance()->g_time - last_particle_update_time;
   last_particle_update_time = Context::Instance()->g_time;
-  memcpy(Context::Instance()->g_particle_ubo_buffer_maped[frame_index], &ubo,
+  ParticlePass::UpdateEmitters(ubo);
+  memcpy(Context::Instance()->g_particle_ubo_buffer_maped[compute_index], &ubo,
          sizeof(ParticleUbo));
 
-  uint32_t compute_cb_index =
-      frame_index + Context::Instance()->g_frame_in_flight * 2;
+  uint32_t compute_cb_index = compute_index + frame_in_flight * 2;
+  // read before Compute flips the lists
+  uint64_t wait_semaphore_value = ParticlePass::GetGraphicsReleaseValue();
   Context::Instance()->g_command_buffer[compute_cb_index].reset();
   Context::Instance()->g_command_buffer[compute_cb_index].begin({});
-  ParticlePass::Compute(compute_cb_index, frame_index);
+  ParticlePass::Compute(compute_cb_index, compute_index);
   Context::Instance()->g_command_buffer[compute_cb_index].end();
   vk::PipelineStageFlags compute_wait_dst_stage_mask =
-      vk::PipelineStageFlags{vk::PipelineStageFlagBits::eComputeShader};
-  uint64_t wait_semaphore_value = Context::Instance()->g_particle_compute_count;
+      vk::PipelineStageFlagBits::eComputeShader |
+      vk::PipelineStageFlagBits::eTransfer;
   uint64_t signal_semaphore_value =
       ++Context::Instance()->g_particle_compute_count;
   vk::TimelineSemaphoreSubmitInfo compute_semaphore_submit_info{
@@ -230,7 +355,7 @@ void UpdateParticle(uint32_t frame_index) {
   vk::SubmitInfo compute_submit_info{
       .pNext = &compute_semaphore_submit_info,
       .waitSemaphoreCount = 1,
-      .pWaitSemaphores = &*Context::Instance()->g_particle_compute_semaphore,
+      .pWaitSemaphores = &*Context::Instance()->g_graphics_semaphore,
       .pWaitDstStageMask = &compute_wait_dst_stage_mask,
       .commandBufferCount = 1,
       .pCommandBuffers =
@@ -238,12 +363,36 @@ void UpdateParticle(uint32_t frame_index) {
       .signalSemaphoreCount = 1,
       .pSignalSemaphores = &*Context::Instance()->g_particle_compute_semaphore,
   };
-  Context::Instance()->g_queue.submit(compute_submit_info, nullptr);
+  Context::Instance()->g_compute_queue.submit(compute_submit_info, nullptr);
 }
 
-bool GpuPrepareData(uint32_t frame_index) {
-  UpdateParticle(frame_index);
-  return true;
+// the last camera matrix belongs to another extent
+void InvalidatePrevModelViewProj() {
+  Context::Instance()->g_prev_model_view_proj_valid = false;
+}
+
+// resources of single passes that changed from the gui, the swapchain stays
+void RecreatePassResources() {
+  Context::Instance()->g_device.waitIdle();
+  // no frame reads the vertex buffer any more
+  if (Context::Instance()->g_pbr_dirty) {
+    UpdateMesh();
+    Context::Instance()->g_pbr_dirty = false;
+  }
+  if (Context::Instance()->g_bloom_resources_dirty) {
+    BloomPass::RecreateResources();
+    Context::Instance()->g_bloom_resources_dirty = false;
+  }
+  if (Context::Instance()->g_particle_pool_dirty) {
+    ParticlePass::RecreatePool();
+    Context::Instance()->g_particle_pool_dirty = false;
+  }
+  if (Context::Instance()->g_shadow_resources_dirty) {
+    ShadowmapPass::RecreateResources();
+    Context::Instance()->g_shadow_resources_dirty = false;
+  }
+  RenderManager::UpdateDescriptorSetInfo();
+  DescriptorSetManager::UpdateDescriptorSets();
 }
 
 void CreateUboBuffer() {
@@ -271,9 +420,16 @@ void CreateUboBuffer() {
 void RenderManager::Init() {
   CreateUboBuffer();
   ShadowmapPass::UpdateResources();
+  ShadowAtlasPass::UpdateResources();
+  SsaoPass::UpdateResources();
+  TemporalPass::UpdateResources();
   DeferLightingPass::UpdateResources();
   BloomPass::UpdateResources();
   ParticlePass::UpdateResources();
+  OitPass::UpdateResources();
+  VisibilityBufferPass::UpdateResources();
+  MeshletCullPass::UpdateResources();
+  HiZPass::UpdateResources();
 
   UpdateDescriptorSetInfo();
 
@@ -282,7 +438,9 @@ void RenderManager::Init() {
   DescriptorSetManager::CreateDescriptorPool();
   DescriptorSetManager::CreateDescriptorSets();
   CreateCommandBuffer();
+  QueryManager::CreateQueryPools();
   CreateSyncObjects();
+  SwapChainManager::RegisterRecreateFunction(InvalidatePrevModelViewProj);
   SwapChainManager::RegisterRecreateFunction(
       RenderManager::UpdateDescriptorSetInfo);
   SwapChainManager::RegisterRecreateFunction(
@@ -300,7 +458,8 @@ void RenderManager::UpdateDescriptorSetInfo() {
     }
     DescriptorSetManager::RegisterDescriptorSetInfo(
         0, vk::DescriptorType::eUniformBuffer,
-        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment |
+            vk::ShaderStageFlagBits::eCompute,
         {}, buffer_info);
   }
   {
@@ -315,16 +474,29 @@ void RenderManager::UpdateDescriptorSetInfo() {
         vk::ShaderStageFlagBits::eFragment, image_info, {});
   }
   ShadowmapPass::UpdateDescriptorSetInfo();
+  ShadowAtlasPass::UpdateDescriptorSetInfo();
+  SsaoPass::UpdateDescriptorSetInfo();
+  TemporalPass::UpdateDescriptorSetInfo();
   DeferLightingPass::UpdateDescriptorSetInfo();
   BloomPass::UpdateDescriptorSetInfo();
   ParticlePass::UpdateDescriptorSetInfo();
+  OitPass::UpdateDescriptorSetInfo();
+  VisibilityBufferPass::UpdateDescriptorSetInfo();
+  MeshletCullPass::UpdateDescriptorSetInfo();
+  HiZPass::UpdateDescriptorSetInfo();
 }
 
 bool RenderManager::PrepareData(uint32_t frame_index) {
-  return CpuPrepareData(frame_index) && GpuPrepareData(frame_index);
+  return CpuPrepareData(frame_index);
 }
 
 bool RenderManager::DrawFrame(uint32_t frame_index) {
+  if (Context::Instance()->g_bloom_resources_dirty ||
+      Context::Instance()->g_particle_pool_dirty ||
+      Context::Instance()->g_pbr_dirty ||
+      Context::Instance()->g_shadow_resources_dirty) {
+    RecreatePassResources();
+  }
   if (Context::Instance()->g_window_resized) {
     SwapChainManager::RecreateSwapchain();
   }
@@ -346,35 +518,45 @@ bool RenderManager::DrawFrame(uint32_t frame_index) {
     }
   }
   RecordCommandBuffer(image_index, frame_index);
-  vk::PipelineStageFlags wait_dst_stage_mask =
-      vk::PipelineStageFlagBits::eColorAttachmentOutput |
-      vk::PipelineStageFlagBits::eVertexInput;
+  // the particle simulation submitted after the last frame, the binary
+  // semaphore values are ignored
+  std::vector<vk::PipelineStageFlags> wait_dst_stage_masks{
+      vk::PipelineStageFlagBits::eDrawIndirect,
+      vk::PipelineStageFlagBits::eColorAttachmentOutput};
   std::vector<uint64_t> wait_values{
-      Context::Instance()->g_particle_compute_count, 1};
+      Context::Instance()->g_particle_compute_count, 0};
+  std::vector<uint64_t> signal_values{
+      0, ++Context::Instance()->g_graphics_count};
   vk::TimelineSemaphoreSubmitInfo graphics_semaphore_submit_info{
-      .waitSemaphoreValueCount = 2,
+      .waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size()),
       .pWaitSemaphoreValues = wait_values.data(),
-      .signalSemaphoreValueCount = 0,
+      .signalSemaphoreValueCount = static_cast<uint32_t>(signal_values.size()),
+      .pSignalSemaphoreValues = signal_values.data(),
   };
   std::vector<vk::Semaphore> graphics_wait_semaphores{
       *Context::Instance()->g_particle_compute_semaphore,
       *Context::Instance()->g_present_complete_semaphore[frame_index]};
+  std::vector<vk::Semaphore> graphics_signal_semaphores{
+      *Context::Instance()->g_render_finished_semaphore[frame_index],
+      *Context::Instance()->g_graphics_semaphore};
   vk::SubmitInfo submit_info{
       .pNext = &graphics_semaphore_submit_info,
       .waitSemaphoreCount =
           static_cast<uint32_t>(graphics_wait_semaphores.size()),
       .pWaitSemaphores = graphics_wait_semaphores.data(),
-      .pWaitDstStageMask = &wait_dst_stage_mask,
+      .pWaitDstStageMask = wait_dst_stage_masks.data(),
       .commandBufferCount = 1,
       .pCommandBuffers = &*Context::Instance()->g_command_buffer[frame_index],
-      .signalSemaphoreCount = 1,
-      .pSignalSemaphores =
-          &*Context::Instance()->g_render_finished_semaphore[frame_index],
+      .signalSemaphoreCount =
+          static_cast<uint32_t>(graphics_signal_semaphores.size()),
+      .pSignalSemaphores = graphics_signal_semaphores.data(),
   };
   Context::Instance()->g_device.resetFences(
       *Context::Instance()->g_draw_fence[frame_index]);
   Context::Instance()->g_queue.submit(
       submit_info, *Context::Instance()->g_draw_fence[frame_index]);
+  // runs on the compute queue while this frame renders
+  UpdateParticle();
   while (vk::Result::eTimeout ==
          Context::Instance()->g_device.waitForFences(
              *Context::Instance()->g_draw_fence[frame_index], vk::True,
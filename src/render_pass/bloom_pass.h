@@ -9,5 +9,8 @@ void UpdateResources();
 void CreatePipeline(const vk::raii::ShaderModule& shader_module);
 void Draw(uint32_t image_index, uint32_t frame_index, vk::Viewport viewport,
           vk::Rect2D scissor);
+// after g_bloom_downscale or g_bloom_mip_levels changed, the device must be
+// idle and the descriptor sets updated afterwards
+void RecreateResources();
 void UpdateDescriptorSetInfo();
 }  // namespace BloomPass
@@ -3,6 +3,10 @@
 #include "context.h"
 #include "descriptor_set.h"
 #include "memory.h"
+#include "query.h"
+#include "render_pass/meshlet_cull_pass.h"
+#include "render_pass/ssao_pass.h"
+#include "render_pass/temporal_pass.h"
 #include "swapchain.h"
 #include "utils.h"
 
@@ -128,6 +132,54 @@ void CreateGbufferResources() {
   Context::Instance()->g_gbuffer_roughness_f0_image_view =
       CreateImageView(*Context::Instance()->g_gbuffer_roughness_f0_image, 0, 1,
                       format, vk::ImageAspectFlagBits::eColor);
+  // sampled by the bloom downsample and the post pass, the compute particle
+  // rasterizer blends into it as a storage image
+  CreateImage(Context::Instance()->g_swapchain_extent.width,
+              Context::Instance()->g_swapchain_extent.height, 1,
+              vk::SampleCountFlagBits::e1, Context::Instance()->g_hdr_format,
+              vk::ImageTiling::eOptimal,
+              vk::ImageUsageFlagBits::eColorAttachment |
+                  vk::ImageUsageFlagBits::eSampled |
+                  vk::ImageUsageFlagBits::eStorage,
+              vk::MemoryPropertyFlagBits::eDeviceLocal,
+              Context::Instance()->g_hdr_image,
+              Context::Instance()->g_hdr_image_memory);
+  Context::Instance()->g_hdr_image_view = CreateImageView(
+      *Context::Instance()->g_hdr_image, 0, 1,
+      Context::Instance()->g_hdr_format, vk::ImageAspectFlagBits::eColor);
+}
+
+void BindGeometry(uint32_t frame_index, vk::Viewport viewport,
+                  vk::Rect2D scissor) {
+  Context::Instance()->g_command_buffer[frame_index].bindVertexBuffers(
+      0,
+      {*Context::Instance()->g_vertex_buffer,
+       *Context::Instance()->g_vertex_buffer},
+      {0, Context::Instance()->g_attribute_offset});
+  Context::Instance()->g_command_buffer[frame_index].bindIndexBuffer(
+      *Context::Instance()->g_index_buffer, 0,
+      Context::Instance()->g_index_type);
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics, Context::Instance()->g_pipeline_layout,
+      0, *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  Context::Instance()->g_command_buffer[frame_index].setViewport(0, viewport);
+  Context::Instance()->g_command_buffer[frame_index].setScissor(0, scissor);
+}
+
+void DrawDepthPrepass(uint32_t frame_index) {
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_texture_masked
+          ? Context::Instance()->g_depth_prepass_masked_pipeline
+          : Context::Instance()->g_depth_prepass_pipeline);
+  QueryManager::BeginStatistics(frame_index, "Depth Prepass");
+  // the occluders already drew the depth of the early camera list
+  if (MeshletCullPass::CullsOcclusion()) {
+    MeshletCullPass::DrawLateCameraView(frame_index);
+  } else {
+    MeshletCullPass::DrawCameraView(frame_index);
+  }
+  QueryManager::EndStatistics(frame_index, "Depth Prepass");
 }
 }  // namespace
 
@@ -160,11 +212,11 @@ void DeferLightingPass::CreatePipeline(
       .dynamicStateCount = static_cast<uint32_t>(dynamic_states.size()),
       .pDynamicStates = dynamic_states.data(),
   };
-  auto binding_desc = Vertex::GetBindingDescription();
-  auto attribute_desc = Vertex::GetAttributeDescription();
+  auto binding_desc = QuantizedVertexStreams::GetBindingDescription();
+  auto attribute_desc = QuantizedVertexStreams::GetAttributeDescription();
   vk::PipelineVertexInputStateCreateInfo vertex_input_info{
-      .vertexBindingDescriptionCount = 1,
-      .pVertexBindingDescriptions = &binding_desc,
+      .vertexBindingDescriptionCount = binding_desc.size(),
+      .pVertexBindingDescriptions = binding_desc.data(),
       .vertexAttributeDescriptionCount = attribute_desc.size(),
       .pVertexAttributeDescriptions = attribute_desc.data(),
   };
@@ -227,7 +279,7 @@ void DeferLightingPass::CreatePipeline(
       Context::Instance()->g_gbuffer_format,
       Context::Instance()->g_gbuffer_format,
       Context::Instance()->g_gbuffer_format,
-      Context::Instance()->g_gbuffer_format,
+      Context::Instance()->g_hdr_format,
   };
   vk::PipelineRenderingCreateInfo pipeline_rending_info{
       .colorAttachmentCount = static_cast<uint32_t>(graphsic_formats.size()),
@@ -257,6 +309,85 @@ void DeferLightingPass::CreatePipeline(
   Context::Instance()->g_graphics_pipeline =
       vk::raii::Pipeline(Context::Instance()->g_device, nullptr, pipeline_info);
 
+  // depth prepass, same layout and attachments but no color write
+  vk::PipelineShaderStageCreateInfo depth_prepass_shader_stage_create_info[2] =
+      {
+          {
+              .stage = vk::ShaderStageFlagBits::eVertex,
+              .module = shader_module,
+              .pName = "vertDepthPrepass",
+              .pSpecializationInfo = nullptr,
+          },
+          {
+              .stage = vk::ShaderStageFlagBits::eFragment,
+              .module = shader_module,
+              .pName = "fragDepthPrepassMasked",
+              .pSpecializationInfo = nullptr,
+          },
+      };
+  std::vector<vk::PipelineColorBlendAttachmentState>
+      depth_prepass_blend_attachments(5, {.blendEnable = vk::False,
+                                          .colorWriteMask = {}});
+  vk::PipelineColorBlendStateCreateInfo depth_prepass_color_blend_info{
+      .logicOpEnable = vk::False,
+      .logicOp = vk::LogicOp::eCopy,
+      .attachmentCount =
+          static_cast<uint32_t>(depth_prepass_blend_attachments.size()),
+      .pAttachments = depth_prepass_blend_attachments.data(),
+      .blendConstants = {},
+  };
+  vk::GraphicsPipelineCreateInfo depth_prepass_pipeline_info = pipeline_info;
+  depth_prepass_pipeline_info.pStages = depth_prepass_shader_stage_create_info;
+  depth_prepass_pipeline_info.pColorBlendState =
+      &depth_prepass_color_blend_info;
+  Context::Instance()->g_depth_prepass_masked_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, depth_prepass_pipeline_info);
+  // opaque geometry needs no fragment shader at all and only fetches the
+  // position stream
+  vk::PipelineShaderStageCreateInfo
+      depth_prepass_opaque_shader_stage_create_info{
+          .stage = vk::ShaderStageFlagBits::eVertex,
+          .module = shader_module,
+          .pName = "vertDepthPrepassOpaque",
+          .pSpecializationInfo = nullptr,
+      };
+  auto position_binding_desc = QuantizedPositionLayout::GetBindingDescription();
+  auto position_attribute_desc =
+      QuantizedPositionLayout::GetAttributeDescription();
+  vk::PipelineVertexInputStateCreateInfo position_vertex_input_info{
+      .vertexBindingDescriptionCount = 1,
+      .pVertexBindingDescriptions = &position_binding_desc,
+      .vertexAttributeDescriptionCount = position_attribute_desc.size(),
+      .pVertexAttributeDescriptions = position_attribute_desc.data(),
+  };
+  depth_prepass_pipeline_info.stageCount = 1;
+  depth_prepass_pipeline_info.pStages =
+      &depth_prepass_opaque_shader_stage_create_info;
+  depth_prepass_pipeline_info.pVertexInputState = &position_vertex_input_info;
+  Context::Instance()->g_depth_prepass_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, depth_prepass_pipeline_info);
+  // gbuffer after prepass, only the visible fragment of each pixel is shaded
+  // and the fragment shader has no discard, so early-Z stays enabled
+  vk::PipelineShaderStageCreateInfo depth_equal_shader_stage_create_info[2] = {
+      pipeline_shader_stage_create_info[0],
+      {
+          .stage = vk::ShaderStageFlagBits::eFragment,
+          .module = shader_module,
+          .pName = "fragMainOpaque",
+          .pSpecializationInfo = nullptr,
+      },
+  };
+  vk::PipelineDepthStencilStateCreateInfo depth_equal_depth_stencil_info =
+      depth_stencil_info;
+  depth_equal_depth_stencil_info.depthWriteEnable = vk::False;
+  depth_equal_depth_stencil_info.depthCompareOp = vk::CompareOp::eEqual;
+  vk::GraphicsPipelineCreateInfo depth_equal_pipeline_info = pipeline_info;
+  depth_equal_pipeline_info.pStages = depth_equal_shader_stage_create_info;
+  depth_equal_pipeline_info.pDepthStencilState =
+      &depth_equal_depth_stencil_info;
+  Context::Instance()->g_gbuffer_depth_equal_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, depth_equal_pipeline_info);
+
   vk::PipelineRenderingCreateInfo lighting_pipeline_rending_info{
       .colorAttachmentCount = static_cast<uint32_t>(graphsic_formats.size()),
       .pColorAttachmentFormats = graphsic_formats.data(),
@@ -338,22 +469,25 @@ void DeferLightingPass::CreatePipeline(
 
 void DeferLightingPass::Draw(uint32_t image_index, uint32_t frame_index,
                              vk::Viewport viewport, vk::Rect2D scissor) {
+  // the depth of the occluders is kept, the hi-z downsample read it
+  bool occluder_depth = MeshletCullPass::CullsOcclusion();
+  vk::ImageLayout depth_layout =
+      occluder_depth ? vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal
+                     : vk::ImageLayout::eUndefined;
   TransformImageLayout(Context::Instance()->g_depth_image, frame_index,
-                       vk::ImageLayout::eUndefined,
+                       depth_layout,
                        vk::ImageLayout::eDepthStencilAttachmentOptimal, {},
                        vk::AccessFlagBits2::eDepthStencilAttachmentRead |
                            vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
-                       vk::PipelineStageFlagBits2::eTopOfPipe,
+                       vk::PipelineStageFlagBits2::eComputeShader,
                        vk::PipelineStageFlagBits2::eEarlyFragmentTests |
                            vk::PipelineStageFlagBits2::eLateFragmentTests,
                        vk::ImageAspectFlagBits::eDepth);
-  TransformImageLayout(Context::Instance()->g_bloom_image, frame_index,
+  TransformImageLayout(Context::Instance()->g_hdr_image, frame_index,
                        vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
                        {}, vk::AccessFlagBits2::eColorAttachmentWrite,
                        vk::PipelineStageFlagBits2::eTopOfPipe,
-                       vk::PipelineStageFlagBits2::eColorAttachmentOutput,
-                       vk::ImageAspectFlagBits::eColor, 0,
-                       Context::Instance()->g_bloom_mip_levels);
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput);
   // https://docs.vulkan.org/features/latest/features/proposals/VK_KHR_dynamic_rendering_local_read.html
   // can not change attachments inside renderpass, use superset and remapping
   std::vector<vk::RenderingAttachmentInfo> attachment_infos{
@@ -391,18 +525,21 @@ void DeferLightingPass::Draw(uint32_t image_index, uint32_t frame_index,
           .clearValue = vk::ClearColorValue{0.0f, 0.0f, 0.0f, 0.0f},
       },
       {
-          .imageView = Context::Instance()->g_bloom_image_view,
+          .imageView = Context::Instance()->g_hdr_image_view,
           .imageLayout = vk::ImageLayout::eGeneral,
           .loadOp = vk::AttachmentLoadOp::eClear,
           .storeOp = vk::AttachmentStoreOp::eStore,
           .clearValue = vk::ClearColorValue{0.0f, 0.0f, 0.0f, 0.0f},
       },
   };
+  vk::AttachmentLoadOp depth_load_op = occluder_depth
+                                          ? vk::AttachmentLoadOp::eLoad
+                                          : vk::AttachmentLoadOp::eClear;
   vk::RenderingAttachmentInfo depth_info{
       .imageView = Context::Instance()->g_depth_image_view,
       .imageLayout = vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
-      .loadOp = vk::AttachmentLoadOp::eClear,
-      .storeOp = vk::AttachmentStoreOp::eDontCare,
+      .loadOp = depth_load_op,
+      .storeOp = vk::AttachmentStoreOp::eStore,
       .clearValue = vk::ClearDepthStencilValue{1.0f, 0},
   };
   vk::RenderingInfo rendering_info{
@@ -413,33 +550,74 @@ void DeferLightingPass::Draw(uint32_t image_index, uint32_t frame_index,
       .pColorAttachments = attachment_infos.data(),
       .pDepthAttachment = &depth_info,
   };
+  // compute ssao and the temporal accumulation need the whole depth buffer
+  // before the gbuffer is shaded, so the depth prepass gets its own scope and
+  // is forced on. the depth of the occluders forces it too, it only adds
+  // what the late phase found
+  bool compute_ssao = Context::Instance()->g_enable_ssao;
+  bool temporal = Context::Instance()->g_enable_temporal_visibility;
+  bool compute_visibility = compute_ssao || temporal;
+  bool depth_prepass = Context::Instance()->g_enable_depth_prepass ||
+                       compute_visibility || occluder_depth;
+  if (compute_visibility) {
+    std::vector<vk::RenderingAttachmentInfo> prepass_attachment_infos =
+        attachment_infos;
+    for (vk::RenderingAttachmentInfo& attachment_info :
+         prepass_attachment_infos) {
+      attachment_info.loadOp = vk::AttachmentLoadOp::eDontCare;
+      attachment_info.storeOp = vk::AttachmentStoreOp::eDontCare;
+    }
+    vk::RenderingAttachmentInfo prepass_depth_info{
+        .imageView = Context::Instance()->g_depth_image_view,
+        .imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
+        .loadOp = depth_load_op,
+        .storeOp = vk::AttachmentStoreOp::eStore,
+        .clearValue = vk::ClearDepthStencilValue{1.0f, 0},
+    };
+    vk::RenderingInfo prepass_rendering_info = rendering_info;
+    prepass_rendering_info.pColorAttachments = prepass_attachment_infos.data();
+    prepass_rendering_info.pDepthAttachment = &prepass_depth_info;
+    Context::Instance()->g_command_buffer[frame_index].beginRendering(
+        prepass_rendering_info);
+    BindGeometry(frame_index, viewport, scissor);
+    DrawDepthPrepass(frame_index);
+    Context::Instance()->g_command_buffer[frame_index].endRendering();
+    TransformImageLayout(
+        Context::Instance()->g_depth_image, frame_index,
+        vk::ImageLayout::eDepthStencilAttachmentOptimal,
+        vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+        vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+        vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+            vk::AccessFlagBits2::eShaderSampledRead,
+        vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+            vk::PipelineStageFlagBits2::eLateFragmentTests,
+        vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+            vk::PipelineStageFlagBits2::eLateFragmentTests |
+            vk::PipelineStageFlagBits2::eComputeShader,
+        vk::ImageAspectFlagBits::eDepth);
+    if (compute_ssao) {
+      SsaoPass::Draw(image_index, frame_index, viewport, scissor);
+    }
+    if (temporal) {
+      TemporalPass::Draw(image_index, frame_index, viewport, scissor);
+    }
+    depth_info.loadOp = vk::AttachmentLoadOp::eLoad;
+  }
   // graphsic pass
-  TransformImageLayout(Context::Instance()->g_shadowmap_image, frame_index,
-                       vk::ImageLayout::eDepthStencilAttachmentOptimal,
-                       vk::ImageLayout::eDepthReadOnlyOptimal,
-                       vk::AccessFlagBits2::eDepthStencilAttachmentRead |
-                           vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
-                       vk::AccessFlagBits2::eDepthStencilAttachmentRead,
-                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
-                           vk::PipelineStageFlagBits2::eLateFragmentTests,
-                       vk::PipelineStageFlagBits2::eFragmentShader,
-                       vk::ImageAspectFlagBits::eDepth);
   Context::Instance()->g_command_buffer[frame_index].beginRendering(
       rendering_info);
+  BindGeometry(frame_index, viewport, scissor);
+  // depth prepass
+  if (depth_prepass && !compute_visibility) {
+    DrawDepthPrepass(frame_index);
+  }
   Context::Instance()->g_command_buffer[frame_index].bindPipeline(
       vk::PipelineBindPoint::eGraphics,
-      Context::Instance()->g_graphics_pipeline);
-  Context::Instance()->g_command_buffer[frame_index].bindVertexBuffers(
-      0, *Context::Instance()->g_vertex_buffer, {0});
-  Context::Instance()->g_command_buffer[frame_index].bindIndexBuffer(
-      *Context::Instance()->g_index_buffer, 0, vk::IndexType::eUint32);
-  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
-      vk::PipelineBindPoint::eGraphics, Context::Instance()->g_pipeline_layout,
-      0, *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
-  Context::Instance()->g_command_buffer[frame_index].setViewport(0, viewport);
-  Context::Instance()->g_command_buffer[frame_index].setScissor(0, scissor);
-  Context::Instance()->g_command_buffer[frame_index].drawIndexed(
-      Context::Instance()->g_index_in.size(), 1, 0, 0, 0);
+      depth_prepass ? Context::Instance()->g_gbuffer_depth_equal_pipeline
+                    : Context::Instance()->g_graphics_pipeline);
+  QueryManager::BeginStatistics(frame_index, "GBuffer");
+  MeshletCullPass::DrawCameraView(frame_index);
+  QueryManager::EndStatistics(frame_index, "GBuffer");
   // lighting pass
   TransformImageLayout(Context::Instance()->g_depth_image, frame_index,
                        vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
@@ -469,57 +647,17 @@ void DeferLightingPass::Draw(uint32_t image_index, uint32_t frame_index,
       Context::Instance()->g_lighting_pipeline_layout, 0,
       *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
   LightingPushConstants lighting_push_constants{
-      .enable_ssao = Context::Instance()->g_enable_ssao};
+      .enable_ssao = Context::Instance()->g_enable_ssao,
+      .shadow_filter_mode = static_cast<uint32_t>(
+          Context::Instance()->g_shadow_filter_mode),
+      .enable_temporal = temporal,
+  };
   Context::Instance()
       ->g_command_buffer[frame_index]
       .pushConstants<LightingPushConstants>(
           Context::Instance()->g_lighting_pipeline_layout,
           vk::ShaderStageFlagBits::eFragment, 0, lighting_push_constants);
   Context::Instance()->g_command_buffer[frame_index].draw(4, 1, 0, 0);
-  // barrier
-  std::vector<vk::ImageMemoryBarrier2> barriers = {
-      {
-          .srcStageMask = vk::PipelineStageFlagBits2::eEarlyFragmentTests |
-                          vk::PipelineStageFlagBits2::eLateFragmentTests,
-          .srcAccessMask = vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
-          .dstStageMask = vk::PipelineStageFlagBits2::eEarlyFragmentTests |
-                          vk::PipelineStageFlagBits2::eLateFragmentTests,
-          .dstAccessMask = vk::AccessFlagBits2::eDepthStencilAttachmentRead |
-                           vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
-          .oldLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
-          .newLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
-          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-          .image = Context::Instance()->g_depth_image,
-          .subresourceRange = {.aspectMask = vk::ImageAspectFlagBits::eDepth,
-                               .baseMipLevel = 0,
-                               .levelCount = 1,
-                               .baseArrayLayer = 0,
-                               .layerCount = 1},
-      },
-  };
-  vk::DependencyInfo dependency_info{
-      .dependencyFlags = vk::DependencyFlagBits::eByRegion,
-      .imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size()),
-      .pImageMemoryBarriers = barriers.data(),
-  };
-  Context::Instance()->g_command_buffer[frame_index].pipelineBarrier2(
-      dependency_info);
-  // particle pass
-  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
-      vk::PipelineBindPoint::eGraphics,
-      Context::Instance()->g_particle_pipeline);
-  Context::Instance()->g_command_buffer[frame_index].bindVertexBuffers(
-      0,
-      *Context::Instance()
-           ->g_particle_buffer[Context::Instance()->g_frame_in_flight - 1],
-      {0});
-  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
-      vk::PipelineBindPoint::eGraphics,
-      Context::Instance()->g_particle_pipeline_layout, 0,
-      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
-  Context::Instance()->g_command_buffer[frame_index].draw(
-      Context::Instance()->kParticleCount, 1, 0, 0);
   Context::Instance()->g_command_buffer[frame_index].endRendering();
 }
 
@@ -578,6 +716,7 @@ void DeferLightingPass::UpdateDescriptorSetInfo() {
     }
     DescriptorSetManager::RegisterDescriptorSetInfo(
         10, vk::DescriptorType::eCombinedImageSampler,
-        vk::ShaderStageFlagBits::eFragment, image_info, {});
+        vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute,
+        image_info, {});
   }
 }
@@ -0,0 +1,402 @@
+#include "hiz_pass.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <vector>
+
+#include "context.h"
+#include "descriptor_set.h"
+#include "memory.h"
+#include "query.h"
+#include "render_pass/meshlet_cull_pass.h"
+#include "swapchain.h"
+
+namespace {
+// a downsample workgroup reduces a 64x64 tile of the depth buffer
+constexpr uint32_t kHiZTileSize = 32;
+
+bool pyramid_valid = false;
+
+// half the depth buffer, rounded up to powers of two so every texel of every
+// mip covers exactly 2x2 texels of the mip above
+vk::Extent2D HiZExtent() {
+  vk::Extent2D extent = Context::Instance()->g_swapchain_extent;
+  return {std::bit_ceil(std::max((extent.width + 1) / 2, 1u)),
+          std::bit_ceil(std::max((extent.height + 1) / 2, 1u))};
+}
+
+void CreateHiZResources() {
+  vk::Extent2D extent = HiZExtent();
+  uint32_t mip_levels =
+      std::min(Context::Instance()->kMaxHiZMipLevels,
+               static_cast<uint32_t>(
+                   std::bit_width(std::max(extent.width, extent.height))));
+  vk::Format format = vk::Format::eR32Sfloat;
+  CreateImage(extent.width, extent.height, mip_levels,
+              vk::SampleCountFlagBits::e1, format, vk::ImageTiling::eOptimal,
+              vk::ImageUsageFlagBits::eSampled |
+                  vk::ImageUsageFlagBits::eStorage,
+              vk::MemoryPropertyFlagBits::eDeviceLocal,
+              Context::Instance()->g_hiz_image,
+              Context::Instance()->g_hiz_image_memory);
+  Context::Instance()->g_hiz_image_view =
+      CreateImageView(*Context::Instance()->g_hiz_image, 0, mip_levels, format,
+                      vk::ImageAspectFlagBits::eColor);
+  Context::Instance()->g_hiz_image_views.clear();
+  for (uint32_t i = 0; i < mip_levels; ++i) {
+    Context::Instance()->g_hiz_image_views.emplace_back(
+        CreateImageView(*Context::Instance()->g_hiz_image, i, 1, format,
+                        vk::ImageAspectFlagBits::eColor));
+  }
+  // stays in general, written and read by compute
+  TransformImageLayoutImmediately(
+      Context::Instance()->g_hiz_image, vk::ImageLayout::eUndefined,
+      vk::ImageLayout::eGeneral, {}, vk::AccessFlagBits::eShaderRead,
+      vk::PipelineStageFlagBits::eTopOfPipe,
+      vk::PipelineStageFlagBits::eComputeShader,
+      vk::ImageAspectFlagBits::eColor, 0, mip_levels);
+  // the new pyramid holds no depth yet
+  pyramid_valid = false;
+}
+
+void CreateHiZCounter() {
+  CreateBuffer(sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               Context::Instance()->g_hiz_counter_buffer,
+               Context::Instance()->g_hiz_counter_buffer_memory);
+  // the last workgroup of every downsample puts it back to 0
+  void* data = Context::Instance()->g_hiz_counter_buffer_memory.mapMemory(
+      0, sizeof(uint32_t));
+  memset(data, 0, sizeof(uint32_t));
+  Context::Instance()->g_hiz_counter_buffer_memory.unmapMemory();
+}
+
+// depth only versions of the depth prepass pipelines, the occluders are drawn
+// outside of the gbuffer scope
+void CreateOccluderPipelines(const vk::raii::ShaderModule& shader_module) {
+  vk::PipelineShaderStageCreateInfo masked_shader_stage_create_info[2] = {
+      {
+          .stage = vk::ShaderStageFlagBits::eVertex,
+          .module = shader_module,
+          .pName = "vertDepthPrepass",
+          .pSpecializationInfo = nullptr,
+      },
+      {
+          .stage = vk::ShaderStageFlagBits::eFragment,
+          .module = shader_module,
+          .pName = "fragDepthPrepassMasked",
+          .pSpecializationInfo = nullptr,
+      },
+  };
+  std::vector dynamic_states = {vk::DynamicState::eViewport,
+                                vk::DynamicState::eScissor};
+  vk::PipelineDynamicStateCreateInfo dyanmic_state_create_info = {
+      .dynamicStateCount = static_cast<uint32_t>(dynamic_states.size()),
+      .pDynamicStates = dynamic_states.data(),
+  };
+  auto binding_desc = QuantizedVertexStreams::GetBindingDescription();
+  auto attribute_desc = QuantizedVertexStreams::GetAttributeDescription();
+  vk::PipelineVertexInputStateCreateInfo vertex_input_info{
+      .vertexBindingDescriptionCount = binding_desc.size(),
+      .pVertexBindingDescriptions = binding_desc.data(),
+      .vertexAttributeDescriptionCount = attribute_desc.size(),
+      .pVertexAttributeDescriptions = attribute_desc.data(),
+  };
+  vk::PipelineInputAssemblyStateCreateInfo input_assembly_info{
+      .topology = vk::PrimitiveTopology::eTriangleList};
+  vk::PipelineViewportStateCreateInfo viewport_state_info{
+      .viewportCount = 1,
+      .pViewports = nullptr,
+      .scissorCount = 1,
+      .pScissors = nullptr,
+  };
+  vk::PipelineRasterizationStateCreateInfo rasterization_create_info{
+      .depthClampEnable = vk::False,
+      .rasterizerDiscardEnable = vk::False,
+      .polygonMode = vk::PolygonMode::eFill,
+      .cullMode = vk::CullModeFlagBits::eBack,
+      .frontFace = vk::FrontFace::eCounterClockwise,
+      .depthBiasEnable = vk::False,
+      .depthBiasConstantFactor = 1.0f,
+      .depthBiasClamp = 0.0f,
+      .depthBiasSlopeFactor = 0.0f,
+      .lineWidth = 1.0f,
+  };
+  vk::PipelineMultisampleStateCreateInfo multisample_create_info{
+      .rasterizationSamples = Context::Instance()->g_msaa_samples,
+      .sampleShadingEnable = vk::False,
+  };
+  vk::PipelineDepthStencilStateCreateInfo depth_stencil_info{
+      .depthTestEnable = vk::True,
+      .depthWriteEnable = vk::True,
+      .depthCompareOp = vk::CompareOp::eLess,
+      .depthBoundsTestEnable = vk::False,
+      .stencilTestEnable = vk::False,
+  };
+  vk::PipelineColorBlendStateCreateInfo color_blend_info{
+      .logicOpEnable = vk::False,
+      .logicOp = vk::LogicOp::eCopy,
+      .attachmentCount = 0,
+      .pAttachments = nullptr,
+      .blendConstants = {},
+  };
+  vk::PipelineRenderingCreateInfo pipeline_rending_info{
+      .colorAttachmentCount = 0,
+      .pColorAttachmentFormats = nullptr,
+      .depthAttachmentFormat = Context::Instance()->g_depth_image_format,
+      .stencilAttachmentFormat = vk::Format::eUndefined,
+  };
+  vk::GraphicsPipelineCreateInfo pipeline_info{
+      .pNext = &pipeline_rending_info,
+      .stageCount = 2,
+      .pStages = masked_shader_stage_create_info,
+      .pVertexInputState = &vertex_input_info,
+      .pInputAssemblyState = &input_assembly_info,
+      .pTessellationState = {},
+      .pViewportState = &viewport_state_info,
+      .pRasterizationState = &rasterization_create_info,
+      .pMultisampleState = &multisample_create_info,
+      .pDepthStencilState = &depth_stencil_info,
+      .pColorBlendState = &color_blend_info,
+      .pDynamicState = &dyanmic_state_create_info,
+      .layout = Context::Instance()->g_pipeline_layout,
+      .renderPass = nullptr,
+      .subpass = {},
+      .basePipelineHandle = {},
+      .basePipelineIndex = {},
+  };
+  Context::Instance()->g_occluder_masked_pipeline =
+      vk::raii::Pipeline(Context::Instance()->g_device, nullptr, pipeline_info);
+  vk::PipelineShaderStageCreateInfo opaque_shader_stage_create_info{
+      .stage = vk::ShaderStageFlagBits::eVertex,
+      .module = shader_module,
+      .pName = "vertDepthPrepassOpaque",
+      .pSpecializationInfo = nullptr,
+  };
+  auto position_binding_desc = QuantizedPositionLayout::GetBindingDescription();
+  auto position_attribute_desc =
+      QuantizedPositionLayout::GetAttributeDescription();
+  vk::PipelineVertexInputStateCreateInfo position_vertex_input_info{
+      .vertexBindingDescriptionCount = 1,
+      .pVertexBindingDescriptions = &position_binding_desc,
+      .vertexAttributeDescriptionCount = position_attribute_desc.size(),
+      .pVertexAttributeDescriptions = position_attribute_desc.data(),
+  };
+  pipeline_info.stageCount = 1;
+  pipeline_info.pStages = &opaque_shader_stage_create_info;
+  pipeline_info.pVertexInputState = &position_vertex_input_info;
+  Context::Instance()->g_occluder_pipeline =
+      vk::raii::Pipeline(Context::Instance()->g_device, nullptr, pipeline_info);
+}
+
+void RasterizeOccluders(uint32_t frame_index, vk::Viewport viewport,
+                        vk::Rect2D scissor) {
+  auto& command_buffer = Context::Instance()->g_command_buffer[frame_index];
+  // the downsample of the last frame read the depth
+  TransformImageLayout(Context::Instance()->g_depth_image, frame_index,
+                       vk::ImageLayout::eUndefined,
+                       vk::ImageLayout::eDepthStencilAttachmentOptimal, {},
+                       vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+                           vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                           vk::PipelineStageFlagBits2::eLateFragmentTests,
+                       vk::ImageAspectFlagBits::eDepth);
+  vk::RenderingAttachmentInfo depth_info{
+      .imageView = Context::Instance()->g_depth_image_view,
+      .imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
+      .loadOp = vk::AttachmentLoadOp::eClear,
+      .storeOp = vk::AttachmentStoreOp::eStore,
+      .clearValue = vk::ClearDepthStencilValue{1.0f, 0},
+  };
+  vk::RenderingInfo rendering_info{
+      .renderArea = {.offset = {0, 0},
+                     .extent = Context::Instance()->g_swapchain_extent},
+      .layerCount = 1,
+      .colorAttachmentCount = 0,
+      .pColorAttachments = nullptr,
+      .pDepthAttachment = &depth_info,
+  };
+  command_buffer.beginRendering(rendering_info);
+  command_buffer.bindVertexBuffers(
+      0,
+      {*Context::Instance()->g_vertex_buffer,
+       *Context::Instance()->g_vertex_buffer},
+      {0, Context::Instance()->g_attribute_offset});
+  command_buffer.bindIndexBuffer(*Context::Instance()->g_index_buffer, 0,
+                                 Context::Instance()->g_index_type);
+  command_buffer.bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics, Context::Instance()->g_pipeline_layout,
+      0, *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  command_buffer.setViewport(0, viewport);
+  command_buffer.setScissor(0, scissor);
+  command_buffer.bindPipeline(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_texture_masked
+          ? Context::Instance()->g_occluder_masked_pipeline
+          : Context::Instance()->g_occluder_pipeline);
+  // the late list is filled after the pyramid of these
+  QueryManager::BeginStatistics(frame_index, "Occluders");
+  MeshletCullPass::DrawView(frame_index,
+                            Context::Instance()->g_meshlet_camera_view);
+  QueryManager::EndStatistics(frame_index, "Occluders");
+  command_buffer.endRendering();
+  TransformImageLayout(
+      Context::Instance()->g_depth_image, frame_index,
+      vk::ImageLayout::eDepthStencilAttachmentOptimal,
+      vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+      vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+      vk::AccessFlagBits2::eShaderSampledRead,
+      vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+          vk::PipelineStageFlagBits2::eLateFragmentTests,
+      vk::PipelineStageFlagBits2::eComputeShader,
+      vk::ImageAspectFlagBits::eDepth);
+}
+
+// reduces the depth buffer in its read only layout to the pyramid, all in
+// one dispatch
+void Downsample(uint32_t frame_index) {
+  uint32_t mip_levels =
+      static_cast<uint32_t>(Context::Instance()->g_hiz_image_views.size());
+  vk::Extent2D extent = HiZExtent();
+  auto& command_buffer = Context::Instance()->g_command_buffer[frame_index];
+  // the culling before read the pyramid
+  TransformImageLayout(Context::Instance()->g_hiz_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderRead,
+                       vk::AccessFlagBits2::eShaderWrite,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::ImageAspectFlagBits::eColor, 0, mip_levels);
+  command_buffer.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_hiz_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  uint32_t group_x = (extent.width + kHiZTileSize - 1) / kHiZTileSize;
+  uint32_t group_y = (extent.height + kHiZTileSize - 1) / kHiZTileSize;
+  HiZPushConstants push_constants{
+      .mip_count = mip_levels,
+      .group_count = group_x * group_y,
+  };
+  command_buffer.pushConstants<HiZPushConstants>(
+      Context::Instance()->g_hiz_pipeline_layout,
+      vk::ShaderStageFlagBits::eCompute, 0, push_constants);
+  command_buffer.bindPipeline(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_hiz_downsample_pipeline);
+  command_buffer.dispatch(group_x, group_y, 1);
+  TransformImageLayout(Context::Instance()->g_hiz_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderWrite,
+                       vk::AccessFlagBits2::eShaderRead,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::ImageAspectFlagBits::eColor, 0, mip_levels);
+}
+}  // namespace
+
+void HiZPass::UpdateResources() {
+  CreateHiZResources();
+  CreateHiZCounter();
+  SwapChainManager::RegisterRecreateFunction(CreateHiZResources);
+}
+
+void HiZPass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
+  std::vector<vk::PushConstantRange> push_constant_range{{
+      .stageFlags = vk::ShaderStageFlagBits::eCompute,
+      .offset = 0,
+      .size = sizeof(HiZPushConstants),
+  }};
+  vk::PipelineLayoutCreateInfo pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount =
+          static_cast<uint32_t>(push_constant_range.size()),
+      .pPushConstantRanges = push_constant_range.data(),
+  };
+  Context::Instance()->g_hiz_pipeline_layout = vk::raii::PipelineLayout(
+      Context::Instance()->g_device, pipeline_layout_info);
+  vk::ComputePipelineCreateInfo compute_pipeline_info{
+      .stage =
+          {
+              .stage = vk::ShaderStageFlagBits::eCompute,
+              .module = shader_module,
+              .pName = "compHiZDownsample",
+              .pSpecializationInfo = nullptr,
+          },
+      .layout = Context::Instance()->g_hiz_pipeline_layout,
+  };
+  Context::Instance()->g_hiz_downsample_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, compute_pipeline_info);
+  CreateOccluderPipelines(shader_module);
+}
+
+void HiZPass::DrawOccluders(uint32_t frame_index, vk::Viewport viewport,
+                            vk::Rect2D scissor) {
+  RasterizeOccluders(frame_index, viewport, scissor);
+  Downsample(frame_index);
+}
+
+void HiZPass::Draw(uint32_t image_index, uint32_t frame_index,
+                   vk::Viewport viewport, vk::Rect2D scissor) {
+  // the main pass left the depth read only
+  TransformImageLayout(Context::Instance()->g_depth_image, frame_index,
+                       vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+                       vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+                       vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                       vk::AccessFlagBits2::eShaderSampledRead,
+                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                           vk::PipelineStageFlagBits2::eLateFragmentTests,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::ImageAspectFlagBits::eDepth);
+  Downsample(frame_index);
+  pyramid_valid = true;
+}
+
+void HiZPass::UpdateDescriptorSetInfo() {
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr, *Context::Instance()->g_hiz_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        48, vk::DescriptorType::eSampledImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {});
+  }
+  {
+    // the array is sized for the most mips, the rest repeat the last mip
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      for (uint32_t j = 0; j < Context::Instance()->kMaxHiZMipLevels; ++j) {
+        uint32_t mip = std::min(
+            j, static_cast<uint32_t>(
+                   Context::Instance()->g_hiz_image_views.size() - 1));
+        image_info.emplace_back(nullptr,
+                                *Context::Instance()->g_hiz_image_views[mip],
+                                vk::ImageLayout::eGeneral);
+      }
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        49, vk::DescriptorType::eStorageImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {},
+        Context::Instance()->kMaxHiZMipLevels);
+  }
+  {
+    std::vector<vk::DescriptorBufferInfo> buffer_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      buffer_info.emplace_back(Context::Instance()->g_hiz_counter_buffer, 0,
+                               sizeof(uint32_t));
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        50, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eCompute, {}, buffer_info);
+  }
+}
+
+bool HiZPass::HasPyramid() { return pyramid_valid; }
+
+void HiZPass::Invalidate() { pyramid_valid = false; }
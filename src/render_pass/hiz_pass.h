@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+#include "third_part/vulkan_headers.h"
+
+namespace HiZPass {
+void UpdateResources();
+void CreatePipeline(const vk::raii::ShaderModule& shader_module);
+// draws the camera list of the early occlusion phase into the depth buffer
+// and reduces it to the hi-z pyramid the late phase tests against, the main
+// pass keeps the depth
+void DrawOccluders(uint32_t frame_index, vk::Viewport viewport,
+                   vk::Rect2D scissor);
+// reduces the final depth of the main pass to the pyramid the early phase of
+// the next frame tests against
+void Draw(uint32_t image_index, uint32_t frame_index, vk::Viewport viewport,
+          vk::Rect2D scissor);
+void UpdateDescriptorSetInfo();
+// true once a Draw filled the pyramid of the current extent
+bool HasPyramid();
+// the next frames skip the early phase until the next Draw
+void Invalidate();
+}  // namespace HiZPass
@@ -0,0 +1,637 @@
+#include "meshlet_cull_pass.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include "context.h"
+#include "culling.h"
+#include "descriptor_set.h"
+#include "memory.h"
+#include "render_pass/hiz_pass.h"
+
+namespace {
+// keep in sync with meshlet.slang
+constexpr uint32_t kMeshletCullGroupSize = 64;
+
+std::vector<MeshletCullView> cull_views;
+// draw counts of the last frame read back
+uint32_t drawn_meshlet_count = 0;
+uint32_t drawn_camera_meshlet_count = 0;
+uint32_t drawn_view_count = 0;
+// survivors past the capacity of their list, not drawn
+uint32_t dropped_meshlet_count = 0;
+OcclusionCullState occlusion_state{};
+// draw capacities of the views culled by the last Cull of each frame in
+// flight
+std::vector<std::vector<uint32_t>> frame_view_capacities;
+// whether the last Cull of each frame in flight ran the early phase
+std::vector<bool> frame_occlusion;
+// of this frame, decided by Cull
+uint32_t occlusion_phase = kOcclusionOff;
+// consecutive views with the same planes, the static and dynamic views of a
+// cascade, share one list of visible instances
+std::vector<uint32_t> view_instance_lists;
+std::vector<std::vector<uint32_t>> instance_lists;
+std::vector<BvhCullStats> instance_list_stats;
+std::vector<BvhCullStats> view_instance_stats;
+double instance_cull_time = 0.0;
+
+uint32_t ItemCount() {
+  return static_cast<uint32_t>(
+      Context::Instance()->g_meshlet_cull_items.size());
+}
+
+// the camera and cascade views can keep every item, an atlas view of a local
+// light at most kMaxLocalLightMeshletDraws
+uint32_t DrawListEntries() {
+  uint32_t item_count = std::max(ItemCount(), 1u);
+  return (2 + 2 * kMaxShadowCascades) * item_count +
+         kMaxShadowLights * kMaxShadowLightViews *
+             std::min(item_count, kMaxLocalLightMeshletDraws);
+}
+
+uint32_t DrawBufferSize() { return sizeof(MeshletDraw) * DrawListEntries(); }
+
+uint32_t InstanceCount() {
+  return static_cast<uint32_t>(Context::Instance()->g_instances.size());
+}
+
+// the early phase rejects every item at most once
+uint32_t RejectBufferSize() {
+  return sizeof(uint32_t) * std::max(ItemCount(), 1u);
+}
+
+uint32_t InstanceOcclusionBufferSize() {
+  return sizeof(uint32_t) * std::max(InstanceCount(), 1u);
+}
+
+MeshletCullPushConstants PushConstants(uint32_t view_count, uint32_t phase) {
+  return {
+      .view_count = view_count,
+      .item_count = ItemCount(),
+      .enable_culling = Context::Instance()->g_enable_meshlet_culling,
+      .instance_count = InstanceCount(),
+      .occlusion_phase = phase,
+      .occlusion_view = Context::Instance()->g_meshlet_camera_view,
+      .occlusion_late_view = Context::Instance()->g_meshlet_late_camera_view,
+      .occlusion_width = Context::Instance()->g_swapchain_extent.width,
+      .occlusion_height = Context::Instance()->g_swapchain_extent.height,
+  };
+}
+
+// the instances of the occlusion view behind the pyramid of the phase
+void CullOccludedInstances(uint32_t frame_index, uint32_t view_count,
+                           uint32_t phase) {
+  if (InstanceCount() == 0) {
+    return;
+  }
+  auto& command_buffer = Context::Instance()->g_command_buffer[frame_index];
+  command_buffer.bindPipeline(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_instance_occlusion_pipeline);
+  command_buffer.pushConstants<MeshletCullPushConstants>(
+      Context::Instance()->g_meshlet_cull_pipeline_layout,
+      vk::ShaderStageFlagBits::eCompute, 0,
+      PushConstants(view_count, phase));
+  command_buffer.dispatch(
+      (InstanceCount() + kMeshletCullGroupSize - 1) / kMeshletCullGroupSize, 1,
+      1);
+  GlobalMemoryBarrier(frame_index, vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::AccessFlagBits2::eShaderStorageRead |
+                          vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::PipelineStageFlagBits2::eComputeShader,
+                      vk::PipelineStageFlagBits2::eComputeShader);
+}
+
+// selected level of every sub mesh of every instance
+uint32_t InstanceLodBufferSize() {
+  return sizeof(uint32_t) *
+         std::max<uint32_t>(Context::Instance()->g_instance_lods.size(), 1u);
+}
+
+void CreateMeshletCullBuffers() {
+  Context::Instance()->g_meshlet_cull_view_buffer.clear();
+  Context::Instance()->g_meshlet_cull_view_buffer_memory.clear();
+  Context::Instance()->g_meshlet_cull_view_buffer_maped.clear();
+  Context::Instance()->g_meshlet_count_readback_buffer.clear();
+  Context::Instance()->g_meshlet_count_readback_buffer_memory.clear();
+  Context::Instance()->g_meshlet_count_readback_buffer_maped.clear();
+
+  for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+    uint32_t size = sizeof(MeshletCullView) * kMaxMeshletCullViews;
+    vk::raii::Buffer buffer = nullptr;
+    vk::raii::DeviceMemory memory = nullptr;
+    CreateBuffer(size, vk::BufferUsageFlagBits::eStorageBuffer,
+                 vk::SharingMode::eExclusive,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 buffer, memory);
+    void* data = memory.mapMemory(0, size);
+    Context::Instance()->g_meshlet_cull_view_buffer.emplace_back(
+        std::move(buffer));
+    Context::Instance()->g_meshlet_cull_view_buffer_memory.emplace_back(
+        std::move(memory));
+    Context::Instance()->g_meshlet_cull_view_buffer_maped.emplace_back(data);
+  }
+  for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+    uint32_t size = sizeof(uint32_t) * kMaxMeshletCullViews;
+    vk::raii::Buffer buffer = nullptr;
+    vk::raii::DeviceMemory memory = nullptr;
+    CreateBuffer(size, vk::BufferUsageFlagBits::eTransferDst,
+                 vk::SharingMode::eExclusive,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 buffer, memory);
+    void* data = memory.mapMemory(0, size);
+    Context::Instance()->g_meshlet_count_readback_buffer.emplace_back(
+        std::move(buffer));
+    Context::Instance()->g_meshlet_count_readback_buffer_memory.emplace_back(
+        std::move(memory));
+    Context::Instance()->g_meshlet_count_readback_buffer_maped.emplace_back(
+        data);
+  }
+  Context::Instance()->g_instance_lod_buffer.clear();
+  Context::Instance()->g_instance_lod_buffer_memory.clear();
+  Context::Instance()->g_instance_lod_buffer_maped.clear();
+  for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+    uint32_t size = InstanceLodBufferSize();
+    vk::raii::Buffer buffer = nullptr;
+    vk::raii::DeviceMemory memory = nullptr;
+    CreateBuffer(size, vk::BufferUsageFlagBits::eStorageBuffer,
+                 vk::SharingMode::eExclusive,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 buffer, memory);
+    void* data = memory.mapMemory(0, size);
+    Context::Instance()->g_instance_lod_buffer.emplace_back(std::move(buffer));
+    Context::Instance()->g_instance_lod_buffer_memory.emplace_back(
+        std::move(memory));
+    Context::Instance()->g_instance_lod_buffer_maped.emplace_back(data);
+  }
+  frame_view_capacities.assign(Context::Instance()->g_frame_in_flight, {});
+  Context::Instance()->g_occlusion_readback_buffer.clear();
+  Context::Instance()->g_occlusion_readback_buffer_memory.clear();
+  Context::Instance()->g_occlusion_readback_buffer_maped.clear();
+  for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+    uint32_t size = sizeof(OcclusionCullState);
+    vk::raii::Buffer buffer = nullptr;
+    vk::raii::DeviceMemory memory = nullptr;
+    CreateBuffer(size, vk::BufferUsageFlagBits::eTransferDst,
+                 vk::SharingMode::eExclusive,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 buffer, memory);
+    void* data = memory.mapMemory(0, size);
+    Context::Instance()->g_occlusion_readback_buffer.emplace_back(
+        std::move(buffer));
+    Context::Instance()->g_occlusion_readback_buffer_memory.emplace_back(
+        std::move(memory));
+    Context::Instance()->g_occlusion_readback_buffer_maped.emplace_back(data);
+  }
+  frame_occlusion.assign(Context::Instance()->g_frame_in_flight, false);
+
+  CreateBuffer(DrawBufferSize(),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eIndirectBuffer,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_meshlet_draw_buffer,
+               Context::Instance()->g_meshlet_draw_buffer_memory);
+  CreateBuffer(sizeof(uint32_t) * kMaxMeshletCullViews,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eIndirectBuffer |
+                   vk::BufferUsageFlagBits::eTransferSrc |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_meshlet_count_buffer,
+               Context::Instance()->g_meshlet_count_buffer_memory);
+  CreateBuffer(RejectBufferSize(), vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_occlusion_reject_buffer,
+               Context::Instance()->g_occlusion_reject_buffer_memory);
+  CreateBuffer(sizeof(OcclusionCullState),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eIndirectBuffer |
+                   vk::BufferUsageFlagBits::eTransferSrc |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_occlusion_state_buffer,
+               Context::Instance()->g_occlusion_state_buffer_memory);
+  CreateBuffer(InstanceOcclusionBufferSize(),
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_instance_occlusion_buffer,
+               Context::Instance()->g_instance_occlusion_buffer_memory);
+}
+}  // namespace
+
+void MeshletCullPass::UpdateResources() { CreateMeshletCullBuffers(); }
+
+void MeshletCullPass::CreatePipeline(
+    const vk::raii::ShaderModule& shader_module) {
+  std::vector<vk::PushConstantRange> push_constant_range{{
+      .stageFlags = vk::ShaderStageFlagBits::eCompute,
+      .offset = 0,
+      .size = sizeof(MeshletCullPushConstants),
+  }};
+  vk::PipelineLayoutCreateInfo pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount =
+          static_cast<uint32_t>(push_constant_range.size()),
+      .pPushConstantRanges = push_constant_range.data(),
+  };
+  Context::Instance()->g_meshlet_cull_pipeline_layout =
+      vk::raii::PipelineLayout(Context::Instance()->g_device,
+                               pipeline_layout_info);
+  vk::ComputePipelineCreateInfo compute_pipeline_info{
+      .stage =
+          {
+              .stage = vk::ShaderStageFlagBits::eCompute,
+              .module = shader_module,
+              .pName = "compMeshletCull",
+              .pSpecializationInfo = nullptr,
+          },
+      .layout = Context::Instance()->g_meshlet_cull_pipeline_layout,
+  };
+  Context::Instance()->g_meshlet_cull_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, compute_pipeline_info);
+  compute_pipeline_info.stage.pName = "compInstanceOcclusion";
+  Context::Instance()->g_instance_occlusion_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, compute_pipeline_info);
+  compute_pipeline_info.stage.pName = "compMeshletOcclusion";
+  Context::Instance()->g_meshlet_occlusion_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, compute_pipeline_info);
+}
+
+void MeshletCullPass::UpdateDescriptorSetInfo() {
+  auto register_storage_buffer = [](uint32_t binding,
+                                    const vk::raii::Buffer& buffer,
+                                    vk::DeviceSize size) {
+    std::vector<vk::DescriptorBufferInfo> buffer_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      buffer_info.emplace_back(buffer, 0, size);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        binding, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eCompute, {}, buffer_info);
+  };
+  register_storage_buffer(40, Context::Instance()->g_meshlet_buffer,
+                          sizeof(Meshlet) *
+                              std::max<uint32_t>(
+                                  Context::Instance()->g_meshlets.size(), 1u));
+  {
+    std::vector<vk::DescriptorBufferInfo> buffer_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      buffer_info.emplace_back(
+          Context::Instance()->g_meshlet_cull_view_buffer[i], 0,
+          sizeof(MeshletCullView) * kMaxMeshletCullViews);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        41, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eCompute, {}, buffer_info);
+  }
+  // the culling runs on the graphics queue, one frame at a time
+  register_storage_buffer(42, Context::Instance()->g_meshlet_draw_buffer,
+                          DrawBufferSize());
+  register_storage_buffer(43, Context::Instance()->g_meshlet_count_buffer,
+                          sizeof(uint32_t) * kMaxMeshletCullViews);
+  {
+    std::vector<vk::DescriptorBufferInfo> buffer_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      buffer_info.emplace_back(Context::Instance()->g_instance_lod_buffer[i],
+                               0, InstanceLodBufferSize());
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        44, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eCompute, {}, buffer_info);
+  }
+  // vertex shaders find their instance through the slot of the draw,
+  // the visibility material pass through the slot in the visibility id
+  {
+    std::vector<vk::DescriptorBufferInfo> buffer_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      buffer_info.emplace_back(
+          Context::Instance()->g_instance_buffer, 0,
+          sizeof(InstanceData) *
+              std::max<uint32_t>(Context::Instance()->g_instances.size(), 1u));
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        45, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment |
+            vk::ShaderStageFlagBits::eCompute,
+        {}, buffer_info);
+  }
+  {
+    std::vector<vk::DescriptorBufferInfo> buffer_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      buffer_info.emplace_back(Context::Instance()->g_meshlet_draw_buffer, 0,
+                               DrawBufferSize());
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        46, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        {}, buffer_info);
+  }
+  register_storage_buffer(
+      47, Context::Instance()->g_meshlet_cull_item_buffer,
+      sizeof(MeshletCullItem) * std::max(ItemCount(), 1u));
+  register_storage_buffer(51, Context::Instance()->g_occlusion_reject_buffer,
+                          RejectBufferSize());
+  register_storage_buffer(52, Context::Instance()->g_occlusion_state_buffer,
+                          sizeof(OcclusionCullState));
+  register_storage_buffer(53, Context::Instance()->g_instance_occlusion_buffer,
+                          InstanceOcclusionBufferSize());
+}
+
+void MeshletCullPass::ResetViews() { cull_views.clear(); }
+
+uint32_t MeshletCullPass::AddView(const glm::mat4& model_view_proj,
+                                  MeshletCullFilter filter,
+                                  const glm::vec4& eye,
+                                  uint32_t max_draw_count) {
+  if (cull_views.size() == kMaxMeshletCullViews) {
+    throw std::runtime_error("too many meshlet cull views!");
+  }
+  uint32_t draw_offset =
+      cull_views.empty()
+          ? 0
+          : cull_views.back().draw_offset + cull_views.back().draw_capacity;
+  uint32_t draw_capacity = std::min(ItemCount(), max_draw_count);
+  if (draw_offset + draw_capacity > DrawListEntries()) {
+    throw std::runtime_error("meshlet draw lists are full!");
+  }
+  MeshletCullView& view = cull_views.emplace_back();
+  ExtractFrustumPlanes(model_view_proj, view.planes);
+  view.eye = eye;
+  view.filter = filter;
+  view.draw_offset = draw_offset;
+  view.draw_capacity = draw_capacity;
+  return static_cast<uint32_t>(cull_views.size() - 1);
+}
+
+void MeshletCullPass::CullInstances() {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<FrustumPlanes> list_planes;
+  view_instance_lists.clear();
+  for (const MeshletCullView& view : cull_views) {
+    FrustumPlanes planes;
+    std::copy(std::begin(view.planes), std::end(view.planes), planes.begin());
+    if (list_planes.empty() || list_planes.back() != planes) {
+      list_planes.emplace_back(planes);
+    }
+    view_instance_lists.emplace_back(
+        static_cast<uint32_t>(list_planes.size() - 1));
+  }
+  uint32_t list_count = static_cast<uint32_t>(list_planes.size());
+  if (Context::Instance()->g_enable_instance_culling) {
+    Context::Instance()->g_instance_bvh.CullViews(list_planes, instance_lists,
+                                                  instance_list_stats);
+  } else {
+    uint32_t instance_count =
+        static_cast<uint32_t>(Context::Instance()->g_instances.size());
+    instance_lists.resize(list_count);
+    for (std::vector<uint32_t>& list : instance_lists) {
+      list.resize(instance_count);
+      std::iota(list.begin(), list.end(), 0u);
+    }
+    instance_list_stats.assign(list_count,
+                               {.tested = 0, .visible = instance_count});
+  }
+  view_instance_stats.clear();
+  for (uint32_t list : view_instance_lists) {
+    view_instance_stats.emplace_back(instance_list_stats[list]);
+  }
+  std::chrono::duration<double, std::milli> duration =
+      std::chrono::steady_clock::now() - start;
+  instance_cull_time = duration.count();
+}
+
+const std::vector<uint32_t>& MeshletCullPass::GetVisibleInstances(
+    uint32_t view) {
+  return instance_lists[view_instance_lists[view]];
+}
+
+const std::vector<BvhCullStats>& MeshletCullPass::GetInstanceCullStats() {
+  return view_instance_stats;
+}
+
+double MeshletCullPass::GetInstanceCullTime() { return instance_cull_time; }
+
+void MeshletCullPass::Cull(uint32_t frame_index) {
+  // the last cull of this frame in flight finished with its fence
+  const auto* counts = static_cast<const uint32_t*>(
+      Context::Instance()->g_meshlet_count_readback_buffer_maped[frame_index]);
+  // the counts pass the capacity of a full list
+  const std::vector<uint32_t>& capacities = frame_view_capacities[frame_index];
+  drawn_view_count = static_cast<uint32_t>(capacities.size());
+  drawn_meshlet_count = 0;
+  dropped_meshlet_count = 0;
+  for (uint32_t i = 0; i < drawn_view_count; ++i) {
+    drawn_meshlet_count += std::min(counts[i], capacities[i]);
+    dropped_meshlet_count += counts[i] - std::min(counts[i], capacities[i]);
+  }
+  drawn_camera_meshlet_count = 0;
+  for (uint32_t view : {Context::Instance()->g_meshlet_camera_view,
+                        Context::Instance()->g_meshlet_late_camera_view}) {
+    if (view < drawn_view_count) {
+      drawn_camera_meshlet_count += std::min(counts[view], capacities[view]);
+    }
+  }
+  occlusion_state =
+      frame_occlusion[frame_index]
+          ? *static_cast<const OcclusionCullState*>(
+                Context::Instance()
+                    ->g_occlusion_readback_buffer_maped[frame_index])
+          : OcclusionCullState{};
+  frame_view_capacities[frame_index].clear();
+  frame_occlusion[frame_index] = false;
+  uint32_t view_count = static_cast<uint32_t>(cull_views.size());
+  // the early phase needs the pyramid of the last frame
+  occlusion_phase = Context::Instance()->g_enable_occlusion_culling &&
+                            HiZPass::HasPyramid() && view_count > 0
+                        ? kOcclusionEarly
+                        : kOcclusionOff;
+  if (view_count == 0) {
+    return;
+  }
+  memcpy(Context::Instance()->g_meshlet_cull_view_buffer_maped[frame_index],
+         cull_views.data(), sizeof(MeshletCullView) * view_count);
+  memcpy(Context::Instance()->g_instance_lod_buffer_maped[frame_index],
+         Context::Instance()->g_instance_lods.data(),
+         sizeof(uint32_t) * Context::Instance()->g_instance_lods.size());
+
+  auto& command_buffer = Context::Instance()->g_command_buffer[frame_index];
+  // the draws of the last frame still read the lists
+  GlobalMemoryBarrier(frame_index, vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::AccessFlagBits2::eTransferWrite |
+                          vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::PipelineStageFlagBits2::eComputeShader |
+                          vk::PipelineStageFlagBits2::eDrawIndirect |
+                          vk::PipelineStageFlagBits2::eVertexShader |
+                          vk::PipelineStageFlagBits2::eFragmentShader |
+                          vk::PipelineStageFlagBits2::eCopy,
+                      vk::PipelineStageFlagBits2::eClear |
+                          vk::PipelineStageFlagBits2::eComputeShader);
+  command_buffer.fillBuffer(Context::Instance()->g_meshlet_count_buffer, 0,
+                            sizeof(uint32_t) * view_count, 0);
+  if (occlusion_phase == kOcclusionEarly) {
+    // no rejects and an empty late dispatch of 0x1x1 workgroups
+    command_buffer.fillBuffer(Context::Instance()->g_occlusion_state_buffer, 0,
+                              sizeof(OcclusionCullState), 0);
+    command_buffer.fillBuffer(
+        Context::Instance()->g_occlusion_state_buffer,
+        offsetof(vk::DispatchIndirectCommand, y), 2 * sizeof(uint32_t), 1);
+  }
+  GlobalMemoryBarrier(frame_index, vk::AccessFlagBits2::eTransferWrite,
+                      vk::AccessFlagBits2::eShaderStorageRead |
+                          vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::PipelineStageFlagBits2::eClear,
+                      vk::PipelineStageFlagBits2::eComputeShader);
+  // an empty scene still needs the zero counts
+  if (ItemCount() > 0) {
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute,
+        Context::Instance()->g_meshlet_cull_pipeline_layout, 0,
+        *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+    if (occlusion_phase == kOcclusionEarly) {
+      CullOccludedInstances(frame_index, view_count, occlusion_phase);
+    }
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                Context::Instance()->g_meshlet_cull_pipeline);
+    command_buffer.pushConstants<MeshletCullPushConstants>(
+        Context::Instance()->g_meshlet_cull_pipeline_layout,
+        vk::ShaderStageFlagBits::eCompute, 0,
+        PushConstants(view_count, occlusion_phase));
+    command_buffer.dispatch(
+        (ItemCount() + kMeshletCullGroupSize - 1) / kMeshletCullGroupSize,
+        view_count, 1);
+  }
+  GlobalMemoryBarrier(frame_index, vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::AccessFlagBits2::eIndirectCommandRead |
+                          vk::AccessFlagBits2::eShaderStorageRead |
+                          vk::AccessFlagBits2::eTransferRead,
+                      vk::PipelineStageFlagBits2::eComputeShader,
+                      vk::PipelineStageFlagBits2::eDrawIndirect |
+                          vk::PipelineStageFlagBits2::eVertexShader |
+                          vk::PipelineStageFlagBits2::eFragmentShader |
+                          vk::PipelineStageFlagBits2::eCopy);
+}
+
+void MeshletCullPass::CullOccluded(uint32_t frame_index) {
+  uint32_t view_count = static_cast<uint32_t>(cull_views.size());
+  if (view_count == 0) {
+    return;
+  }
+  auto& command_buffer = Context::Instance()->g_command_buffer[frame_index];
+  bool late = occlusion_phase == kOcclusionEarly && ItemCount() > 0;
+  if (late) {
+    // the pyramid of the occluders is ready after HiZPass::DrawOccluders
+    GlobalMemoryBarrier(frame_index, vk::AccessFlagBits2::eShaderStorageWrite,
+                        vk::AccessFlagBits2::eShaderStorageRead |
+                            vk::AccessFlagBits2::eShaderStorageWrite |
+                            vk::AccessFlagBits2::eIndirectCommandRead,
+                        vk::PipelineStageFlagBits2::eComputeShader |
+                            vk::PipelineStageFlagBits2::eDrawIndirect |
+                            vk::PipelineStageFlagBits2::eVertexShader |
+                            vk::PipelineStageFlagBits2::eFragmentShader,
+                        vk::PipelineStageFlagBits2::eComputeShader |
+                            vk::PipelineStageFlagBits2::eDrawIndirect);
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute,
+        Context::Instance()->g_meshlet_cull_pipeline_layout, 0,
+        *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+    CullOccludedInstances(frame_index, view_count, kOcclusionLate);
+    command_buffer.bindPipeline(
+        vk::PipelineBindPoint::eCompute,
+        Context::Instance()->g_meshlet_occlusion_pipeline);
+    command_buffer.pushConstants<MeshletCullPushConstants>(
+        Context::Instance()->g_meshlet_cull_pipeline_layout,
+        vk::ShaderStageFlagBits::eCompute, 0,
+        PushConstants(view_count, kOcclusionLate));
+    command_buffer.dispatchIndirect(
+        Context::Instance()->g_occlusion_state_buffer,
+        offsetof(OcclusionCullState, late_dispatch));
+    GlobalMemoryBarrier(frame_index, vk::AccessFlagBits2::eShaderStorageWrite,
+                        vk::AccessFlagBits2::eIndirectCommandRead |
+                            vk::AccessFlagBits2::eShaderStorageRead |
+                            vk::AccessFlagBits2::eTransferRead,
+                        vk::PipelineStageFlagBits2::eComputeShader,
+                        vk::PipelineStageFlagBits2::eDrawIndirect |
+                            vk::PipelineStageFlagBits2::eVertexShader |
+                            vk::PipelineStageFlagBits2::eFragmentShader |
+                            vk::PipelineStageFlagBits2::eCopy);
+  }
+  command_buffer.copyBuffer(
+      Context::Instance()->g_meshlet_count_buffer,
+      Context::Instance()->g_meshlet_count_readback_buffer[frame_index],
+      vk::BufferCopy{.srcOffset = 0,
+                     .dstOffset = 0,
+                     .size = sizeof(uint32_t) * view_count});
+  if (occlusion_phase == kOcclusionEarly) {
+    command_buffer.copyBuffer(
+        Context::Instance()->g_occlusion_state_buffer,
+        Context::Instance()->g_occlusion_readback_buffer[frame_index],
+        vk::BufferCopy{.srcOffset = 0,
+                       .dstOffset = 0,
+                       .size = sizeof(OcclusionCullState)});
+  }
+  GlobalMemoryBarrier(frame_index, vk::AccessFlagBits2::eTransferWrite,
+                      vk::AccessFlagBits2::eHostRead,
+                      vk::PipelineStageFlagBits2::eCopy,
+                      vk::PipelineStageFlagBits2::eHost);
+  frame_view_capacities[frame_index].clear();
+  for (const MeshletCullView& view : cull_views) {
+    frame_view_capacities[frame_index].emplace_back(view.draw_capacity);
+  }
+  frame_occlusion[frame_index] = occlusion_phase == kOcclusionEarly;
+}
+
+void MeshletCullPass::DrawView(uint32_t frame_index, uint32_t view) {
+  const MeshletCullView& cull_view = cull_views[view];
+  Context::Instance()->g_command_buffer[frame_index].drawIndexedIndirectCount(
+      Context::Instance()->g_meshlet_draw_buffer,
+      sizeof(MeshletDraw) * cull_view.draw_offset,
+      Context::Instance()->g_meshlet_count_buffer, sizeof(uint32_t) * view,
+      cull_view.draw_capacity, sizeof(MeshletDraw));
+}
+
+void MeshletCullPass::DrawCameraView(uint32_t frame_index) {
+  DrawView(frame_index, Context::Instance()->g_meshlet_camera_view);
+  DrawView(frame_index, Context::Instance()->g_meshlet_late_camera_view);
+}
+
+void MeshletCullPass::DrawLateCameraView(uint32_t frame_index) {
+  DrawView(frame_index, Context::Instance()->g_meshlet_late_camera_view);
+}
+
+bool MeshletCullPass::CullsOcclusion() {
+  return occlusion_phase == kOcclusionEarly;
+}
+
+uint32_t MeshletCullPass::GetDrawnMeshletCount() {
+  return drawn_meshlet_count;
+}
+
+uint32_t MeshletCullPass::GetViewCount() { return drawn_view_count; }
+
+uint32_t MeshletCullPass::GetDroppedMeshletCount() {
+  return dropped_meshlet_count;
+}
+
+uint32_t MeshletCullPass::GetDrawnCameraMeshletCount() {
+  return drawn_camera_meshlet_count;
+}
+
+const OcclusionCullState& MeshletCullPass::GetOcclusionState() {
+  return occlusion_state;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "data.h"
+#include "instance_bvh.h"
+#include "third_part/vulkan_headers.h"
+
+namespace MeshletCullPass {
+void UpdateResources();
+void CreatePipeline(const vk::raii::ShaderModule& shader_module);
+void UpdateDescriptorSetInfo();
+// drops the views of the last frame, called before the passes add theirs
+void ResetViews();
+// draw list of a view culled by the next Cull, model_view_proj and eye are
+// in the space of the instances, eye.w = 1 enables the normal cone test, only
+// for back face culled passes, the list keeps at most max_draw_count meshlets
+uint32_t AddView(
+    const glm::mat4& model_view_proj, MeshletCullFilter filter,
+    const glm::vec4& eye = glm::vec4(0.0f),
+    uint32_t max_draw_count = std::numeric_limits<uint32_t>::max());
+// culls the instances against every view added this frame on the job system,
+// called after the last AddView and before the levels are selected
+void CullInstances();
+// instances of the view the last CullInstances kept, all of them without
+// instance culling
+const std::vector<uint32_t>& GetVisibleInstances(uint32_t view);
+// one per view of the last CullInstances
+const std::vector<BvhCullStats>& GetInstanceCullStats();
+double GetInstanceCullTime();
+// culls the meshlets of every instance against every view added this frame
+// and compacts the survivors of each view into its draw list, recorded before
+// the first DrawView of the frame, without meshlet culling the lists keep
+// every meshlet of the selected levels. with occlusion culling the camera
+// view also drops what lies behind the hi-z pyramid of the last frame
+void Cull(uint32_t frame_index);
+// late phase of the occlusion culling, what Cull dropped behind the old
+// pyramid is tested against the one HiZPass::DrawOccluders built from the
+// camera list and the visible part fills the late camera list, recorded after
+// HiZPass::DrawOccluders and before the camera lists are drawn, also every
+// frame without occlusion culling as it reads back the counts
+void CullOccluded(uint32_t frame_index);
+// the survivors of a view in one indirect draw, the index buffer and a
+// pipeline reading the instances must be bound
+void DrawView(uint32_t frame_index, uint32_t view);
+// the camera list and the late camera list
+void DrawCameraView(uint32_t frame_index);
+// what the late phase found in front of the occluders, for the passes that
+// load the depth of HiZPass::DrawOccluders
+void DrawLateCameraView(uint32_t frame_index);
+// true if the last Cull ran the early phase, the occluders are drawn this
+// frame and the main pass starts from their depth
+bool CullsOcclusion();
+// summed over all views of the last frame read back
+uint32_t GetDrawnMeshletCount();
+uint32_t GetViewCount();
+// survivors that did not fit into their list, e.g. a local light reaching
+// more than kMaxLocalLightMeshletDraws meshlets
+uint32_t GetDroppedMeshletCount();
+// both camera lists
+uint32_t GetDrawnCameraMeshletCount();
+// of the last frame read back, all 0 if it did not cull occlusion
+const OcclusionCullState& GetOcclusionState();
+}  // namespace MeshletCullPass
@@ -0,0 +1,324 @@
+#include "oit_pass.h"
+
+#include <vector>
+
+#include "context.h"
+#include "descriptor_set.h"
+#include "memory.h"
+#include "particle_pass.h"
+#include "swapchain.h"
+#include "utils.h"
+
+namespace {
+// attachments of the transparency scope are accumulation, revealage and the
+// lit scene, transparent draws write the first two and the composite the last
+std::vector<uint32_t> transparent_attachment_locations{0, 1,
+                                                       vk::AttachmentUnused};
+std::vector<uint32_t> composite_attachment_locations{
+    vk::AttachmentUnused, vk::AttachmentUnused, 0};
+
+void CreateOitResources() {
+  // only read back as input attachments inside the same scope
+  CreateImage(Context::Instance()->g_swapchain_extent.width,
+              Context::Instance()->g_swapchain_extent.height, 1,
+              vk::SampleCountFlagBits::e1,
+              Context::Instance()->g_oit_accum_format,
+              vk::ImageTiling::eOptimal,
+              vk::ImageUsageFlagBits::eTransientAttachment |
+                  vk::ImageUsageFlagBits::eColorAttachment |
+                  vk::ImageUsageFlagBits::eInputAttachment,
+              vk::MemoryPropertyFlagBits::eDeviceLocal,
+              Context::Instance()->g_oit_accum_image,
+              Context::Instance()->g_oit_accum_image_memory);
+  Context::Instance()->g_oit_accum_image_view = CreateImageView(
+      *Context::Instance()->g_oit_accum_image, 0, 1,
+      Context::Instance()->g_oit_accum_format, vk::ImageAspectFlagBits::eColor);
+  CreateImage(Context::Instance()->g_swapchain_extent.width,
+              Context::Instance()->g_swapchain_extent.height, 1,
+              vk::SampleCountFlagBits::e1,
+              Context::Instance()->g_oit_revealage_format,
+              vk::ImageTiling::eOptimal,
+              vk::ImageUsageFlagBits::eTransientAttachment |
+                  vk::ImageUsageFlagBits::eColorAttachment |
+                  vk::ImageUsageFlagBits::eInputAttachment,
+              vk::MemoryPropertyFlagBits::eDeviceLocal,
+              Context::Instance()->g_oit_revealage_image,
+              Context::Instance()->g_oit_revealage_image_memory);
+  Context::Instance()->g_oit_revealage_image_view =
+      CreateImageView(*Context::Instance()->g_oit_revealage_image, 0, 1,
+                      Context::Instance()->g_oit_revealage_format,
+                      vk::ImageAspectFlagBits::eColor);
+}
+}  // namespace
+
+void OitPass::UpdateResources() {
+  CreateOitResources();
+  SwapChainManager::RegisterRecreateFunction(CreateOitResources);
+}
+
+void OitPass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
+  vk::PipelineShaderStageCreateInfo
+      composite_pipeline_shader_stage_create_info[2] = {
+          {
+              .stage = vk::ShaderStageFlagBits::eVertex,
+              .module = shader_module,
+              .pName = "vertOitComposite",
+              .pSpecializationInfo = nullptr,
+          },
+          {
+              .stage = vk::ShaderStageFlagBits::eFragment,
+              .module = shader_module,
+              .pName = "fragOitComposite",
+              .pSpecializationInfo = nullptr,
+          },
+      };
+  std::vector dynamic_states = {vk::DynamicState::eViewport,
+                                vk::DynamicState::eScissor};
+  vk::PipelineDynamicStateCreateInfo dyanmic_state_create_info = {
+      .dynamicStateCount = static_cast<uint32_t>(dynamic_states.size()),
+      .pDynamicStates = dynamic_states.data(),
+  };
+  vk::PipelineViewportStateCreateInfo viewport_state_info{
+      .viewportCount = 1,
+      .pViewports = nullptr,
+      .scissorCount = 1,
+      .pScissors = nullptr,
+  };
+  vk::PipelineMultisampleStateCreateInfo multisample_create_info{
+      .rasterizationSamples = vk::SampleCountFlagBits::e1,
+      .sampleShadingEnable = vk::False,
+  };
+  // accumulation and revealage are only read, the average transparent color
+  // is blended over the scene with the total coverage
+  vk::PipelineColorBlendAttachmentState masked_blend_attachment{
+      .blendEnable = vk::False,
+      .colorWriteMask = {},
+  };
+  vk::PipelineColorBlendAttachmentState composite_blend_attachment{
+      .blendEnable = vk::True,
+      .srcColorBlendFactor = vk::BlendFactor::eSrcAlpha,
+      .dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha,
+      .colorBlendOp = vk::BlendOp::eAdd,
+      .srcAlphaBlendFactor = vk::BlendFactor::eOne,
+      .dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha,
+      .alphaBlendOp = vk::BlendOp::eAdd,
+      .colorWriteMask =
+          vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+          vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA,
+  };
+  std::vector<vk::PipelineColorBlendAttachmentState>
+      composite_color_blend_infos{masked_blend_attachment,
+                                  masked_blend_attachment,
+                                  composite_blend_attachment};
+  vk::PipelineColorBlendStateCreateInfo composite_color_blend_info{
+      .logicOpEnable = vk::False,
+      .logicOp = vk::LogicOp::eCopy,
+      .attachmentCount =
+          static_cast<uint32_t>(composite_color_blend_infos.size()),
+      .pAttachments = composite_color_blend_infos.data(),
+  };
+  vk::PipelineVertexInputStateCreateInfo composite_vertex_input_info{};
+  vk::PipelineInputAssemblyStateCreateInfo composite_input_assembly_info{
+      .topology = vk::PrimitiveTopology::eTriangleStrip};
+  vk::PipelineRasterizationStateCreateInfo composite_rasterization_create_info{
+      .depthClampEnable = vk::False,
+      .rasterizerDiscardEnable = vk::False,
+      .polygonMode = vk::PolygonMode::eFill,
+      .cullMode = vk::CullModeFlagBits::eBack,
+      .frontFace = vk::FrontFace::eClockwise,
+      .depthBiasEnable = vk::False,
+      .depthBiasConstantFactor = 1.0f,
+      .depthBiasClamp = 0.0f,
+      .depthBiasSlopeFactor = 0.0f,
+      .lineWidth = 1.0f,
+  };
+  vk::PipelineDepthStencilStateCreateInfo composite_depth_stencil_info{
+      .depthTestEnable = vk::False,
+      .depthWriteEnable = vk::False,
+      .depthCompareOp = vk::CompareOp::eLess,
+      .depthBoundsTestEnable = vk::False,
+      .stencilTestEnable = vk::False,
+  };
+  vk::RenderingAttachmentLocationInfo composite_attachment_location_info{
+      .colorAttachmentCount =
+          static_cast<uint32_t>(composite_attachment_locations.size()),
+      .pColorAttachmentLocations = composite_attachment_locations.data(),
+  };
+  std::vector<vk::Format> graphsic_formats{
+      Context::Instance()->g_oit_accum_format,
+      Context::Instance()->g_oit_revealage_format,
+      Context::Instance()->g_hdr_format,
+  };
+  vk::PipelineRenderingCreateInfo composite_pipeline_rending_info{
+      .pNext = &composite_attachment_location_info,
+      .colorAttachmentCount = static_cast<uint32_t>(graphsic_formats.size()),
+      .pColorAttachmentFormats = graphsic_formats.data(),
+      .depthAttachmentFormat = Context::Instance()->g_depth_image_format,
+  };
+  vk::PipelineLayoutCreateInfo composite_pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount = 0,
+      .pPushConstantRanges = nullptr,
+  };
+  Context::Instance()->g_oit_composite_pipeline_layout =
+      vk::raii::PipelineLayout(Context::Instance()->g_device,
+                               composite_pipeline_layout_info);
+  vk::GraphicsPipelineCreateInfo composite_pipeline_info{
+      .pNext = &composite_pipeline_rending_info,
+      .stageCount = 2,
+      .pStages = composite_pipeline_shader_stage_create_info,
+      .pVertexInputState = &composite_vertex_input_info,
+      .pInputAssemblyState = &composite_input_assembly_info,
+      .pTessellationState = {},
+      .pViewportState = &viewport_state_info,
+      .pRasterizationState = &composite_rasterization_create_info,
+      .pMultisampleState = &multisample_create_info,
+      .pDepthStencilState = &composite_depth_stencil_info,
+      .pColorBlendState = &composite_color_blend_info,
+      .pDynamicState = &dyanmic_state_create_info,
+      .layout = Context::Instance()->g_oit_composite_pipeline_layout,
+      .renderPass = nullptr,
+      .subpass = {},
+      .basePipelineHandle = {},
+      .basePipelineIndex = {},
+  };
+  Context::Instance()->g_oit_composite_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, composite_pipeline_info);
+}
+
+void OitPass::Draw(uint32_t image_index, uint32_t frame_index,
+                   vk::Viewport viewport, vk::Rect2D scissor) {
+  // the opaque scope stored the depth and the lit scene
+  TransformImageLayout(Context::Instance()->g_depth_image, frame_index,
+                       vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+                       vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+                       vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                       vk::AccessFlagBits2::eDepthStencilAttachmentRead,
+                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                           vk::PipelineStageFlagBits2::eLateFragmentTests,
+                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                           vk::PipelineStageFlagBits2::eLateFragmentTests,
+                       vk::ImageAspectFlagBits::eDepth);
+  TransformImageLayout(Context::Instance()->g_hdr_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eColorAttachmentWrite,
+                       vk::AccessFlagBits2::eColorAttachmentRead |
+                           vk::AccessFlagBits2::eColorAttachmentWrite,
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput);
+  // local read needs the general layout
+  for (const vk::raii::Image* image :
+       {&Context::Instance()->g_oit_accum_image,
+        &Context::Instance()->g_oit_revealage_image}) {
+    TransformImageLayout(**image, frame_index, vk::ImageLayout::eUndefined,
+                         vk::ImageLayout::eGeneral, {},
+                         vk::AccessFlagBits2::eColorAttachmentWrite,
+                         vk::PipelineStageFlagBits2::eTopOfPipe,
+                         vk::PipelineStageFlagBits2::eColorAttachmentOutput);
+  }
+  std::vector<vk::RenderingAttachmentInfo> attachment_infos{
+      {
+          .imageView = Context::Instance()->g_oit_accum_image_view,
+          .imageLayout = vk::ImageLayout::eGeneral,
+          .loadOp = vk::AttachmentLoadOp::eClear,
+          .storeOp = vk::AttachmentStoreOp::eDontCare,
+          .clearValue = vk::ClearColorValue{0.0f, 0.0f, 0.0f, 0.0f},
+      },
+      {
+          .imageView = Context::Instance()->g_oit_revealage_image_view,
+          .imageLayout = vk::ImageLayout::eGeneral,
+          .loadOp = vk::AttachmentLoadOp::eClear,
+          .storeOp = vk::AttachmentStoreOp::eDontCare,
+          .clearValue = vk::ClearColorValue{1.0f, 0.0f, 0.0f, 0.0f},
+      },
+      {
+          .imageView = Context::Instance()->g_hdr_image_view,
+          .imageLayout = vk::ImageLayout::eGeneral,
+          .loadOp = vk::AttachmentLoadOp::eLoad,
+          .storeOp = vk::AttachmentStoreOp::eStore,
+      },
+  };
+  vk::RenderingAttachmentInfo depth_info{
+      .imageView = Context::Instance()->g_depth_image_view,
+      .imageLayout = vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+      .loadOp = vk::AttachmentLoadOp::eLoad,
+      .storeOp = vk::AttachmentStoreOp::eNone,
+  };
+  vk::RenderingInfo rendering_info{
+      .renderArea = {.offset = {0, 0},
+                     .extent = Context::Instance()->g_swapchain_extent},
+      .layerCount = 1,
+      .colorAttachmentCount = static_cast<uint32_t>(attachment_infos.size()),
+      .pColorAttachments = attachment_infos.data(),
+      .pDepthAttachment = &depth_info,
+  };
+  Context::Instance()->g_command_buffer[frame_index].beginRendering(
+      rendering_info);
+  Context::Instance()->g_command_buffer[frame_index].setViewport(0, viewport);
+  Context::Instance()->g_command_buffer[frame_index].setScissor(0, scissor);
+  Context::Instance()
+      ->g_command_buffer[frame_index]
+      .setRenderingAttachmentLocations(vk::RenderingAttachmentLocationInfo{
+          .colorAttachmentCount =
+              static_cast<uint32_t>(transparent_attachment_locations.size()),
+          .pColorAttachmentLocations = transparent_attachment_locations.data(),
+      });
+  // transparent draws, any order
+  ParticlePass::Draw(frame_index);
+  // composite
+  vk::MemoryBarrier2 barrier{
+      .srcStageMask = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+      .srcAccessMask = vk::AccessFlagBits2::eColorAttachmentWrite,
+      .dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+      .dstAccessMask = vk::AccessFlagBits2::eInputAttachmentRead,
+  };
+  vk::DependencyInfo dependency_info{
+      .dependencyFlags = vk::DependencyFlagBits::eByRegion,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+  };
+  Context::Instance()->g_command_buffer[frame_index].pipelineBarrier2(
+      dependency_info);
+  Context::Instance()
+      ->g_command_buffer[frame_index]
+      .setRenderingAttachmentLocations(vk::RenderingAttachmentLocationInfo{
+          .colorAttachmentCount =
+              static_cast<uint32_t>(composite_attachment_locations.size()),
+          .pColorAttachmentLocations = composite_attachment_locations.data(),
+      });
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_oit_composite_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_oit_composite_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  Context::Instance()->g_command_buffer[frame_index].draw(4, 1, 0, 0);
+  Context::Instance()->g_command_buffer[frame_index].endRendering();
+}
+
+void OitPass::UpdateDescriptorSetInfo() {
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr,
+                              *Context::Instance()->g_oit_accum_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        34, vk::DescriptorType::eInputAttachment,
+        vk::ShaderStageFlagBits::eFragment, image_info, {});
+  }
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr,
+                              *Context::Instance()->g_oit_revealage_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        35, vk::DescriptorType::eInputAttachment,
+        vk::ShaderStageFlagBits::eFragment, image_info, {});
+  }
+}
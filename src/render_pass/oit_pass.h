@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+#include "third_part/vulkan_headers.h"
+
+namespace OitPass {
+void UpdateResources();
+void CreatePipeline(const vk::raii::ShaderModule& shader_module);
+// transparent draws into the accumulation and revealage targets, then the
+// composite over g_hdr_image, all in one scope that only reads the depth left
+// by the opaque pass
+void Draw(uint32_t image_index, uint32_t frame_index, vk::Viewport viewport,
+          vk::Rect2D scissor);
+void UpdateDescriptorSetInfo();
+}  // namespace OitPass
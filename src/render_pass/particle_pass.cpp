@@ -1,5 +1,10 @@
 #include "particle_pass.h"
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "command_buffer.h"
 #include "context.h"
 #include "descriptor_set.h"
 #include "memory.h"
@@ -7,12 +12,34 @@
 #include "utils.h"
 
 namespace {
-void CreateParticleResources() {
+// capacity of the buffers in use, g_particle_capacity may already hold the
+// next one until RecreatePool
+uint32_t allocated_capacity = 0;
+// alive list the next simulation reads, flipped after every compute
+uint32_t current_list = 0;
+// fractions of a particle carried over to the next frame
+std::array<double, kMaxParticleEmitters> emit_remainders{};
+// the dead list and the counters are filled by the next compute
+bool reset_pool = true;
+// pending queue family ownership transfers of the vertex buffers
+std::array<bool, 2> released_by_compute{};
+std::array<bool, 2> released_by_graphics{};
+// graphics timeline value signaled once the graphics queue released the
+// vertex buffer of each list
+std::array<uint64_t, 2> graphics_release_values{};
+// screen tiles of the compute rasterizer
+uint32_t tile_count_x = 0;
+uint32_t tile_count_y = 0;
+
+bool AsyncCompute() {
+  return Context::Instance()->g_compute_queue_index !=
+         Context::Instance()->g_queue_index;
+}
+
+void CreateParticleUboBuffers() {
   Context::Instance()->g_particle_ubo_buffer.clear();
   Context::Instance()->g_particle_ubo_buffer_memory.clear();
   Context::Instance()->g_particle_ubo_buffer_maped.clear();
-  Context::Instance()->g_particle_buffer.clear();
-  Context::Instance()->g_particle_buffer_memory.clear();
 
   uint32_t size = sizeof(ParticleUbo);
   for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
@@ -28,50 +55,110 @@ void CreateParticleResources() {
     Context::Instance()->g_particle_ubo_buffer_memory.emplace_back(
         std::move(memory));
     Context::Instance()->g_particle_ubo_buffer_maped.emplace_back(data);
-    size = sizeof(Particle) * Context::Instance()->kParticleCount;
-    buffer = nullptr;
-    memory = nullptr;
-    CreateBuffer(size,
+  }
+}
+
+// every particle starts dead, the pool itself needs no initial data and the
+// dead list is filled on the compute queue that owns it
+void CreateParticlePool() {
+  uint32_t capacity = Context::Instance()->g_particle_capacity;
+  if (capacity == allocated_capacity) {
+    return;
+  }
+  Context::Instance()->g_particle_buffer = nullptr;
+  Context::Instance()->g_particle_buffer_memory = nullptr;
+  Context::Instance()->g_particle_index_buffer = nullptr;
+  Context::Instance()->g_particle_index_buffer_memory = nullptr;
+  Context::Instance()->g_particle_vertex_buffer.clear();
+  Context::Instance()->g_particle_vertex_buffer_memory.clear();
+  Context::Instance()->g_particle_counter_buffer = nullptr;
+  Context::Instance()->g_particle_counter_buffer_memory = nullptr;
+  Context::Instance()->g_particle_splat_buffer = nullptr;
+  Context::Instance()->g_particle_splat_buffer_memory = nullptr;
+
+  CreateBuffer(sizeof(Particle) * capacity,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_particle_buffer,
+               Context::Instance()->g_particle_buffer_memory);
+  CreateBuffer(sizeof(uint32_t) * capacity * 3,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_particle_index_buffer,
+               Context::Instance()->g_particle_index_buffer_memory);
+  CreateBuffer(sizeof(ParticleCounters),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eIndirectBuffer |
+                   vk::BufferUsageFlagBits::eTransferSrc,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_particle_counter_buffer,
+               Context::Instance()->g_particle_counter_buffer_memory);
+  CreateBuffer(sizeof(ParticleSplat) * capacity,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::SharingMode::eExclusive,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_particle_splat_buffer,
+               Context::Instance()->g_particle_splat_buffer_memory);
+  vk::raii::CommandBuffer command_buffer = BeginOneTimeCommandBuffer();
+  for (uint32_t i = 0; i < 2; ++i) {
+    vk::raii::Buffer buffer = nullptr;
+    vk::raii::DeviceMemory memory = nullptr;
+    CreateBuffer(sizeof(ParticleVertex) * (capacity + 1),
                  vk::BufferUsageFlagBits::eStorageBuffer |
                      vk::BufferUsageFlagBits::eVertexBuffer |
+                     vk::BufferUsageFlagBits::eIndirectBuffer |
                      vk::BufferUsageFlagBits::eTransferDst,
                  vk::SharingMode::eExclusive,
                  vk::MemoryPropertyFlagBits::eDeviceLocal, buffer, memory);
-    Context::Instance()->g_particle_buffer.emplace_back(std::move(buffer));
-    Context::Instance()->g_particle_buffer_memory.emplace_back(
+    // zero instances, graphics may draw a list before it was simulated
+    command_buffer.fillBuffer(buffer, 0, sizeof(vk::DrawIndirectCommand), 0);
+    Context::Instance()->g_particle_vertex_buffer.emplace_back(
+        std::move(buffer));
+    Context::Instance()->g_particle_vertex_buffer_memory.emplace_back(
         std::move(memory));
   }
-  std::vector<Particle> particles{Context::Instance()->kParticleCount};
-  constexpr float kParticleRange = 1.3f;
-  for (uint32_t i = 0; i < Context::Instance()->kParticleCount; ++i) {
-    particles[i].pos.x =
-        std::rand() / float(RAND_MAX) * kParticleRange - kParticleRange / 2.0f;
-    particles[i].pos.y =
-        std::rand() / float(RAND_MAX) * kParticleRange - kParticleRange / 2.0f;
-    particles[i].pos.z = 0.3f;
-    particles[i].v = glm::vec3{0.0f, 0.0f, 0.2f};
-    particles[i].color = glm::vec3(1.0f);
-  }
-  vk::raii::Buffer temp_buffer = nullptr;
-  vk::raii::DeviceMemory temp_memory = nullptr;
-  size = sizeof(Particle) * Context::Instance()->kParticleCount;
-  CreateBuffer(size, vk::BufferUsageFlagBits::eTransferSrc,
+  EndOneTimeCommandBuffer(command_buffer);
+
+  allocated_capacity = capacity;
+  current_list = 0;
+  reset_pool = true;
+  released_by_compute = {};
+  released_by_graphics = {};
+  graphics_release_values = {};
+}
+
+// the counts are cleared before every binning
+void CreateParticleTiles() {
+  tile_count_x = (Context::Instance()->g_swapchain_extent.width +
+                  kParticleTileSize - 1) /
+                 kParticleTileSize;
+  tile_count_y = (Context::Instance()->g_swapchain_extent.height +
+                  kParticleTileSize - 1) /
+                 kParticleTileSize;
+  Context::Instance()->g_particle_tile_buffer = nullptr;
+  Context::Instance()->g_particle_tile_buffer_memory = nullptr;
+  CreateBuffer(sizeof(uint32_t) * tile_count_x * tile_count_y *
+                   (1 + kParticleTileCapacity),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
                vk::SharingMode::eExclusive,
-               vk::MemoryPropertyFlagBits::eHostVisible |
-                   vk::MemoryPropertyFlagBits::eHostCoherent,
-               temp_buffer, temp_memory);
-  void* data = temp_memory.mapMemory(0, size);
-  memcpy(data, particles.data(), size);
-  temp_memory.unmapMemory();
-  CopyBuffer(
-      temp_buffer,
-      Context::Instance()
-          ->g_particle_buffer[Context::Instance()->g_frame_in_flight - 1],
-      size);
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               Context::Instance()->g_particle_tile_buffer,
+               Context::Instance()->g_particle_tile_buffer_memory);
 }
 }  // namespace
 
-void ParticlePass::UpdateResources() { CreateParticleResources(); }
+void ParticlePass::UpdateResources() {
+  CreateParticleUboBuffers();
+  CreateParticlePool();
+  CreateParticleTiles();
+  SwapChainManager::RegisterRecreateFunction(CreateParticleTiles);
+}
+
+void ParticlePass::RecreatePool() { CreateParticlePool(); }
 
 void ParticlePass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
   vk::PipelineShaderStageCreateInfo
@@ -95,8 +182,9 @@ void ParticlePass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
       .dynamicStateCount = static_cast<uint32_t>(dynamic_states.size()),
       .pDynamicStates = dynamic_states.data(),
   };
-  auto binding_desc = Particle::GetBindingDescription();
-  auto particle_attribute_desc = Particle::GetAttributeDescription();
+  auto binding_desc = ParticleVertexLayout::GetBindingDescription();
+  auto particle_attribute_desc =
+      ParticleVertexLayout::GetAttributeDescription();
   vk::PipelineVertexInputStateCreateInfo particle_vertex_input_info{
       .vertexBindingDescriptionCount = 1,
       .pVertexBindingDescriptions = &binding_desc,
@@ -124,7 +212,7 @@ void ParticlePass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
       .lineWidth = 1.0f,
   };
   vk::PipelineMultisampleStateCreateInfo multisample_create_info{
-      .rasterizationSamples = Context::Instance()->g_msaa_samples,
+      .rasterizationSamples = vk::SampleCountFlagBits::e1,
       .sampleShadingEnable = vk::False,
   };
   vk::PipelineDepthStencilStateCreateInfo particle_depth_stencil_info{
@@ -134,20 +222,38 @@ void ParticlePass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
       .depthBoundsTestEnable = vk::False,
       .stencilTestEnable = vk::False,
   };
-  vk::PipelineColorBlendAttachmentState transparent_blend_attachment{
+  // weighted blended oit, the weighted color and coverage add up in the
+  // accumulation target and revealage is multiplied by 1 - alpha, the lit
+  // scene is only written by the composite
+  vk::PipelineColorBlendAttachmentState accum_blend_attachment{
       .blendEnable = vk::True,
-      .srcColorBlendFactor = vk::BlendFactor::eSrcAlpha,
-      .dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha,
+      .srcColorBlendFactor = vk::BlendFactor::eOne,
+      .dstColorBlendFactor = vk::BlendFactor::eOne,
       .colorBlendOp = vk::BlendOp::eAdd,
       .srcAlphaBlendFactor = vk::BlendFactor::eOne,
-      .dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha,
+      .dstAlphaBlendFactor = vk::BlendFactor::eOne,
       .alphaBlendOp = vk::BlendOp::eAdd,
       .colorWriteMask =
           vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
           vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA,
   };
-  std::vector<vk::PipelineColorBlendAttachmentState> particle_color_blend_infos(
-      5, transparent_blend_attachment);
+  vk::PipelineColorBlendAttachmentState revealage_blend_attachment{
+      .blendEnable = vk::True,
+      .srcColorBlendFactor = vk::BlendFactor::eZero,
+      .dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcColor,
+      .colorBlendOp = vk::BlendOp::eAdd,
+      .srcAlphaBlendFactor = vk::BlendFactor::eZero,
+      .dstAlphaBlendFactor = vk::BlendFactor::eOne,
+      .alphaBlendOp = vk::BlendOp::eAdd,
+      .colorWriteMask = vk::ColorComponentFlagBits::eR,
+  };
+  vk::PipelineColorBlendAttachmentState masked_blend_attachment{
+      .blendEnable = vk::False,
+      .colorWriteMask = {},
+  };
+  std::vector<vk::PipelineColorBlendAttachmentState> particle_color_blend_infos{
+      accum_blend_attachment, revealage_blend_attachment,
+      masked_blend_attachment};
   vk::PipelineColorBlendStateCreateInfo particle_color_blend_info{
       .logicOpEnable = vk::False,
       .logicOp = vk::LogicOp::eCopy,
@@ -161,14 +267,21 @@ void ParticlePass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
       .pushConstantRangeCount = 0,
       .pPushConstantRanges = nullptr,
   };
+  // attachments of the oit scope, see oit_pass.cpp
+  std::vector<uint32_t> particle_attachment_locations{0, 1,
+                                                      vk::AttachmentUnused};
+  vk::RenderingAttachmentLocationInfo particle_attachment_location_info{
+      .colorAttachmentCount =
+          static_cast<uint32_t>(particle_attachment_locations.size()),
+      .pColorAttachmentLocations = particle_attachment_locations.data(),
+  };
   std::vector<vk::Format> graphsic_formats{
-      Context::Instance()->g_gbuffer_format,
-      Context::Instance()->g_gbuffer_format,
-      Context::Instance()->g_gbuffer_format,
-      Context::Instance()->g_gbuffer_format,
-      Context::Instance()->g_gbuffer_format,
+      Context::Instance()->g_oit_accum_format,
+      Context::Instance()->g_oit_revealage_format,
+      Context::Instance()->g_hdr_format,
   };
   vk::PipelineRenderingCreateInfo particle_pipeline_rending_info{
+      .pNext = &particle_attachment_location_info,
       .colorAttachmentCount = static_cast<uint32_t>(graphsic_formats.size()),
       .pColorAttachmentFormats = graphsic_formats.data(),
       .depthAttachmentFormat = Context::Instance()->g_depth_image_format,
@@ -198,35 +311,320 @@ void ParticlePass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
   Context::Instance()->g_particle_pipeline = vk::raii::Pipeline(
       Context::Instance()->g_device, nullptr, particle_pipeline_info);
 
-  vk::PipelineShaderStageCreateInfo compute_pipeline_shader_stage_create_info{
-      .stage = vk::ShaderStageFlagBits::eCompute,
-      .module = shader_module,
-      .pName = "compParticle",
-      .pSpecializationInfo = nullptr,
-  };
   vk::PipelineLayoutCreateInfo compute_pipeline_layout_info{
       .setLayoutCount = 1,
       .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
   };
-  Context::Instance()->g_compute_pipeline_layout = vk::raii::PipelineLayout(
-      Context::Instance()->g_device, compute_pipeline_layout_info);
-  vk::ComputePipelineCreateInfo compute_pipeline_info{
-      .stage = compute_pipeline_shader_stage_create_info,
-      .layout = Context::Instance()->g_compute_pipeline_layout,
+  Context::Instance()->g_particle_compute_pipeline_layout =
+      vk::raii::PipelineLayout(Context::Instance()->g_device,
+                               compute_pipeline_layout_info);
+  auto create_compute_pipeline = [&](const char* entry,
+                                     const vk::raii::PipelineLayout& layout) {
+    vk::ComputePipelineCreateInfo compute_pipeline_info{
+        .stage =
+            {
+                .stage = vk::ShaderStageFlagBits::eCompute,
+                .module = shader_module,
+                .pName = entry,
+                .pSpecializationInfo = nullptr,
+            },
+        .layout = layout,
+    };
+    return vk::raii::Pipeline(Context::Instance()->g_device, nullptr,
+                              compute_pipeline_info);
+  };
+  const vk::raii::PipelineLayout& simulation_layout =
+      Context::Instance()->g_particle_compute_pipeline_layout;
+  Context::Instance()->g_particle_init_pipeline =
+      create_compute_pipeline("compParticleInit", simulation_layout);
+  Context::Instance()->g_particle_kickoff_pipeline =
+      create_compute_pipeline("compParticleKickoff", simulation_layout);
+  Context::Instance()->g_particle_emit_pipeline =
+      create_compute_pipeline("compParticleEmit", simulation_layout);
+  Context::Instance()->g_particle_simulate_pipeline =
+      create_compute_pipeline("compParticleSimulate", simulation_layout);
+
+  std::vector<vk::PushConstantRange> raster_push_constant_range{{
+      .stageFlags = vk::ShaderStageFlagBits::eCompute,
+      .offset = 0,
+      .size = sizeof(ParticleRasterPushConstants),
+  }};
+  vk::PipelineLayoutCreateInfo raster_pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount =
+          static_cast<uint32_t>(raster_push_constant_range.size()),
+      .pPushConstantRanges = raster_push_constant_range.data(),
   };
-  Context::Instance()->g_compute_pipeline = vk::raii::Pipeline(
-      Context::Instance()->g_device, nullptr, compute_pipeline_info);
+  Context::Instance()->g_particle_raster_pipeline_layout =
+      vk::raii::PipelineLayout(Context::Instance()->g_device,
+                               raster_pipeline_layout_info);
+  const vk::raii::PipelineLayout& raster_layout =
+      Context::Instance()->g_particle_raster_pipeline_layout;
+  Context::Instance()->g_particle_bin_pipeline =
+      create_compute_pipeline("compParticleBin", raster_layout);
+  Context::Instance()->g_particle_splat_pipeline =
+      create_compute_pipeline("compParticleSplat", raster_layout);
 }
 
-void ParticlePass::Compute(uint32_t compute_cb_index, uint32_t frame_index) {
-  Context::Instance()->g_command_buffer[compute_cb_index].bindPipeline(
-      vk::PipelineBindPoint::eCompute, Context::Instance()->g_compute_pipeline);
-  Context::Instance()->g_command_buffer[compute_cb_index].bindDescriptorSets(
+void ParticlePass::UpdateEmitters(ParticleUbo& ubo) {
+  const auto& emitters = Context::Instance()->g_particle_emitters;
+  ubo.emitter_count = std::min<uint32_t>(emitters.size(), kMaxParticleEmitters);
+  ubo.capacity = allocated_capacity;
+  ubo.seed = Context::Instance()->g_frame_count;
+  ubo.current_list = current_list;
+  for (uint32_t i = 0; i < ubo.emitter_count; ++i) {
+    ubo.emitters[i] = emitters[i];
+    double count = emitters[i].rate * ubo.delta_time + emit_remainders[i];
+    // a long hitch must not ask for more than the pool holds
+    count = std::min(count, static_cast<double>(allocated_capacity));
+    ubo.emitters[i].emit_count = static_cast<uint32_t>(count);
+    emit_remainders[i] = count - ubo.emitters[i].emit_count;
+  }
+}
+
+void ParticlePass::Compute(uint32_t compute_cb_index,
+                           uint32_t descriptor_set_index) {
+  auto& command_buffer =
+      Context::Instance()->g_command_buffer[compute_cb_index];
+  uint32_t graphics_family = Context::Instance()->g_queue_index;
+  uint32_t compute_family = Context::Instance()->g_compute_queue_index;
+  uint32_t output_list = 1 - current_list;
+  const auto& output_buffer =
+      Context::Instance()->g_particle_vertex_buffer[output_list];
+  // the last simulation wrote the lists and the counters
+  GlobalMemoryBarrier(compute_cb_index,
+                      vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::AccessFlagBits2::eIndirectCommandRead |
+                          vk::AccessFlagBits2::eShaderStorageRead |
+                          vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::PipelineStageFlagBits2::eComputeShader,
+                      vk::PipelineStageFlagBits2::eDrawIndirect |
+                          vk::PipelineStageFlagBits2::eComputeShader);
+  if (!AsyncCompute()) {
+    // the draw before the last one still reads the output list
+    GlobalMemoryBarrier(compute_cb_index, {}, {},
+                        vk::PipelineStageFlagBits2::eDrawIndirect |
+                            vk::PipelineStageFlagBits2::eVertexAttributeInput |
+                            vk::PipelineStageFlagBits2::eComputeShader,
+                        vk::PipelineStageFlagBits2::eComputeShader |
+                            vk::PipelineStageFlagBits2::eCopy);
+  } else if (released_by_graphics[output_list]) {
+    BufferMemoryBarrier(compute_cb_index, output_buffer, {},
+                        vk::AccessFlagBits2::eShaderStorageWrite |
+                            vk::AccessFlagBits2::eTransferWrite,
+                        vk::PipelineStageFlagBits2::eNone,
+                        vk::PipelineStageFlagBits2::eComputeShader |
+                            vk::PipelineStageFlagBits2::eCopy,
+                        graphics_family, compute_family);
+    released_by_graphics[output_list] = false;
+  }
+  command_buffer.bindDescriptorSets(
       vk::PipelineBindPoint::eCompute,
-      Context::Instance()->g_compute_pipeline_layout, 0,
+      Context::Instance()->g_particle_compute_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[descriptor_set_index], nullptr);
+  if (reset_pool) {
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                Context::Instance()->g_particle_init_pipeline);
+    command_buffer.dispatch((allocated_capacity + 255) / 256, 1, 1);
+    GlobalMemoryBarrier(compute_cb_index,
+                        vk::AccessFlagBits2::eShaderStorageWrite,
+                        vk::AccessFlagBits2::eShaderStorageRead |
+                            vk::AccessFlagBits2::eShaderStorageWrite,
+                        vk::PipelineStageFlagBits2::eComputeShader,
+                        vk::PipelineStageFlagBits2::eComputeShader);
+    reset_pool = false;
+  }
+  command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                              Context::Instance()->g_particle_kickoff_pipeline);
+  command_buffer.dispatch(1, 1, 1);
+  GlobalMemoryBarrier(compute_cb_index,
+                      vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::AccessFlagBits2::eIndirectCommandRead |
+                          vk::AccessFlagBits2::eShaderStorageRead |
+                          vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::PipelineStageFlagBits2::eComputeShader,
+                      vk::PipelineStageFlagBits2::eDrawIndirect |
+                          vk::PipelineStageFlagBits2::eComputeShader);
+  command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                              Context::Instance()->g_particle_emit_pipeline);
+  command_buffer.dispatchIndirect(
+      Context::Instance()->g_particle_counter_buffer,
+      offsetof(ParticleCounters, emit_dispatch));
+  GlobalMemoryBarrier(compute_cb_index,
+                      vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::AccessFlagBits2::eShaderStorageRead |
+                          vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::PipelineStageFlagBits2::eComputeShader,
+                      vk::PipelineStageFlagBits2::eComputeShader);
+  command_buffer.bindPipeline(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_particle_simulate_pipeline);
+  command_buffer.dispatchIndirect(
+      Context::Instance()->g_particle_counter_buffer,
+      offsetof(ParticleCounters, simulate_dispatch));
+  // the draw arguments of the output list lead its vertex buffer
+  GlobalMemoryBarrier(compute_cb_index,
+                      vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::AccessFlagBits2::eTransferRead,
+                      vk::PipelineStageFlagBits2::eComputeShader,
+                      vk::PipelineStageFlagBits2::eCopy);
+  command_buffer.copyBuffer(
+      Context::Instance()->g_particle_counter_buffer, output_buffer,
+      vk::BufferCopy{
+          .srcOffset = offsetof(ParticleCounters, draw) +
+                       sizeof(vk::DrawIndirectCommand) * output_list,
+          .dstOffset = 0,
+          .size = sizeof(vk::DrawIndirectCommand)});
+  if (!AsyncCompute()) {
+    GlobalMemoryBarrier(compute_cb_index,
+                        vk::AccessFlagBits2::eShaderStorageWrite |
+                            vk::AccessFlagBits2::eTransferWrite,
+                        vk::AccessFlagBits2::eIndirectCommandRead |
+                            vk::AccessFlagBits2::eVertexAttributeRead |
+                            vk::AccessFlagBits2::eShaderStorageRead,
+                        vk::PipelineStageFlagBits2::eComputeShader |
+                            vk::PipelineStageFlagBits2::eCopy,
+                        vk::PipelineStageFlagBits2::eDrawIndirect |
+                            vk::PipelineStageFlagBits2::eVertexAttributeInput |
+                            vk::PipelineStageFlagBits2::eComputeShader);
+  } else {
+    BufferMemoryBarrier(compute_cb_index, output_buffer,
+                        vk::AccessFlagBits2::eShaderStorageWrite |
+                            vk::AccessFlagBits2::eTransferWrite,
+                        {},
+                        vk::PipelineStageFlagBits2::eComputeShader |
+                            vk::PipelineStageFlagBits2::eCopy,
+                        vk::PipelineStageFlagBits2::eNone, compute_family,
+                        graphics_family);
+    released_by_compute[output_list] = true;
+  }
+  current_list = output_list;
+}
+
+uint64_t ParticlePass::GetGraphicsReleaseValue() {
+  return graphics_release_values[1 - current_list];
+}
+
+void ParticlePass::Acquire(uint32_t frame_index) {
+  if (!AsyncCompute() || !released_by_compute[current_list]) {
+    return;
+  }
+  BufferMemoryBarrier(
+      frame_index, Context::Instance()->g_particle_vertex_buffer[current_list],
+      {},
+      vk::AccessFlagBits2::eIndirectCommandRead |
+          vk::AccessFlagBits2::eVertexAttributeRead |
+          vk::AccessFlagBits2::eShaderStorageRead,
+      vk::PipelineStageFlagBits2::eNone,
+      vk::PipelineStageFlagBits2::eDrawIndirect |
+          vk::PipelineStageFlagBits2::eVertexAttributeInput |
+          vk::PipelineStageFlagBits2::eComputeShader,
+      Context::Instance()->g_compute_queue_index,
+      Context::Instance()->g_queue_index);
+  released_by_compute[current_list] = false;
+}
+
+void ParticlePass::Release(uint32_t frame_index) {
+  if (!AsyncCompute()) {
+    return;
+  }
+  BufferMemoryBarrier(
+      frame_index, Context::Instance()->g_particle_vertex_buffer[current_list],
+      {}, {},
+      vk::PipelineStageFlagBits2::eDrawIndirect |
+          vk::PipelineStageFlagBits2::eVertexAttributeInput |
+          vk::PipelineStageFlagBits2::eComputeShader,
+      vk::PipelineStageFlagBits2::eNone, Context::Instance()->g_queue_index,
+      Context::Instance()->g_compute_queue_index);
+  released_by_graphics[current_list] = true;
+  // signaled by the submit of this command buffer
+  graphics_release_values[current_list] =
+      Context::Instance()->g_graphics_count + 1;
+}
+
+void ParticlePass::Draw(uint32_t frame_index) {
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_particle_pipeline);
+  // the vertices follow the draw arguments
+  Context::Instance()->g_command_buffer[frame_index].bindVertexBuffers(
+      0, *Context::Instance()->g_particle_vertex_buffer[current_list],
+      {sizeof(ParticleVertex)});
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_particle_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  Context::Instance()->g_command_buffer[frame_index].drawIndirect(
+      Context::Instance()->g_particle_vertex_buffer[current_list], 0, 1,
+      sizeof(vk::DrawIndirectCommand));
+}
+
+void ParticlePass::Rasterize(uint32_t frame_index) {
+  auto& command_buffer = Context::Instance()->g_command_buffer[frame_index];
+  // the last splat still reads the tiles and the splats
+  GlobalMemoryBarrier(frame_index, vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::AccessFlagBits2::eTransferWrite |
+                          vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::PipelineStageFlagBits2::eComputeShader,
+                      vk::PipelineStageFlagBits2::eClear |
+                          vk::PipelineStageFlagBits2::eComputeShader);
+  command_buffer.fillBuffer(Context::Instance()->g_particle_tile_buffer, 0,
+                            sizeof(uint32_t) * tile_count_x * tile_count_y,
+                            0);
+  GlobalMemoryBarrier(frame_index, vk::AccessFlagBits2::eTransferWrite,
+                      vk::AccessFlagBits2::eShaderStorageRead |
+                          vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::PipelineStageFlagBits2::eClear,
+                      vk::PipelineStageFlagBits2::eComputeShader);
+  // depth and the lit scene of the opaque scope
+  TransformImageLayout(Context::Instance()->g_depth_image, frame_index,
+                       vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+                       vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+                       vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                       vk::AccessFlagBits2::eShaderSampledRead,
+                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                           vk::PipelineStageFlagBits2::eLateFragmentTests,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::ImageAspectFlagBits::eDepth);
+  TransformImageLayout(Context::Instance()->g_hdr_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eColorAttachmentWrite,
+                       vk::AccessFlagBits2::eShaderStorageRead |
+                           vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  command_buffer.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_particle_raster_pipeline_layout, 0,
       *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
-  Context::Instance()->g_command_buffer[compute_cb_index].dispatch(
-      Context::Instance()->kParticleCount / 256, 1, 1);
+  ParticleRasterPushConstants push_constants{
+      .list = current_list,
+      .capacity = allocated_capacity,
+      .tile_count_x = tile_count_x,
+      .tile_count_y = tile_count_y,
+  };
+  command_buffer.pushConstants<ParticleRasterPushConstants>(
+      Context::Instance()->g_particle_raster_pipeline_layout,
+      vk::ShaderStageFlagBits::eCompute, 0, push_constants);
+  // the alive count is only known on the gpu, threads past it return
+  command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                              Context::Instance()->g_particle_bin_pipeline);
+  command_buffer.dispatch((allocated_capacity + 255) / 256, 1, 1);
+  GlobalMemoryBarrier(frame_index, vk::AccessFlagBits2::eShaderStorageWrite,
+                      vk::AccessFlagBits2::eShaderStorageRead,
+                      vk::PipelineStageFlagBits2::eComputeShader,
+                      vk::PipelineStageFlagBits2::eComputeShader);
+  command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                              Context::Instance()->g_particle_splat_pipeline);
+  command_buffer.dispatch(tile_count_x, tile_count_y, 1);
+  // later passes wait on the color attachment output of the lit scene
+  TransformImageLayout(Context::Instance()->g_hdr_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::AccessFlagBits2::eColorAttachmentWrite,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput);
 }
 
 void ParticlePass::UpdateDescriptorSetInfo() {
@@ -240,29 +638,52 @@ void ParticlePass::UpdateDescriptorSetInfo() {
         2, vk::DescriptorType::eUniformBuffer,
         vk::ShaderStageFlagBits::eCompute, {}, buffer_info);
   }
-  {
+  // the pool is shared by all frames, the simulations run in order on the
+  // compute queue
+  auto register_storage_buffer = [](uint32_t binding,
+                                    const vk::raii::Buffer& buffer,
+                                    vk::DeviceSize size) {
     std::vector<vk::DescriptorBufferInfo> buffer_info;
     for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
-      buffer_info.emplace_back(
-          Context::Instance()
-              ->g_particle_buffer[(i - 1 +
-                                   Context::Instance()->g_frame_in_flight) %
-                                  Context::Instance()->g_frame_in_flight],
-          0, sizeof(Particle) * Context::Instance()->kParticleCount);
+      buffer_info.emplace_back(buffer, 0, size);
     }
     DescriptorSetManager::RegisterDescriptorSetInfo(
-        3, vk::DescriptorType::eStorageBuffer,
+        binding, vk::DescriptorType::eStorageBuffer,
         vk::ShaderStageFlagBits::eCompute, {}, buffer_info);
-  }
+  };
+  register_storage_buffer(3, Context::Instance()->g_particle_buffer,
+                          sizeof(Particle) * allocated_capacity);
+  register_storage_buffer(4, Context::Instance()->g_particle_index_buffer,
+                          sizeof(uint32_t) * allocated_capacity * 3);
+  register_storage_buffer(33, Context::Instance()->g_particle_counter_buffer,
+                          sizeof(ParticleCounters));
   {
     std::vector<vk::DescriptorBufferInfo> buffer_info;
     for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
-      buffer_info.emplace_back(
-          Context::Instance()->g_particle_buffer[i], 0,
-          sizeof(Particle) * Context::Instance()->kParticleCount);
+      for (const auto& buffer :
+           Context::Instance()->g_particle_vertex_buffer) {
+        buffer_info.emplace_back(
+            buffer, 0, sizeof(ParticleVertex) * (allocated_capacity + 1));
+      }
     }
     DescriptorSetManager::RegisterDescriptorSetInfo(
-        4, vk::DescriptorType::eStorageBuffer,
-        vk::ShaderStageFlagBits::eCompute, {}, buffer_info);
+        31, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eCompute, {}, buffer_info, 2);
+  }
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr, *Context::Instance()->g_hdr_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        36, vk::DescriptorType::eStorageImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {});
   }
+  // the rasterizer runs on the graphics queue, one frame at a time
+  register_storage_buffer(37, Context::Instance()->g_particle_splat_buffer,
+                          sizeof(ParticleSplat) * allocated_capacity);
+  register_storage_buffer(38, Context::Instance()->g_particle_tile_buffer,
+                          sizeof(uint32_t) * tile_count_x * tile_count_y *
+                              (1 + kParticleTileCapacity));
 }
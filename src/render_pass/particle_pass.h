@@ -2,12 +2,32 @@
 
 #include <cstdint>
 
+#include "data.h"
 #include "third_part/vulkan_headers.h"
 
 namespace ParticlePass {
 void UpdateResources();
+// after g_particle_capacity changed, the device must be idle and the
+// descriptor sets updated afterwards
+void RecreatePool();
 void CreatePipeline(const vk::raii::ShaderModule& shader_module);
-void Compute(uint32_t compute_cb_index, uint32_t frame_index);
-// draw particle is in draw pass, ect. defer_lighting_pass
+// emit counts of this frame from the emitter rates and ubo.delta_time
+void UpdateEmitters(ParticleUbo& ubo);
+// kickoff, emit and simulate on the compute queue, the cost on the cpu does
+// not depend on the number of particles
+void Compute(uint32_t compute_cb_index, uint32_t descriptor_set_index);
+// graphics timeline value the next Compute has to wait for before it writes
+// its output list
+uint64_t GetGraphicsReleaseValue();
+// queue family ownership of the drawn list, recorded outside of rendering at
+// the start and the end of the graphics command buffer
+void Acquire(uint32_t frame_index);
+void Release(uint32_t frame_index);
+// weighted blended particles inside the transparency scope of oit_pass
+void Draw(uint32_t frame_index);
+// compute alternative to Draw outside of rendering, bins the drawn list into
+// screen tiles and blends every tile in one workgroup into g_hdr_image with
+// the same weighted oit, depth tested against the opaque depth
+void Rasterize(uint32_t frame_index);
 void UpdateDescriptorSetInfo();
 }  // namespace ParticlePass
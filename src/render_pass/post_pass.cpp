@@ -0,0 +1,166 @@
+#include "post_pass.h"
+
+#include "context.h"
+#include "memory.h"
+#include "utils.h"
+
+void PostPass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
+  vk::PipelineShaderStageCreateInfo post_pipeline_shader_stage_create_info[2] =
+      {
+          {
+              .stage = vk::ShaderStageFlagBits::eVertex,
+              .module = shader_module,
+              .pName = "vertPost",
+              .pSpecializationInfo = nullptr,
+          },
+          {
+              .stage = vk::ShaderStageFlagBits::eFragment,
+              .module = shader_module,
+              .pName = "fragPost",
+              .pSpecializationInfo = nullptr,
+          },
+      };
+  std::vector dynamic_states = {vk::DynamicState::eViewport,
+                                vk::DynamicState::eScissor};
+  vk::PipelineDynamicStateCreateInfo dyanmic_state_create_info = {
+      .dynamicStateCount = static_cast<uint32_t>(dynamic_states.size()),
+      .pDynamicStates = dynamic_states.data(),
+  };
+  vk::PipelineViewportStateCreateInfo viewport_state_info{
+      .viewportCount = 1,
+      .pViewports = nullptr,
+      .scissorCount = 1,
+      .pScissors = nullptr,
+  };
+  vk::PipelineMultisampleStateCreateInfo multisample_create_info{
+      .rasterizationSamples = vk::SampleCountFlagBits::e1,
+      .sampleShadingEnable = vk::False,
+  };
+  vk::PipelineColorBlendAttachmentState opaque_blend_attachment{
+      .blendEnable = vk::False,
+      .colorWriteMask =
+          vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+          vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA,
+  };
+  vk::PipelineColorBlendStateCreateInfo post_color_blend_info{
+      .logicOpEnable = vk::False,
+      .logicOp = vk::LogicOp::eCopy,
+      .attachmentCount = 1,
+      .pAttachments = &opaque_blend_attachment,
+  };
+  vk::PipelineVertexInputStateCreateInfo post_vertex_input_info{};
+  vk::PipelineInputAssemblyStateCreateInfo post_input_assembly_info{
+      .topology = vk::PrimitiveTopology::eTriangleStrip};
+  vk::PipelineRasterizationStateCreateInfo post_rasterization_create_info{
+      .depthClampEnable = vk::False,
+      .rasterizerDiscardEnable = vk::False,
+      .polygonMode = vk::PolygonMode::eFill,
+      .cullMode = vk::CullModeFlagBits::eBack,
+      .frontFace = vk::FrontFace::eClockwise,
+      .depthBiasEnable = vk::False,
+      .depthBiasConstantFactor = 1.0f,
+      .depthBiasClamp = 0.0f,
+      .depthBiasSlopeFactor = 0.0f,
+      .lineWidth = 1.0f,
+  };
+  vk::PipelineDepthStencilStateCreateInfo post_depth_stencil_info{
+      .depthTestEnable = vk::False,
+      .depthWriteEnable = vk::False,
+      .depthCompareOp = vk::CompareOp::eLess,
+      .depthBoundsTestEnable = vk::False,
+      .stencilTestEnable = vk::False,
+  };
+  vk::PipelineRenderingCreateInfo post_pipeline_rending_info{
+      .colorAttachmentCount = 1,
+      .pColorAttachmentFormats =
+          &Context::Instance()->g_swapchain_image_format,
+  };
+  std::vector<vk::PushConstantRange> post_push_constant_range{{
+      .stageFlags = vk::ShaderStageFlagBits::eFragment,
+      .offset = 0,
+      .size = sizeof(PostPushConstants),
+  }};
+  vk::PipelineLayoutCreateInfo post_pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount =
+          static_cast<uint32_t>(post_push_constant_range.size()),
+      .pPushConstantRanges = post_push_constant_range.data(),
+  };
+  Context::Instance()->g_post_pipeline_layout = vk::raii::PipelineLayout(
+      Context::Instance()->g_device, post_pipeline_layout_info);
+  vk::GraphicsPipelineCreateInfo post_pipeline_info{
+      .pNext = &post_pipeline_rending_info,
+      .stageCount = 2,
+      .pStages = post_pipeline_shader_stage_create_info,
+      .pVertexInputState = &post_vertex_input_info,
+      .pInputAssemblyState = &post_input_assembly_info,
+      .pTessellationState = {},
+      .pViewportState = &viewport_state_info,
+      .pRasterizationState = &post_rasterization_create_info,
+      .pMultisampleState = &multisample_create_info,
+      .pDepthStencilState = &post_depth_stencil_info,
+      .pColorBlendState = &post_color_blend_info,
+      .pDynamicState = &dyanmic_state_create_info,
+      .layout = Context::Instance()->g_post_pipeline_layout,
+      .renderPass = nullptr,
+      .subpass = {},
+      .basePipelineHandle = {},
+      .basePipelineIndex = {},
+  };
+  Context::Instance()->g_post_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, post_pipeline_info);
+}
+
+void PostPass::Draw(uint32_t image_index, uint32_t frame_index,
+                    vk::Viewport viewport, vk::Rect2D scissor) {
+  // bloom only samples the lit scene, it still has to be made visible to
+  // the fragment shader after the color attachment writes
+  TransformImageLayout(Context::Instance()->g_hdr_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eColorAttachmentWrite,
+                       vk::AccessFlagBits2::eShaderSampledRead,
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+                       vk::PipelineStageFlagBits2::eFragmentShader);
+  // every pixel is written, nothing to load
+  vk::RenderingAttachmentInfo attachment_info{
+      .imageView = Context::Instance()->g_swapchain_image_views[image_index],
+      .imageLayout = vk::ImageLayout::eColorAttachmentOptimal,
+      .loadOp = vk::AttachmentLoadOp::eDontCare,
+      .storeOp = vk::AttachmentStoreOp::eStore,
+  };
+  vk::RenderingInfo rendering_info{
+      .renderArea = {.offset = {0, 0},
+                     .extent = Context::Instance()->g_swapchain_extent},
+      .layerCount = 1,
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &attachment_info,
+      .pDepthAttachment = nullptr,
+  };
+  Context::Instance()->g_command_buffer[frame_index].beginRendering(
+      rendering_info);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eGraphics, Context::Instance()->g_post_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_post_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  PostPushConstants post_push_constants{
+      .exposure = Context::Instance()->g_exposure,
+      .bloom_factor = Context::Instance()->g_enable_bloom
+                          ? Context::Instance()->kBloomRate /
+                                (Context::Instance()->kBloomRate + 1)
+                          : 0.0f,
+      .enable_fxaa = Context::Instance()->g_enable_fxaa,
+      .enable_dither = Context::Instance()->g_enable_dither,
+  };
+  Context::Instance()
+      ->g_command_buffer[frame_index]
+      .pushConstants<PostPushConstants>(
+          Context::Instance()->g_post_pipeline_layout,
+          vk::ShaderStageFlagBits::eFragment, 0, post_push_constants);
+  Context::Instance()->g_command_buffer[frame_index].setViewport(0, viewport);
+  Context::Instance()->g_command_buffer[frame_index].setScissor(0, scissor);
+  Context::Instance()->g_command_buffer[frame_index].draw(4, 1, 0, 0);
+  Context::Instance()->g_command_buffer[frame_index].endRendering();
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+#include "third_part/vulkan_headers.h"
+
+namespace PostPass {
+void CreatePipeline(const vk::raii::ShaderModule& shader_module);
+// the swapchain image must be in color attachment optimal
+void Draw(uint32_t image_index, uint32_t frame_index, vk::Viewport viewport,
+          vk::Rect2D scissor);
+}  // namespace PostPass
@@ -0,0 +1,448 @@
+#include "shadow_atlas_pass.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <functional>
+
+#include "context.h"
+#include "descriptor_set.h"
+#include "memory.h"
+#include "meshlet_cull_pass.h"
+#include "swapchain.h"
+#include "utils.h"
+
+namespace {
+// tile sizes are powers of two between these
+constexpr uint32_t kMinShadowTileSize = 128;
+constexpr uint32_t kMaxShadowTileSize = 1024;
+constexpr float kShadowLightNear = 0.05f;
+
+struct AtlasView {
+  uint32_t light_index;
+  uint32_t view_index;
+  vk::Rect2D rect;
+  uint32_t cull_view = 0;
+};
+std::vector<AtlasView> atlas_views;
+// in min tile units
+uint32_t atlas_used_units = 0;
+
+void CreateShadowAtlasResources() {
+  CreateImage(Context::Instance()->g_shadow_atlas_size,
+              Context::Instance()->g_shadow_atlas_size, 1,
+              vk::SampleCountFlagBits::e1,
+              Context::Instance()->g_shadowmap_image_format,
+              vk::ImageTiling::eOptimal,
+              vk::ImageUsageFlagBits::eDepthStencilAttachment |
+                  vk::ImageUsageFlagBits::eSampled,
+              vk::MemoryPropertyFlagBits::eDeviceLocal,
+              Context::Instance()->g_shadow_atlas_image,
+              Context::Instance()->g_shadow_atlas_image_memory);
+  Context::Instance()->g_shadow_atlas_image_view =
+      CreateImageView(*Context::Instance()->g_shadow_atlas_image, 0, 1,
+                      Context::Instance()->g_shadowmap_image_format,
+                      vk::ImageAspectFlagBits::eDepth);
+  // frames without shadowed local lights skip the pass
+  TransformImageLayoutImmediately(
+      Context::Instance()->g_shadow_atlas_image, vk::ImageLayout::eUndefined,
+      vk::ImageLayout::eDepthReadOnlyOptimal, {},
+      vk::AccessFlagBits::eShaderRead, vk::PipelineStageFlagBits::eTopOfPipe,
+      vk::PipelineStageFlagBits::eFragmentShader,
+      vk::ImageAspectFlagBits::eDepth);
+
+  Context::Instance()->g_shadow_light_buffer.clear();
+  Context::Instance()->g_shadow_light_buffer_memory.clear();
+  Context::Instance()->g_shadow_light_buffer_maped.clear();
+  uint32_t size = sizeof(ShadowLight) * kMaxShadowLights;
+  for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+    vk::raii::Buffer buffer = nullptr;
+    vk::raii::DeviceMemory memory = nullptr;
+    CreateBuffer(size, vk::BufferUsageFlagBits::eStorageBuffer,
+                 vk::SharingMode::eExclusive,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 buffer, memory);
+    void* data = memory.mapMemory(0, size);
+    Context::Instance()->g_shadow_light_buffer.emplace_back(std::move(buffer));
+    Context::Instance()->g_shadow_light_buffer_memory.emplace_back(
+        std::move(memory));
+    Context::Instance()->g_shadow_light_buffer_maped.emplace_back(data);
+  }
+}
+
+// 0 if the light can not be seen
+uint32_t ShadowTileSize(const LocalLight& light, const glm::mat4& view,
+                        const glm::mat4& proj) {
+  glm::vec3 view_pos = glm::vec3(view * glm::vec4(light.pos, 1.0f));
+  if (view_pos.z < -light.range) {
+    return 0;
+  }
+  // projected radius of the light sphere, 1 covers half the screen height
+  float coverage = 1.0f;
+  if (glm::length(view_pos) > light.range) {
+    coverage = std::min(
+        light.range * proj[1][1] / std::max(view_pos.z, 1e-3f), 1.0f);
+  }
+  uint32_t size = std::bit_ceil(
+      static_cast<uint32_t>(coverage * kMaxShadowTileSize));
+  return std::clamp(size, kMinShadowTileSize, kMaxShadowTileSize);
+}
+
+uint32_t CompactBits(uint32_t x) {
+  x &= 0x55555555;
+  x = (x | (x >> 1)) & 0x33333333;
+  x = (x | (x >> 2)) & 0x0f0f0f0f;
+  x = (x | (x >> 4)) & 0x00ff00ff;
+  x = (x | (x >> 8)) & 0x0000ffff;
+  return x;
+}
+
+// power of two tiles placed from large to small along a morton curve of min
+// tile units, each tile starts aligned to its own size so none overlap
+vk::Rect2D AllocateTile(uint32_t& cursor, uint32_t tile_size) {
+  uint32_t units = tile_size / kMinShadowTileSize;
+  vk::Rect2D rect{
+      .offset = {static_cast<int32_t>(CompactBits(cursor) *
+                                      kMinShadowTileSize),
+                 static_cast<int32_t>(CompactBits(cursor >> 1) *
+                                      kMinShadowTileSize)},
+      .extent = {tile_size, tile_size},
+  };
+  cursor += units * units;
+  return rect;
+}
+
+// +x -x +y -y +z -z, same order as cube_face in shadow.slang
+void CubeFaceViews(const glm::vec3& pos, glm::mat4* views) {
+  const glm::vec3 kDirections[6] = {{1.0f, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f},
+                                    {0.0f, 1.0f, 0.0f}, {0.0f, -1.0f, 0.0f},
+                                    {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}};
+  for (uint32_t i = 0; i < 6; ++i) {
+    glm::vec3 up = i < 4 ? glm::vec3(0.0f, 0.0f, 1.0f)
+                         : glm::vec3(0.0f, 1.0f, 0.0f);
+    views[i] = glm::lookAt(pos, pos + kDirections[i], up);
+  }
+}
+}  // namespace
+
+void ShadowAtlasPass::UpdateResources() { CreateShadowAtlasResources(); }
+
+void ShadowAtlasPass::CreatePipeline(
+    const vk::raii::ShaderModule& shader_module) {
+  vk::PipelineShaderStageCreateInfo
+      shadow_atlas_pipeline_shader_stage_create_info[2] = {
+          {
+              .stage = vk::ShaderStageFlagBits::eVertex,
+              .module = shader_module,
+              .pName = "vertShadowAtlas",
+              .pSpecializationInfo = nullptr,
+          },
+          {
+              .stage = vk::ShaderStageFlagBits::eFragment,
+              .module = shader_module,
+              .pName = "fragShadowmap",
+              .pSpecializationInfo = nullptr,
+          },
+      };
+  std::vector dynamic_states = {vk::DynamicState::eViewport,
+                                vk::DynamicState::eScissor};
+  vk::PipelineDynamicStateCreateInfo dyanmic_state_create_info = {
+      .dynamicStateCount = static_cast<uint32_t>(dynamic_states.size()),
+      .pDynamicStates = dynamic_states.data(),
+  };
+  auto binding_desc = QuantizedPositionLayout::GetBindingDescription();
+  auto attribute_desc = QuantizedPositionLayout::GetAttributeDescription();
+  vk::PipelineVertexInputStateCreateInfo vertex_input_info{
+      .vertexBindingDescriptionCount = 1,
+      .pVertexBindingDescriptions = &binding_desc,
+      .vertexAttributeDescriptionCount = attribute_desc.size(),
+      .pVertexAttributeDescriptions = attribute_desc.data(),
+  };
+  vk::PipelineInputAssemblyStateCreateInfo input_assembly_info{
+      .topology = vk::PrimitiveTopology::eTriangleList};
+  vk::PipelineViewportStateCreateInfo viewport_state_info{
+      .viewportCount = 1,
+      .pViewports = nullptr,
+      .scissorCount = 1,
+      .pScissors = nullptr,
+  };
+  vk::PipelineRasterizationStateCreateInfo rasterization_create_info{
+      .depthClampEnable = vk::False,
+      .rasterizerDiscardEnable = vk::False,
+      .polygonMode = vk::PolygonMode::eFill,
+      .cullMode = vk::CullModeFlagBits::eNone,
+      .frontFace = vk::FrontFace::eClockwise,
+      .depthBiasEnable = vk::False,
+      .depthBiasConstantFactor = 1.0f,
+      .depthBiasClamp = 0.0f,
+      .depthBiasSlopeFactor = 0.0f,
+      .lineWidth = 1.0f,
+  };
+  vk::PipelineMultisampleStateCreateInfo multisample_create_info{
+      .rasterizationSamples = vk::SampleCountFlagBits::e1,
+      .sampleShadingEnable = vk::False,
+  };
+  vk::PipelineDepthStencilStateCreateInfo depth_stencil_info{
+      .depthTestEnable = vk::True,
+      .depthWriteEnable = vk::True,
+      .depthCompareOp = vk::CompareOp::eLess,
+      .depthBoundsTestEnable = vk::False,
+      .stencilTestEnable = vk::False,
+  };
+  vk::PipelineColorBlendStateCreateInfo color_blend_info{
+      .logicOpEnable = vk::False,
+      .logicOp = vk::LogicOp::eCopy,
+      .attachmentCount = 0,
+      .pAttachments = nullptr,
+      .blendConstants = {},
+  };
+  std::vector<vk::PushConstantRange> push_constant_range{{
+      .stageFlags = vk::ShaderStageFlagBits::eVertex,
+      .offset = 0,
+      .size = sizeof(ShadowAtlasPushConstants),
+  }};
+  vk::PipelineLayoutCreateInfo pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount =
+          static_cast<uint32_t>(push_constant_range.size()),
+      .pPushConstantRanges = push_constant_range.data(),
+  };
+  Context::Instance()->g_shadow_atlas_pipeline_layout =
+      vk::raii::PipelineLayout(Context::Instance()->g_device,
+                               pipeline_layout_info);
+  vk::PipelineRenderingCreateInfo pipeline_rending_info{
+      .colorAttachmentCount = 0,
+      .depthAttachmentFormat = Context::Instance()->g_shadowmap_image_format,
+  };
+  vk::GraphicsPipelineCreateInfo pipeline_info{
+      .pNext = &pipeline_rending_info,
+      .stageCount = 2,
+      .pStages = shadow_atlas_pipeline_shader_stage_create_info,
+      .pVertexInputState = &vertex_input_info,
+      .pInputAssemblyState = &input_assembly_info,
+      .pTessellationState = {},
+      .pViewportState = &viewport_state_info,
+      .pRasterizationState = &rasterization_create_info,
+      .pMultisampleState = &multisample_create_info,
+      .pDepthStencilState = &depth_stencil_info,
+      .pColorBlendState = &color_blend_info,
+      .pDynamicState = &dyanmic_state_create_info,
+      .layout = Context::Instance()->g_shadow_atlas_pipeline_layout,
+      .renderPass = nullptr,
+      .subpass = {},
+      .basePipelineHandle = {},
+      .basePipelineIndex = {},
+  };
+  Context::Instance()->g_shadow_atlas_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, pipeline_info);
+}
+
+void ShadowAtlasPass::Draw(uint32_t image_index, uint32_t frame_index,
+                           vk::Viewport viewport, vk::Rect2D scissor) {
+  if (atlas_views.empty()) {
+    return;
+  }
+  // every view is cleared below, the rest of the atlas is never sampled
+  TransformImageLayout(Context::Instance()->g_shadow_atlas_image, frame_index,
+                       vk::ImageLayout::eUndefined,
+                       vk::ImageLayout::eDepthStencilAttachmentOptimal, {},
+                       vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+                           vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                       vk::PipelineStageFlagBits2::eFragmentShader,
+                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                           vk::PipelineStageFlagBits2::eLateFragmentTests,
+                       vk::ImageAspectFlagBits::eDepth);
+  vk::RenderingAttachmentInfo atlas_depth_info{
+      .imageView = Context::Instance()->g_shadow_atlas_image_view,
+      .imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
+      .loadOp = vk::AttachmentLoadOp::eDontCare,
+      .storeOp = vk::AttachmentStoreOp::eStore,
+  };
+  vk::RenderingInfo atlas_rendering_info{
+      .renderArea = {.offset = {0, 0},
+                     .extent = {Context::Instance()->g_shadow_atlas_size,
+                                Context::Instance()->g_shadow_atlas_size}},
+      .layerCount = 1,
+      .colorAttachmentCount = 0,
+      .pColorAttachments = nullptr,
+      .pDepthAttachment = &atlas_depth_info,
+  };
+  Context::Instance()->g_command_buffer[frame_index].beginRendering(
+      atlas_rendering_info);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_shadow_atlas_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].bindVertexBuffers(
+      0, *Context::Instance()->g_vertex_buffer, {0});
+  Context::Instance()->g_command_buffer[frame_index].bindIndexBuffer(
+      *Context::Instance()->g_index_buffer, 0,
+      Context::Instance()->g_index_type);
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_shadow_atlas_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  for (const AtlasView& atlas_view : atlas_views) {
+    vk::Viewport view_viewport(
+        static_cast<float>(atlas_view.rect.offset.x),
+        static_cast<float>(atlas_view.rect.offset.y),
+        static_cast<float>(atlas_view.rect.extent.width),
+        static_cast<float>(atlas_view.rect.extent.height), 0.0f, 1.0f);
+    Context::Instance()->g_command_buffer[frame_index].setViewport(
+        0, view_viewport);
+    Context::Instance()->g_command_buffer[frame_index].setScissor(
+        0, atlas_view.rect);
+    Context::Instance()->g_command_buffer[frame_index].clearAttachments(
+        vk::ClearAttachment{
+            .aspectMask = vk::ImageAspectFlagBits::eDepth,
+            .clearValue = vk::ClearDepthStencilValue{1.0f, 0},
+        },
+        vk::ClearRect{
+            .rect = atlas_view.rect, .baseArrayLayer = 0, .layerCount = 1});
+    Context::Instance()
+        ->g_command_buffer[frame_index]
+        .pushConstants<ShadowAtlasPushConstants>(
+            Context::Instance()->g_shadow_atlas_pipeline_layout,
+            vk::ShaderStageFlagBits::eVertex, 0,
+            ShadowAtlasPushConstants{.light_index = atlas_view.light_index,
+                                     .view_index = atlas_view.view_index});
+    MeshletCullPass::DrawView(frame_index, atlas_view.cull_view);
+  }
+  Context::Instance()->g_command_buffer[frame_index].endRendering();
+  TransformImageLayout(Context::Instance()->g_shadow_atlas_image, frame_index,
+                       vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                       vk::ImageLayout::eDepthReadOnlyOptimal,
+                       vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                       vk::AccessFlagBits2::eShaderSampledRead,
+                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                           vk::PipelineStageFlagBits2::eLateFragmentTests,
+                       vk::PipelineStageFlagBits2::eFragmentShader,
+                       vk::ImageAspectFlagBits::eDepth);
+}
+
+void ShadowAtlasPass::UpdateDescriptorSetInfo() {
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr,
+                              *Context::Instance()->g_shadow_atlas_image_view,
+                              vk::ImageLayout::eDepthReadOnlyOptimal);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        19, vk::DescriptorType::eSampledImage,
+        vk::ShaderStageFlagBits::eFragment, image_info, {});
+  }
+  {
+    std::vector<vk::DescriptorBufferInfo> buffer_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      buffer_info.emplace_back(Context::Instance()->g_shadow_light_buffer[i], 0,
+                               sizeof(ShadowLight) * kMaxShadowLights);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        20, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        {}, buffer_info);
+  }
+}
+
+void ShadowAtlasPass::UpdateLights(UniformBufferObject& ubo,
+                                   uint32_t frame_index) {
+  struct TileRequest {
+    uint32_t light_index;
+    uint32_t tile_size;
+  };
+  std::vector<TileRequest> requests;
+  if (Context::Instance()->g_enable_local_lights) {
+    const std::vector<LocalLight>& lights = Context::Instance()->g_local_lights;
+    for (uint32_t i = 0;
+         i < lights.size() && requests.size() < kMaxShadowLights; ++i) {
+      uint32_t tile_size = ShadowTileSize(lights[i], ubo.view, ubo.proj);
+      if (tile_size > 0) {
+        requests.emplace_back(i, tile_size);
+      }
+    }
+  }
+  std::ranges::stable_sort(requests, std::greater{}, &TileRequest::tile_size);
+
+  ShadowLight* shadow_lights = static_cast<ShadowLight*>(
+      Context::Instance()->g_shadow_light_buffer_maped[frame_index]);
+  uint32_t atlas_units =
+      Context::Instance()->g_shadow_atlas_size / kMinShadowTileSize;
+  atlas_units *= atlas_units;
+  uint32_t cursor = 0;
+  // shrinking a tile caps the later ones, keeping the sizes non increasing
+  uint32_t size_cap = kMaxShadowTileSize;
+  atlas_views.clear();
+  for (uint32_t i = 0; i < requests.size(); ++i) {
+    const LocalLight& light =
+        Context::Instance()->g_local_lights[requests[i].light_index];
+    ShadowLight& shadow_light = shadow_lights[i];
+    shadow_light.pos = light.pos;
+    shadow_light.range = light.range;
+    shadow_light.intensities = light.intensities;
+    shadow_light.type = light.type;
+    shadow_light.direction = glm::normalize(light.direction);
+    shadow_light.spot_cos_angle = std::cos(light.spot_angle);
+
+    uint32_t view_count = light.type == kLightTypePoint ? 6 : 1;
+    uint32_t tile_size = std::min(requests[i].tile_size, size_cap);
+    auto tile_units = [](uint32_t size) {
+      return (size / kMinShadowTileSize) * (size / kMinShadowTileSize);
+    };
+    while (tile_size > kMinShadowTileSize &&
+           cursor + view_count * tile_units(tile_size) > atlas_units) {
+      tile_size /= 2;
+    }
+    size_cap = tile_size;
+    if (cursor + view_count * tile_units(tile_size) > atlas_units) {
+      // atlas is full, the light stays unshadowed
+      shadow_light.view_count = 0;
+      continue;
+    }
+    shadow_light.view_count = view_count;
+
+    glm::mat4 views[kMaxShadowLightViews];
+    glm::mat4 proj;
+    if (light.type == kLightTypePoint) {
+      CubeFaceViews(light.pos, views);
+      proj = glm::perspective(glm::radians(90.0f), 1.0f, kShadowLightNear,
+                              light.range);
+    } else {
+      glm::vec3 up = std::abs(shadow_light.direction.z) > 0.99f
+                         ? glm::vec3(0.0f, 1.0f, 0.0f)
+                         : glm::vec3(0.0f, 0.0f, 1.0f);
+      views[0] =
+          glm::lookAt(light.pos, light.pos + shadow_light.direction, up);
+      proj = glm::perspective(light.spot_angle * 2.0f, 1.0f, kShadowLightNear,
+                              light.range);
+    }
+    float atlas_size =
+        static_cast<float>(Context::Instance()->g_shadow_atlas_size);
+    for (uint32_t j = 0; j < view_count; ++j) {
+      vk::Rect2D rect = AllocateTile(cursor, tile_size);
+      shadow_light.view_proj[j] = proj * views[j];
+      shadow_light.atlas_rect[j] =
+          glm::vec4(rect.offset.x, rect.offset.y, rect.extent.width,
+                    rect.extent.height) /
+          atlas_size;
+      AtlasView& atlas_view = atlas_views.emplace_back(i, j, rect);
+      // a local light reaches few meshlets, its list is kept short
+      atlas_view.cull_view = MeshletCullPass::AddView(
+          shadow_light.view_proj[j] * ubo.modu, kMeshletCullAll,
+          glm::vec4(0.0f), kMaxLocalLightMeshletDraws);
+    }
+  }
+  atlas_used_units = cursor;
+  ubo.shadow_light_count = static_cast<uint32_t>(requests.size());
+}
+
+uint32_t ShadowAtlasPass::GetAtlasViewCount() {
+  return static_cast<uint32_t>(atlas_views.size());
+}
+
+float ShadowAtlasPass::GetAtlasOccupancy() {
+  float atlas_units = static_cast<float>(
+      Context::Instance()->g_shadow_atlas_size / kMinShadowTileSize);
+  return atlas_used_units / (atlas_units * atlas_units);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+#include "data.h"
+#include "third_part/vulkan_headers.h"
+
+namespace ShadowAtlasPass {
+void UpdateResources();
+void CreatePipeline(const vk::raii::ShaderModule& shader_module);
+void Draw(uint32_t image_index, uint32_t frame_index, vk::Viewport viewport,
+          vk::Rect2D scissor);
+void UpdateDescriptorSetInfo();
+// size atlas tiles by screen coverage, pack them and fill the light table of
+// this frame
+void UpdateLights(UniformBufferObject& ubo, uint32_t frame_index);
+uint32_t GetAtlasViewCount();
+// fraction of the atlas covered by tiles
+float GetAtlasOccupancy();
+}  // namespace ShadowAtlasPass
@@ -1,32 +1,343 @@
 #include "shadowmap_pass.h"
 
+#include <algorithm>
+#include <array>
+#include <tuple>
+
 #include "context.h"
+#include "culling.h"
 #include "descriptor_set.h"
 #include "memory.h"
+#include "meshlet_cull_pass.h"
 #include "swapchain.h"
 #include "utils.h"
 
 namespace {
+// instances with static or dynamic casters inside each cascade, cascades
+// without dynamic casters keep their cached layer, the meshlet culling picks
+// what is drawn
+std::array<std::vector<uint32_t>, kMaxShadowCascades> cascade_static_casters;
+std::array<std::vector<uint32_t>, kMaxShadowCascades> cascade_dynamic_casters;
+std::array<glm::mat4, kMaxShadowCascades> cascade_light_view_proj;
+// cascade_light_view_proj times ubo modu, maps the space of the instances
+std::array<glm::mat4, kMaxShadowCascades> cascade_model_view_proj;
+// meshlet cull views of the casters of each cascade
+std::array<uint32_t, kMaxShadowCascades> cascade_static_cull_views;
+std::array<uint32_t, kMaxShadowCascades> cascade_dynamic_cull_views;
+
+// what the static casters of a layer were rendered with, the layer is reused
+// while the light matrix of its cascade, the model transform and the selected
+// levels match
+struct ShadowCacheKey {
+  glm::mat4 light_view_proj{0.0f};
+  uint64_t model_transform_version = 0;
+  uint64_t lod_version = 0;
+  bool valid = false;
+  bool operator==(const ShadowCacheKey&) const = default;
+};
+// shadow map layers holding only static casters, invalid once dynamic casters
+// are drawn into them
+std::array<ShadowCacheKey, kMaxShadowCascades> shadowmap_keys;
+// cache layers of cascades with dynamic casters
+std::array<ShadowCacheKey, kMaxShadowCascades> shadow_cache_keys;
+bool shadow_moments_dirty = true;
+uint32_t rendered_cascade_count = 0;
+
 void CreateShadowmapResources() {
+  // always allocate every cascade, changing the count needs no recreation
   CreateImage(
       Context::Instance()->g_shadowmap_width,
       Context::Instance()->g_shadowmap_height, 1, vk::SampleCountFlagBits::e1,
       Context::Instance()->g_shadowmap_image_format, vk::ImageTiling::eOptimal,
       vk::ImageUsageFlagBits::eDepthStencilAttachment |
-          vk::ImageUsageFlagBits::eSampled,
+          vk::ImageUsageFlagBits::eSampled |
+          vk::ImageUsageFlagBits::eTransferDst,
       vk::MemoryPropertyFlagBits::eDeviceLocal,
       Context::Instance()->g_shadowmap_image,
-      Context::Instance()->g_shadowmap_image_memory);
-  Context::Instance()->g_shadowmap_image_view =
-      CreateImageView(*Context::Instance()->g_shadowmap_image, 0, 1,
-                      Context::Instance()->g_shadowmap_image_format,
-                      vk::ImageAspectFlagBits::eDepth);
+      Context::Instance()->g_shadowmap_image_memory, kMaxShadowCascades);
+  // cached layers are sampled before the pass touches them again
+  TransformImageLayoutImmediately(
+      Context::Instance()->g_shadowmap_image, vk::ImageLayout::eUndefined,
+      vk::ImageLayout::eDepthReadOnlyOptimal, {},
+      vk::AccessFlagBits::eShaderRead, vk::PipelineStageFlagBits::eTopOfPipe,
+      vk::PipelineStageFlagBits::eFragmentShader,
+      vk::ImageAspectFlagBits::eDepth);
+  Context::Instance()->g_shadowmap_image_view = CreateImageView(
+      *Context::Instance()->g_shadowmap_image, 0, 1,
+      Context::Instance()->g_shadowmap_image_format,
+      vk::ImageAspectFlagBits::eDepth, 0, kMaxShadowCascades,
+      vk::ImageViewType::e2DArray);
+  Context::Instance()->g_shadowmap_layer_image_views.clear();
+  for (uint32_t i = 0; i < kMaxShadowCascades; ++i) {
+    Context::Instance()->g_shadowmap_layer_image_views.emplace_back(
+        CreateImageView(*Context::Instance()->g_shadowmap_image, 0, 1,
+                        Context::Instance()->g_shadowmap_image_format,
+                        vk::ImageAspectFlagBits::eDepth, i, 1));
+  }
+  CreateImage(
+      Context::Instance()->g_shadowmap_width,
+      Context::Instance()->g_shadowmap_height, 1, vk::SampleCountFlagBits::e1,
+      Context::Instance()->g_shadowmap_image_format, vk::ImageTiling::eOptimal,
+      vk::ImageUsageFlagBits::eDepthStencilAttachment |
+          vk::ImageUsageFlagBits::eTransferSrc,
+      vk::MemoryPropertyFlagBits::eDeviceLocal,
+      Context::Instance()->g_shadow_cache_image,
+      Context::Instance()->g_shadow_cache_image_memory, kMaxShadowCascades);
+  // rests in transfer src between updates
+  TransformImageLayoutImmediately(
+      Context::Instance()->g_shadow_cache_image, vk::ImageLayout::eUndefined,
+      vk::ImageLayout::eTransferSrcOptimal, {},
+      vk::AccessFlagBits::eTransferRead, vk::PipelineStageFlagBits::eTopOfPipe,
+      vk::PipelineStageFlagBits::eTransfer, vk::ImageAspectFlagBits::eDepth);
+  Context::Instance()->g_shadow_cache_layer_image_views.clear();
+  for (uint32_t i = 0; i < kMaxShadowCascades; ++i) {
+    Context::Instance()->g_shadow_cache_layer_image_views.emplace_back(
+        CreateImageView(*Context::Instance()->g_shadow_cache_image, 0, 1,
+                        Context::Instance()->g_shadowmap_image_format,
+                        vk::ImageAspectFlagBits::eDepth, i, 1));
+  }
+  shadowmap_keys.fill({});
+  shadow_cache_keys.fill({});
+  shadow_moments_dirty = true;
+  // hardware pcf, the bilinear weights are applied to the compare results
+  vk::SamplerCreateInfo compare_sampler_info{
+      .magFilter = vk::Filter::eLinear,
+      .minFilter = vk::Filter::eLinear,
+      .mipmapMode = vk::SamplerMipmapMode::eNearest,
+      .addressModeU = vk::SamplerAddressMode::eClampToBorder,
+      .addressModeV = vk::SamplerAddressMode::eClampToBorder,
+      .addressModeW = vk::SamplerAddressMode::eClampToBorder,
+      .mipLodBias = 0.0f,
+      .anisotropyEnable = vk::False,
+      .compareEnable = vk::True,
+      .compareOp = vk::CompareOp::eLessOrEqual,
+      .minLod = 0,
+      .maxLod = 0,
+      .borderColor = vk::BorderColor::eFloatOpaqueWhite,
+      .unnormalizedCoordinates = vk::False,
+  };
+  Context::Instance()->g_shadowmap_compare_sampler =
+      vk::raii::Sampler(Context::Instance()->g_device, compare_sampler_info);
+}
+
+void CreateShadowMomentsResources() {
+  vk::Format format = Context::Instance()->g_shadow_moments_format;
+  for (auto [image, memory, image_view] :
+       {std::tie(Context::Instance()->g_shadow_moments_temp_image,
+                 Context::Instance()->g_shadow_moments_temp_image_memory,
+                 Context::Instance()->g_shadow_moments_temp_image_view),
+        std::tie(Context::Instance()->g_shadow_moments_image,
+                 Context::Instance()->g_shadow_moments_image_memory,
+                 Context::Instance()->g_shadow_moments_image_view)}) {
+    CreateImage(Context::Instance()->g_shadowmap_width / 2,
+                Context::Instance()->g_shadowmap_height / 2, 1,
+                vk::SampleCountFlagBits::e1, format, vk::ImageTiling::eOptimal,
+                vk::ImageUsageFlagBits::eStorage |
+                    vk::ImageUsageFlagBits::eSampled,
+                vk::MemoryPropertyFlagBits::eDeviceLocal, image, memory,
+                kMaxShadowCascades);
+    image_view = CreateImageView(
+        *image, 0, 1, format, vk::ImageAspectFlagBits::eColor, 0,
+        kMaxShadowCascades, vk::ImageViewType::e2DArray);
+    // stays in general, written by compute and sampled by lighting
+    TransformImageLayoutImmediately(
+        image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, {},
+        vk::AccessFlagBits::eShaderRead, vk::PipelineStageFlagBits::eTopOfPipe,
+        vk::PipelineStageFlagBits::eComputeShader);
+  }
+  shadow_moments_dirty = true;
+  vk::SamplerCreateInfo sampler_info{
+      .magFilter = vk::Filter::eLinear,
+      .minFilter = vk::Filter::eLinear,
+      .mipmapMode = vk::SamplerMipmapMode::eNearest,
+      .addressModeU = vk::SamplerAddressMode::eClampToEdge,
+      .addressModeV = vk::SamplerAddressMode::eClampToEdge,
+      .addressModeW = vk::SamplerAddressMode::eClampToEdge,
+      .mipLodBias = 0.0f,
+      .anisotropyEnable = vk::False,
+      .compareEnable = vk::False,
+      .compareOp = vk::CompareOp::eAlways,
+      .minLod = 0,
+      .maxLod = 0,
+      .borderColor = vk::BorderColor::eFloatOpaqueWhite,
+      .unnormalizedCoordinates = vk::False,
+  };
+  Context::Instance()->g_shadow_moments_sampler =
+      vk::raii::Sampler(Context::Instance()->g_device, sampler_info);
+}
+
+// blur depth moments once instead of filtering per pixel
+void ComputeShadowMoments(uint32_t frame_index) {
+  uint32_t group_count_x =
+      (Context::Instance()->g_shadowmap_width / 2 + 15) / 16;
+  uint32_t group_count_y =
+      (Context::Instance()->g_shadowmap_height / 2 + 15) / 16;
+  uint32_t group_count_z = Context::Instance()->g_shadow_cascade_count;
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_shadow_moments_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  TransformImageLayout(Context::Instance()->g_shadow_moments_temp_image,
+                       frame_index, vk::ImageLayout::eGeneral,
+                       vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageRead,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_shadow_moments_horizontal_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].dispatch(
+      group_count_x, group_count_y, group_count_z);
+  TransformImageLayout(Context::Instance()->g_shadow_moments_temp_image,
+                       frame_index, vk::ImageLayout::eGeneral,
+                       vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::AccessFlagBits2::eShaderStorageRead,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  TransformImageLayout(Context::Instance()->g_shadow_moments_image,
+                       frame_index, vk::ImageLayout::eGeneral,
+                       vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderSampledRead,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::PipelineStageFlagBits2::eFragmentShader |
+                           vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_shadow_moments_vertical_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].dispatch(
+      group_count_x, group_count_y, group_count_z);
+  TransformImageLayout(Context::Instance()->g_shadow_moments_image,
+                       frame_index, vk::ImageLayout::eGeneral,
+                       vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::AccessFlagBits2::eShaderSampledRead,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eFragmentShader |
+                           vk::PipelineStageFlagBits2::eComputeShader);
+}
+
+float ViewDepthToNdc(const glm::mat4& proj, float view_depth) {
+  glm::vec4 clip = proj * glm::vec4(0.0f, 0.0f, view_depth, 1.0f);
+  return clip.z / clip.w;
+}
+
+// https://developer.nvidia.com/gpugems/gpugems3/part-ii-light-and-shadows/chapter-10-parallel-split-shadow-maps-programmable-gpus
+// the light is perspective, so cascades crop its clip space to the bounds of
+// the camera sub frustum instead of fitting an orthographic projection
+glm::mat4 CascadeCropMatrix(const glm::mat4& inv_view_proj,
+                            const glm::mat4& proj,
+                            const glm::mat4& light_view_proj, float split_near,
+                            float split_far) {
+  glm::vec2 bounds_min(1.0f);
+  glm::vec2 bounds_max(-1.0f);
+  for (float view_depth : {split_near, split_far}) {
+    float ndc_z = ViewDepthToNdc(proj, view_depth);
+    for (float x : {-1.0f, 1.0f}) {
+      for (float y : {-1.0f, 1.0f}) {
+        glm::vec4 corner = inv_view_proj * glm::vec4(x, y, ndc_z, 1.0f);
+        glm::vec4 light_clip = light_view_proj * (corner / corner.w);
+        // corner behind the light, keep the whole light frustum
+        if (light_clip.w <= 1e-4f) {
+          return glm::mat4(1.0f);
+        }
+        glm::vec2 light_ndc = glm::vec2(light_clip) / light_clip.w;
+        bounds_min = glm::min(bounds_min, light_ndc);
+        bounds_max = glm::max(bounds_max, light_ndc);
+      }
+    }
+  }
+  bounds_min = glm::max(bounds_min, glm::vec2(-1.0f));
+  bounds_max = glm::min(bounds_max, glm::vec2(1.0f));
+  // square cascade, its origin snapped to its own texel grid so static
+  // shadows do not shimmer when the camera moves
+  float extent = std::max({bounds_max.x - bounds_min.x,
+                           bounds_max.y - bounds_min.y, 1e-3f});
+  glm::vec2 texel_size =
+      glm::vec2(extent) /
+      glm::vec2(Context::Instance()->g_shadowmap_width,
+                Context::Instance()->g_shadowmap_height);
+  bounds_min = glm::floor(bounds_min / texel_size) * texel_size;
+  float scale = 2.0f / extent;
+  glm::mat4 crop(1.0f);
+  crop[0][0] = scale;
+  crop[1][1] = scale;
+  crop[3][0] = -1.0f - bounds_min.x * scale;
+  crop[3][1] = -1.0f - bounds_min.y * scale;
+  return crop;
+}
+
+// depth only render of the casters cull_view kept into one layer of a shadow
+// map image, the shadowmap pipeline must be bound
+void DrawCasters(uint32_t frame_index, const vk::raii::ImageView& layer_view,
+                 uint32_t cascade, uint32_t cull_view,
+                 vk::AttachmentLoadOp load_op) {
+  vk::RenderingAttachmentInfo shadowmap_depth_info{
+      .imageView = layer_view,
+      .imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
+      .loadOp = load_op,
+      .storeOp = vk::AttachmentStoreOp::eStore,
+      .clearValue = vk::ClearDepthStencilValue{1.0f, 0},
+  };
+  vk::RenderingInfo shadowmap_rendering_info{
+      .renderArea = {.offset = {0, 0},
+                     .extent = {Context::Instance()->g_shadowmap_width,
+                                Context::Instance()->g_shadowmap_height}},
+      .layerCount = 1,
+      .colorAttachmentCount = 0,
+      .pColorAttachments = nullptr,
+      .pDepthAttachment = &shadowmap_depth_info,
+  };
+  Context::Instance()->g_command_buffer[frame_index].beginRendering(
+      shadowmap_rendering_info);
+  Context::Instance()
+      ->g_command_buffer[frame_index]
+      .pushConstants<ShadowPushConstants>(
+          Context::Instance()->g_shadowmap_pipeline_layout,
+          vk::ShaderStageFlagBits::eVertex, 0,
+          ShadowPushConstants{.cascade_index = cascade});
+  MeshletCullPass::DrawView(frame_index, cull_view);
+  Context::Instance()->g_command_buffer[frame_index].endRendering();
+}
+
+void BindShadowmapPipeline(uint32_t frame_index) {
+  vk::Viewport shadowmap_viewport = vk::Viewport(
+      0.0f, 0.0f, static_cast<float>(Context::Instance()->g_shadowmap_width),
+      static_cast<float>(Context::Instance()->g_shadowmap_height), 0.0f, 1.0f);
+  vk::Rect2D shadowmap_scissor =
+      vk::Rect2D({0, 0}, {Context::Instance()->g_shadowmap_width,
+                          Context::Instance()->g_shadowmap_height});
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_shadowmap_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].bindVertexBuffers(
+      0, *Context::Instance()->g_vertex_buffer, {0});
+  Context::Instance()->g_command_buffer[frame_index].bindIndexBuffer(
+      *Context::Instance()->g_index_buffer, 0,
+      Context::Instance()->g_index_type);
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_shadowmap_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  Context::Instance()->g_command_buffer[frame_index].setViewport(
+      0, shadowmap_viewport);
+  Context::Instance()->g_command_buffer[frame_index].setScissor(
+      0, shadowmap_scissor);
 }
 }  // namespace
 
 void ShadowmapPass::UpdateResources() {
   CreateShadowmapResources();
+  CreateShadowMomentsResources();
   SwapChainManager::RegisterRecreateFunction(CreateShadowmapResources);
+  SwapChainManager::RegisterRecreateFunction(CreateShadowMomentsResources);
+}
+
+void ShadowmapPass::RecreateResources() {
+  CreateShadowmapResources();
+  CreateShadowMomentsResources();
 }
 
 void ShadowmapPass::CreatePipeline(
@@ -52,8 +363,8 @@ void ShadowmapPass::CreatePipeline(
       .dynamicStateCount = static_cast<uint32_t>(dynamic_states.size()),
       .pDynamicStates = dynamic_states.data(),
   };
-  auto binding_desc = Vertex::GetBindingDescription();
-  auto attribute_desc = Vertex::GetAttributeDescription();
+  auto binding_desc = QuantizedPositionLayout::GetBindingDescription();
+  auto attribute_desc = QuantizedPositionLayout::GetAttributeDescription();
   vk::PipelineVertexInputStateCreateInfo vertex_input_info{
       .vertexBindingDescriptionCount = 1,
       .pVertexBindingDescriptions = &binding_desc,
@@ -106,18 +417,24 @@ void ShadowmapPass::CreatePipeline(
       .pAttachments = color_blend_attachments.data(),
       .blendConstants = {},
   };
+  std::vector<vk::PushConstantRange> shadowmap_push_constant_range{{
+      .stageFlags = vk::ShaderStageFlagBits::eVertex,
+      .offset = 0,
+      .size = sizeof(ShadowPushConstants),
+  }};
   vk::PipelineLayoutCreateInfo pipeline_layout_info{
       .setLayoutCount = 1,
       .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
-      .pushConstantRangeCount = 0,
-      .pPushConstantRanges = nullptr,
+      .pushConstantRangeCount =
+          static_cast<uint32_t>(shadowmap_push_constant_range.size()),
+      .pPushConstantRanges = shadowmap_push_constant_range.data(),
   };
   std::vector<vk::Format> graphsic_formats{
       Context::Instance()->g_gbuffer_format,
       Context::Instance()->g_gbuffer_format,
       Context::Instance()->g_gbuffer_format,
       Context::Instance()->g_gbuffer_format,
-      Context::Instance()->g_gbuffer_format,
+      Context::Instance()->g_hdr_format,
   };
   vk::PipelineRenderingCreateInfo shodowmap_pipeline_rending_info{
       .colorAttachmentCount = 0,
@@ -147,62 +464,180 @@ void ShadowmapPass::CreatePipeline(
 
   Context::Instance()->g_shadowmap_pipeline = vk::raii::Pipeline(
       Context::Instance()->g_device, nullptr, shodowmap_pipeline_info);
+
+  vk::PipelineLayoutCreateInfo shadow_moments_pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount = 0,
+      .pPushConstantRanges = nullptr,
+  };
+  Context::Instance()->g_shadow_moments_pipeline_layout =
+      vk::raii::PipelineLayout(Context::Instance()->g_device,
+                               shadow_moments_pipeline_layout_info);
+  vk::ComputePipelineCreateInfo shadow_moments_pipeline_info{
+      .stage =
+          {
+              .stage = vk::ShaderStageFlagBits::eCompute,
+              .module = shader_module,
+              .pName = "compShadowMomentsHorizontal",
+              .pSpecializationInfo = nullptr,
+          },
+      .layout = Context::Instance()->g_shadow_moments_pipeline_layout,
+  };
+  Context::Instance()->g_shadow_moments_horizontal_pipeline =
+      vk::raii::Pipeline(Context::Instance()->g_device, nullptr,
+                         shadow_moments_pipeline_info);
+  shadow_moments_pipeline_info.stage.pName = "compShadowMomentsVertical";
+  Context::Instance()->g_shadow_moments_vertical_pipeline =
+      vk::raii::Pipeline(Context::Instance()->g_device, nullptr,
+                         shadow_moments_pipeline_info);
 }
 
 void ShadowmapPass::Draw(uint32_t image_index, uint32_t frame_index,
                          vk::Viewport viewport, vk::Rect2D scissor) {
-  // shadowmap pass
-  TransformImageLayout(Context::Instance()->g_shadowmap_image, frame_index,
-                       vk::ImageLayout::eUndefined,
-                       vk::ImageLayout::eDepthStencilAttachmentOptimal, {},
-                       vk::AccessFlagBits2::eDepthStencilAttachmentRead |
-                           vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
-                       vk::PipelineStageFlagBits2::eTopOfPipe,
-                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
-                           vk::PipelineStageFlagBits2::eLateFragmentTests,
-                       vk::ImageAspectFlagBits::eDepth);
-  vk::RenderingAttachmentInfo shadowmap_depth_info{
-      .imageView = Context::Instance()->g_shadowmap_image_view,
-      .imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
-      .loadOp = vk::AttachmentLoadOp::eClear,
-      .storeOp = vk::AttachmentStoreOp::eStore,
-      .clearValue = vk::ClearDepthStencilValue{1.0f, 0},
-  };
-  vk::RenderingInfo shadowmap_rendering_info{
-      .renderArea = {.offset = {0, 0},
-                     .extent = {Context::Instance()->g_shadowmap_width,
-                                Context::Instance()->g_shadowmap_height}},
-      .layerCount = 1,
-      .colorAttachmentCount = 0,
-      .pColorAttachments = nullptr,
-      .pDepthAttachment = &shadowmap_depth_info,
-  };
-  vk::Viewport shadowmap_viewport = vk::Viewport(
-      0.0f, 0.0f, static_cast<float>(Context::Instance()->g_shadowmap_width),
-      static_cast<float>(Context::Instance()->g_shadowmap_height), 0.0f, 1.0f);
-  vk::Rect2D shadowmap_scissor =
-      vk::Rect2D({0, 0}, {Context::Instance()->g_shadowmap_width,
-                          Context::Instance()->g_shadowmap_height});
-  Context::Instance()->g_command_buffer[frame_index].beginRendering(
-      shadowmap_rendering_info);
-  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
-      vk::PipelineBindPoint::eGraphics,
-      Context::Instance()->g_shadowmap_pipeline);
-  Context::Instance()->g_command_buffer[frame_index].bindVertexBuffers(
-      0, *Context::Instance()->g_vertex_buffer, {0});
-  Context::Instance()->g_command_buffer[frame_index].bindIndexBuffer(
-      *Context::Instance()->g_index_buffer, 0, vk::IndexType::eUint32);
-  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
-      vk::PipelineBindPoint::eGraphics,
-      Context::Instance()->g_shadowmap_pipeline_layout, 0,
-      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
-  Context::Instance()->g_command_buffer[frame_index].setViewport(
-      0, shadowmap_viewport);
-  Context::Instance()->g_command_buffer[frame_index].setScissor(
-      0, shadowmap_scissor);
-  Context::Instance()->g_command_buffer[frame_index].drawIndexed(
-      Context::Instance()->g_index_in.size(), 1, 0, 0, 0);
-  Context::Instance()->g_command_buffer[frame_index].endRendering();
+  // sort cascades by the work they need, layers whose casters and light did
+  // not change since they were rendered are kept as is
+  bool enable_cache = Context::Instance()->g_enable_shadow_cache;
+  std::vector<uint32_t> cache_update_cascades;
+  std::vector<uint32_t> dynamic_cascades;
+  std::vector<uint32_t> static_cascades;
+  for (uint32_t i = 0; i < Context::Instance()->g_shadow_cascade_count; ++i) {
+    ShadowCacheKey key{
+        .light_view_proj = cascade_light_view_proj[i],
+        .model_transform_version =
+            Context::Instance()->g_model_transform_version,
+        .lod_version = Context::Instance()->g_lod_version,
+        .valid = true,
+    };
+    if (!cascade_dynamic_casters[i].empty()) {
+      if (!enable_cache || shadow_cache_keys[i] != key) {
+        cache_update_cascades.emplace_back(i);
+        shadow_cache_keys[i] = key;
+      }
+      dynamic_cascades.emplace_back(i);
+      shadowmap_keys[i] = {};
+    } else if (!enable_cache || shadowmap_keys[i] != key) {
+      static_cascades.emplace_back(i);
+      shadowmap_keys[i] = key;
+    }
+  }
+  rendered_cascade_count =
+      static_cast<uint32_t>(dynamic_cascades.size() + static_cascades.size());
+
+  if (rendered_cascade_count > 0) {
+    BindShadowmapPipeline(frame_index);
+  }
+  // static casters of dynamic cascades into the cache
+  if (!cache_update_cascades.empty()) {
+    TransformImageLayout(Context::Instance()->g_shadow_cache_image,
+                         frame_index, vk::ImageLayout::eTransferSrcOptimal,
+                         vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                         vk::AccessFlagBits2::eTransferRead,
+                         vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+                             vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                         vk::PipelineStageFlagBits2::eTransfer,
+                         vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                             vk::PipelineStageFlagBits2::eLateFragmentTests,
+                         vk::ImageAspectFlagBits::eDepth);
+    for (uint32_t i : cache_update_cascades) {
+      DrawCasters(frame_index,
+                  Context::Instance()->g_shadow_cache_layer_image_views[i], i,
+                  cascade_static_cull_views[i],
+                  vk::AttachmentLoadOp::eClear);
+    }
+    TransformImageLayout(Context::Instance()->g_shadow_cache_image,
+                         frame_index,
+                         vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                         vk::ImageLayout::eTransferSrcOptimal,
+                         vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                         vk::AccessFlagBits2::eTransferRead,
+                         vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                             vk::PipelineStageFlagBits2::eLateFragmentTests,
+                         vk::PipelineStageFlagBits2::eTransfer,
+                         vk::ImageAspectFlagBits::eDepth);
+  }
+  // restore the static casters under the dynamic ones
+  if (!dynamic_cascades.empty()) {
+    TransformImageLayout(Context::Instance()->g_shadowmap_image, frame_index,
+                         vk::ImageLayout::eDepthReadOnlyOptimal,
+                         vk::ImageLayout::eTransferDstOptimal,
+                         vk::AccessFlagBits2::eShaderSampledRead,
+                         vk::AccessFlagBits2::eTransferWrite,
+                         vk::PipelineStageFlagBits2::eComputeShader |
+                             vk::PipelineStageFlagBits2::eFragmentShader,
+                         vk::PipelineStageFlagBits2::eTransfer,
+                         vk::ImageAspectFlagBits::eDepth);
+    std::vector<vk::ImageCopy> regions;
+    for (uint32_t i : dynamic_cascades) {
+      regions.push_back(vk::ImageCopy{
+          .srcSubresource = {vk::ImageAspectFlagBits::eDepth, 0, i, 1},
+          .srcOffset = {0, 0, 0},
+          .dstSubresource = {vk::ImageAspectFlagBits::eDepth, 0, i, 1},
+          .dstOffset = {0, 0, 0},
+          .extent = {Context::Instance()->g_shadowmap_width,
+                     Context::Instance()->g_shadowmap_height, 1},
+      });
+    }
+    Context::Instance()->g_command_buffer[frame_index].copyImage(
+        Context::Instance()->g_shadow_cache_image,
+        vk::ImageLayout::eTransferSrcOptimal,
+        Context::Instance()->g_shadowmap_image,
+        vk::ImageLayout::eTransferDstOptimal, regions);
+    TransformImageLayout(Context::Instance()->g_shadowmap_image, frame_index,
+                         vk::ImageLayout::eTransferDstOptimal,
+                         vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                         vk::AccessFlagBits2::eTransferWrite,
+                         vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+                             vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                         vk::PipelineStageFlagBits2::eTransfer,
+                         vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                             vk::PipelineStageFlagBits2::eLateFragmentTests,
+                         vk::ImageAspectFlagBits::eDepth);
+  } else if (!static_cascades.empty()) {
+    TransformImageLayout(Context::Instance()->g_shadowmap_image, frame_index,
+                         vk::ImageLayout::eDepthReadOnlyOptimal,
+                         vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                         vk::AccessFlagBits2::eShaderSampledRead,
+                         vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+                             vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                         vk::PipelineStageFlagBits2::eComputeShader |
+                             vk::PipelineStageFlagBits2::eFragmentShader,
+                         vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                             vk::PipelineStageFlagBits2::eLateFragmentTests,
+                         vk::ImageAspectFlagBits::eDepth);
+  }
+  if (rendered_cascade_count > 0) {
+    for (uint32_t i : static_cascades) {
+      DrawCasters(frame_index,
+                  Context::Instance()->g_shadowmap_layer_image_views[i], i,
+                  cascade_static_cull_views[i],
+                  vk::AttachmentLoadOp::eClear);
+    }
+    for (uint32_t i : dynamic_cascades) {
+      DrawCasters(frame_index,
+                  Context::Instance()->g_shadowmap_layer_image_views[i], i,
+                  cascade_dynamic_cull_views[i],
+                  vk::AttachmentLoadOp::eLoad);
+    }
+    TransformImageLayout(Context::Instance()->g_shadowmap_image, frame_index,
+                         vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                         vk::ImageLayout::eDepthReadOnlyOptimal,
+                         vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                         vk::AccessFlagBits2::eShaderSampledRead,
+                         vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                             vk::PipelineStageFlagBits2::eLateFragmentTests,
+                         vk::PipelineStageFlagBits2::eComputeShader |
+                             vk::PipelineStageFlagBits2::eFragmentShader,
+                         vk::ImageAspectFlagBits::eDepth);
+    shadow_moments_dirty = true;
+  }
+  // moments only follow the layers that changed
+  if (static_cast<ShadowFilterMode>(
+          Context::Instance()->g_shadow_filter_mode) == kShadowFilterVsm &&
+      shadow_moments_dirty) {
+    ComputeShadowMoments(frame_index);
+    shadow_moments_dirty = false;
+  }
 }
 
 void ShadowmapPass::UpdateDescriptorSetInfo() {
@@ -211,10 +646,128 @@ void ShadowmapPass::UpdateDescriptorSetInfo() {
     for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
       image_info.emplace_back(nullptr,
                               *Context::Instance()->g_shadowmap_image_view,
-                              vk::ImageLayout::eShaderReadOnlyOptimal);
+                              vk::ImageLayout::eDepthReadOnlyOptimal);
     }
     DescriptorSetManager::RegisterDescriptorSetInfo(
         9, vk::DescriptorType::eSampledImage,
-        vk::ShaderStageFlagBits::eFragment, image_info, {});
+        vk::ShaderStageFlagBits::eFragment |
+            vk::ShaderStageFlagBits::eCompute,
+        image_info, {});
+  }
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(*Context::Instance()->g_shadowmap_compare_sampler,
+                              nullptr, vk::ImageLayout::eUndefined);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        15, vk::DescriptorType::eSampler,
+        vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute,
+        image_info, {});
+  }
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(
+          nullptr, *Context::Instance()->g_shadow_moments_temp_image_view,
+          vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        16, vk::DescriptorType::eStorageImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {});
+  }
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr,
+                              *Context::Instance()->g_shadow_moments_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        17, vk::DescriptorType::eStorageImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {});
   }
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(*Context::Instance()->g_shadow_moments_sampler,
+                              *Context::Instance()->g_shadow_moments_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        18, vk::DescriptorType::eCombinedImageSampler,
+        vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute,
+        image_info, {});
+  }
+}
+
+void ShadowmapPass::UpdateCascades(UniformBufferObject& ubo,
+                                   float camera_near, float camera_far) {
+  uint32_t cascade_count = Context::Instance()->g_shadow_cascade_count;
+  float lambda = Context::Instance()->g_shadow_cascade_split_lambda;
+  glm::mat4 inv_view_proj = glm::inverse(ubo.proj * ubo.view);
+  glm::mat4 light_view_proj = ubo.light_proj * ubo.light_view;
+  ubo.cascade_count = cascade_count;
+  float split_near = camera_near;
+  for (uint32_t i = 0; i < cascade_count; ++i) {
+    float ratio = static_cast<float>(i + 1) / cascade_count;
+    float log_split = camera_near * std::pow(camera_far / camera_near, ratio);
+    float uniform_split = camera_near + (camera_far - camera_near) * ratio;
+    float split_far = glm::mix(uniform_split, log_split, lambda);
+    ubo.cascade_splits[i] = split_far;
+    ubo.light_view_proj[i] =
+        CascadeCropMatrix(inv_view_proj, ubo.proj, light_view_proj,
+                          split_near, split_far) *
+        light_view_proj;
+    split_near = split_far;
+
+    cascade_light_view_proj[i] = ubo.light_view_proj[i];
+
+    // the shadow pipeline culls no faces, so no cone test
+    glm::mat4 model_view_proj = ubo.light_view_proj[i] * ubo.modu;
+    cascade_model_view_proj[i] = model_view_proj;
+    cascade_static_cull_views[i] =
+        MeshletCullPass::AddView(model_view_proj, kMeshletCullStatic);
+    cascade_dynamic_cull_views[i] =
+        MeshletCullPass::AddView(model_view_proj, kMeshletCullDynamic);
+  }
+}
+
+void ShadowmapPass::UpdateCasters() {
+  for (uint32_t i = 0; i < Context::Instance()->g_shadow_cascade_count; ++i) {
+    cascade_static_casters[i].clear();
+    cascade_dynamic_casters[i].clear();
+    for (uint32_t j :
+         MeshletCullPass::GetVisibleInstances(cascade_static_cull_views[i])) {
+      const Instance& instance = Context::Instance()->g_instances[j];
+      const Mesh& mesh = Context::Instance()->g_meshes[instance.mesh];
+      glm::mat4 instance_view_proj =
+          cascade_model_view_proj[i] * instance.model;
+      if (!IntersectFrustum(instance_view_proj, mesh.bounds_min,
+                            mesh.bounds_max)) {
+        continue;
+      }
+      bool has_static = false;
+      bool has_dynamic = false;
+      for (uint32_t k = 0; k < mesh.sub_mesh_count; ++k) {
+        const SubMesh& sub_mesh =
+            Context::Instance()->g_sub_meshes[mesh.first_sub_mesh + k];
+        if (IntersectFrustum(instance_view_proj, sub_mesh)) {
+          bool dynamic = instance.dynamic_caster || sub_mesh.dynamic_caster;
+          has_static |= !dynamic;
+          has_dynamic |= dynamic;
+        }
+      }
+      if (has_static) {
+        cascade_static_casters[i].emplace_back(j);
+      }
+      if (has_dynamic) {
+        cascade_dynamic_casters[i].emplace_back(j);
+      }
+    }
+  }
+}
+
+uint32_t ShadowmapPass::GetRenderedCascadeCount() {
+  return rendered_cascade_count;
 }
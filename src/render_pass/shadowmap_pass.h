@@ -2,12 +2,24 @@
 
 #include <cstdint>
 
+#include "data.h"
 #include "third_part/vulkan_headers.h"
 
 namespace ShadowmapPass {
 void UpdateResources();
+// after g_shadowmap_width or g_shadowmap_height changed, the device must be
+// idle and the descriptor sets updated afterwards
+void RecreateResources();
 void CreatePipeline(const vk::raii::ShaderModule& shader_module);
 void Draw(uint32_t image_index, uint32_t frame_index, vk::Viewport viewport,
           vk::Rect2D scissor);
 void UpdateDescriptorSetInfo();
+// fit cascades to the camera frustum and add their meshlet cull views
+void UpdateCascades(UniformBufferObject& ubo, float camera_near,
+                    float camera_far);
+// static and dynamic casters of each cascade among the instances its view
+// kept, after MeshletCullPass::CullInstances
+void UpdateCasters();
+// cascades re-rendered by the last Draw, the others came from the cache
+uint32_t GetRenderedCascadeCount();
 }  // namespace ShadowmapPass
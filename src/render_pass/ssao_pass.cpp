@@ -0,0 +1,239 @@
+#include "ssao_pass.h"
+
+#include <algorithm>
+
+#include "context.h"
+#include "descriptor_set.h"
+#include "memory.h"
+#include "query.h"
+#include "swapchain.h"
+#include "utils.h"
+
+namespace {
+void CreateSsaoImage(uint32_t width, uint32_t height, vk::raii::Image& image,
+                     vk::raii::DeviceMemory& memory,
+                     vk::raii::ImageView& image_view) {
+  vk::Format format = Context::Instance()->g_ssao_format;
+  CreateImage(width, height, 1, vk::SampleCountFlagBits::e1, format,
+              vk::ImageTiling::eOptimal,
+              vk::ImageUsageFlagBits::eStorage |
+                  vk::ImageUsageFlagBits::eSampled,
+              vk::MemoryPropertyFlagBits::eDeviceLocal, image, memory);
+  image_view =
+      CreateImageView(*image, 0, 1, format, vk::ImageAspectFlagBits::eColor);
+  // stays in general, written by compute and read by lighting
+  TransformImageLayoutImmediately(
+      image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, {},
+      vk::AccessFlagBits::eShaderRead, vk::PipelineStageFlagBits::eTopOfPipe,
+      vk::PipelineStageFlagBits::eFragmentShader);
+}
+
+void CreateSsaoResources() {
+  uint32_t width = Context::Instance()->g_swapchain_extent.width;
+  uint32_t height = Context::Instance()->g_swapchain_extent.height;
+  CreateSsaoImage((width + 1) / 2, (height + 1) / 2,
+                  Context::Instance()->g_ssao_half_image,
+                  Context::Instance()->g_ssao_half_image_memory,
+                  Context::Instance()->g_ssao_half_image_view);
+  CreateSsaoImage((width + 1) / 2, (height + 1) / 2,
+                  Context::Instance()->g_ssao_blur_image,
+                  Context::Instance()->g_ssao_blur_image_memory,
+                  Context::Instance()->g_ssao_blur_image_view);
+  CreateSsaoImage(width, height, Context::Instance()->g_ssao_image,
+                  Context::Instance()->g_ssao_image_memory,
+                  Context::Instance()->g_ssao_image_view);
+}
+}  // namespace
+
+void SsaoPass::UpdateResources() {
+  CreateSsaoResources();
+  SwapChainManager::RegisterRecreateFunction(CreateSsaoResources);
+}
+
+void SsaoPass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
+  std::vector<vk::PushConstantRange> push_constant_range{{
+      .stageFlags = vk::ShaderStageFlagBits::eCompute,
+      .offset = 0,
+      .size = sizeof(SsaoPushConstants),
+  }};
+  vk::PipelineLayoutCreateInfo pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount =
+          static_cast<uint32_t>(push_constant_range.size()),
+      .pPushConstantRanges = push_constant_range.data(),
+  };
+  Context::Instance()->g_ssao_pipeline_layout = vk::raii::PipelineLayout(
+      Context::Instance()->g_device, pipeline_layout_info);
+  vk::ComputePipelineCreateInfo pipeline_info{
+      .stage =
+          {
+              .stage = vk::ShaderStageFlagBits::eCompute,
+              .module = shader_module,
+              .pName = "compSsao",
+              .pSpecializationInfo = nullptr,
+          },
+      .layout = Context::Instance()->g_ssao_pipeline_layout,
+  };
+  Context::Instance()->g_ssao_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, pipeline_info);
+  pipeline_info.stage.pName = "compSsaoBlurHorizontal";
+  Context::Instance()->g_ssao_blur_horizontal_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, pipeline_info);
+  pipeline_info.stage.pName = "compSsaoBlurVertical";
+  Context::Instance()->g_ssao_blur_vertical_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, pipeline_info);
+  pipeline_info.stage.pName = "compSsaoUpsample";
+  Context::Instance()->g_ssao_upsample_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, pipeline_info);
+}
+
+void SsaoPass::Draw(uint32_t image_index, uint32_t frame_index,
+                    vk::Viewport viewport, vk::Rect2D scissor) {
+  QueryManager::BeginTimestamp(frame_index, "SSAO");
+  uint32_t width = Context::Instance()->g_swapchain_extent.width;
+  uint32_t height = Context::Instance()->g_swapchain_extent.height;
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_ssao_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  // accumulated over frames, every frame takes a share of the samples with
+  // noise that moves each frame
+  bool temporal = Context::Instance()->g_enable_temporal_visibility;
+  uint32_t sample_count =
+      static_cast<uint32_t>(Context::Instance()->g_ssao_sample_count);
+  if (temporal) {
+    sample_count =
+        std::max(sample_count / Context::kTemporalSampleDivisor, 1u);
+  }
+  Context::Instance()
+      ->g_command_buffer[frame_index]
+      .pushConstants<SsaoPushConstants>(
+          Context::Instance()->g_ssao_pipeline_layout,
+          vk::ShaderStageFlagBits::eCompute, 0,
+          SsaoPushConstants{
+              .sample_count = sample_count,
+              .radius = Context::Instance()->g_ssao_radius,
+              .noise_frame =
+                  temporal ? Context::Instance()->g_frame_count : 0u,
+          });
+  TransformImageLayout(Context::Instance()->g_ssao_half_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageRead,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eCompute, Context::Instance()->g_ssao_pipeline);
+  uint32_t half_group_x = ((width + 1) / 2 + 7) / 8;
+  uint32_t half_group_y = ((height + 1) / 2 + 7) / 8;
+  Context::Instance()->g_command_buffer[frame_index].dispatch(
+      half_group_x, half_group_y, 1);
+  // separable blur at half resolution, half -> blur -> half
+  TransformImageLayout(Context::Instance()->g_ssao_half_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::AccessFlagBits2::eShaderStorageRead,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  TransformImageLayout(Context::Instance()->g_ssao_blur_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageRead,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_ssao_blur_horizontal_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].dispatch(
+      half_group_x, half_group_y, 1);
+  TransformImageLayout(Context::Instance()->g_ssao_blur_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::AccessFlagBits2::eShaderStorageRead,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  TransformImageLayout(Context::Instance()->g_ssao_half_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageRead,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_ssao_blur_vertical_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].dispatch(
+      half_group_x, half_group_y, 1);
+  TransformImageLayout(Context::Instance()->g_ssao_half_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::AccessFlagBits2::eShaderStorageRead,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  TransformImageLayout(Context::Instance()->g_ssao_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderSampledRead,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::PipelineStageFlagBits2::eFragmentShader |
+                           vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_ssao_upsample_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].dispatch(
+      (width + 7) / 8, (height + 7) / 8, 1);
+  TransformImageLayout(Context::Instance()->g_ssao_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::AccessFlagBits2::eShaderSampledRead,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eFragmentShader |
+                           vk::PipelineStageFlagBits2::eComputeShader);
+  QueryManager::EndTimestamp(frame_index, "SSAO");
+}
+
+void SsaoPass::UpdateDescriptorSetInfo() {
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr,
+                              *Context::Instance()->g_ssao_half_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        21, vk::DescriptorType::eStorageImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {});
+  }
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr, *Context::Instance()->g_ssao_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        22, vk::DescriptorType::eStorageImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {});
+  }
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr,
+                              *Context::Instance()->g_ssao_blur_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        54, vk::DescriptorType::eStorageImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {});
+  }
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr, *Context::Instance()->g_ssao_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        23, vk::DescriptorType::eSampledImage,
+        vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute,
+        image_info, {});
+  }
+}
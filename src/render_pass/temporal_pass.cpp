@@ -0,0 +1,216 @@
+#include "temporal_pass.h"
+
+#include "context.h"
+#include "descriptor_set.h"
+#include "memory.h"
+#include "query.h"
+#include "swapchain.h"
+#include "utils.h"
+
+namespace {
+// the history images hold garbage after they are created
+bool reset_history = true;
+// frame count of the last Draw, a gap means accumulation was switched off
+uint32_t last_frame_count = 0;
+
+void CreateTemporalResources() {
+  uint32_t width = Context::Instance()->g_swapchain_extent.width;
+  uint32_t height = Context::Instance()->g_swapchain_extent.height;
+  vk::Format mask_format = Context::Instance()->g_shadow_mask_format;
+  CreateImage(width, height, 1, vk::SampleCountFlagBits::e1, mask_format,
+              vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eStorage,
+              vk::MemoryPropertyFlagBits::eDeviceLocal,
+              Context::Instance()->g_shadow_mask_image,
+              Context::Instance()->g_shadow_mask_image_memory);
+  Context::Instance()->g_shadow_mask_image_view =
+      CreateImageView(*Context::Instance()->g_shadow_mask_image, 0, 1,
+                      mask_format, vk::ImageAspectFlagBits::eColor);
+  TransformImageLayoutImmediately(
+      Context::Instance()->g_shadow_mask_image, vk::ImageLayout::eUndefined,
+      vk::ImageLayout::eGeneral, {}, vk::AccessFlagBits::eShaderRead,
+      vk::PipelineStageFlagBits::eTopOfPipe,
+      vk::PipelineStageFlagBits::eComputeShader);
+
+  vk::Format history_format = Context::Instance()->g_temporal_history_format;
+  Context::Instance()->g_temporal_history_image_views.clear();
+  Context::Instance()->g_temporal_history_images.clear();
+  Context::Instance()->g_temporal_history_image_memory.clear();
+  for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+    vk::raii::Image image = nullptr;
+    vk::raii::DeviceMemory memory = nullptr;
+    CreateImage(width, height, 1, vk::SampleCountFlagBits::e1, history_format,
+                vk::ImageTiling::eOptimal,
+                vk::ImageUsageFlagBits::eStorage |
+                    vk::ImageUsageFlagBits::eSampled,
+                vk::MemoryPropertyFlagBits::eDeviceLocal, image, memory);
+    // stays in general, written by compute and read by compute and lighting
+    TransformImageLayoutImmediately(
+        image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, {},
+        vk::AccessFlagBits::eShaderRead, vk::PipelineStageFlagBits::eTopOfPipe,
+        vk::PipelineStageFlagBits::eComputeShader);
+    Context::Instance()->g_temporal_history_image_views.emplace_back(
+        CreateImageView(*image, 0, 1, history_format,
+                        vk::ImageAspectFlagBits::eColor));
+    Context::Instance()->g_temporal_history_images.emplace_back(
+        std::move(image));
+    Context::Instance()->g_temporal_history_image_memory.emplace_back(
+        std::move(memory));
+  }
+  reset_history = true;
+}
+}  // namespace
+
+void TemporalPass::UpdateResources() {
+  CreateTemporalResources();
+  SwapChainManager::RegisterRecreateFunction(CreateTemporalResources);
+}
+
+void TemporalPass::CreatePipeline(const vk::raii::ShaderModule& shader_module) {
+  std::vector<vk::PushConstantRange> push_constant_range{{
+      .stageFlags = vk::ShaderStageFlagBits::eCompute,
+      .offset = 0,
+      .size = sizeof(TemporalPushConstants),
+  }};
+  vk::PipelineLayoutCreateInfo pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount =
+          static_cast<uint32_t>(push_constant_range.size()),
+      .pPushConstantRanges = push_constant_range.data(),
+  };
+  Context::Instance()->g_temporal_pipeline_layout = vk::raii::PipelineLayout(
+      Context::Instance()->g_device, pipeline_layout_info);
+  vk::ComputePipelineCreateInfo pipeline_info{
+      .stage =
+          {
+              .stage = vk::ShaderStageFlagBits::eCompute,
+              .module = shader_module,
+              .pName = "compShadowMask",
+              .pSpecializationInfo = nullptr,
+          },
+      .layout = Context::Instance()->g_temporal_pipeline_layout,
+  };
+  Context::Instance()->g_shadow_mask_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, pipeline_info);
+  pipeline_info.stage.pName = "compTemporalAccumulate";
+  Context::Instance()->g_temporal_accumulate_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, pipeline_info);
+}
+
+void TemporalPass::Draw(uint32_t image_index, uint32_t frame_index,
+                        vk::Viewport viewport, vk::Rect2D scissor) {
+  QueryManager::BeginTimestamp(frame_index, "Temporal");
+  uint32_t width = Context::Instance()->g_swapchain_extent.width;
+  uint32_t height = Context::Instance()->g_swapchain_extent.height;
+  uint32_t frame_count = Context::Instance()->g_frame_count;
+  bool reset = reset_history || frame_count != last_frame_count + 1;
+  reset_history = false;
+  last_frame_count = frame_count;
+  uint32_t history_count = Context::Instance()->g_frame_in_flight;
+  uint32_t prev_index = (frame_index + history_count - 1) % history_count;
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_temporal_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  Context::Instance()
+      ->g_command_buffer[frame_index]
+      .pushConstants<TemporalPushConstants>(
+          Context::Instance()->g_temporal_pipeline_layout,
+          vk::ShaderStageFlagBits::eCompute, 0,
+          TemporalPushConstants{
+              .shadow_filter_mode = static_cast<uint32_t>(
+                  Context::Instance()->g_shadow_filter_mode),
+              .enable_ssao = Context::Instance()->g_enable_ssao,
+              .reset_history = reset,
+              .sample_divisor = Context::kTemporalSampleDivisor,
+          });
+  TransformImageLayout(Context::Instance()->g_shadow_mask_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageRead,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_shadow_mask_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].dispatch(
+      (width + 7) / 8, (height + 7) / 8, 1);
+  TransformImageLayout(Context::Instance()->g_shadow_mask_image, frame_index,
+                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+                       vk::AccessFlagBits2::eShaderStorageWrite,
+                       vk::AccessFlagBits2::eShaderStorageRead,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eComputeShader);
+  // written by the last frame, read as history
+  TransformImageLayout(
+      Context::Instance()->g_temporal_history_images[prev_index], frame_index,
+      vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+      vk::AccessFlagBits2::eShaderStorageWrite,
+      vk::AccessFlagBits2::eShaderSampledRead,
+      vk::PipelineStageFlagBits2::eComputeShader,
+      vk::PipelineStageFlagBits2::eComputeShader);
+  TransformImageLayout(
+      Context::Instance()->g_temporal_history_images[frame_index], frame_index,
+      vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+      vk::AccessFlagBits2::eShaderSampledRead,
+      vk::AccessFlagBits2::eShaderStorageWrite,
+      vk::PipelineStageFlagBits2::eFragmentShader |
+          vk::PipelineStageFlagBits2::eComputeShader,
+      vk::PipelineStageFlagBits2::eComputeShader);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eCompute,
+      Context::Instance()->g_temporal_accumulate_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].dispatch(
+      (width + 7) / 8, (height + 7) / 8, 1);
+  TransformImageLayout(
+      Context::Instance()->g_temporal_history_images[frame_index], frame_index,
+      vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+      vk::AccessFlagBits2::eShaderStorageWrite,
+      vk::AccessFlagBits2::eShaderSampledRead,
+      vk::PipelineStageFlagBits2::eComputeShader,
+      vk::PipelineStageFlagBits2::eFragmentShader);
+  QueryManager::EndTimestamp(frame_index, "Temporal");
+}
+
+void TemporalPass::UpdateDescriptorSetInfo() {
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr,
+                              *Context::Instance()->g_shadow_mask_image_view,
+                              vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        24, vk::DescriptorType::eStorageImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {});
+  }
+  uint32_t history_count = Context::Instance()->g_frame_in_flight;
+  {
+    // frames in flight run in order, frame i reads what frame i - 1 wrote
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < history_count; ++i) {
+      image_info.emplace_back(
+          nullptr,
+          *Context::Instance()->g_temporal_history_image_views
+               [(i + history_count - 1) % history_count],
+          vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        25, vk::DescriptorType::eSampledImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {});
+  }
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < history_count; ++i) {
+      image_info.emplace_back(
+          nullptr, *Context::Instance()->g_temporal_history_image_views[i],
+          vk::ImageLayout::eGeneral);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        26, vk::DescriptorType::eStorageImage,
+        vk::ShaderStageFlagBits::eCompute, image_info, {});
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        27, vk::DescriptorType::eSampledImage,
+        vk::ShaderStageFlagBits::eFragment, image_info, {});
+  }
+}
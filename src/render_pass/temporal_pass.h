@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+#include "third_part/vulkan_headers.h"
+
+namespace TemporalPass {
+void UpdateResources();
+void CreatePipeline(const vk::raii::ShaderModule& shader_module);
+// after SsaoPass::Draw, the depth image must be readable by compute shaders
+void Draw(uint32_t image_index, uint32_t frame_index, vk::Viewport viewport,
+          vk::Rect2D scissor);
+void UpdateDescriptorSetInfo();
+}  // namespace TemporalPass
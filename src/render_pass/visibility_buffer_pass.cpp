@@ -0,0 +1,427 @@
+#include "visibility_buffer_pass.h"
+
+#include "context.h"
+#include "descriptor_set.h"
+#include "memory.h"
+#include "render_pass/meshlet_cull_pass.h"
+#include "render_pass/ssao_pass.h"
+#include "render_pass/temporal_pass.h"
+#include "swapchain.h"
+#include "utils.h"
+
+namespace {
+void CreateVisibilityResources() {
+  CreateImage(Context::Instance()->g_swapchain_extent.width,
+              Context::Instance()->g_swapchain_extent.height, 1,
+              vk::SampleCountFlagBits::e1,
+              Context::Instance()->g_visibility_image_format,
+              vk::ImageTiling::eOptimal,
+              vk::ImageUsageFlagBits::eColorAttachment |
+                  vk::ImageUsageFlagBits::eSampled,
+              vk::MemoryPropertyFlagBits::eDeviceLocal,
+              Context::Instance()->g_visibility_image,
+              Context::Instance()->g_visibility_image_memory);
+  Context::Instance()->g_visibility_image_view =
+      CreateImageView(*Context::Instance()->g_visibility_image, 0, 1,
+                      Context::Instance()->g_visibility_image_format,
+                      vk::ImageAspectFlagBits::eColor);
+}
+}  // namespace
+
+void VisibilityBufferPass::UpdateResources() {
+  CreateVisibilityResources();
+  SwapChainManager::RegisterRecreateFunction(CreateVisibilityResources);
+}
+
+void VisibilityBufferPass::CreatePipeline(
+    const vk::raii::ShaderModule& shader_module) {
+  vk::PipelineShaderStageCreateInfo pipeline_shader_stage_create_info[2] = {
+      {
+          .stage = vk::ShaderStageFlagBits::eVertex,
+          .module = shader_module,
+          .pName = "vertVisibility",
+          .pSpecializationInfo = nullptr,
+      },
+      {
+          .stage = vk::ShaderStageFlagBits::eFragment,
+          .module = shader_module,
+          .pName = "fragVisibility",
+          .pSpecializationInfo = nullptr,
+      },
+  };
+  std::vector dynamic_states = {vk::DynamicState::eViewport,
+                                vk::DynamicState::eScissor};
+  vk::PipelineDynamicStateCreateInfo dyanmic_state_create_info = {
+      .dynamicStateCount = static_cast<uint32_t>(dynamic_states.size()),
+      .pDynamicStates = dynamic_states.data(),
+  };
+  auto binding_desc = QuantizedVertexStreams::GetBindingDescription();
+  auto attribute_desc = QuantizedVertexStreams::GetAttributeDescription();
+  vk::PipelineVertexInputStateCreateInfo vertex_input_info{
+      .vertexBindingDescriptionCount = binding_desc.size(),
+      .pVertexBindingDescriptions = binding_desc.data(),
+      .vertexAttributeDescriptionCount = attribute_desc.size(),
+      .pVertexAttributeDescriptions = attribute_desc.data(),
+  };
+  vk::PipelineInputAssemblyStateCreateInfo input_assembly_info{
+      .topology = vk::PrimitiveTopology::eTriangleList};
+  vk::PipelineViewportStateCreateInfo viewport_state_info{
+      .viewportCount = 1,
+      .pViewports = nullptr,
+      .scissorCount = 1,
+      .pScissors = nullptr,
+  };
+  vk::PipelineRasterizationStateCreateInfo rasterization_create_info{
+      .depthClampEnable = vk::False,
+      .rasterizerDiscardEnable = vk::False,
+      .polygonMode = vk::PolygonMode::eFill,
+      .cullMode = vk::CullModeFlagBits::eBack,
+      .frontFace = vk::FrontFace::eCounterClockwise,
+      .depthBiasEnable = vk::False,
+      .depthBiasConstantFactor = 1.0f,
+      .depthBiasClamp = 0.0f,
+      .depthBiasSlopeFactor = 0.0f,
+      .lineWidth = 1.0f,
+  };
+  vk::PipelineMultisampleStateCreateInfo multisample_create_info{
+      .rasterizationSamples = vk::SampleCountFlagBits::e1,
+      .sampleShadingEnable = vk::False,
+  };
+  // the occluders of the occlusion culling left their depth, the same
+  // triangles pass again to write their ids
+  vk::PipelineDepthStencilStateCreateInfo depth_stencil_info{
+      .depthTestEnable = vk::True,
+      .depthWriteEnable = vk::True,
+      .depthCompareOp = vk::CompareOp::eLessOrEqual,
+      .depthBoundsTestEnable = vk::False,
+      .stencilTestEnable = vk::False,
+  };
+  vk::PipelineColorBlendAttachmentState opaque_blend_attachment{
+      .blendEnable = vk::False,
+      .colorWriteMask =
+          vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+          vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA,
+  };
+  vk::PipelineColorBlendStateCreateInfo visibility_color_blend_info{
+      .logicOpEnable = vk::False,
+      .logicOp = vk::LogicOp::eCopy,
+      .attachmentCount = 1,
+      .pAttachments = &opaque_blend_attachment,
+      .blendConstants = {},
+  };
+  vk::PipelineLayoutCreateInfo pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount = 0,
+      .pPushConstantRanges = nullptr,
+  };
+  Context::Instance()->g_visibility_pipeline_layout = vk::raii::PipelineLayout(
+      Context::Instance()->g_device, pipeline_layout_info);
+  vk::PipelineRenderingCreateInfo pipeline_rending_info{
+      .colorAttachmentCount = 1,
+      .pColorAttachmentFormats =
+          &Context::Instance()->g_visibility_image_format,
+      .depthAttachmentFormat = Context::Instance()->g_depth_image_format,
+      .stencilAttachmentFormat = vk::Format::eUndefined,
+  };
+  vk::GraphicsPipelineCreateInfo pipeline_info{
+      .pNext = &pipeline_rending_info,
+      .stageCount = 2,
+      .pStages = pipeline_shader_stage_create_info,
+      .pVertexInputState = &vertex_input_info,
+      .pInputAssemblyState = &input_assembly_info,
+      .pTessellationState = {},
+      .pViewportState = &viewport_state_info,
+      .pRasterizationState = &rasterization_create_info,
+      .pMultisampleState = &multisample_create_info,
+      .pDepthStencilState = &depth_stencil_info,
+      .pColorBlendState = &visibility_color_blend_info,
+      .pDynamicState = &dyanmic_state_create_info,
+      .layout = Context::Instance()->g_visibility_pipeline_layout,
+      .renderPass = nullptr,
+      .subpass = {},
+      .basePipelineHandle = {},
+      .basePipelineIndex = {},
+  };
+  Context::Instance()->g_visibility_pipeline =
+      vk::raii::Pipeline(Context::Instance()->g_device, nullptr, pipeline_info);
+
+  vk::PipelineColorBlendStateCreateInfo material_color_blend_info{
+      .logicOpEnable = vk::False,
+      .logicOp = vk::LogicOp::eCopy,
+      .attachmentCount = 1,
+      .pAttachments = &opaque_blend_attachment,
+      .blendConstants = {},
+  };
+  // material pass only shades into the hdr image
+  vk::PipelineRenderingCreateInfo material_pipeline_rending_info{
+      .colorAttachmentCount = 1,
+      .pColorAttachmentFormats = &Context::Instance()->g_hdr_format,
+      .depthAttachmentFormat = Context::Instance()->g_depth_image_format,
+  };
+  vk::PipelineShaderStageCreateInfo
+      material_pipeline_shader_stage_create_info[2] = {
+          {
+              .stage = vk::ShaderStageFlagBits::eVertex,
+              .module = shader_module,
+              .pName = "vertVisibilityMaterial",
+              .pSpecializationInfo = nullptr,
+          },
+          {
+              .stage = vk::ShaderStageFlagBits::eFragment,
+              .module = shader_module,
+              .pName = "fragVisibilityMaterial",
+              .pSpecializationInfo = nullptr,
+          },
+      };
+  vk::PipelineVertexInputStateCreateInfo material_vertex_input_info{};
+  vk::PipelineInputAssemblyStateCreateInfo material_input_assembly_info{
+      .topology = vk::PrimitiveTopology::eTriangleStrip};
+  vk::PipelineRasterizationStateCreateInfo material_rasterization_create_info{
+      .depthClampEnable = vk::False,
+      .rasterizerDiscardEnable = vk::False,
+      .polygonMode = vk::PolygonMode::eFill,
+      .cullMode = vk::CullModeFlagBits::eBack,
+      .frontFace = vk::FrontFace::eClockwise,
+      .depthBiasEnable = vk::False,
+      .depthBiasConstantFactor = 1.0f,
+      .depthBiasClamp = 0.0f,
+      .depthBiasSlopeFactor = 0.0f,
+      .lineWidth = 1.0f,
+  };
+  vk::PipelineDepthStencilStateCreateInfo material_depth_stencil_info{
+      .depthTestEnable = vk::False,
+      .depthWriteEnable = vk::False,
+      .depthCompareOp = vk::CompareOp::eLess,
+      .depthBoundsTestEnable = vk::False,
+      .stencilTestEnable = vk::False,
+  };
+  std::vector<vk::PushConstantRange> material_push_constant_range{{
+      .stageFlags = vk::ShaderStageFlagBits::eFragment,
+      .offset = 0,
+      .size = sizeof(LightingPushConstants),
+  }};
+  vk::PipelineLayoutCreateInfo material_pipeline_layout_info{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*Context::Instance()->g_descriptor_set_layout,
+      .pushConstantRangeCount =
+          static_cast<uint32_t>(material_push_constant_range.size()),
+      .pPushConstantRanges = material_push_constant_range.data(),
+  };
+  Context::Instance()->g_visibility_material_pipeline_layout =
+      vk::raii::PipelineLayout(Context::Instance()->g_device,
+                               material_pipeline_layout_info);
+  vk::GraphicsPipelineCreateInfo material_pipeline_info{
+      .pNext = &material_pipeline_rending_info,
+      .stageCount = 2,
+      .pStages = material_pipeline_shader_stage_create_info,
+      .pVertexInputState = &material_vertex_input_info,
+      .pInputAssemblyState = &material_input_assembly_info,
+      .pTessellationState = {},
+      .pViewportState = &viewport_state_info,
+      .pRasterizationState = &material_rasterization_create_info,
+      .pMultisampleState = &multisample_create_info,
+      .pDepthStencilState = &material_depth_stencil_info,
+      .pColorBlendState = &material_color_blend_info,
+      .pDynamicState = &dyanmic_state_create_info,
+      .layout = Context::Instance()->g_visibility_material_pipeline_layout,
+      .renderPass = nullptr,
+      .subpass = {},
+      .basePipelineHandle = {},
+      .basePipelineIndex = {},
+  };
+  Context::Instance()->g_visibility_material_pipeline = vk::raii::Pipeline(
+      Context::Instance()->g_device, nullptr, material_pipeline_info);
+}
+
+void VisibilityBufferPass::Draw(uint32_t image_index, uint32_t frame_index,
+                                vk::Viewport viewport, vk::Rect2D scissor) {
+  // the depth of the occluders is kept, the hi-z downsample read it
+  bool occluder_depth = MeshletCullPass::CullsOcclusion();
+  vk::ImageLayout depth_layout =
+      occluder_depth ? vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal
+                     : vk::ImageLayout::eUndefined;
+  TransformImageLayout(Context::Instance()->g_depth_image, frame_index,
+                       depth_layout,
+                       vk::ImageLayout::eDepthStencilAttachmentOptimal, {},
+                       vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+                           vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                       vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                           vk::PipelineStageFlagBits2::eLateFragmentTests,
+                       vk::ImageAspectFlagBits::eDepth);
+  TransformImageLayout(Context::Instance()->g_hdr_image, frame_index,
+                       vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
+                       {}, vk::AccessFlagBits2::eColorAttachmentWrite,
+                       vk::PipelineStageFlagBits2::eTopOfPipe,
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput);
+  TransformImageLayout(Context::Instance()->g_visibility_image, frame_index,
+                       vk::ImageLayout::eUndefined,
+                       vk::ImageLayout::eColorAttachmentOptimal, {},
+                       vk::AccessFlagBits2::eColorAttachmentWrite,
+                       vk::PipelineStageFlagBits2::eTopOfPipe,
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput);
+  // visibility pass, only triangle id and depth are written
+  vk::RenderingAttachmentInfo visibility_attachment_info{
+      .imageView = Context::Instance()->g_visibility_image_view,
+      .imageLayout = vk::ImageLayout::eColorAttachmentOptimal,
+      .loadOp = vk::AttachmentLoadOp::eClear,
+      .storeOp = vk::AttachmentStoreOp::eStore,
+      .clearValue = vk::ClearColorValue{0.0f, 0.0f, 0.0f, 0.0f},
+  };
+  vk::RenderingAttachmentInfo visibility_depth_info{
+      .imageView = Context::Instance()->g_depth_image_view,
+      .imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
+      .loadOp = occluder_depth ? vk::AttachmentLoadOp::eLoad
+                               : vk::AttachmentLoadOp::eClear,
+      .storeOp = vk::AttachmentStoreOp::eStore,
+      .clearValue = vk::ClearDepthStencilValue{1.0f, 0},
+  };
+  vk::RenderingInfo visibility_rendering_info{
+      .renderArea = {.offset = {0, 0},
+                     .extent = Context::Instance()->g_swapchain_extent},
+      .layerCount = 1,
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &visibility_attachment_info,
+      .pDepthAttachment = &visibility_depth_info,
+  };
+  Context::Instance()->g_command_buffer[frame_index].beginRendering(
+      visibility_rendering_info);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_visibility_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].bindVertexBuffers(
+      0,
+      {*Context::Instance()->g_vertex_buffer,
+       *Context::Instance()->g_vertex_buffer},
+      {0, Context::Instance()->g_attribute_offset});
+  Context::Instance()->g_command_buffer[frame_index].bindIndexBuffer(
+      *Context::Instance()->g_index_buffer, 0,
+      Context::Instance()->g_index_type);
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_visibility_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  Context::Instance()->g_command_buffer[frame_index].setViewport(0, viewport);
+  Context::Instance()->g_command_buffer[frame_index].setScissor(0, scissor);
+  MeshletCullPass::DrawCameraView(frame_index);
+  Context::Instance()->g_command_buffer[frame_index].endRendering();
+
+  // material pass
+  TransformImageLayout(Context::Instance()->g_visibility_image, frame_index,
+                       vk::ImageLayout::eColorAttachmentOptimal,
+                       vk::ImageLayout::eShaderReadOnlyOptimal,
+                       vk::AccessFlagBits2::eColorAttachmentWrite,
+                       vk::AccessFlagBits2::eShaderRead,
+                       vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+                       vk::PipelineStageFlagBits2::eFragmentShader);
+  TransformImageLayout(Context::Instance()->g_depth_image, frame_index,
+                       vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                       vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+                       vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+                       vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+                           vk::AccessFlagBits2::eShaderRead,
+                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                           vk::PipelineStageFlagBits2::eLateFragmentTests,
+                       vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                           vk::PipelineStageFlagBits2::eLateFragmentTests |
+                           vk::PipelineStageFlagBits2::eFragmentShader |
+                           vk::PipelineStageFlagBits2::eComputeShader,
+                       vk::ImageAspectFlagBits::eDepth);
+  if (Context::Instance()->g_enable_ssao) {
+    SsaoPass::Draw(image_index, frame_index, viewport, scissor);
+  }
+  if (Context::Instance()->g_enable_temporal_visibility) {
+    TemporalPass::Draw(image_index, frame_index, viewport, scissor);
+  }
+  vk::RenderingAttachmentInfo hdr_attachment_info{
+      .imageView = Context::Instance()->g_hdr_image_view,
+      .imageLayout = vk::ImageLayout::eGeneral,
+      .loadOp = vk::AttachmentLoadOp::eClear,
+      .storeOp = vk::AttachmentStoreOp::eStore,
+      .clearValue = vk::ClearColorValue{0.0f, 0.0f, 0.0f, 0.0f},
+  };
+  vk::RenderingAttachmentInfo depth_info{
+      .imageView = Context::Instance()->g_depth_image_view,
+      .imageLayout = vk::ImageLayout::eDepthReadOnlyStencilAttachmentOptimal,
+      .loadOp = vk::AttachmentLoadOp::eLoad,
+      .storeOp = vk::AttachmentStoreOp::eStore,
+  };
+  vk::RenderingInfo rendering_info{
+      .renderArea = {.offset = {0, 0},
+                     .extent = Context::Instance()->g_swapchain_extent},
+      .layerCount = 1,
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &hdr_attachment_info,
+      .pDepthAttachment = &depth_info,
+  };
+  Context::Instance()->g_command_buffer[frame_index].beginRendering(
+      rendering_info);
+  Context::Instance()->g_command_buffer[frame_index].bindPipeline(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_visibility_material_pipeline);
+  Context::Instance()->g_command_buffer[frame_index].bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics,
+      Context::Instance()->g_visibility_material_pipeline_layout, 0,
+      *Context::Instance()->g_descriptor_sets[frame_index], nullptr);
+  LightingPushConstants lighting_push_constants{
+      .enable_ssao = Context::Instance()->g_enable_ssao,
+      .shadow_filter_mode = static_cast<uint32_t>(
+          Context::Instance()->g_shadow_filter_mode),
+      .enable_temporal = Context::Instance()->g_enable_temporal_visibility,
+  };
+  Context::Instance()
+      ->g_command_buffer[frame_index]
+      .pushConstants<LightingPushConstants>(
+          Context::Instance()->g_visibility_material_pipeline_layout,
+          vk::ShaderStageFlagBits::eFragment, 0, lighting_push_constants);
+  Context::Instance()->g_command_buffer[frame_index].setViewport(0, viewport);
+  Context::Instance()->g_command_buffer[frame_index].setScissor(0, scissor);
+  Context::Instance()->g_command_buffer[frame_index].draw(4, 1, 0, 0);
+  Context::Instance()->g_command_buffer[frame_index].endRendering();
+}
+
+void VisibilityBufferPass::UpdateDescriptorSetInfo() {
+  {
+    std::vector<vk::DescriptorImageInfo> image_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      image_info.emplace_back(nullptr,
+                              *Context::Instance()->g_visibility_image_view,
+                              vk::ImageLayout::eShaderReadOnlyOptimal);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        12, vk::DescriptorType::eSampledImage,
+        vk::ShaderStageFlagBits::eFragment, image_info, {});
+  }
+  {
+    std::vector<vk::DescriptorBufferInfo> buffer_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      buffer_info.emplace_back(*Context::Instance()->g_vertex_buffer, 0,
+                               Context::Instance()->g_attribute_offset);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        13, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eFragment, {}, buffer_info);
+  }
+  {
+    std::vector<vk::DescriptorBufferInfo> buffer_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      buffer_info.emplace_back(*Context::Instance()->g_vertex_buffer,
+                               Context::Instance()->g_attribute_offset,
+                               vk::WholeSize);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        39, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eFragment, {}, buffer_info);
+  }
+  {
+    std::vector<vk::DescriptorBufferInfo> buffer_info;
+    for (uint32_t i = 0; i < Context::Instance()->g_frame_in_flight; ++i) {
+      buffer_info.emplace_back(*Context::Instance()->g_index_buffer, 0,
+                               vk::WholeSize);
+    }
+    DescriptorSetManager::RegisterDescriptorSetInfo(
+        14, vk::DescriptorType::eStorageBuffer,
+        vk::ShaderStageFlagBits::eFragment, {}, buffer_info);
+  }
+}
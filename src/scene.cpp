@@ -0,0 +1,136 @@
+#include "scene.h"
+
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "context.h"
+#include "culling.h"
+#include "json.h"
+#include "model.h"
+#include "utils.h"
+
+namespace {
+glm::vec3 Vec3Or(const JsonValue& object, std::string_view key,
+                 const glm::vec3& fallback) {
+  const JsonValue* value = object.Find(key);
+  if (!value) {
+    return fallback;
+  }
+  const std::vector<JsonValue>& array = value->AsArray();
+  if (array.size() != 3) {
+    throw std::runtime_error("scene: " + std::string(key) +
+                             " needs 3 numbers!");
+  }
+  return glm::vec3(array[0].AsNumber(), array[1].AsNumber(),
+                   array[2].AsNumber());
+}
+
+glm::mat4 InstanceTransform(const glm::vec3& position,
+                            const glm::vec3& rotation, float scale) {
+  glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+  model = glm::rotate(model, glm::radians(rotation.z),
+                      glm::vec3(0.0f, 0.0f, 1.0f));
+  model = glm::rotate(model, glm::radians(rotation.y),
+                      glm::vec3(0.0f, 1.0f, 0.0f));
+  model = glm::rotate(model, glm::radians(rotation.x),
+                      glm::vec3(1.0f, 0.0f, 0.0f));
+  return glm::scale(model, glm::vec3(scale));
+}
+}  // namespace
+
+void LoadScene(const std::filesystem::path& scene_path) {
+  std::vector<char> text = ReadFile(scene_path.string().c_str());
+  JsonValue scene =
+      JsonValue::Parse(std::string_view(text.data(), text.size()));
+  const JsonValue* meshes = scene.Find("meshes");
+  const JsonValue* instances = scene.Find("instances");
+  if (!meshes || !instances) {
+    throw std::runtime_error("scene: meshes and instances are required!");
+  }
+
+  std::unordered_map<std::string, uint32_t> mesh_indices;
+  for (const JsonValue& mesh : meshes->AsArray()) {
+    const JsonValue* file = mesh.Find("file");
+    if (!file) {
+      throw std::runtime_error("scene: mesh without file!");
+    }
+    std::filesystem::path path =
+        scene_path.parent_path() / std::filesystem::path(file->AsString());
+    const JsonValue* name = mesh.Find("name");
+    mesh_indices[name ? name->AsString() : path.stem().string()] =
+        LoadMesh(path);
+  }
+
+  std::vector<Instance>& scene_instances = Context::Instance()->g_instances;
+  uint32_t lod_count = 0;
+  for (const JsonValue& instance : instances->AsArray()) {
+    const JsonValue* mesh_name = instance.Find("mesh");
+    if (!mesh_name) {
+      throw std::runtime_error("scene: instance without mesh!");
+    }
+    auto mesh_index = mesh_indices.find(mesh_name->AsString());
+    if (mesh_index == mesh_indices.end()) {
+      throw std::runtime_error("scene: unknown mesh " +
+                               mesh_name->AsString() + "!");
+    }
+    const Mesh& mesh = Context::Instance()->g_meshes[mesh_index->second];
+    glm::vec3 position = Vec3Or(instance, "position", glm::vec3(0.0f));
+    glm::vec3 rotation = Vec3Or(instance, "rotation", glm::vec3(0.0f));
+    float scale = static_cast<float>(instance.NumberOr("scale", 1.0));
+    bool dynamic = instance.BoolOr("dynamic", false);
+    glm::vec3 count(1.0f);
+    glm::vec3 spacing(0.0f);
+    if (const JsonValue* grid = instance.Find("grid")) {
+      count = glm::max(Vec3Or(*grid, "count", count), glm::vec3(0.0f));
+      spacing = Vec3Or(*grid, "spacing", spacing);
+    }
+    for (uint32_t z = 0; z < static_cast<uint32_t>(count.z); ++z) {
+      for (uint32_t y = 0; y < static_cast<uint32_t>(count.y); ++y) {
+        for (uint32_t x = 0; x < static_cast<uint32_t>(count.x); ++x) {
+          scene_instances.emplace_back(Instance{
+              .mesh = mesh_index->second,
+              .model = InstanceTransform(
+                  position + spacing * glm::vec3(x, y, z), rotation, scale),
+              .dynamic_caster = dynamic,
+              .first_lod = lod_count,
+          });
+          lod_count += mesh.sub_mesh_count;
+        }
+      }
+    }
+  }
+  Context::Instance()->g_instance_lods.assign(lod_count, 0);
+  // nothing to reproject from
+  Context::Instance()->g_prev_model_view_proj_valid = false;
+
+  std::vector<MeshletCullItem>& items =
+      Context::Instance()->g_meshlet_cull_items;
+  for (uint32_t i = 0; i < scene_instances.size(); ++i) {
+    const Mesh& mesh = Context::Instance()->g_meshes[scene_instances[i].mesh];
+    for (uint32_t j = 0; j < mesh.meshlet_count; ++j) {
+      items.emplace_back(MeshletCullItem{
+          .instance = i,
+          .meshlet = mesh.first_meshlet + j,
+      });
+    }
+  }
+
+  std::vector<glm::vec3> bounds_min(scene_instances.size());
+  std::vector<glm::vec3> bounds_max(scene_instances.size());
+  for (uint32_t i = 0; i < scene_instances.size(); ++i) {
+    const Mesh& mesh = Context::Instance()->g_meshes[scene_instances[i].mesh];
+    TransformBounds(scene_instances[i].model, mesh.bounds_min, mesh.bounds_max,
+                    bounds_min[i], bounds_max[i]);
+  }
+  Context::Instance()->g_instance_bvh.Build(std::move(bounds_min),
+                                            std::move(bounds_max));
+  LOG("scene ", scene_path.filename().string(), ", ",
+      std::to_string(Context::Instance()->g_meshes.size()), " meshes, ",
+      std::to_string(scene_instances.size()), " instances, ",
+      std::to_string(items.size()), " meshlet cull items, ",
+      std::to_string(Context::Instance()->g_instance_bvh.GetNodeCount()),
+      " bvh nodes");
+}
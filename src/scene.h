@@ -0,0 +1,19 @@
+#pragma once
+
+#include <filesystem>
+
+// reads a json scene, loads each of its meshes once and places the instances,
+// fills g_meshes, g_instances, g_instance_lods and g_meshlet_cull_items
+//
+// {
+//   "meshes": [{"name": "room", "file": "viking_room.obj"}],
+//   "instances": [{"mesh": "room", "position": [0, 0, 0],
+//                  "rotation": [0, 0, 0], "scale": 1, "dynamic": false,
+//                  "grid": {"count": [4, 4, 1], "spacing": [2, 2, 0]}}]
+// }
+//
+// files are relative to the scene, rotation is in degrees applied x, y then
+// z, the optional grid repeats an instance count times spacing apart
+// starting at position, dynamic instances are redrawn into the shadow map
+// every frame
+void LoadScene(const std::filesystem::path& scene_path);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "third_part/vulkan_headers.h"
+
+// bytes of one attribute in the formats vertex layouts use, 0 for the rest
+constexpr uint32_t VertexFormatSize(vk::Format format) {
+  switch (format) {
+    case vk::Format::eR32Sfloat:
+    case vk::Format::eR8G8B8A8Unorm:
+    case vk::Format::eR16G16Snorm:
+    case vk::Format::eR16G16Sfloat:
+      return 4;
+    case vk::Format::eR32G32Sfloat:
+    case vk::Format::eR16G16B16A16Unorm:
+      return 8;
+    case vk::Format::eR32G32B32Sfloat:
+      return 12;
+    case vk::Format::eR32G32B32A32Sfloat:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+// one member of a vertex struct, see VERTEX_ATTRIBUTE
+template <uint32_t Offset, uint32_t Size, vk::Format Format>
+struct VertexAttribute {
+  static_assert(VertexFormatSize(Format) != 0,
+                "add the format to VertexFormatSize");
+  static_assert(VertexFormatSize(Format) == Size,
+                "the format does not match the size of the member");
+  static constexpr uint32_t kOffset = Offset;
+  static constexpr vk::Format kFormat = Format;
+};
+
+#define VERTEX_ATTRIBUTE(type, member, format)                   \
+  VertexAttribute<offsetof(type, member), sizeof(type::member), \
+                  vk::Format::format>
+
+// one binding fed with VertexType, the shader locations follow the order of
+// the attributes and have to match the members of the shader side struct
+template <typename VertexType, typename... Attributes>
+struct VertexLayout {
+  static constexpr uint32_t kAttributeCount = sizeof...(Attributes);
+
+  static constexpr vk::VertexInputBindingDescription GetBindingDescription(
+      uint32_t binding = 0) {
+    return {
+        .binding = binding,
+        .stride = sizeof(VertexType),
+        .inputRate = vk::VertexInputRate::eVertex,
+    };
+  }
+  static constexpr std::array<vk::VertexInputAttributeDescription,
+                              kAttributeCount>
+  GetAttributeDescription(uint32_t binding = 0, uint32_t first_location = 0) {
+    uint32_t location = first_location;
+    return {vk::VertexInputAttributeDescription{
+        .location = location++,
+        .binding = binding,
+        .format = Attributes::kFormat,
+        .offset = Attributes::kOffset,
+    }...};
+  }
+};
+
+// a vertex split over several buffers, layout i is fed from binding i and the
+// locations run on from one layout to the next
+template <typename... Layouts>
+struct VertexStreams {
+  static constexpr uint32_t kAttributeCount = (Layouts::kAttributeCount + ...);
+
+  static constexpr std::array<vk::VertexInputBindingDescription,
+                              sizeof...(Layouts)>
+  GetBindingDescription() {
+    uint32_t binding = 0;
+    return {Layouts::GetBindingDescription(binding++)...};
+  }
+  static constexpr std::array<vk::VertexInputAttributeDescription,
+                              kAttributeCount>
+  GetAttributeDescription() {
+    std::array<vk::VertexInputAttributeDescription, kAttributeCount>
+        descriptions{};
+    uint32_t binding = 0;
+    uint32_t location = 0;
+    auto append = [&](const auto& layout_descriptions) {
+      for (const auto& description : layout_descriptions) {
+        descriptions[location++] = description;
+      }
+      ++binding;
+    };
+    (append(Layouts::GetAttributeDescription(binding, location)), ...);
+    return descriptions;
+  }
+};